@@ -9,6 +9,7 @@
 	#define DLL_EXPORT __declspec(dllexport)
 	#define DLL_IMPORT __declspec(dllimport)
 	#define FORCEINLINE __forceinline
+	#define FORCENOINLINE __declspec(noinline)
 	#define UNUSED
 	#include <intrin.h>
 #else
@@ -17,6 +18,7 @@
 	#define DLL_EXPORT
 	#define DLL_IMPORT
 	#define FORCEINLINE inline __attribute__((always_inline))
+	#define FORCENOINLINE __attribute__((noinline))
 	#define UNUSED __attribute__((unused))
 #endif
 
@@ -64,6 +66,21 @@ namespace Platform
 		Mutex* mutex;
 	};
 
+	// A platform-independent event that one thread can wait for another thread to signal. Signaling the event wakes one
+	// waiting thread, or if no thread is waiting, the next thread to wait. Allows calling the constructor during static
+	// initialization, like Mutex.
+	struct Event
+	{
+		CORE_API Event();
+		CORE_API ~Event();
+
+		CORE_API void wait();
+		CORE_API void signal();
+
+	private:
+		void* handle;
+	};
+
 	// Describes allowed memory accesses.
 	enum class MemoryAccess
 	{
@@ -95,10 +112,35 @@ namespace Platform
 	// baseVirtualAddress must be a multiple of the preferred page size.
 	CORE_API void decommitVirtualPages(uint8* baseVirtualAddress,size_t numPages);
 
+	// Returns the base 2 logarithm of the size of the huge pages that adviseHugePages may back virtual pages with, or 0 if the
+	// platform doesn't support them.
+	CORE_API uintp getHugePageSizeLog2();
+
+	// Advises the platform to back the specified committed virtual pages with huge pages, which reduces the TLB misses caused
+	// by accesses spread over many pages. Only the huge page aligned ranges fully covered by committed pages with the same
+	// access can be backed by a huge page. Decommitting pages discards the advice for them.
+	// baseVirtualAddress must be a multiple of the preferred page size. Returns true if successful.
+	CORE_API bool adviseHugePages(uint8* baseVirtualAddress,size_t numPages);
+
 	// Frees virtual addresses. Any physical memory committed to the addresses must have already been decommitted.
 	// baseVirtualAddress must be a multiple of the preferred page size.
 	CORE_API void freeVirtualPages(uint8* baseVirtualAddress,size_t numPages);
 
+	// An immutable copy of the contents of some virtual pages, which may be mapped copy-on-write to other virtual pages.
+	struct MemoryImage;
+
+	// Creates a memory image that contains a copy of numPages virtual pages starting at data.
+	// Returns nullptr if memory images aren't supported by the platform, or the image couldn't be created.
+	CORE_API MemoryImage* createMemoryImage(const uint8* data,size_t numPages);
+
+	// Destroys a memory image. Pages that the image is mapped to keep their contents.
+	CORE_API void destroyMemoryImage(MemoryImage* image);
+
+	// Maps a memory image copy-on-write to the virtual pages starting at baseVirtualAddress, replacing their contents.
+	// The pages must be committed with MemoryAccess::ReadWrite, and may be decommitted as usual afterwards.
+	// baseVirtualAddress must be a multiple of the preferred page size. Returns true if successful.
+	CORE_API bool mapMemoryImage(MemoryImage* image,uint8* baseVirtualAddress);
+
 	// Describes an instruction pointer.
 	CORE_API bool describeInstructionPointer(uintp ip,std::string& outDescription);
 
@@ -124,14 +166,51 @@ namespace Platform
 	// Initializes thread-specific state.
 	CORE_API void initThread();
 
+	// Returns the range of addresses reserved for the calling thread's stack, or null addresses if they aren't known.
+	CORE_API void getThreadStack(uint8*& outMinAddr,uint8*& outMaxAddr);
+
+	// If generated code can address the platform's thread-local variables relative to a thread pointer (the FS segment
+	// base on x86-64 Linux), returns true, and the offset of the calling thread's instance of a thread-local variable from
+	// its thread pointer. The offset of a variable in a module loaded with the process is the same for all threads.
+	CORE_API bool getThreadLocalOffset(const void* threadLocalAddress,intp& outOffset);
+
+	// A fiber: an execution context with its own stack, which runs on the thread that switches to it until it switches to
+	// another fiber. Switching fibers also switches the state of the catchHardwareTraps calls on the fibers' stacks, and the
+	// stack that getThreadStack returns, so a hardware trap is caught by the innermost catchHardwareTraps call on the running
+	// fiber's stack, and overflowing a fiber's stack is a stackOverflow trap.
+	struct Fiber;
+
+	// Returns the fiber that's running on the calling thread. If the thread hasn't switched to another fiber, this is a fiber
+	// for the thread's own stack, which other fibers may switch back to. The thread must have been initialized by initThread.
+	CORE_API Fiber* getCurrentFiber();
+
+	// Creates a fiber with a stack of at least numStackBytes, which calls entry(argument) when it's first switched to. The
+	// entry function must not return: it must switch to another fiber instead. On POSIX, the stack is allocated with
+	// allocateVirtualPages, with 64KB of uncommitted guard pages below it. On Windows, the system allocates the stack and its guard
+	// page. Returns nullptr if the stack couldn't be allocated.
+	CORE_API Fiber* createFiber(size_t numStackBytes,void (*entry)(void*),void* argument);
+
+	// Destroys a fiber created by createFiber, and frees its stack. The fiber must not be running.
+	CORE_API void destroyFiber(Fiber* fiber);
+
+	// Suspends the calling thread's current fiber, and runs another fiber on the thread until some fiber switches back to it.
+	// A suspended fiber may be resumed by a different thread, but the functions suspended on its stack must not rely on the
+	// addresses of the thread's thread-local variables staying the same.
+	CORE_API void switchToFiber(Fiber* fiber);
+
 	// Calls a thunk, and if it causes any of some specific hardware traps, returns true.
 	// If a trap was caught, the outCause, outContext, and outOperand parameters are set to describe the trap.
+	// On POSIX, the signal handlers are installed by the first call, and left installed for the rest of the process. Signals
+	// that aren't raised by a thread while it's calling a thunk are forwarded to the previously installed signal handlers.
+	// For accessViolation, the operand is the address that was accessed. For illegalInstruction, the operand is the address
+	// of the instruction.
 	enum HardwareTrapType
 	{
 		none,
 		accessViolation,
 		stackOverflow,
-		intDivideByZeroOrOverflow
+		intDivideByZeroOrOverflow,
+		illegalInstruction
 	};
 	CORE_API HardwareTrapType catchHardwareTraps(
 		CallStack& outTrapCallStack,
@@ -93,6 +93,12 @@ namespace Intrinsics
 	// Finds an intrinsic object by name and type.
 	RUNTIME_API Runtime::Object* find(const char* name,const WebAssembly::ObjectType& type);
 
+	// Returns an intrinsic's name decorated with its type, which uniquely identifies the intrinsic.
+	RUNTIME_API std::string getDecoratedName(const char* name,const WebAssembly::ObjectType& type);
+
+	// Finds an intrinsic function by its decorated name.
+	RUNTIME_API Runtime::Object* findFunctionByDecoratedName(const std::string& decoratedName);
+
 	// Returns an array of all intrinsic runtime Objects; used as roots for garbage collection.
 	RUNTIME_API std::vector<Runtime::Object*> getAllIntrinsicObjects();
 }
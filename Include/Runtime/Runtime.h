@@ -17,6 +17,115 @@ namespace Runtime
 	// Initializes the runtime. Should only be called once per process.
 	RUNTIME_API void init();
 
+	// How the code compiled for a module ensures that its memory accesses stay within the bounds of its default memory.
+	enum class MemoryBoundsCheckMode : uint8
+	{
+		// The address of each access is masked to the address-space reserved for the memory. Accesses beyond the end of the
+		// memory's committed pages fault on the reserved pages.
+		addressMask,
+
+		// The address of each access is used without any check. Each memory reserves enough address-space that a 32-bit address
+		// plus a 32-bit offset can't reach beyond it, so accesses beyond the end of the memory fault on the reserved pages.
+		// Only supported on 64-bit hosts.
+		guardRegion,
+
+		// The end of each access is compared to the memory's current size, and an access beyond it traps. Each memory only
+		// reserves address-space for its maximum size, so many more memories can be created in a process.
+		explicitChecks
+	};
+
+	// Options that control how modules are compiled to native code.
+	struct CompileOptions
+	{
+		// The number of threads used to compile a module. The module's function definitions are partitioned into a shard per
+		// thread, and the shards are compiled in parallel before being linked together. If 0, uses one thread per hardware thread.
+		uintp numCompileThreads;
+
+		// If not empty, the directory used to cache the objects compiled for modules. Objects are cached by a hash of the
+		// module and everything else that affects the generated code, so instantiating an identical module again in this or a
+		// later process loads the cached object instead of compiling the module.
+		std::string objectCacheDirectory;
+
+		// If true, modules are compiled to code that accesses the instance's memory, table, globals, and imported functions
+		// through a context pointer passed to each function, instead of referencing them directly. The code for a module is
+		// then compiled once and shared by all its instances, at the cost of loading those references at runtime.
+		bool shareCodeBetweenInstances;
+
+		// If true, modules are first compiled with minimal optimization, so they can start running sooner. Once a function has
+		// been called tierUpCallCount times, it is compiled with full optimization on a background thread, and calls to the
+		// function are forwarded to the optimized code once it's ready.
+		bool enableTieredCompilation;
+		uintp tierUpCallCount;
+
+		// If true, a module's functions aren't compiled when it's instantiated. Each function initially points to a stub that
+		// compiles the function the first time it's called, and replaces the function's entry with the compiled code.
+		bool enableLazyCompilation;
+
+		// How much to optimize the generated code, trading compile time for the speed of the code:
+		// 0 doesn't optimize the code at all, and compiles fastest.
+		// 1 runs a few fast scalar optimizations.
+		// 2 and 3 run LLVM's standard optimization pipeline, including inlining, loop optimizations, and vectorization.
+		// If tiered compilation is enabled, this is the level used to compile the optimized tier.
+		uintp optimizationLevel;
+
+		// How memory accesses are bounds checked. Memories are created with the address-space reservation needed by this mode,
+		// so it must not be changed from or to MemoryBoundsCheckMode::explicitChecks after creating memories that are used
+		// by modules instantiated afterwards.
+		MemoryBoundsCheckMode memoryBoundsCheckMode;
+
+		// If true, memories created afterwards ask the platform to back their committed pages with huge pages (2MB on
+		// x86-64 Linux), which reduces the TLB misses caused by random accesses to large memories. Memories that use explicit
+		// bounds checks commit their pages in whole huge pages. Has no effect if the platform doesn't support huge pages.
+		bool useHugePages;
+
+		// If true, and the code is compiled for x86-64, integer division and unreachable are compiled to instructions that
+		// cause a hardware trap instead of branching to a call into the runtime: division by zero relies on the CPU's divide
+		// error, and unreachable executes an undefined instruction. The runtime finds the cause of such a trap from the
+		// address of the instruction that caused it.
+		bool useHardwareTraps;
+
+		// If true, and the code is compiled for x86-64 Linux, each function checks on entry that the stack pointer is above
+		// the calling thread's stack limit, and throws a stackOverflow exception if it isn't. Otherwise, stack overflow is
+		// only detected by the guard page below the thread's stack, so WebAssembly code can't run on stacks without one, and
+		// can't be limited to less than the whole stack. See setInvokeStackBudget.
+		bool checkStackLimit;
+
+		// If true, the code charges the fuel of the instance it runs in for the operators it executes, and throws a
+		// fuelExhausted exception once the fuel runs out. The cost of the operators between each loop header and the next is
+		// charged in one batch at the loop header, and the cost of the rest of a function's operators is charged on entry
+		// to the function, so the fuel consumed is a deterministic over-approximation of the operators executed. See
+		// setInstanceFuel.
+		bool meterFuel;
+
+		// If true, the code polls whether the invoke it's running in has been interrupted by incrementEpoch when entering each
+		// function and at the start of each loop iteration, and throws an interrupted exception if it has. The poll is one
+		// load and compare, unlike metering fuel, which also updates the fuel.
+		bool pollEpoch;
+
+		CompileOptions()
+		: numCompileThreads(1)
+		, shareCodeBetweenInstances(false)
+		, enableTieredCompilation(false)
+		, tierUpCallCount(1000)
+		, enableLazyCompilation(false)
+		, optimizationLevel(1)
+		, memoryBoundsCheckMode(MemoryBoundsCheckMode::addressMask)
+		, useHugePages(false)
+		, useHardwareTraps(false)
+		, checkStackLimit(false)
+		, meterFuel(false)
+		, pollEpoch(false)
+		{}
+	};
+
+	// Gets or sets the options used to compile modules. Setting the options only affects modules instantiated afterwards.
+	RUNTIME_API CompileOptions getCompileOptions();
+	RUNTIME_API void setCompileOptions(const CompileOptions& newOptions);
+
+	// Waits for the background thread to optimize the functions that tiered code has requested optimizing, and returns the
+	// number of functions it has optimized since the process started.
+	RUNTIME_API uintp waitForTierUps();
+
 	// Information about a runtime exception.
 	struct Exception
 	{
@@ -34,7 +143,9 @@ namespace Runtime
 			calledAbort,
 			calledUnimplementedIntrinsic,
 			outOfMemory,
-			invalidSegmentOffset
+			invalidSegmentOffset,
+			fuelExhausted,
+			interrupted
 		};
 
 		Cause cause;
@@ -58,6 +169,8 @@ namespace Runtime
 		case Exception::Cause::calledUnimplementedIntrinsic: return "called unimplemented intrinsic";
 		case Exception::Cause::outOfMemory: return "out of memory";
 		case Exception::Cause::invalidSegmentOffset: return "invalid segment offset";
+		case Exception::Cause::fuelExhausted: return "fuel exhausted";
+		case Exception::Cause::interrupted: return "interrupted";
 		default: return "unknown";
 		}
 	}
@@ -106,12 +219,29 @@ namespace Runtime
 	inline ModuleInstance* asModuleNullable(Object* object)	{ return object && object->kind == WebAssembly::ObjectKind::module ? (ModuleInstance*)object : nullptr; }
 	
 	// Frees unreferenced Objects, using the provided array of Objects as the root set.
+	// Waits for other threads to finish creating objects and changing table elements, and keeps them from starting until the
+	// unreferenced objects are freed; a module's start function runs while it's being created, so it may not call this.
+	// Any object another thread uses, including one it has just created, must be referenced by the root set.
 	RUNTIME_API void freeUnreferencedObjects(const std::vector<Object*>& rootObjectReferences);
 
 	//
 	// Functions
 	//
 
+	// Sets the maximum number of bytes of stack that each function invoked by the calling thread may use, including the
+	// functions it calls, or 0 to only limit invokes by the thread's stack. An invoke made by a function that was itself
+	// invoked is also limited by the outer invoke's budget. Only enforced for code compiled with CompileOptions::checkStackLimit.
+	RUNTIME_API void setInvokeStackBudget(size_t numBytes);
+
+	// Increments the runtime's epoch, which interrupts every invoke that started in an earlier epoch and hasn't finished,
+	// including invokes suspended on fibers. Code compiled with CompileOptions::pollEpoch throws an interrupted exception
+	// the next time it enters a function or loop iteration in an interrupted invoke. Invokes started afterwards aren't
+	// interrupted. May be called from any thread. Returns the new epoch.
+	RUNTIME_API uint64 incrementEpoch();
+
+	// Returns the runtime's current epoch.
+	RUNTIME_API uint64 getEpoch();
+
 	// Invokes a FunctionInstance with the given parameters, and returns the result.
 	// Throws a Runtime::Exception if a trap occurs.
 	RUNTIME_API Result invokeFunction(FunctionInstance* function,const std::vector<Value>& parameters);
@@ -119,6 +249,116 @@ namespace Runtime
 	// Returns the type of a FunctionInstance.
 	RUNTIME_API const WebAssembly::FunctionType* getFunctionType(FunctionInstance* function);
 
+	// Returns the native code to call a FunctionInstance and the context to pass it as a hidden first parameter.
+	// The entry point is called using the C calling convention: entry(context,parameters...)
+	RUNTIME_API void getFunctionEntryAndContext(FunctionInstance* function,void*& outEntry,void*& outContext);
+
+	// Calls a thunk that calls into WebAssembly code, and turns any hardware traps it causes into a Runtime::Exception.
+	RUNTIME_API void catchRuntimeTraps(const std::function<void()>& thunk);
+
+	// An invoke running on a fiber: a stack taken from a pool, separate from the stack of the thread that started the invoke.
+	// An intrinsic function called by the invoke may suspend it with yieldInvokeFiber, which returns to the thread's caller
+	// of startInvokeOnFiber or resumeInvokeFiber, so a thread can interleave many invokes that wait for the host. Traps are
+	// caught on the fiber's stack, and overflowing it throws a stackOverflow exception.
+	struct InvokeFiber;
+
+	// Starts invoking a function on a fiber, and runs the invoke until it finishes or yields. Throws an outOfMemory exception
+	// if the pool is empty and a new fiber couldn't be created.
+	RUNTIME_API InvokeFiber* startInvokeOnFiber(FunctionInstance* function,const std::vector<Value>& parameters);
+
+	// Resumes an invoke that yielded, and runs it until it finishes or yields again. The invoke must be resumed by the thread
+	// that started it, since the functions suspended on the fiber may use the thread's thread-local variables.
+	RUNTIME_API void resumeInvokeFiber(InvokeFiber* invokeFiber);
+
+	// Returns whether an invoke on a fiber has finished: returned, or thrown an exception.
+	RUNTIME_API bool isInvokeFiberFinished(InvokeFiber* invokeFiber);
+
+	// Returns a finished invoke's fiber to the pool, and returns the invoke's result. If the invoke threw a Runtime::Exception,
+	// throws it instead. The InvokeFiber may not be used afterwards.
+	RUNTIME_API Result finishInvokeFiber(InvokeFiber* invokeFiber);
+
+	// Cancels an invoke on a fiber that yielded, or discards the result of one that finished, and returns its fiber to the
+	// pool. A suspended invoke is resumed with the yieldInvokeFiber call that suspended it throwing an interrupted exception,
+	// which unwinds the invoke, and resumed again each time it yields until it finishes. Like resumeInvokeFiber, must be
+	// called by the thread that started the invoke. The InvokeFiber may not be used afterwards.
+	RUNTIME_API void cancelInvokeFiber(InvokeFiber* invokeFiber);
+
+	// Suspends the invoke running on the calling thread's current fiber, and returns when it's resumed. May only be called
+	// by an intrinsic function called by an invoke on a fiber. If the invoke is being cancelled, throws an interrupted
+	// exception when it's resumed.
+	RUNTIME_API void yieldInvokeFiber();
+
+	// Returns the invoke running on the calling thread's current fiber, or null if it isn't running an invoke on a fiber.
+	RUNTIME_API InvokeFiber* getCurrentInvokeFiber();
+
+	// Sets the number of bytes in the stack of each fiber created for an invoke, and the maximum number of fibers kept in a
+	// pool for reuse by later invokes after the invokes using them finish. Frees any pooled fibers with a different stack size,
+	// or that don't fit in the pool. numStackBytes must be at least 128KB. By default, fibers have 1MB stacks, and the pool
+	// keeps up to 16 fibers.
+	RUNTIME_API void setInvokeFiberPool(size_t numStackBytes,uintp maxPooledFibers);
+
+	// Maps the C++ types used by TypedFunction to the WebAssembly types they represent.
+	template<typename Native> struct NativeTypeInfo;
+	template<> struct NativeTypeInfo<void> { static const WebAssembly::ResultType resultType = WebAssembly::ResultType::none; };
+	template<> struct NativeTypeInfo<int32> { static const WebAssembly::ResultType resultType = WebAssembly::ResultType::i32; };
+	template<> struct NativeTypeInfo<int64> { static const WebAssembly::ResultType resultType = WebAssembly::ResultType::i64; };
+	template<> struct NativeTypeInfo<float32> { static const WebAssembly::ResultType resultType = WebAssembly::ResultType::f32; };
+	template<> struct NativeTypeInfo<float64> { static const WebAssembly::ResultType resultType = WebAssembly::ResultType::f64; };
+
+	// A handle to a FunctionInstance with a statically known signature, for calling the same function many times.
+	// The function's type is checked and its entry point is looked up once when the handle is created, so each call
+	// only costs an indirect native call and the setup to catch hardware traps, and doesn't allocate memory.
+	// Throws a Runtime::Exception with cause invokeSignatureMismatch if the function doesn't have the given signature.
+	template<typename Signature> struct TypedFunction;
+	template<typename Return,typename... Args>
+	struct TypedFunction<Return(Args...)>
+	{
+		typedef Return (*EntryPointer)(void*,Args...);
+
+		TypedFunction(FunctionInstance* function)
+		{
+			const WebAssembly::FunctionType* expectedType = WebAssembly::FunctionType::get(
+				NativeTypeInfo<Return>::resultType,
+				std::initializer_list<WebAssembly::ValueType> {WebAssembly::asValueType(NativeTypeInfo<Args>::resultType)...}
+				);
+			if(getFunctionType(function) != expectedType) { throw Exception {Exception::Cause::invokeSignatureMismatch}; }
+
+			void* entryVoid;
+			getFunctionEntryAndContext(function,entryVoid,context);
+			entry = reinterpret_cast<EntryPointer>(entryVoid);
+		}
+
+		Return operator()(Args... args) const { return Invoker<Return>::invoke(entry,context,args...); }
+
+	private:
+
+		EntryPointer entry;
+		void* context;
+
+		// Calls the entry point within catchRuntimeTraps. The thunk is passed to catchRuntimeTraps through a
+		// std::reference_wrapper, which std::function stores without allocating memory.
+		template<typename InvokeReturn,typename Unused = void>
+		struct Invoker
+		{
+			static InvokeReturn invoke(EntryPointer entry,void* context,Args... args)
+			{
+				InvokeReturn result;
+				auto thunk = [&]{ result = (*entry)(context,args...); };
+				catchRuntimeTraps(std::ref(thunk));
+				return result;
+			}
+		};
+		template<typename Unused>
+		struct Invoker<void,Unused>
+		{
+			static void invoke(EntryPointer entry,void* context,Args... args)
+			{
+				auto thunk = [&]{ (*entry)(context,args...); };
+				catchRuntimeTraps(std::ref(thunk));
+			}
+		};
+	};
+
 	//
 	// Tables
 	//
@@ -155,9 +395,47 @@ namespace Runtime
 	RUNTIME_API size_t getMemoryMaxPages(Memory* memory);
 
 	// Grows or shrinks the size of a memory by numPages. Returns the previous size of the memory.
+	// Memories that are only accessed with explicit bounds checks commit pages ahead of their size when they grow. Memories
+	// with a full address-space reservation (the mask and guard region bounds check modes) commit exactly their size, since
+	// accesses beyond it must fault, so each grow of such a memory commits its new pages.
 	RUNTIME_API intp growMemory(Memory* memory,size_t numPages);
 	RUNTIME_API intp shrinkMemory(Memory* memory,size_t numPages);
 
+	// Statistics about the pool of address-space reservations reused by memories.
+	struct MemoryReservationPoolStats
+	{
+		uintp maxPooledReservations;	// The maximum number of reservations kept in the pool.
+		uintp numPooledReservations;	// The number of reservations currently in the pool.
+		uint64 numReused;				// The number of memories created with a reservation taken from the pool.
+		uint64 numAllocated;			// The number of memories created with a new reservation because the pool was empty.
+		uint64 numReturned;				// The number of reservations returned to the pool by deleted memories.
+		uint64 numFreed;				// The number of reservations freed by deleted memories because the pool was full.
+	};
+
+	// Sets the maximum number of address-space reservations kept in a pool for reuse by later memories, and reserves enough
+	// address-space to fill the pool. Only memories created for code without explicit bounds checks use the pool, since they
+	// all reserve the same amount of address-space: 12GB on a 64-bit host. Returns false if reserving the address-space failed.
+	// By default, the pool's size is 0, and each memory reserves and frees its own address-space.
+	RUNTIME_API bool setMemoryReservationPoolSize(uintp maxPooledReservations);
+	RUNTIME_API MemoryReservationPoolStats getMemoryReservationPoolStats();
+
+	// A copy of the size and contents of a memory at some point, which the memory can be restored to.
+	struct MemorySnapshot;
+
+	// Takes a snapshot of a memory's size and contents. If the platform supports memory images, the contents are copied to an
+	// image that restoreMemory maps copy-on-write into the memory.
+	RUNTIME_API MemorySnapshot* snapshotMemory(Memory* memory);
+
+	// Restores a memory to the size and contents in a snapshot. The snapshot's size must be within the memory's type's limits.
+	// If the platform supports memory images, this replaces the memory's pages with a copy-on-write mapping of the snapshot,
+	// so it only costs time proportional to the number of pages that were touched since the memory was last restored.
+	// Must not be called while the memory is being accessed by another thread. Throws a Runtime::Exception with cause
+	// outOfMemory if the memory couldn't be resized or mapped.
+	RUNTIME_API void restoreMemory(Memory* memory,MemorySnapshot* snapshot);
+
+	// Deletes a MemorySnapshot. Memories restored from it keep their contents.
+	RUNTIME_API void deleteMemorySnapshot(MemorySnapshot* snapshot);
+
 	// Validates that an offset range is wholly inside a Memory's virtual address range.
 	RUNTIME_API uint8* getValidatedMemoryOffsetRange(Memory* memory,uintp offset,size_t numBytes);
 	
@@ -189,10 +467,57 @@ namespace Runtime
 	// Instantiates a module, bindings its imports to the specified objects. May throw InstantiationException.
 	RUNTIME_API ModuleInstance* instantiateModule(const WebAssembly::Module& module,std::vector<Object*>&& imports);
 
+	// A module that has been compiled to native code, and may be instantiated any number of times without compiling it again.
+	struct CompiledModule;
+
+	// Compiles a module to instance-independent code, and precomputes the state needed to instantiate it. The module is copied,
+	// so it needn't outlive the CompiledModule.
+	RUNTIME_API CompiledModule* compileModule(const WebAssembly::Module& module);
+
+	// Deletes a CompiledModule. Instances of it may continue to be used after it is deleted.
+	RUNTIME_API void deleteCompiledModule(CompiledModule* compiledModule);
+
+	// Instantiates a compiled module, like instantiateModule, but reusing the compiled module's code. If the offsets of the
+	// module's data segments are constant, the instance's memory is initialized by mapping a copy-on-write image of it.
+	RUNTIME_API ModuleInstance* instantiateCompiledModule(CompiledModule* compiledModule,std::vector<Object*>&& imports);
+
+	// Compiles a module's instance-independent code ahead of time to a precompiled object, which may be saved and loaded by
+	// loadPrecompiledModule in a later process. The code is compiled with the current CompileOptions::optimizationLevel and
+	// CompileOptions::memoryBoundsCheckMode.
+	RUNTIME_API std::vector<uint8> compilePrecompiledObject(const WebAssembly::Module& module);
+
+	// Loads a precompiled object produced by compilePrecompiledObject for a module, and returns a CompiledModule that uses its
+	// code without compiling the module. Returns null if the object wasn't compiled for the module by this version of the
+	// runtime for this target, with the current CompileOptions::memoryBoundsCheckMode, or if the object is corrupted.
+	RUNTIME_API CompiledModule* loadPrecompiledModule(const WebAssembly::Module& module,const std::vector<uint8>& precompiledObject);
+
 	// Gets the default table/memory for a ModuleInstance.
 	RUNTIME_API Memory* getDefaultMemory(ModuleInstance* moduleInstance);
 	RUNTIME_API Table* getDefaultTable(ModuleInstance* moduleInstance);
 
 	// Gets an object exported by a ModuleInstance by name.
 	RUNTIME_API Object* getInstanceExport(ModuleInstance* moduleInstance,const char* exportName);
+
+	// Gets or sets the fuel of a ModuleInstance: the number of operators its code compiled with CompileOptions::meterFuel may
+	// execute before it throws a fuelExhausted exception. Instances start with practically unlimited fuel. The fuel is
+	// negative after the exception is thrown, and the host may refill it to run the instance's code again. Setting the fuel
+	// while the instance's code is running on another thread is allowed, but may be overwritten by that code's next charge.
+	RUNTIME_API void setInstanceFuel(ModuleInstance* moduleInstance,int64 fuel);
+	RUNTIME_API int64 getInstanceFuel(ModuleInstance* moduleInstance);
+
+	// A snapshot of the state of a ModuleInstance, which the instance can be restored to.
+	struct ModuleInstanceSnapshot;
+
+	// Takes a snapshot of the memories and mutable globals defined by a module instance. Imported objects aren't included,
+	// since they may be shared with other instances. Tables aren't included, since WebAssembly code can't modify them.
+	RUNTIME_API ModuleInstanceSnapshot* snapshotModuleInstance(ModuleInstance* moduleInstance);
+
+	// Restores the memories and mutable globals defined by a module instance to their state in a snapshot of the instance,
+	// e.g. to reuse an instance after taking a snapshot of it right after instantiating it. The snapshot must have been taken of
+	// the same instance. Must not be called while the instance's code is running. May throw a Runtime::Exception with cause
+	// outOfMemory, like restoreMemory.
+	RUNTIME_API void restoreModuleInstance(ModuleInstance* moduleInstance,ModuleInstanceSnapshot* snapshot);
+
+	// Deletes a ModuleInstanceSnapshot.
+	RUNTIME_API void deleteModuleInstanceSnapshot(ModuleInstanceSnapshot* snapshot);
 }
@@ -1,5 +1,12 @@
 #ifndef _WIN32
 
+#ifdef __APPLE__
+	// MacOS only declares the ucontext functions if _XOPEN_SOURCE is defined, which hides its other extensions unless
+	// _DARWIN_C_SOURCE is also defined.
+	#define _XOPEN_SOURCE 700
+	#define _DARWIN_C_SOURCE
+#endif
+
 #include "Core/Core.h"
 #include "Core/Platform.h"
 
@@ -8,9 +15,11 @@
 #include <sys/mman.h>
 
 #include <errno.h>
+#include <stdio.h>
 #include <signal.h>
 #include <setjmp.h>
 #include <sys/resource.h>
+#include <ucontext.h>
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
@@ -22,6 +31,7 @@
 #ifdef __linux__
 	#include <execinfo.h>
 	#include <dlfcn.h>
+	#include <sys/syscall.h>
 #endif
 
 namespace Platform
@@ -47,6 +57,51 @@ namespace Platform
 		if(pthread_mutex_unlock((pthread_mutex_t*)handle)) { Core::error("pthread_mutex_unlock failed"); }
 	}
 
+	struct EventHandle
+	{
+		pthread_mutex_t mutex;
+		pthread_cond_t condition;
+		bool isSignaled;
+	};
+
+	Event::Event()
+	{
+		EventHandle* eventHandle = new EventHandle();
+		if(pthread_mutex_init(&eventHandle->mutex,nullptr)) { Core::error("pthread_mutex_init failed"); }
+		if(pthread_cond_init(&eventHandle->condition,nullptr)) { Core::error("pthread_cond_init failed"); }
+		eventHandle->isSignaled = false;
+		handle = eventHandle;
+	}
+
+	Event::~Event()
+	{
+		EventHandle* eventHandle = (EventHandle*)handle;
+		if(pthread_cond_destroy(&eventHandle->condition)) { Core::error("pthread_cond_destroy failed"); }
+		if(pthread_mutex_destroy(&eventHandle->mutex)) { Core::error("pthread_mutex_destroy failed"); }
+		delete eventHandle;
+	}
+
+	void Event::wait()
+	{
+		EventHandle* eventHandle = (EventHandle*)handle;
+		if(pthread_mutex_lock(&eventHandle->mutex)) { Core::error("pthread_mutex_lock failed"); }
+		while(!eventHandle->isSignaled)
+		{
+			if(pthread_cond_wait(&eventHandle->condition,&eventHandle->mutex)) { Core::error("pthread_cond_wait failed"); }
+		}
+		eventHandle->isSignaled = false;
+		if(pthread_mutex_unlock(&eventHandle->mutex)) { Core::error("pthread_mutex_unlock failed"); }
+	}
+
+	void Event::signal()
+	{
+		EventHandle* eventHandle = (EventHandle*)handle;
+		if(pthread_mutex_lock(&eventHandle->mutex)) { Core::error("pthread_mutex_lock failed"); }
+		eventHandle->isSignaled = true;
+		if(pthread_cond_signal(&eventHandle->condition)) { Core::error("pthread_cond_signal failed"); }
+		if(pthread_mutex_unlock(&eventHandle->mutex)) { Core::error("pthread_mutex_unlock failed"); }
+	}
+
 	static size_t internalGetPreferredVirtualPageSizeLog2()
 	{
 		uint32 preferredVirtualPageSize = sysconf(_SC_PAGESIZE);
@@ -107,8 +162,43 @@ namespace Platform
 	{
 		errorUnless(isPageAligned(baseVirtualAddress));
 		auto numBytes = numPages << getPageSizeLog2();
-		if(madvise(baseVirtualAddress,numBytes,MADV_DONTNEED)) { Core::error("madvise failed"); }
-		if(mprotect(baseVirtualAddress,numBytes,PROT_NONE)) { Core::error("mprotect failed"); }
+
+		// Replace the pages with a new anonymous mapping instead of just discarding their contents with madvise, since
+		// discarded pages that a memory image was mapped to would be refilled from the image instead of with zeroes.
+		auto result = mmap(baseVirtualAddress,numBytes,PROT_NONE,MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,-1,0);
+		if(result == MAP_FAILED) { Core::error("mmap failed"); }
+	}
+
+	static uintp internalGetHugePageSizeLog2()
+	{
+		#ifdef __linux__
+			// Transparent huge pages are the size of the pages mapped by a page middle directory entry: 2MB on x86-64.
+			FILE* file = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size","r");
+			if(!file) { return 0; }
+			unsigned long long hugePageSize = 0;
+			const bool isValid = fscanf(file,"%llu",&hugePageSize) == 1
+				&& hugePageSize > (1ull << getPageSizeLog2())
+				&& !(hugePageSize & (hugePageSize - 1));
+			fclose(file);
+			return isValid ? floorLogTwo((uint64)hugePageSize) : 0;
+		#else
+			return 0;
+		#endif
+	}
+	uintp getHugePageSizeLog2()
+	{
+		static uintp hugePageSizeLog2 = internalGetHugePageSizeLog2();
+		return hugePageSizeLog2;
+	}
+
+	bool adviseHugePages(uint8* baseVirtualAddress,size_t numPages)
+	{
+		errorUnless(isPageAligned(baseVirtualAddress));
+		#if defined(__linux__) && defined(MADV_HUGEPAGE)
+			return madvise(baseVirtualAddress,numPages << getPageSizeLog2(),MADV_HUGEPAGE) == 0;
+		#else
+			return false;
+		#endif
 	}
 
 	void freeVirtualPages(uint8* baseVirtualAddress,size_t numPages)
@@ -117,6 +207,86 @@ namespace Platform
 		if(munmap(baseVirtualAddress,numPages << getPageSizeLog2())) { Core::error("munmap failed"); }
 	}
 
+	struct MemoryImage
+	{
+		int fileDescriptor;
+		size_t numPages;
+	};
+
+	#if defined(__linux__) && defined(SYS_memfd_create)
+		// Writes numBytes of data to a file at offset. Returns true if successful.
+		static bool writeFile(int fileDescriptor,const uint8* data,size_t numBytes,size_t offset)
+		{
+			size_t numBytesWritten = 0;
+			while(numBytesWritten < numBytes)
+			{
+				const ssize_t result = pwrite(fileDescriptor,data + numBytesWritten,numBytes - numBytesWritten,offset + numBytesWritten);
+				if(result <= 0)
+				{
+					if(result == -1 && errno == EINTR) { continue; }
+					return false;
+				}
+				numBytesWritten += result;
+			}
+			return true;
+		}
+
+		static bool isZeroPage(const uint8* page)
+		{
+			const uint64* words = (const uint64*)page;
+			const size_t numWords = ((size_t)1 << getPageSizeLog2()) / sizeof(uint64);
+			for(size_t wordIndex = 0;wordIndex < numWords;++wordIndex) { if(words[wordIndex]) { return false; } }
+			return true;
+		}
+	#endif
+
+	MemoryImage* createMemoryImage(const uint8* data,size_t numPages)
+	{
+		#if defined(__linux__) && defined(SYS_memfd_create)
+			// Create an anonymous file that holds a copy of the data.
+			const int fileDescriptor = (int)syscall(SYS_memfd_create,"WAVM memory image",0);
+			if(fileDescriptor == -1) { return nullptr; }
+
+			// Size the file to hold all the pages, but only write the pages that aren't all zeroes. The rest of the file is a
+			// hole that reads as zeroes, and doesn't use any memory.
+			const size_t pageSizeLog2 = getPageSizeLog2();
+			if(ftruncate(fileDescriptor,numPages << pageSizeLog2)) { close(fileDescriptor); return nullptr; }
+			size_t pageIndex = 0;
+			while(pageIndex < numPages)
+			{
+				if(isZeroPage(data + (pageIndex << pageSizeLog2))) { ++pageIndex; continue; }
+
+				const size_t beginPageIndex = pageIndex;
+				while(pageIndex < numPages && !isZeroPage(data + (pageIndex << pageSizeLog2))) { ++pageIndex; }
+				if(!writeFile(fileDescriptor,
+					data + (beginPageIndex << pageSizeLog2),
+					(pageIndex - beginPageIndex) << pageSizeLog2,
+					beginPageIndex << pageSizeLog2))
+				{
+					close(fileDescriptor);
+					return nullptr;
+				}
+			}
+
+			return new MemoryImage {fileDescriptor,numPages};
+		#else
+			return nullptr;
+		#endif
+	}
+
+	void destroyMemoryImage(MemoryImage* image)
+	{
+		if(close(image->fileDescriptor)) { Core::error("close failed"); }
+		delete image;
+	}
+
+	bool mapMemoryImage(MemoryImage* image,uint8* baseVirtualAddress)
+	{
+		errorUnless(isPageAligned(baseVirtualAddress));
+		auto result = mmap(baseVirtualAddress,image->numPages << getPageSizeLog2(),PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_FIXED,image->fileDescriptor,0);
+		return result != MAP_FAILED;
+	}
+
 	bool describeInstructionPointer(uintp ip,std::string& outDescription)
 	{
 		#ifdef __linux__
@@ -131,7 +301,10 @@ namespace Platform
 		return false;
 	}
 
-	THREAD_LOCAL jmp_buf signalReturnEnv;
+	// The signal return environment of the innermost catchHardwareTraps call on this thread, or null if the thread isn't
+	// running a thunk in catchHardwareTraps. Signals received while it's null aren't caused by the thunk, so they're forwarded
+	// to the signal handlers that were installed before catchHardwareTraps installed its handler.
+	THREAD_LOCAL sigjmp_buf* signalReturnEnv = nullptr;
 	THREAD_LOCAL HardwareTrapType signalType = HardwareTrapType::none;
 	THREAD_LOCAL CallStack* signalCallStack = nullptr;
 	THREAD_LOCAL uintp* signalOperand = nullptr;
@@ -182,8 +355,168 @@ namespace Platform
 		}
 	}
 
-	void signalHandler(int signalNumber,siginfo_t* signalInfo,void*)
+	bool getThreadLocalOffset(const void* threadLocalAddress,intp& outOffset)
 	{
+		#if defined(__linux__) && defined(__x86_64__)
+			// The first word of the thread control block that FS points to is the thread pointer.
+			uintp threadPointer;
+			asm("movq %%fs:0, %0" : "=r"(threadPointer));
+			outOffset = intp(reinterpret_cast<uintp>(threadLocalAddress) - threadPointer);
+			return true;
+		#else
+			return false;
+		#endif
+	}
+
+	// The number of bytes of uncommitted pages below the stack of a fiber created by createFiber. Code compiled by LLVM doesn't
+	// probe the pages of large stack frames, so a single guard page could be skipped by a function with a page of locals.
+	enum { fiberStackGuardNumBytes = 65536 };
+
+	struct Fiber
+	{
+		ucontext_t context;
+
+		// The fiber's stack, including the guard pages below it, the number of bytes of guard pages, and if it was created
+		// by createFiber, the number of pages allocated for the stack and guard pages.
+		uint8* stackMinAddr;
+		uint8* stackMaxAddr;
+		size_t numStackGuardBytes;
+		size_t numAllocatedStackPages;
+
+		void (*entry)(void*);
+		void* argument;
+
+		// While the fiber is suspended, the signal state of the innermost catchHardwareTraps call on its stack.
+		sigjmp_buf* signalReturnEnv;
+		CallStack* signalCallStack;
+		uintp* signalOperand;
+	};
+
+	THREAD_LOCAL Fiber* currentFiber = nullptr;
+
+	void getThreadStack(uint8*& outMinAddr,uint8*& outMaxAddr)
+	{
+		// Exclude the guard pages below a fiber's stack, or the extra page that initThread includes below the thread's stack.
+		const size_t numGuardBytes = currentFiber ? currentFiber->numStackGuardBytes : sysconf(_SC_PAGESIZE);
+		outMinAddr = stackMinAddr ? stackMinAddr + numGuardBytes : nullptr;
+		outMaxAddr = stackMaxAddr;
+	}
+
+	Fiber* getCurrentFiber()
+	{
+		if(!currentFiber)
+		{
+			errorUnless(signalStack);
+			currentFiber = new Fiber();
+			currentFiber->stackMinAddr = stackMinAddr;
+			currentFiber->stackMaxAddr = stackMaxAddr;
+			currentFiber->numStackGuardBytes = sysconf(_SC_PAGESIZE);
+		}
+		return currentFiber;
+	}
+
+	static void fiberEntry()
+	{
+		currentFiber->entry(currentFiber->argument);
+		Core::error("fiber entry function returned");
+	}
+
+	Fiber* createFiber(size_t numStackBytes,void (*entry)(void*),void* argument)
+	{
+		// Allocate the stack and the guard pages below it, and only commit the stack.
+		const uintp pageSizeLog2 = getPageSizeLog2();
+		const size_t numStackPages = (numStackBytes + (uintp(1) << pageSizeLog2) - 1) >> pageSizeLog2;
+		const size_t numGuardPages = (fiberStackGuardNumBytes + (uintp(1) << pageSizeLog2) - 1) >> pageSizeLog2;
+		uint8* stackMinAddr = allocateVirtualPages(numGuardPages + numStackPages);
+		if(!stackMinAddr) { return nullptr; }
+		uint8* stackBase = stackMinAddr + (numGuardPages << pageSizeLog2);
+		if(!commitVirtualPages(stackBase,numStackPages))
+		{
+			freeVirtualPages(stackMinAddr,numGuardPages + numStackPages);
+			return nullptr;
+		}
+
+		Fiber* fiber = new Fiber();
+		fiber->stackMinAddr = stackMinAddr;
+		fiber->stackMaxAddr = stackBase + (numStackPages << pageSizeLog2);
+		fiber->numStackGuardBytes = numGuardPages << pageSizeLog2;
+		fiber->numAllocatedStackPages = numGuardPages + numStackPages;
+		fiber->entry = entry;
+		fiber->argument = argument;
+
+		// Create a context that calls fiberEntry on the stack. fiberEntry finds the fiber through currentFiber, since makecontext
+		// can only pass int arguments.
+		if(getcontext(&fiber->context)) { Core::error("getcontext failed"); }
+		fiber->context.uc_stack.ss_sp = stackBase;
+		fiber->context.uc_stack.ss_size = numStackPages << pageSizeLog2;
+		fiber->context.uc_link = nullptr;
+		makecontext(&fiber->context,fiberEntry,0);
+		return fiber;
+	}
+
+	void destroyFiber(Fiber* fiber)
+	{
+		errorUnless(fiber != currentFiber && fiber->numAllocatedStackPages);
+		decommitVirtualPages(fiber->stackMinAddr,fiber->numAllocatedStackPages);
+		freeVirtualPages(fiber->stackMinAddr,fiber->numAllocatedStackPages);
+		delete fiber;
+	}
+
+	void switchToFiber(Fiber* fiber)
+	{
+		Fiber* suspendedFiber = getCurrentFiber();
+		errorUnless(fiber != suspendedFiber);
+
+		// Save the signal state of the suspended fiber, and restore the signal state and stack of the resumed fiber. The
+		// suspended fiber may be resumed by a different thread, so this function doesn't use thread-local variables after
+		// swapcontext returns.
+		suspendedFiber->signalReturnEnv = signalReturnEnv;
+		suspendedFiber->signalCallStack = signalCallStack;
+		suspendedFiber->signalOperand = signalOperand;
+		signalReturnEnv = fiber->signalReturnEnv;
+		signalCallStack = fiber->signalCallStack;
+		signalOperand = fiber->signalOperand;
+		stackMinAddr = fiber->stackMinAddr;
+		stackMaxAddr = fiber->stackMaxAddr;
+		currentFiber = fiber;
+
+		if(swapcontext(&suspendedFiber->context,&fiber->context)) { Core::error("swapcontext failed"); }
+	}
+
+	// The signal actions that were installed before the hardware trap signal handler.
+	static struct sigaction previousSignalActionSEGV;
+	static struct sigaction previousSignalActionBUS;
+	static struct sigaction previousSignalActionFPE;
+	static struct sigaction previousSignalActionILL;
+
+	static void forwardSignal(int signalNumber,siginfo_t* signalInfo,void* context)
+	{
+		const struct sigaction* previousSignalAction;
+		switch(signalNumber)
+		{
+		case SIGSEGV: previousSignalAction = &previousSignalActionSEGV; break;
+		case SIGBUS: previousSignalAction = &previousSignalActionBUS; break;
+		case SIGFPE: previousSignalAction = &previousSignalActionFPE; break;
+		case SIGILL: previousSignalAction = &previousSignalActionILL; break;
+		default: Core::unreachable();
+		};
+
+		if(previousSignalAction->sa_flags & SA_SIGINFO) { previousSignalAction->sa_sigaction(signalNumber,signalInfo,context); }
+		else if(previousSignalAction->sa_handler != SIG_DFL && previousSignalAction->sa_handler != SIG_IGN)
+		{ previousSignalAction->sa_handler(signalNumber); }
+		else
+		{
+			// Restore the default action for the signal. When this handler returns, the faulting instruction will be executed
+			// again, and the signal will be handled by the default action.
+			signal(signalNumber,SIG_DFL);
+		}
+	}
+
+	void signalHandler(int signalNumber,siginfo_t* signalInfo,void* context)
+	{
+		// If the thread isn't running a thunk in catchHardwareTraps, the signal wasn't caused by the thunk.
+		if(!signalReturnEnv) { forwardSignal(signalNumber,signalInfo,context); return; }
+
 		if(isReentrantSignal) { Core::error("reentrant signal handler"); }
 		isReentrantSignal = true;
 
@@ -201,6 +534,10 @@ namespace Platform
 				: HardwareTrapType::accessViolation;
 			*signalOperand = reinterpret_cast<uintp>(signalInfo->si_addr);
 			break;
+		case SIGILL:
+			signalType = HardwareTrapType::illegalInstruction;
+			*signalOperand = reinterpret_cast<uintp>(signalInfo->si_addr);
+			break;
 		default:
 			Core::errorf("unknown signal number: %i",signalNumber);
 			break;
@@ -210,8 +547,23 @@ namespace Platform
 		// so the top of the callstack is the function that triggered the signal.
 		*signalCallStack = captureCallStack(2);
 
-		// Jump back to the setjmp in catchRuntimeExceptions.
-		siglongjmp(signalReturnEnv,1);
+		// Jump back to the sigsetjmp in catchHardwareTraps.
+		siglongjmp(*signalReturnEnv,1);
+	}
+
+	static bool installSignalHandlers()
+	{
+		// SA_NODEFER leaves the signal unblocked while the handler runs, so the signal mask doesn't need to be saved by sigsetjmp
+		// and restored after the handler jumps out of the signal.
+		struct sigaction signalAction;
+		signalAction.sa_sigaction = signalHandler;
+		sigemptyset(&signalAction.sa_mask);
+		signalAction.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+		sigaction(SIGSEGV,&signalAction,&previousSignalActionSEGV);
+		sigaction(SIGBUS,&signalAction,&previousSignalActionBUS);
+		sigaction(SIGFPE,&signalAction,&previousSignalActionFPE);
+		sigaction(SIGILL,&signalAction,&previousSignalActionILL);
+		return true;
 	}
 
 	HardwareTrapType catchHardwareTraps(
@@ -221,41 +573,51 @@ namespace Platform
 		)
 	{
 		errorUnless(signalStack);
-		
-		struct sigaction oldSignalActionSEGV;
-		struct sigaction oldSignalActionBUS;
-		struct sigaction oldSignalActionFPE;
 
-		// Use setjmp to allow signals to jump back to this point.
-		bool isReturningFromSignalHandler = sigsetjmp(signalReturnEnv,1);
+		// Install the signal handlers the first time any thread calls catchHardwareTraps. They're left installed for the rest
+		// of the process, so calling catchHardwareTraps doesn't need any system calls.
+		static const bool areSignalHandlersInstalled = installSignalHandlers();
+		errorUnless(areSignalHandlersInstalled);
+
+		// Save the signal state of any enclosing catchHardwareTraps call, and restore it when this call returns, or when the
+		// thunk throws an exception.
+		struct SignalStateScope
+		{
+			sigjmp_buf* outerSignalReturnEnv;
+			CallStack* outerSignalCallStack;
+			uintp* outerSignalOperand;
+
+			SignalStateScope()
+			: outerSignalReturnEnv(signalReturnEnv), outerSignalCallStack(signalCallStack), outerSignalOperand(signalOperand) {}
+			~SignalStateScope()
+			{
+				isReentrantSignal = false;
+				signalReturnEnv = outerSignalReturnEnv;
+				signalCallStack = outerSignalCallStack;
+				signalOperand = outerSignalOperand;
+			}
+		} signalStateScope;
+
+		// Use sigsetjmp to allow signals to jump back to this point. The signal mask isn't saved, since it's never changed
+		// by the signal handler.
+		sigjmp_buf returnEnv;
+		bool isReturningFromSignalHandler = sigsetjmp(returnEnv,0);
 		if(!isReturningFromSignalHandler)
 		{
 			signalType = HardwareTrapType::none;
+			signalReturnEnv = &returnEnv;
 			signalCallStack = &outTrapCallStack;
 			signalOperand = &outTrapOperand;
 
-			// Set a signal handler for the signals we want to intercept.
-			struct sigaction signalAction;
-			signalAction.sa_sigaction = signalHandler;
-			sigemptyset(&signalAction.sa_mask);
-			signalAction.sa_flags = SA_SIGINFO | SA_ONSTACK;
-			sigaction(SIGSEGV,&signalAction,&oldSignalActionSEGV);
-			sigaction(SIGBUS,&signalAction,&oldSignalActionBUS);
-			sigaction(SIGFPE,&signalAction,&oldSignalActionFPE);
-
 			// Call the thunk.
 			thunk();
 		}
 
-		// Reset the signal state.
-		isReentrantSignal = false;
-		signalCallStack = nullptr;
-		signalOperand = nullptr;
-		sigaction(SIGSEGV,&oldSignalActionSEGV,nullptr);
-		sigaction(SIGBUS,&oldSignalActionBUS,nullptr);
-		sigaction(SIGFPE,&oldSignalActionFPE,nullptr);
-
-		return signalType;
+		// Reset the signal type, so an enclosing catchHardwareTraps call doesn't see it. The rest of the signal state is
+		// restored by signalStateScope.
+		const HardwareTrapType result = signalType;
+		signalType = HardwareTrapType::none;
+		return result;
 	}
 
 	CallStack captureCallStack(uintp numOmittedFramesFromTop)
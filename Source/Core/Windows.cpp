@@ -31,6 +31,27 @@ namespace Platform
 		LeaveCriticalSection((CRITICAL_SECTION*)handle);
 	}
 
+	Event::Event()
+	{
+		handle = CreateEvent(nullptr,FALSE,FALSE,nullptr);
+		if(!handle) { Core::error("CreateEvent failed"); }
+	}
+
+	Event::~Event()
+	{
+		CloseHandle(handle);
+	}
+
+	void Event::wait()
+	{
+		if(WaitForSingleObject(handle,INFINITE) != WAIT_OBJECT_0) { Core::error("WaitForSingleObject failed"); }
+	}
+
+	void Event::signal()
+	{
+		if(!SetEvent(handle)) { Core::error("SetEvent failed"); }
+	}
+
 	static size_t internalGetPreferredVirtualPageSizeLog2()
 	{
 		SYSTEM_INFO systemInfo;
@@ -97,6 +118,11 @@ namespace Platform
 		if(baseVirtualAddress && !result) { Core::error("VirtualFree(MEM_DECOMMIT) failed"); }
 	}
 
+	// Large pages aren't supported on Windows: they can't be committed a page at a time within address-space reserved by
+	// VirtualAlloc, and need the SeLockMemoryPrivilege.
+	uintp getHugePageSizeLog2() { return 0; }
+	bool adviseHugePages(uint8* baseVirtualAddress,size_t numPages) { return false; }
+
 	void freeVirtualPages(uint8* baseVirtualAddress,size_t numPages)
 	{
 		errorUnless(isPageAligned(baseVirtualAddress));
@@ -104,6 +130,12 @@ namespace Platform
 		if(baseVirtualAddress && !result) { Core::error("VirtualFree(MEM_RELEASE) failed"); }
 	}
 
+	// Memory images aren't supported on Windows: MapViewOfFileEx can't map a view into address space reserved by VirtualAlloc.
+	struct MemoryImage {};
+	MemoryImage* createMemoryImage(const uint8* data,size_t numPages) { return nullptr; }
+	void destroyMemoryImage(MemoryImage* image) { delete image; }
+	bool mapMemoryImage(MemoryImage* image,uint8* baseVirtualAddress) { return false; }
+
 	// The interface to the DbgHelp DLL
 	struct DbgHelp
 	{
@@ -265,6 +297,10 @@ namespace Platform
 			case EXCEPTION_STACK_OVERFLOW: outType = HardwareTrapType::stackOverflow; break;
 			case STATUS_INTEGER_DIVIDE_BY_ZERO: outType = HardwareTrapType::intDivideByZeroOrOverflow; break;
 			case STATUS_INTEGER_OVERFLOW: outType = HardwareTrapType::intDivideByZeroOrOverflow; break;
+			case EXCEPTION_ILLEGAL_INSTRUCTION:
+				outType = HardwareTrapType::illegalInstruction;
+				outTrapOperand = reinterpret_cast<uintp>(exceptionPointers->ExceptionRecord->ExceptionAddress);
+				break;
 			default: return EXCEPTION_CONTINUE_SEARCH;
 			}
 			isReentrantException = true;
@@ -287,6 +323,75 @@ namespace Platform
 		SetThreadStackGuarantee(&stackOverflowReserveBytes);
 	}
 
+	void getThreadStack(uint8*& outMinAddr,uint8*& outMaxAddr)
+	{
+		ULONG_PTR lowLimit;
+		ULONG_PTR highLimit;
+		GetCurrentThreadStackLimits(&lowLimit,&highLimit);
+		outMinAddr = reinterpret_cast<uint8*>(lowLimit);
+		outMaxAddr = reinterpret_cast<uint8*>(highLimit);
+	}
+
+	bool getThreadLocalOffset(const void* threadLocalAddress,intp& outOffset)
+	{
+		// Windows' thread-local variables are addressed through the TLS array in the TEB, not at a fixed offset from it.
+		return false;
+	}
+
+	// Windows switches the stack limits in the TEB and the SEH handlers with the fiber, so catchHardwareTraps and
+	// getThreadStack don't need any fiber-specific state.
+	struct Fiber
+	{
+		void* handle;
+		void (*entry)(void*);
+		void* argument;
+	};
+
+	THREAD_LOCAL Fiber* currentFiber = nullptr;
+
+	Fiber* getCurrentFiber()
+	{
+		if(!currentFiber)
+		{
+			errorUnless(isThreadInitialized);
+			currentFiber = new Fiber();
+			currentFiber->handle = ConvertThreadToFiberEx(nullptr,FIBER_FLAG_FLOAT_SWITCH);
+			if(!currentFiber->handle) { Core::error("ConvertThreadToFiberEx failed"); }
+		}
+		return currentFiber;
+	}
+
+	static void WINAPI fiberEntry(void* parameter)
+	{
+		Fiber* fiber = (Fiber*)parameter;
+		fiber->entry(fiber->argument);
+		Core::error("fiber entry function returned");
+	}
+
+	Fiber* createFiber(size_t numStackBytes,void (*entry)(void*),void* argument)
+	{
+		Fiber* fiber = new Fiber();
+		fiber->entry = entry;
+		fiber->argument = argument;
+		fiber->handle = CreateFiberEx(0,numStackBytes,FIBER_FLAG_FLOAT_SWITCH,fiberEntry,fiber);
+		if(!fiber->handle) { delete fiber; return nullptr; }
+		return fiber;
+	}
+
+	void destroyFiber(Fiber* fiber)
+	{
+		errorUnless(fiber != currentFiber);
+		DeleteFiber(fiber->handle);
+		delete fiber;
+	}
+
+	void switchToFiber(Fiber* fiber)
+	{
+		errorUnless(fiber != getCurrentFiber());
+		currentFiber = fiber;
+		SwitchToFiber(fiber->handle);
+	}
+
 	HardwareTrapType catchHardwareTraps(
 		CallStack& outTrapCallStack,
 		uintp& outTrapOperand,
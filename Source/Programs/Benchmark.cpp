@@ -0,0 +1,381 @@
+#include "Core/Core.h"
+#include "CLI.h"
+#include "Runtime/Runtime.h"
+#include "WAST/WAST.h"
+#include "WebAssembly/WebAssembly.h"
+
+#include <chrono>
+#include <inttypes.h>
+#include <thread>
+
+using namespace WebAssembly;
+using namespace Runtime;
+
+// A module with a function that accesses its memory out of bounds, so calling it causes an access violation that the runtime
+// has to find the owner of among all the memories in the process.
+static const char* trappingModuleText =
+	"(module\n"
+	"  (memory 1 1)\n"
+	"  (func (export \"trap\") (result i32) (i32.load (i32.const 65536)))\n"
+	")";
+
+// A module with a 16MB memory that's initialized by a data segment, and a function that writes to a few of its pages, as a
+// request handled by an instance might.
+static const char* resetModuleText =
+	"(module\n"
+	"  (memory 256 256)\n"
+	"  (data (i32.const 0) \"initial data\")\n"
+	"  (global $numRequests (mut i32) (i32.const 0))\n"
+	"  (func (export \"handleRequest\")\n"
+	"    (set_global $numRequests (i32.add (get_global $numRequests) (i32.const 1)))\n"
+	"    (i32.store (i32.const 0) (get_global $numRequests))\n"
+	"    (i32.store (i32.const 65536) (get_global $numRequests))\n"
+	"    (i32.store (i32.const 1048576) (get_global $numRequests))\n"
+	"    (i32.store (i32.const 8388608) (get_global $numRequests))\n"
+	"  )\n"
+	")";
+
+// Creates the text of a module with a memory of numPages pages, and a function that loads from numAccesses random addresses
+// in the memory. numPages must be a power of two.
+static std::string createRandomAccessModuleText(uintp numPages)
+{
+	const uint32 addressMask = uint32((uint64(numPages) << WebAssembly::numBytesPerPageLog2) - 1) & ~3u;
+	return
+		"(module\n"
+		"  (memory " + std::to_string(numPages) + " " + std::to_string(numPages) + ")\n"
+		"  (func (export \"randomAccess\") (param $numAccesses i32) (result i32)\n"
+		"    (local $state i32) (local $sum i32)\n"
+		"    (set_local $state (i32.const 2463534242))\n"
+		"    (loop\n"
+		"      ;; Advance a xorshift random number generator, and load from the address it generates.\n"
+		"      (set_local $state (i32.xor (get_local $state) (i32.shl (get_local $state) (i32.const 13))))\n"
+		"      (set_local $state (i32.xor (get_local $state) (i32.shr_u (get_local $state) (i32.const 17))))\n"
+		"      (set_local $state (i32.xor (get_local $state) (i32.shl (get_local $state) (i32.const 5))))\n"
+		"      (set_local $sum (i32.add (get_local $sum) (i32.load (i32.and (get_local $state) (i32.const " + std::to_string(addressMask) + ")))))\n"
+		"      (br_if 0 (tee_local $numAccesses (i32.sub (get_local $numAccesses) (i32.const 1))))\n"
+		"    )\n"
+		"    (get_local $sum)\n"
+		"  )\n"
+		")";
+}
+
+// A module with a function that runs a loop of float rounding, min/max, and float-to-int conversion operators, as a
+// numeric kernel might.
+static const char* floatModuleText =
+	"(module\n"
+	"  (func (export \"floatOps\") (param $numIterations i32) (result i64)\n"
+	"    (local $x f64) (local $sum i64)\n"
+	"    (set_local $x (f64.const 0.5))\n"
+	"    (loop\n"
+	"      (set_local $x (f64.add (f64.mul (get_local $x) (f64.const 1.000001)) (f64.const 0.75)))\n"
+	"      (set_local $sum (i64.add (get_local $sum) (i64.trunc_s/f64 (f64.floor (get_local $x)))))\n"
+	"      (set_local $sum (i64.add (get_local $sum) (i64.extend_s/i32 (i32.trunc_s/f64 (f64.nearest (f64.min (get_local $x) (f64.const 1000000.0)))))))\n"
+	"      (set_local $sum (i64.add (get_local $sum) (i64.trunc_u/f32 (f32.ceil (f32.max (f32.demote/f64 (get_local $x)) (f32.const 0.0))))))\n"
+	"      (set_local $x (f64.sub (get_local $x) (f64.trunc (get_local $x))))\n"
+	"      (br_if 0 (tee_local $numIterations (i32.sub (get_local $numIterations) (i32.const 1))))\n"
+	"    )\n"
+	"    (get_local $sum)\n"
+	"  )\n"
+	")";
+
+// Measures the rate of random loads from a memory of numPages pages. Compare the rate with different options to measure the
+// effect of backing the memory with huge pages, or of the memory bounds check mode.
+static bool benchmarkRandomAccess(uintp numPages,uintp numAccesses,const CompileOptions& compileOptions,const char* description)
+{
+	setCompileOptions(compileOptions);
+
+	Module module;
+	if(!loadTextModule("randomAccessModule",createRandomAccessModuleText(numPages).c_str(),module)) { return false; }
+	ModuleInstance* moduleInstance = instantiateModule(module,{});
+	TypedFunction<int32(int32)> randomAccess(asFunction(getInstanceExport(moduleInstance,"randomAccess")));
+
+	// Touch the memory's pages before timing the accesses, so the time spent committing physical pages isn't measured.
+	randomAccess((int32)numAccesses);
+
+	Core::Timer timer;
+	randomAccess((int32)numAccesses);
+	Log::logRatePerSecond(description,timer,(float64)numAccesses,"accesses");
+
+	freeUnreferencedObjects({});
+	return true;
+}
+
+// Measures the rate of iterations of a loop of float operators. Compare the rate against a build from before an operator's
+// code generation changed to measure the effect of the change, or against the rate with options that add code to each
+// iteration, such as fuel metering or epoch polling, to measure their overhead.
+static bool benchmarkFloatOps(uintp numIterations,const CompileOptions& compileOptions,const char* description)
+{
+	setCompileOptions(compileOptions);
+
+	Module module;
+	if(!loadTextModule("floatModule",floatModuleText,module)) { return false; }
+	ModuleInstance* moduleInstance = instantiateModule(module,{});
+	TypedFunction<int64(int32)> floatOps(asFunction(getInstanceExport(moduleInstance,"floatOps")));
+
+	Core::Timer timer;
+	const int64 sum = floatOps((int32)numIterations);
+	Log::logRatePerSecond(description,timer,(float64)numIterations,"iterations");
+	Log::printf(Log::Category::metrics,"Float operator loop result: %" PRId64 "\n",sum);
+	if(compileOptions.meterFuel) { Log::printf(Log::Category::metrics,"Float operator loop consumed %" PRId64 " fuel\n",INT64_MAX - getInstanceFuel(moduleInstance)); }
+
+	freeUnreferencedObjects({});
+	return true;
+}
+
+// Measures the time from incrementing the epoch on another thread to an invoke of code that polls the epoch throwing the
+// interrupted exception.
+static bool benchmarkInterrupt()
+{
+	CompileOptions compileOptions;
+	compileOptions.pollEpoch = true;
+	setCompileOptions(compileOptions);
+
+	Module module;
+	if(!loadTextModule("floatModule",floatModuleText,module)) { return false; }
+	ModuleInstance* moduleInstance = instantiateModule(module,{});
+	TypedFunction<int64(int32)> floatOps(asFunction(getInstanceExport(moduleInstance,"floatOps")));
+
+	// Interrupt the loop long before it would finish.
+	std::chrono::high_resolution_clock::time_point interruptTime;
+	std::thread interruptThread([&interruptTime]
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		interruptTime = std::chrono::high_resolution_clock::now();
+		incrementEpoch();
+	});
+
+	bool wasInterrupted = false;
+	try { floatOps(INT32_MAX); }
+	catch(const Runtime::Exception& exception) { wasInterrupted = exception.cause == Exception::Cause::interrupted; }
+	const auto catchTime = std::chrono::high_resolution_clock::now();
+	interruptThread.join();
+
+	if(!wasInterrupted) { Log::printf(Log::Category::error,"The float operator loop wasn't interrupted.\n"); return false; }
+	Log::printf(Log::Category::metrics,"Interrupted the float operator loop from another thread in %" PRIu64 "us\n",
+		uint64(std::chrono::duration_cast<std::chrono::microseconds>(catchTime - interruptTime).count()));
+
+	freeUnreferencedObjects({});
+	return true;
+}
+
+void showHelp()
+{
+	std::cerr << "Usage: Benchmark [switches]" << std::endl;
+	std::cerr << "  --memories n\t\tCreate and free n memories. Default: 100000" << std::endl;
+	std::cerr << "  --traps n\t\tCause n access violations while the memories exist. Default: 1000" << std::endl;
+	std::cerr << "  --churn n\t\tCreate and free n memories that don't use explicit bounds checks, one at a time. Default: 10000" << std::endl;
+	std::cerr << "  --memory-pool n\tKeep up to n freed memory reservations for reuse by new memories. Default: 0" << std::endl;
+	std::cerr << "  --random-access-pages n\tRandomly access a memory of n pages (rounded down to a power of two), with and without huge pages. Default: 4096" << std::endl;
+	std::cerr << "  --random-accesses n\tMake n random accesses to the memory. Default: 20000000" << std::endl;
+	std::cerr << "  --bounds-check-accesses n\tMake n random accesses to the memory with each bounds check mode: mask, guard (on 64-bit hosts), and explicit. Default: 20000000" << std::endl;
+	std::cerr << "  --float-ops n\t\tRun n iterations of a loop of float rounding, min/max, and conversion operators, with and without fuel metering and epoch polling. Default: 20000000" << std::endl;
+	std::cerr << "  --resets n\t\tReset an instance n times by restoring a snapshot, and by instantiating it again. Default: 1000" << std::endl;
+}
+
+int commandMain(int argc,char** argv)
+{
+	uintp numMemories = 100000;
+	uintp numTraps = 1000;
+	uintp numChurnMemories = 10000;
+	uintp memoryReservationPoolSize = 0;
+	uintp numRandomAccessPages = 4096;
+	uintp numRandomAccesses = 20000000;
+	uintp numBoundsCheckAccesses = 20000000;
+	uintp numFloatOps = 20000000;
+	uintp numResets = 1000;
+	for(auto args = argv + 1;*args;++args)
+	{
+		if(!strcmp(*args,"--memories"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			numMemories = (uintp)atoi(*args);
+		}
+		else if(!strcmp(*args,"--traps"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			numTraps = (uintp)atoi(*args);
+		}
+		else if(!strcmp(*args,"--churn"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			numChurnMemories = (uintp)atoi(*args);
+		}
+		else if(!strcmp(*args,"--memory-pool"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			memoryReservationPoolSize = (uintp)atoi(*args);
+		}
+		else if(!strcmp(*args,"--random-access-pages"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			numRandomAccessPages = std::min((uintp)atoi(*args),(uintp)WebAssembly::maxMemoryPages);
+		}
+		else if(!strcmp(*args,"--random-accesses"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			numRandomAccesses = (uintp)atoi(*args);
+			if(!numRandomAccesses || numRandomAccesses > INT32_MAX) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args,"--bounds-check-accesses"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			numBoundsCheckAccesses = (uintp)atoi(*args);
+			if(numBoundsCheckAccesses > INT32_MAX) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args,"--float-ops"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			numFloatOps = (uintp)atoi(*args);
+			if(numFloatOps > INT32_MAX) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args,"--resets"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			numResets = (uintp)atoi(*args);
+		}
+		else { showHelp(); return EXIT_FAILURE; }
+	}
+
+	Log::setCategoryEnabled(Log::Category::metrics,true);
+	Runtime::init();
+	if(memoryReservationPoolSize && !setMemoryReservationPoolSize(memoryReservationPoolSize))
+	{
+		std::cerr << "Couldn't reserve address-space for the memory reservation pool." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// Create the memories with explicit bounds checks, so each only reserves address-space for its maximum size.
+	CompileOptions compileOptions;
+	compileOptions.memoryBoundsCheckMode = MemoryBoundsCheckMode::explicitChecks;
+	setCompileOptions(compileOptions);
+
+	Core::Timer createTimer;
+	for(uintp memoryIndex = 0;memoryIndex < numMemories;++memoryIndex)
+	{
+		Memory* memory = createMemory(MemoryType(SizeConstraints {1,1}));
+		errorUnless(memory);
+	}
+	Log::logRatePerSecond("Created memories",createTimer,(float64)numMemories,"memories");
+
+	// Instantiate a module whose code relies on its memory's address-space reservation to catch out-of-bounds accesses.
+	Module trappingModule;
+	if(!loadTextModule("trappingModule",trappingModuleText,trappingModule)) { return EXIT_FAILURE; }
+	compileOptions.memoryBoundsCheckMode = MemoryBoundsCheckMode::addressMask;
+	setCompileOptions(compileOptions);
+	ModuleInstance* moduleInstance = instantiateModule(trappingModule,{});
+	FunctionInstance* trapFunction = asFunction(getInstanceExport(moduleInstance,"trap"));
+
+	Core::Timer trapTimer;
+	for(uintp trapIndex = 0;trapIndex < numTraps;++trapIndex)
+	{
+		try
+		{
+			invokeFunction(trapFunction,{});
+			Core::error("expected the function to trap");
+		}
+		catch(Runtime::Exception exception)
+		{
+			errorUnless(exception.cause == Exception::Cause::accessViolation);
+		}
+	}
+	Log::logRatePerSecond("Caught access violations",trapTimer,(float64)numTraps,"traps");
+
+	// Free the memories and the module instance.
+	Core::Timer freeTimer;
+	freeUnreferencedObjects({});
+	Log::logRatePerSecond("Freed objects",freeTimer,(float64)numMemories,"memories");
+
+	// Create and free memories that reserve the full address-space needed to elide bounds checks, as short-lived instances
+	// would. These take their reservations from the memory reservation pool if it's enabled.
+	Core::Timer churnTimer;
+	for(uintp memoryIndex = 0;memoryIndex < numChurnMemories;++memoryIndex)
+	{
+		Memory* memory = createMemory(MemoryType(SizeConstraints {1,1}));
+		errorUnless(memory);
+		freeUnreferencedObjects({});
+	}
+	Log::logRatePerSecond("Created and freed memories",churnTimer,(float64)numChurnMemories,"memories");
+
+	const MemoryReservationPoolStats poolStats = getMemoryReservationPoolStats();
+	Log::printf(Log::Category::metrics,"Memory reservation pool: %" PRIuPTR " pooled, %" PRIu64 " reused, %" PRIu64 " allocated, %" PRIu64 " returned, %" PRIu64 " freed\n",
+		poolStats.numPooledReservations,
+		poolStats.numReused,
+		poolStats.numAllocated,
+		poolStats.numReturned,
+		poolStats.numFreed);
+
+	// Compare the rate of random accesses to a large memory with and without huge pages.
+	if(numRandomAccessPages)
+	{
+		if(!Platform::getHugePageSizeLog2()) { Log::printf(Log::Category::metrics,"Huge pages aren't supported by this platform.\n"); }
+		numRandomAccessPages = (uintp)1 << Platform::floorLogTwo((uint64)numRandomAccessPages);
+		CompileOptions hugePageCompileOptions;
+		hugePageCompileOptions.useHugePages = true;
+		if(!benchmarkRandomAccess(numRandomAccessPages,numRandomAccesses,CompileOptions(),"Random accesses without huge pages")) { return EXIT_FAILURE; }
+		if(!benchmarkRandomAccess(numRandomAccessPages,numRandomAccesses,hugePageCompileOptions,"Random accesses with huge pages")) { return EXIT_FAILURE; }
+
+		// Compare the rate of random accesses with each memory bounds check mode.
+		if(numBoundsCheckAccesses)
+		{
+			CompileOptions boundsCheckCompileOptions;
+			boundsCheckCompileOptions.memoryBoundsCheckMode = MemoryBoundsCheckMode::addressMask;
+			if(!benchmarkRandomAccess(numRandomAccessPages,numBoundsCheckAccesses,boundsCheckCompileOptions,"Random accesses with masked addresses")) { return EXIT_FAILURE; }
+			if(sizeof(uintp) == 8)
+			{
+				boundsCheckCompileOptions.memoryBoundsCheckMode = MemoryBoundsCheckMode::guardRegion;
+				if(!benchmarkRandomAccess(numRandomAccessPages,numBoundsCheckAccesses,boundsCheckCompileOptions,"Random accesses with a guard region")) { return EXIT_FAILURE; }
+			}
+			boundsCheckCompileOptions.memoryBoundsCheckMode = MemoryBoundsCheckMode::explicitChecks;
+			if(!benchmarkRandomAccess(numRandomAccessPages,numBoundsCheckAccesses,boundsCheckCompileOptions,"Random accesses with explicit bounds checks")) { return EXIT_FAILURE; }
+		}
+	}
+
+	if(numFloatOps)
+	{
+		CompileOptions fuelCompileOptions;
+		fuelCompileOptions.meterFuel = true;
+		CompileOptions epochCompileOptions;
+		epochCompileOptions.pollEpoch = true;
+		if(!benchmarkFloatOps(numFloatOps,CompileOptions(),"Float operator loop iterations")) { return EXIT_FAILURE; }
+		if(!benchmarkFloatOps(numFloatOps,fuelCompileOptions,"Float operator loop iterations with fuel metering")) { return EXIT_FAILURE; }
+		if(!benchmarkFloatOps(numFloatOps,epochCompileOptions,"Float operator loop iterations with epoch polling")) { return EXIT_FAILURE; }
+		if(!benchmarkInterrupt()) { return EXIT_FAILURE; }
+	}
+
+	// Compare resetting an instance to its initial state between requests by restoring a snapshot of it, to instantiating
+	// the module again.
+	if(numResets)
+	{
+		setCompileOptions(CompileOptions());
+		Module resetModule;
+		if(!loadTextModule("resetModule",resetModuleText,resetModule)) { return EXIT_FAILURE; }
+		CompiledModule* compiledResetModule = compileModule(resetModule);
+
+		ModuleInstance* resetInstance = instantiateCompiledModule(compiledResetModule,{});
+		ModuleInstanceSnapshot* snapshot = snapshotModuleInstance(resetInstance);
+		TypedFunction<void()> handleRequest(asFunction(getInstanceExport(resetInstance,"handleRequest")));
+		Core::Timer restoreTimer;
+		for(uintp resetIndex = 0;resetIndex < numResets;++resetIndex)
+		{
+			handleRequest();
+			restoreModuleInstance(resetInstance,snapshot);
+		}
+		Log::logRatePerSecond("Handled requests, restoring a snapshot after each",restoreTimer,(float64)numResets,"requests");
+		deleteModuleInstanceSnapshot(snapshot);
+
+		Core::Timer instantiateTimer;
+		for(uintp resetIndex = 0;resetIndex < numResets;++resetIndex)
+		{
+			ModuleInstance* requestInstance = instantiateCompiledModule(compiledResetModule,{});
+			TypedFunction<void()> handleRequestOnce(asFunction(getInstanceExport(requestInstance,"handleRequest")));
+			handleRequestOnce();
+			freeUnreferencedObjects({});
+		}
+		Log::logRatePerSecond("Handled requests, instantiating the module for each",instantiateTimer,(float64)numResets,"requests");
+
+		deleteCompiledModule(compiledResetModule);
+		freeUnreferencedObjects({});
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -160,6 +160,16 @@ inline bool endsWith(const char *str, const char *suffix)
 	return (strncmp(str+lenstr-lensuffix, suffix, lensuffix) == 0);
 }
 
+// Parses the name of a memory bounds check mode: mask, guard, or explicit.
+inline bool parseMemoryBoundsCheckMode(const char* name,Runtime::MemoryBoundsCheckMode& outMode)
+{
+	if(!strcmp(name,"mask")) { outMode = Runtime::MemoryBoundsCheckMode::addressMask; }
+	else if(!strcmp(name,"guard")) { outMode = Runtime::MemoryBoundsCheckMode::guardRegion; }
+	else if(!strcmp(name,"explicit")) { outMode = Runtime::MemoryBoundsCheckMode::explicitChecks; }
+	else { return false; }
+	return true;
+}
+
 int commandMain(int argc,char** argv);
 
 int main(int argc,char** argv)
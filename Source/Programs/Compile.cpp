@@ -0,0 +1,71 @@
+#include "Core/Core.h"
+#include "CLI.h"
+#include "Runtime/Runtime.h"
+#include "WebAssembly/WebAssembly.h"
+
+void showHelp()
+{
+	std::cerr << "Usage: Compile [switches] in.wast|in.wasm out.wavmobj" << std::endl;
+	std::cerr << "  -O|--opt-level n\tOptimize the code at level n: 0 (fastest compile) to 3 (fastest code). Default: 1" << std::endl;
+	std::cerr << "  --bounds-checks mode\tCheck memory accesses with mode: mask, guard, or explicit. Default: mask" << std::endl;
+	std::cerr << "  --hardware-traps\tOn x86-64, trap on integer division by zero and unreachable with hardware traps" << std::endl;
+	std::cerr << "  --stack-limit-checks\tOn x86-64 Linux, check the stack limit when entering each function" << std::endl;
+	std::cerr << "  --meter-fuel\t\tCharge the instance's fuel for the operators the code executes" << std::endl;
+	std::cerr << "  --poll-epoch\t\tPoll whether the invoke was interrupted when entering each function and loop iteration" << std::endl;
+	std::cerr << "The output may be loaded with wavm --precompiled out.wavmobj in.wasm" << std::endl;
+}
+
+int commandMain(int argc,char** argv)
+{
+	const char* inputFilename = nullptr;
+	const char* outputFilename = nullptr;
+	Runtime::CompileOptions compileOptions;
+	for(auto args = argv + 1;*args;++args)
+	{
+		if(!strcmp(*args,"-O") || !strcmp(*args,"--opt-level"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.optimizationLevel = (uintp)atoi(*args);
+			if(compileOptions.optimizationLevel > 3) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args,"--bounds-checks"))
+		{
+			if(!*++args || !parseMemoryBoundsCheckMode(*args,compileOptions.memoryBoundsCheckMode)) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args,"--hardware-traps")) { compileOptions.useHardwareTraps = true; }
+		else if(!strcmp(*args,"--stack-limit-checks")) { compileOptions.checkStackLimit = true; }
+		else if(!strcmp(*args,"--meter-fuel")) { compileOptions.meterFuel = true; }
+		else if(!strcmp(*args,"--poll-epoch")) { compileOptions.pollEpoch = true; }
+		else if(!inputFilename) { inputFilename = *args; }
+		else if(!outputFilename) { outputFilename = *args; }
+		else { showHelp(); return EXIT_FAILURE; }
+	}
+	if(!inputFilename || !outputFilename)
+	{
+		showHelp();
+		return EXIT_FAILURE;
+	}
+
+	// Load the module.
+	WebAssembly::Module module;
+	if(!loadModule(inputFilename,module)) { return EXIT_FAILURE; }
+
+	// Compile the module to a precompiled object.
+	Runtime::init();
+	Runtime::setCompileOptions(compileOptions);
+	Core::Timer compileTimer;
+	const std::vector<uint8> precompiledObject = Runtime::compilePrecompiledObject(module);
+	Log::logTimer("Compiled module",compileTimer);
+
+	// Write the precompiled object to the output file.
+	std::ofstream outputStream(outputFilename,std::ios::binary);
+	outputStream.write((const char*)precompiledObject.data(),precompiledObject.size());
+	outputStream.close();
+	if(outputStream.fail())
+	{
+		std::cerr << "Failed to write " << outputFilename << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -11,34 +11,277 @@
 
 #include "CLI.h"
 
+#include <atomic>
+#include <set>
+#include <thread>
+
 using namespace SExp;
 using namespace WAST;
 using namespace WebAssembly;
 using namespace Runtime;
 
+// Reads a Value as the C++ type used to pass it to a TypedFunction.
+template<typename Native> Native getNativeValue(const Value& value);
+template<> int32 getNativeValue<int32>(const Value& value) { return value.i32; }
+template<> int64 getNativeValue<int64>(const Value& value) { return value.i64; }
+template<> float32 getNativeValue<float32>(const Value& value) { return value.f32; }
+template<> float64 getNativeValue<float64>(const Value& value) { return value.f64; }
+
+// Calls a function through a TypedFunction<Return(Args...)>, and returns its result as a Result.
+template<typename Return> struct TypedInvoker
+{
+	template<typename... Args> static Result invoke(FunctionInstance* function,Args... args)
+	{
+		TypedFunction<Return(Args...)> typedFunction(function);
+		return Result(typedFunction(args...));
+	}
+};
+template<> struct TypedInvoker<void>
+{
+	template<typename... Args> static Result invoke(FunctionInstance* function,Args... args)
+	{
+		TypedFunction<void(Args...)> typedFunction(function);
+		typedFunction(args...);
+		return Result();
+	}
+};
+
+template<typename Return,typename Parameter>
+bool invokeTypedFunction(FunctionInstance* function,const std::vector<Value>& parameters,Result& outResult)
+{
+	switch(parameters.size())
+	{
+	case 0: outResult = TypedInvoker<Return>::invoke(function); return true;
+	case 1: outResult = TypedInvoker<Return>::invoke(function,getNativeValue<Parameter>(parameters[0])); return true;
+	case 2: outResult = TypedInvoker<Return>::invoke(function,getNativeValue<Parameter>(parameters[0]),getNativeValue<Parameter>(parameters[1])); return true;
+	case 3: outResult = TypedInvoker<Return>::invoke(function,getNativeValue<Parameter>(parameters[0]),getNativeValue<Parameter>(parameters[1]),getNativeValue<Parameter>(parameters[2])); return true;
+	default: return false;
+	};
+}
+
+template<typename Return>
+bool invokeTypedFunction(FunctionInstance* function,const std::vector<Value>& parameters,Result& outResult)
+{
+	// Only functions whose parameters all have the same type are instantiated, to bound the number of signatures.
+	const ValueType parameterType = parameters.size() ? parameters[0].type : ValueType::i32;
+	for(auto parameter : parameters) { if(parameter.type != parameterType) { return false; } }
+
+	switch(parameterType)
+	{
+	case ValueType::i32: return invokeTypedFunction<Return,int32>(function,parameters,outResult);
+	case ValueType::i64: return invokeTypedFunction<Return,int64>(function,parameters,outResult);
+	case ValueType::f32: return invokeTypedFunction<Return,float32>(function,parameters,outResult);
+	case ValueType::f64: return invokeTypedFunction<Return,float64>(function,parameters,outResult);
+	default: Core::unreachable();
+	};
+}
+
+// Invokes a function through a TypedFunction if the test has a TypedFunction signature that matches the function's type.
+// Returns false if it doesn't.
+bool invokeTypedFunction(FunctionInstance* function,const std::vector<Value>& parameters,Result& outResult)
+{
+	switch(getFunctionType(function)->ret)
+	{
+	case ResultType::none: return invokeTypedFunction<void>(function,parameters,outResult);
+	case ResultType::i32: return invokeTypedFunction<int32>(function,parameters,outResult);
+	case ResultType::i64: return invokeTypedFunction<int64>(function,parameters,outResult);
+	case ResultType::f32: return invokeTypedFunction<float32>(function,parameters,outResult);
+	case ResultType::f64: return invokeTypedFunction<float64>(function,parameters,outResult);
+	default: Core::unreachable();
+	};
+}
+
+// Options that control how a test script instantiates and invokes modules.
+struct TestScriptOptions
+{
+	bool useCompiledModules;
+	bool usePrecompiledObjects;
+	bool useTypedInvoke;
+
+	// If true, each invoke is checked to be undone by restoring a snapshot of the instance taken before it.
+	bool snapshotInvokes;
+
+	// If true, each invoke runs on a fiber, and is resumed each time it yields until it finishes.
+	bool useInvokeFibers;
+
+	// If not zero, the fuel the instance is refilled with before each invoke of one of its functions.
+	int64 invokeFuel;
+
+	// If true, unreferenced objects are freed between modules. The objects referenced by all the scripts running at the
+	// same time are used as the root set, and scripts that collect garbage don't create objects while one of them does.
+	bool collectGarbage;
+
+	// If true, precompiled objects are checked to be rejected when compiled with different options. Disabled when other
+	// threads are running scripts at the same time, since it temporarily changes the runtime's compile options.
+	bool checkPrecompiledObjectOptions;
+
+	TestScriptOptions()
+	: useCompiledModules(false)
+	, usePrecompiledObjects(false)
+	, useTypedInvoke(false)
+	, snapshotInvokes(false)
+	, useInvokeFibers(false)
+	, invokeFuel(0)
+	, collectGarbage(true)
+	, checkPrecompiledObjectOptions(true)
+	{}
+};
+
+struct TestScriptState;
+
+// The scripts that collect garbage, and a mutex they hold while they change which objects they reference, or free the
+// objects none of them reference. The runtime doesn't free objects while they're being created, but a module instance a
+// script has just created isn't referenced by the script until it's recorded, so the mutex is held until then.
+static Platform::Mutex garbageCollectingScriptsMutex;
+static std::set<TestScriptState*> garbageCollectingScripts;
+
+// Locks garbageCollectingScriptsMutex if the script collects garbage, so scripts that don't collect garbage can create
+// objects concurrently.
+struct ScriptObjectsLock
+{
+	ScriptObjectsLock(bool isLocked): mutex(isLocked ? &garbageCollectingScriptsMutex : nullptr) { if(mutex) { mutex->Lock(); } }
+	~ScriptObjectsLock() { if(mutex) { mutex->Unlock(); } }
+
+private:
+	Platform::Mutex* mutex;
+};
+
 struct TestScriptState : private Resolver
 {
 	std::vector<WAST::Error> errors;
 
-	TestScriptState(const char* inFilename): filename(inFilename), lastModuleInstance(nullptr) {}
+	TestScriptState(const char* inFilename,const TestScriptOptions& inOptions)
+	: filename(inFilename)
+	, useCompiledModules(inOptions.useCompiledModules || inOptions.usePrecompiledObjects)
+	, usePrecompiledObjects(inOptions.usePrecompiledObjects)
+	, useTypedInvoke(inOptions.useTypedInvoke)
+	, snapshotInvokes(inOptions.snapshotInvokes)
+	, useInvokeFibers(inOptions.useInvokeFibers)
+	, invokeFuel(inOptions.invokeFuel)
+	, shouldCollectGarbage(inOptions.collectGarbage)
+	, checkPrecompiledObjectOptions(inOptions.checkPrecompiledObjectOptions)
+	, lastModuleInstance(nullptr)
+	{
+		if(shouldCollectGarbage)
+		{
+			Platform::Lock lock(garbageCollectingScriptsMutex);
+			garbageCollectingScripts.insert(this);
+		}
+	}
+
+	~TestScriptState()
+	{
+		if(shouldCollectGarbage)
+		{
+			Platform::Lock lock(garbageCollectingScriptsMutex);
+			garbageCollectingScripts.erase(this);
+		}
+		for(auto& mapIt : compiledModules) { deleteCompiledModule(mapIt.second); }
+	}
 
 	bool process();
 
 private:
 
 	const char* filename;
+	bool useCompiledModules;
+	bool usePrecompiledObjects;
+	bool useTypedInvoke;
+	bool snapshotInvokes;
+	bool useInvokeFibers;
+	int64 invokeFuel;
+	bool shouldCollectGarbage;
+	bool checkPrecompiledObjectOptions;
 
 	ModuleInstance* lastModuleInstance;
 	
 	std::map<std::string,ModuleInstance*> moduleInternalNameToInstanceMap;
 	std::map<std::string,ModuleInstance*> moduleNameToInstanceMap;
 
+	// The CompiledModule for each distinct module the script has instantiated, keyed by the module's serialized bytes.
+	std::map<std::vector<uint8>,CompiledModule*> compiledModules;
+
+	// The precompiled object for the last module the script instantiated from one.
+	std::vector<uint8> lastPrecompiledObject;
+
+	// Checks that loadPrecompiledModule rejects a module's precompiled object if it's truncated or corrupted, and rejects
+	// the precompiled object of a different module or one compiled with different options.
+	void checkPrecompiledObjectRejection(const Module& module,const std::vector<uint8>& precompiledObject)
+	{
+		std::vector<uint8> truncatedObject(precompiledObject.begin(),precompiledObject.begin() + precompiledObject.size() / 2);
+		errorUnless(!loadPrecompiledModule(module,truncatedObject));
+
+		// Corrupt the last character of the header's first line, which identifies the module and the options it was compiled with.
+		std::vector<uint8> corruptedHeaderObject = precompiledObject;
+		auto newlineIt = std::find(corruptedHeaderObject.begin(),corruptedHeaderObject.end(),uint8('\n'));
+		errorUnless(newlineIt != corruptedHeaderObject.begin() && newlineIt != corruptedHeaderObject.end());
+		*(newlineIt - 1) ^= 1;
+		errorUnless(!loadPrecompiledModule(module,corruptedHeaderObject));
+
+		std::vector<uint8> corruptedCodeObject = precompiledObject;
+		corruptedCodeObject[corruptedCodeObject.size() - 1] ^= 1;
+		errorUnless(!loadPrecompiledModule(module,corruptedCodeObject));
+
+		if(lastPrecompiledObject.size() && lastPrecompiledObject != precompiledObject)
+		{
+			errorUnless(!loadPrecompiledModule(module,lastPrecompiledObject));
+		}
+
+		if(checkPrecompiledObjectOptions)
+		{
+			const CompileOptions compileOptions = getCompileOptions();
+			CompileOptions otherCompileOptions = compileOptions;
+			otherCompileOptions.meterFuel = !compileOptions.meterFuel;
+			setCompileOptions(otherCompileOptions);
+			const std::vector<uint8> otherOptionsObject = compilePrecompiledObject(module);
+			setCompileOptions(compileOptions);
+			errorUnless(!loadPrecompiledModule(module,otherOptionsObject));
+		}
+	}
+
+	// Instantiates a module, through a CompiledModule if useCompiledModules is set. If usePrecompiledObjects is set, the
+	// CompiledModule is loaded from a precompiled object compiled for the module. Identical modules in the script are
+	// instantiated from the same CompiledModule, to check that its instances don't share any state.
+	ModuleInstance* instantiate(const Module& module,std::vector<Object*>&& imports)
+	{
+		if(!useCompiledModules) { return instantiateModule(module,std::move(imports)); }
+		else
+		{
+			Serialization::ArrayOutputStream moduleStream;
+			WebAssembly::serialize(moduleStream,module);
+			CompiledModule*& compiledModule = compiledModules[moduleStream.getBytes()];
+			if(!compiledModule)
+			{
+				if(!usePrecompiledObjects) { compiledModule = compileModule(module); }
+				else
+				{
+					const std::vector<uint8> precompiledObject = compilePrecompiledObject(module);
+					checkPrecompiledObjectRejection(module,precompiledObject);
+					lastPrecompiledObject = precompiledObject;
+
+					compiledModule = loadPrecompiledModule(module,precompiledObject);
+					errorUnless(compiledModule);
+				}
+			}
+			return instantiateCompiledModule(compiledModule,std::move(imports));
+		}
+	}
+
+	void getRootObjects(std::vector<Object*>& outRootObjects) const
+	{
+		outRootObjects.push_back(asObject(lastModuleInstance));
+		for(auto& mapIt : moduleInternalNameToInstanceMap) { outRootObjects.push_back(asObject(mapIt.second)); }
+		for(auto& mapIt : moduleNameToInstanceMap) { outRootObjects.push_back(asObject(mapIt.second)); }
+	}
+
+	// Frees the objects that aren't referenced by any of the scripts that collect garbage.
 	void collectGarbage()
 	{
+		if(!shouldCollectGarbage) { return; }
+
+		Platform::Lock lock(garbageCollectingScriptsMutex);
 		std::vector<Object*> rootObjects;
-		rootObjects.push_back(asObject(lastModuleInstance));
-		for(auto& mapIt : moduleInternalNameToInstanceMap) { rootObjects.push_back(asObject(mapIt.second)); }
-		for(auto& mapIt : moduleNameToInstanceMap) { rootObjects.push_back(asObject(mapIt.second)); }
+		for(auto script : garbageCollectingScripts) { script->getRootObjects(rootObjects); }
 		freeUnreferencedObjects(rootObjects);
 	}
 
@@ -125,6 +368,27 @@ private:
 		return Value();
 	}
 
+	// Invokes a function exported by a module instance, on a fiber if useInvokeFibers is set, or through a TypedFunction if
+	// useTypedInvoke is set and the function's type allows it. If invokeFuel is set, the instance's fuel is refilled first.
+	Result invoke(ModuleInstance* moduleInstance,FunctionInstance* functionInstance,const std::vector<Value>& parameters)
+	{
+		if(invokeFuel) { setInstanceFuel(moduleInstance,invokeFuel); }
+
+		if(useInvokeFibers)
+		{
+			InvokeFiber* invokeFiber = startInvokeOnFiber(functionInstance,parameters);
+			while(!isInvokeFiberFinished(invokeFiber)) { resumeInvokeFiber(invokeFiber); }
+			return finishInvokeFiber(invokeFiber);
+		}
+
+		Result result;
+		if(!useTypedInvoke || !invokeTypedFunction(functionInstance,parameters,result))
+		{
+			result = invokeFunction(functionInstance,parameters);
+		}
+		return result;
+	}
+
 	bool processAction(SNodeIt nodeIt,Result& outResult)
 	{
 		SNodeIt childNodeIt;
@@ -169,8 +433,35 @@ private:
 				// Verify that all of the invoke's operands were parsed.
 				if(childNodeIt) { recordExcessInputError(childNodeIt,"invoke unexpected argument"); }
 
-				// Execute the invoke
-				outResult = invokeFunction(functionInstance,parameters);
+				if(!snapshotInvokes) { outResult = invoke(moduleInstance,functionInstance,parameters); }
+				else
+				{
+					// Execute the invoke, restore the instance to a snapshot taken before it, and execute the invoke again. The
+					// second invoke must produce the same result as the first, which it only will if the first invoke's effects on
+					// the instance were undone.
+					ModuleInstanceSnapshot* snapshot = snapshotModuleInstance(moduleInstance);
+					Result firstResult;
+					bool didFirstInvokeThrow = false;
+					Exception::Cause firstExceptionCause = Exception::Cause::unknown;
+					try { firstResult = invoke(moduleInstance,functionInstance,parameters); }
+					catch(Runtime::Exception exception)
+					{
+						didFirstInvokeThrow = true;
+						firstExceptionCause = exception.cause;
+					}
+					restoreModuleInstance(moduleInstance,snapshot);
+					deleteModuleInstanceSnapshot(snapshot);
+
+					try { outResult = invoke(moduleInstance,functionInstance,parameters); }
+					catch(Runtime::Exception exception)
+					{
+						if(!didFirstInvokeThrow || exception.cause != firstExceptionCause)
+						{ recordError(savedExportNameIt,"invoke threw an exception after restoring a snapshot, but not before"); }
+						throw;
+					}
+					if(didFirstInvokeThrow || !areBitsEqual(outResult,firstResult))
+					{ recordError(savedExportNameIt,"invoke produced a different result after restoring a snapshot"); }
+				}
 			}
 
 			return true;
@@ -218,7 +509,10 @@ private:
 		else if(parseTaggedNode(nodeIt,Symbol::_module,childNodeIt))
 		{
 			// Clear the previous module.
-			lastModuleInstance = nullptr;
+			{
+				ScriptObjectsLock objectsLock(shouldCollectGarbage);
+				lastModuleInstance = nullptr;
+			}
 			collectGarbage();
 
 			// Parse a module definition.
@@ -229,7 +523,11 @@ private:
 			{
 				// Link and instantiate the module.
 				LinkResult linkResult = linkModule(*module,*this);
-				if(linkResult.success) { lastModuleInstance = instantiateModule(*module,std::move(linkResult.resolvedImports)); }
+				if(linkResult.success)
+				{
+					ScriptObjectsLock objectsLock(shouldCollectGarbage);
+					lastModuleInstance = instantiate(*module,std::move(linkResult.resolvedImports));
+				}
 				else
 				{
 					for(auto& missingImport : linkResult.missingImports)
@@ -255,7 +553,11 @@ private:
 			{
 				// Don't check for duplicate names for now, since the ml-proto tests rely on name shadowing.
 				/*if(moduleInternalNameToInstanceMap.count(moduleInternalName)) { recordError(moduleInternalNameIt,std::string("duplicate module name: ") + moduleInternalName); }
-				else*/ { moduleInternalNameToInstanceMap[moduleInternalName] = lastModuleInstance; }
+				else*/
+				{
+					ScriptObjectsLock objectsLock(shouldCollectGarbage);
+					moduleInternalNameToInstanceMap[moduleInternalName] = lastModuleInstance;
+				}
 			}
 
 			return true;
@@ -331,6 +633,8 @@ private:
 		else if(!strcmp(message.c_str(),"undefined")) { expectedCause = Exception::Cause::undefinedTableElement; }
 		else if(!strcmp(message.c_str(),"uninitialized")) { expectedCause = Exception::Cause::undefinedTableElement; }
 		else if(!strcmp(message.c_str(),"uninitialized element")) { expectedCause = Exception::Cause::undefinedTableElement; }
+		else if(!strcmp(message.c_str(),"fuel exhausted")) { expectedCause = Exception::Cause::fuelExhausted; }
+		else if(!strcmp(message.c_str(),"interrupted")) { expectedCause = Exception::Cause::interrupted; }
 		const char* expectedCauseDescription = describeExceptionCause(expectedCause);
 
 		// Process the action.
@@ -440,7 +744,8 @@ private:
 			if(linkResult.success)
 			{
 				Log::printf(Log::Category::debug,"assert_unlinkable: %u c\n",moduleNodeIt->startLocus.newlines + 1);
-				instantiateModule(*unlinkableModule,std::move(linkResult.resolvedImports));
+				ScriptObjectsLock objectsLock(shouldCollectGarbage);
+				instantiate(*unlinkableModule,std::move(linkResult.resolvedImports));
 				Log::printf(Log::Category::debug,"assert_unlinkable: %u d\n",moduleNodeIt->startLocus.newlines + 1);
 				recordError(moduleNodeIt,"expected unlinkable module, but link succeeded");
 			}
@@ -547,12 +852,14 @@ bool TestScriptState::process()
 			{
 				auto mapIt = moduleInternalNameToInstanceMap.find(moduleInternalName);
 				if(mapIt == moduleInternalNameToInstanceMap.end()) { recordError(childNodeIt,"unknown module internal name"); continue; }
+				ScriptObjectsLock objectsLock(shouldCollectGarbage);
 				moduleNameToInstanceMap[moduleName] = mapIt->second;
 			}
 			else
 			{
 				// If no internal name is used, just use the last declared module.
 				if(!lastModuleInstance) { recordError(childNodeIt,"no module to register"); continue; }
+				ScriptObjectsLock objectsLock(shouldCollectGarbage);
 				moduleNameToInstanceMap[moduleName] = lastModuleInstance;
 			}
 		}
@@ -654,6 +961,83 @@ DEFINE_INTRINSIC_FUNCTION2(spectest,spectest_print,print,none,i64,a,f64,b)
 	std::cout << a << " : i64, " << b << " : f64" << std::endl;
 }
 
+// Suspends the invoke that called it if it's running on a fiber, to test that invokes may be suspended and resumed anywhere.
+DEFINE_INTRINSIC_FUNCTION0(wavmTest,wavmTest_yield,yield,none)
+{
+	if(getCurrentInvokeFiber()) { yieldInvokeFiber(); }
+}
+
+// Invokes started on fibers by wavmTest.startFiber, so a script can interleave several suspended invokes on one thread. The
+// functions they invoke are taken from the wavmTest.fiberFunctions table, and must have type (i32)->i32.
+enum { numTestInvokeFibers = 4 };
+static THREAD_LOCAL InvokeFiber* testInvokeFibers[numTestInvokeFibers];
+DEFINE_INTRINSIC_TABLE(wavmTest,wavmTest_fiberFunctions,fiberFunctions,TableType(TableElementType::anyfunc,SizeConstraints {4,4}))
+
+static InvokeFiber*& getTestInvokeFiber(int32 fiberIndex)
+{
+	errorUnless(fiberIndex >= 0 && fiberIndex < numTestInvokeFibers);
+	return testInvokeFibers[fiberIndex];
+}
+
+// Starts invoking a function from wavmTest.fiberFunctions on a fiber, and returns whether it finished without yielding.
+DEFINE_INTRINSIC_FUNCTION3(wavmTest,wavmTest_startFiber,startFiber,i32,i32,fiberIndex,i32,functionIndex,i32,argument)
+{
+	InvokeFiber*& invokeFiber = getTestInvokeFiber(fiberIndex);
+	errorUnless(!invokeFiber && functionIndex >= 0);
+	FunctionInstance* function = asFunctionNullable(getTableElement(wavmTest_fiberFunctions,(uintp)functionIndex));
+	errorUnless(function);
+	invokeFiber = startInvokeOnFiber(function,{Value(argument)});
+	return isInvokeFiberFinished(invokeFiber) ? 1 : 0;
+}
+
+// Resumes an invoke started by wavmTest.startFiber, and returns whether it finished.
+DEFINE_INTRINSIC_FUNCTION1(wavmTest,wavmTest_resumeFiber,resumeFiber,i32,i32,fiberIndex)
+{
+	InvokeFiber* invokeFiber = getTestInvokeFiber(fiberIndex);
+	errorUnless(invokeFiber);
+	resumeInvokeFiber(invokeFiber);
+	return isInvokeFiberFinished(invokeFiber) ? 1 : 0;
+}
+
+// Finishes an invoke started by wavmTest.startFiber, and returns its result, or rethrows the exception it threw.
+DEFINE_INTRINSIC_FUNCTION1(wavmTest,wavmTest_finishFiber,finishFiber,i32,i32,fiberIndex)
+{
+	InvokeFiber*& invokeFiber = getTestInvokeFiber(fiberIndex);
+	errorUnless(invokeFiber);
+	InvokeFiber* finishedInvokeFiber = invokeFiber;
+	invokeFiber = nullptr;
+	return finishInvokeFiber(finishedInvokeFiber).i32;
+}
+
+// Cancels an invoke started by wavmTest.startFiber.
+DEFINE_INTRINSIC_FUNCTION1(wavmTest,wavmTest_cancelFiber,cancelFiber,none,i32,fiberIndex)
+{
+	InvokeFiber*& invokeFiber = getTestInvokeFiber(fiberIndex);
+	errorUnless(invokeFiber);
+	cancelInvokeFiber(invokeFiber);
+	invokeFiber = nullptr;
+}
+
+// Increments the runtime's epoch, interrupting the invoke that called it, to test interrupting invokes in code that polls the epoch.
+DEFINE_INTRINSIC_FUNCTION0(wavmTest,wavmTest_interrupt,interrupt,none)
+{
+	incrementEpoch();
+}
+
+// Sets the stack budget of the invokes the thread makes after the one that called it, to test that a budget stops recursion
+// that succeeds without it.
+DEFINE_INTRINSIC_FUNCTION1(wavmTest,wavmTest_setInvokeStackBudget,setInvokeStackBudget,none,i32,numBytes)
+{
+	setInvokeStackBudget((size_t)(uint32)numBytes);
+}
+
+// Waits for the functions that tiered code has requested optimizing to be optimized, and returns the number of functions
+// optimized so far, to test that functions are optimized after the expected number of calls.
+DEFINE_INTRINSIC_FUNCTION0(wavmTest,wavmTest_waitForTierUps,waitForTierUps,i32)
+{
+	return (int32)waitForTierUps();
+}
+
 DEFINE_INTRINSIC_GLOBAL(spectest,spectest_globalI32,global,i32,false,666)
 DEFINE_INTRINSIC_GLOBAL(spectest,spectest_globalI64,global,i64,false,0)
 DEFINE_INTRINSIC_GLOBAL(spectest,spectest_globalF32,global,f32,false,0.0f)
@@ -662,29 +1046,162 @@ DEFINE_INTRINSIC_GLOBAL(spectest,spectest_globalF64,global,f64,false,0.0)
 DEFINE_INTRINSIC_TABLE(spectest,spectest_table,table,TableType(TableElementType::anyfunc,SizeConstraints {10,20}))
 DEFINE_INTRINSIC_MEMORY(spectest,spectest_memory,memory,MemoryType(SizeConstraints {1,2}))
 
+void showHelp()
+{
+	std::cerr << "Usage: Test [switches] in.wast" << std::endl;
+	std::cerr << "  --compile-threads n\tCompile modules on n threads" << std::endl;
+	std::cerr << "  --object-cache dir\tCache compiled code in dir, and reuse it for identical modules" << std::endl;
+	std::cerr << "  --share-code\t\tCompile code that is shared between instances of the same module" << std::endl;
+	std::cerr << "  --compiled-modules\tInstantiate modules through Runtime::compileModule" << std::endl;
+	std::cerr << "  --precompiled-objects\tInstantiate modules through Runtime::compilePrecompiledObject and loadPrecompiledModule" << std::endl;
+	std::cerr << "  --tier-up-calls n\tUse tiered compilation, optimizing functions after n calls" << std::endl;
+	std::cerr << "  --lazy\t\tCompile each function when it's first called" << std::endl;
+	std::cerr << "  --opt-level n\tOptimize the code at level n (0-3)" << std::endl;
+	std::cerr << "  --bounds-checks mode\tCheck memory accesses with mode: mask, guard, or explicit" << std::endl;
+	std::cerr << "  --typed-invoke\tInvoke functions through Runtime::TypedFunction where possible" << std::endl;
+	std::cerr << "  --threads n\t\tRun the script on n threads at once" << std::endl;
+	std::cerr << "  --threads-gc\t\tWith --threads, free the objects no thread references between modules on each thread" << std::endl;
+	std::cerr << "  --memory-pool n\tKeep up to n freed memory reservations for reuse by new memories" << std::endl;
+	std::cerr << "  --huge-pages\t\tBack memories with huge pages if the platform supports them" << std::endl;
+	std::cerr << "  --hardware-traps\tTrap on integer division by zero and unreachable with hardware traps on x86-64" << std::endl;
+	std::cerr << "  --stack-limit-checks\tCheck the stack limit when entering each function on x86-64 Linux" << std::endl;
+	std::cerr << "  --invoke-stack-budget n\tLimit each invoke to n bytes of stack" << std::endl;
+	std::cerr << "  --snapshot-invokes\tCheck that restoring a snapshot of the instance taken before each invoke undoes it" << std::endl;
+	std::cerr << "  --invoke-fibers\tRun each invoke on a fiber, resuming it whenever it calls wavmTest.yield" << std::endl;
+	std::cerr << "  --fuel n\t\tMeter fuel, and refill the instance with n fuel before each invoke" << std::endl;
+	std::cerr << "  --poll-epoch\t\tPoll whether the invoke was interrupted by wavmTest.interrupt when entering each function and loop iteration" << std::endl;
+}
+
+// Runs a test script, and prints whether it passed.
+static bool processScript(const char* filename,const TestScriptOptions& options)
+{
+	TestScriptState scriptState(filename,options);
+	if(!scriptState.process())
+	{
+		std::cerr << filename << ": testing failed!" << std::endl;
+		return false;
+	}
+	else
+	{
+		std::cout << filename << ": all tests passed." << std::endl;
+		return true;
+	}
+}
+
 int commandMain(int argc,char** argv)
 {
-	if(argc != 2)
+	const char* filename = nullptr;
+	CompileOptions compileOptions;
+	TestScriptOptions scriptOptions;
+	uintp numThreads = 1;
+	bool collectGarbageOnThreads = false;
+	uintp memoryReservationPoolSize = 0;
+	uintp invokeStackBudget = 0;
+	for(auto args = argv + 1;*args;++args)
+	{
+		if(!strcmp(*args,"--compile-threads"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.numCompileThreads = (uintp)atoi(*args);
+		}
+		else if(!strcmp(*args,"--object-cache"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.objectCacheDirectory = *args;
+		}
+		else if(!strcmp(*args,"--share-code")) { compileOptions.shareCodeBetweenInstances = true; }
+		else if(!strcmp(*args,"--compiled-modules")) { scriptOptions.useCompiledModules = true; }
+		else if(!strcmp(*args,"--precompiled-objects")) { scriptOptions.usePrecompiledObjects = true; }
+		else if(!strcmp(*args,"--typed-invoke")) { scriptOptions.useTypedInvoke = true; }
+		else if(!strcmp(*args,"--snapshot-invokes")) { scriptOptions.snapshotInvokes = true; }
+		else if(!strcmp(*args,"--invoke-fibers")) { scriptOptions.useInvokeFibers = true; }
+		else if(!strcmp(*args,"--fuel"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.meterFuel = true;
+			scriptOptions.invokeFuel = (int64)atoll(*args);
+			if(scriptOptions.invokeFuel <= 0) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args,"--poll-epoch")) { compileOptions.pollEpoch = true; }
+		else if(!strcmp(*args,"--threads"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			numThreads = (uintp)atoi(*args);
+			if(!numThreads) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args,"--threads-gc")) { collectGarbageOnThreads = true; }
+		else if(!strcmp(*args,"--memory-pool"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			memoryReservationPoolSize = (uintp)atoi(*args);
+		}
+		else if(!strcmp(*args,"--tier-up-calls"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.enableTieredCompilation = true;
+			compileOptions.tierUpCallCount = (uintp)atoi(*args);
+		}
+		else if(!strcmp(*args,"--lazy")) { compileOptions.enableLazyCompilation = true; }
+		else if(!strcmp(*args,"--opt-level"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.optimizationLevel = (uintp)atoi(*args);
+			if(compileOptions.optimizationLevel > 3) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args,"--bounds-checks"))
+		{
+			if(!*++args || !parseMemoryBoundsCheckMode(*args,compileOptions.memoryBoundsCheckMode)) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args,"--huge-pages")) { compileOptions.useHugePages = true; }
+		else if(!strcmp(*args,"--hardware-traps")) { compileOptions.useHardwareTraps = true; }
+		else if(!strcmp(*args,"--stack-limit-checks")) { compileOptions.checkStackLimit = true; }
+		else if(!strcmp(*args,"--invoke-stack-budget"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			invokeStackBudget = (uintp)atoi(*args);
+		}
+		else if(!filename) { filename = *args; }
+		else { showHelp(); return EXIT_FAILURE; }
+	}
+	if(!filename)
 	{
-		std::cerr <<  "Usage: Test in.wast" << std::endl;
+		showHelp();
 		return EXIT_FAILURE;
 	}
-	const char* filename = argv[1];
 	
 	// Always enable debug logging for tests.
 	Log::setCategoryEnabled(Log::Category::debug,true);
 
 	init();
+	setCompileOptions(compileOptions);
+	if(memoryReservationPoolSize) { errorUnless(setMemoryReservationPoolSize(memoryReservationPoolSize)); }
+	setInvokeStackBudget(invokeStackBudget);
 	
-	TestScriptState scriptState(filename);
-	if(!scriptState.process())
-	{
-		std::cerr << filename << ": testing failed!" << std::endl;
-		return EXIT_FAILURE;
-	}
+	if(numThreads == 1) { return processScript(filename,scriptOptions) ? EXIT_SUCCESS : EXIT_FAILURE; }
 	else
 	{
-		std::cout << filename << ": all tests passed." << std::endl;
-		return EXIT_SUCCESS;
+		// Run the script on multiple threads at once, to test that the runtime can be used concurrently. Each thread
+		// instantiates its own modules, but they share the runtime's global state, and the instance-independent code and
+		// object cache if enabled. Unless --threads-gc is used, objects are only freed once all the threads finish, so the
+		// threads don't wait for each other to create objects.
+		scriptOptions.collectGarbage = collectGarbageOnThreads;
+		scriptOptions.checkPrecompiledObjectOptions = false;
+		std::atomic<bool> allPassed(true);
+		std::vector<std::thread> threads;
+		for(uintp threadIndex = 0;threadIndex < numThreads;++threadIndex)
+		{
+			threads.emplace_back([&]
+			{
+				Platform::initThread();
+				setInvokeStackBudget(invokeStackBudget);
+				if(!processScript(filename,scriptOptions)) { allPassed = false; }
+			});
+		}
+		for(auto& thread : threads) { thread.join(); }
+
+		// Free all the objects created by the threads.
+		freeUnreferencedObjects({});
+
+		return allPassed ? EXIT_SUCCESS : EXIT_FAILURE;
 	}
 }
@@ -11,6 +11,13 @@
 
 #include "CLI.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <inttypes.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 using namespace WebAssembly;
 using namespace Runtime;
 
@@ -21,6 +28,20 @@ void showHelp()
 	std::cerr << "  -f|--function name\t\tSpecify function name to run in module rather than main" << std::endl;
 	std::cerr << "  -c|--check\t\t\tExit after checking that the program is valid" << std::endl;
 	std::cerr << "  -d|--debug\t\t\tWrite additional debug information to stdout" << std::endl;
+	std::cerr << "  -j|--compile-threads n\tCompile the module on n threads (0 to use all hardware threads)" << std::endl;
+	std::cerr << "  --object-cache dir\t\tCache compiled code in dir, and reuse it if the same module is run again" << std::endl;
+	std::cerr << "  --tiered\t\t\tStart running with quickly compiled code, and optimize frequently called functions in the background" << std::endl;
+	std::cerr << "  --tier-up-calls n\t\tOptimize a function after n calls to it (implies --tiered)" << std::endl;
+	std::cerr << "  --lazy\t\t\tCompile each function when it's first called, instead of when the module is loaded" << std::endl;
+	std::cerr << "  --precompiled file\t\tLoad the module's code from a precompiled object produced by Compile" << std::endl;
+	std::cerr << "  -O|--opt-level n\t\tOptimize the code at level n: 0 (fastest compile) to 3 (fastest code). Default: 1" << std::endl;
+	std::cerr << "  --bounds-checks mode\tCheck memory accesses by masking their address (mask), relying on a guard region (guard), or comparing them to the memory's size (explicit). Default: mask" << std::endl;
+	std::cerr << "  --huge-pages\t\t\tBack the module's memory with huge pages if the platform supports them" << std::endl;
+	std::cerr << "  --hardware-traps\t\tOn x86-64, trap on integer division by zero and unreachable with hardware traps instead of branches" << std::endl;
+	std::cerr << "  --stack-limit-checks\t\tOn x86-64 Linux, check the stack limit when entering each function instead of relying on the stack's guard page" << std::endl;
+	std::cerr << "  --invoke-stack-budget n\tLimit the program to n bytes of stack" << std::endl;
+	std::cerr << "  --fuel n\t\t\tMeter the operators the program executes, and stop it once it has executed about n operators" << std::endl;
+	std::cerr << "  --timeout ms\t\t\tStop the program if it's still running after ms milliseconds" << std::endl;
 	std::cerr << "  --\t\t\t\tStop parsing arguments" << std::endl;
 }
 
@@ -71,7 +92,38 @@ struct RootResolver : Resolver
 	}
 };
 
-int mainBody(const char* filename,const char* functionName,bool onlyCheck,char** args)
+// Interrupts the invokes in progress by incrementing the runtime's epoch from another thread once a timeout expires, unless
+// it's destroyed first.
+struct InvokeTimeout
+{
+	InvokeTimeout(uintp timeoutMilliseconds)
+	: isCancelled(false)
+	, thread([this,timeoutMilliseconds]
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if(!condition.wait_for(lock,std::chrono::milliseconds(timeoutMilliseconds),[this] { return isCancelled; }))
+			{ incrementEpoch(); }
+		})
+	{}
+
+	~InvokeTimeout()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			isCancelled = true;
+		}
+		condition.notify_one();
+		thread.join();
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool isCancelled;
+	std::thread thread;
+};
+
+int mainBody(const char* filename,const char* functionName,const char* precompiledFilename,bool onlyCheck,int64 fuel,uintp timeoutMilliseconds,char** args)
 {
 	Module module;
 	if(filename)
@@ -100,8 +152,25 @@ int mainBody(const char* filename,const char* functionName,bool onlyCheck,char**
 		}
 		return EXIT_FAILURE;
 	}
-	ModuleInstance* moduleInstance = instantiateModule(module,std::move(linkResult.resolvedImports));
+	ModuleInstance* moduleInstance;
+	if(!precompiledFilename) { moduleInstance = instantiateModule(module,std::move(linkResult.resolvedImports)); }
+	else
+	{
+		// Load the module's code from the precompiled object instead of compiling it.
+		const std::string precompiledObjectString = loadFile(precompiledFilename);
+		if(!precompiledObjectString.size()) { return EXIT_FAILURE; }
+		const std::vector<uint8> precompiledObject(precompiledObjectString.begin(),precompiledObjectString.end());
+		CompiledModule* compiledModule = loadPrecompiledModule(module,precompiledObject);
+		if(!compiledModule)
+		{
+			std::cerr << "Failed to load precompiled object " << precompiledFilename << std::endl;
+			return EXIT_FAILURE;
+		}
+		moduleInstance = instantiateCompiledModule(compiledModule,std::move(linkResult.resolvedImports));
+		deleteCompiledModule(compiledModule);
+	}
 	if(!moduleInstance) { return EXIT_FAILURE; }
+	if(fuel) { setInstanceFuel(moduleInstance,fuel); }
 	Emscripten::initInstance(module,moduleInstance);
 
 	// Look up the function export to call.
@@ -171,8 +240,11 @@ int mainBody(const char* filename,const char* functionName,bool onlyCheck,char**
 
 	// Invoke the function.
 	Core::Timer executionTimer;
+	std::unique_ptr<InvokeTimeout> timeout(timeoutMilliseconds ? new InvokeTimeout(timeoutMilliseconds) : nullptr);
 	auto functionResult = invokeFunction(functionInstance,invokeArgs);
+	timeout.reset();
 	Log::logTimer("Invoked function",executionTimer);
+	if(fuel) { Log::printf(Log::Category::metrics,"Consumed %" PRId64 " fuel\n",fuel - getInstanceFuel(moduleInstance)); }
 
 	if(functionName)
 	{
@@ -187,8 +259,13 @@ int commandMain(int argc,char** argv)
 {
 	const char* filename = nullptr;
 	const char* functionName = nullptr;
+	const char* precompiledFilename = nullptr;
 
 	bool onlyCheck = false;
+	CompileOptions compileOptions;
+	uintp invokeStackBudget = 0;
+	int64 fuel = 0;
+	uintp timeoutMilliseconds = 0;
 	auto args = argv;
 	while(*++args)
 	{
@@ -205,6 +282,76 @@ int commandMain(int argc,char** argv)
 		{
 			Log::setCategoryEnabled(Log::Category::debug,true);
 		}
+		else if(!strcmp(*args, "--compile-threads") || !strcmp(*args, "-j"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.numCompileThreads = (uintp)atoi(*args);
+		}
+		else if(!strcmp(*args, "--object-cache"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.objectCacheDirectory = *args;
+		}
+		else if(!strcmp(*args, "--tiered"))
+		{
+			compileOptions.enableTieredCompilation = true;
+		}
+		else if(!strcmp(*args, "--tier-up-calls"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.enableTieredCompilation = true;
+			compileOptions.tierUpCallCount = (uintp)atoi(*args);
+		}
+		else if(!strcmp(*args, "--lazy"))
+		{
+			compileOptions.enableLazyCompilation = true;
+		}
+		else if(!strcmp(*args, "--precompiled"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			precompiledFilename = *args;
+		}
+		else if(!strcmp(*args, "-O") || !strcmp(*args, "--opt-level"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.optimizationLevel = (uintp)atoi(*args);
+			if(compileOptions.optimizationLevel > 3) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args, "--bounds-checks"))
+		{
+			if(!*++args || !parseMemoryBoundsCheckMode(*args,compileOptions.memoryBoundsCheckMode)) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args, "--huge-pages"))
+		{
+			compileOptions.useHugePages = true;
+		}
+		else if(!strcmp(*args, "--hardware-traps"))
+		{
+			compileOptions.useHardwareTraps = true;
+		}
+		else if(!strcmp(*args, "--stack-limit-checks"))
+		{
+			compileOptions.checkStackLimit = true;
+		}
+		else if(!strcmp(*args, "--invoke-stack-budget"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			invokeStackBudget = (uintp)atoi(*args);
+		}
+		else if(!strcmp(*args, "--fuel"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.meterFuel = true;
+			fuel = (int64)atoll(*args);
+			if(fuel <= 0) { showHelp(); return EXIT_FAILURE; }
+		}
+		else if(!strcmp(*args, "--timeout"))
+		{
+			if(!*++args) { showHelp(); return EXIT_FAILURE; }
+			compileOptions.pollEpoch = true;
+			timeoutMilliseconds = (uintp)atoi(*args);
+			if(!timeoutMilliseconds) { showHelp(); return EXIT_FAILURE; }
+		}
 		else if(!strcmp(*args, "--"))
 		{
 			++args;
@@ -223,13 +370,15 @@ int commandMain(int argc,char** argv)
 	}
 
 	Runtime::init();
+	Runtime::setCompileOptions(compileOptions);
+	Runtime::setInvokeStackBudget(invokeStackBudget);
 
 	int returnCode = EXIT_FAILURE;
 	#ifdef __AFL_LOOP
 	while(__AFL_LOOP(2000))
 	#endif
 	{
-		returnCode = mainBody(filename,functionName,onlyCheck,args);
+		returnCode = mainBody(filename,functionName,precompiledFilename,onlyCheck,fuel,timeoutMilliseconds,args);
 		Runtime::freeUnreferencedObjects({});
 	}
 	return returnCode;
@@ -153,6 +153,13 @@ namespace Intrinsics
 		return result;
 	}
 	
+	Runtime::Object* findFunctionByDecoratedName(const std::string& decoratedName)
+	{
+		Platform::Lock Lock(Singleton::get().mutex);
+		auto keyValue = Singleton::get().functionMap.find(decoratedName);
+		return keyValue == Singleton::get().functionMap.end() ? nullptr : asObject(keyValue->second->function);
+	}
+	
 	std::vector<Runtime::Object*> getAllIntrinsicObjects()
 	{
 		Platform::Lock lock(Singleton::get().mutex);
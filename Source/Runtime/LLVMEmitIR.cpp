@@ -1,8 +1,11 @@
 #include "LLVMJIT.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/InlineAsm.h"
 #include "WebAssembly/Operations.h"
 #include "WebAssembly/OperatorLoggingProxy.h"
 
+#include <algorithm>
+
 #define ENABLE_LOGGING 0
 #define ENABLE_FUNCTION_ENTER_EXIT_HOOKS 0
 
@@ -14,16 +17,38 @@ namespace LLVMJIT
 	struct EmitModuleContext
 	{
 		const Module& module;
-		ModuleInstance* moduleInstance;
+		const std::vector<std::string>& functionDefNames;
+		uintp beginFunctionDefIndex;
+		uintp endFunctionDefIndex;
+		EmitModuleOptions options;
 
 		llvm::Module* llvmModule;
 		std::vector<llvm::Function*> functionDefs;
+		llvm::StructType* tableElementType;
+
+		// The types of the module's imported functions and globals, and whether it has a default memory and table.
+		std::vector<const FunctionType*> importedFunctionTypes;
+		std::vector<ValueType> globalValueTypes;
+		bool hasDefaultMemory;
+		bool hasDefaultTable;
+
+		// References to the instance's objects through external symbols. Only used if the code isn't instance-independent.
 		std::vector<llvm::Constant*> importedFunctionPointers;
+		std::vector<llvm::Constant*> importedFunctionContexts;
 		std::vector<llvm::Constant*> globalPointers;
 		llvm::Constant* defaultTablePointer;
-		llvm::Constant* defaultTableEndOffset;
+		llvm::Constant* defaultTableEndIndex;
+		llvm::Constant* defaultTableObjectAsI64;
 		llvm::Constant* defaultMemoryBase;
 		llvm::Constant* defaultMemoryAddressMask;
+		llvm::Constant* defaultMemoryNumPagesPointer;
+		llvm::Constant* defaultMemoryObjectAsI64;
+
+		// References to the module's table of function entries, and the state of baseline tier code.
+		llvm::Constant* functionDefEntries;
+		llvm::Constant* functionDefCallCounts;
+		llvm::Constant* moduleCodePointer;
+		llvm::Constant* requestTierUpFunction;
 		
 		llvm::DIBuilder diBuilder;
 		llvm::DICompileUnit* diCompileUnit;
@@ -34,10 +59,18 @@ namespace LLVMJIT
 		llvm::MDNode* likelyFalseBranchWeights;
 		llvm::MDNode* likelyTrueBranchWeights;
 
-		EmitModuleContext(const Module& inModule,ModuleInstance* inModuleInstance)
+		EmitModuleContext(
+			const Module& inModule,
+			const std::vector<std::string>& inFunctionDefNames,
+			uintp inBeginFunctionDefIndex,
+			uintp inEndFunctionDefIndex,
+			const EmitModuleOptions& inOptions)
 		: module(inModule)
-		, moduleInstance(inModuleInstance)
-		, llvmModule(new llvm::Module("",context))
+		, functionDefNames(inFunctionDefNames)
+		, beginFunctionDefIndex(inBeginFunctionDefIndex)
+		, endFunctionDefIndex(inEndFunctionDefIndex)
+		, options(inOptions)
+		, llvmModule(new llvm::Module("",*context))
 		, diBuilder(*llvmModule)
 		{
 			diCompileUnit = diBuilder.createCompileUnit(0xffff,"unknown","unknown","WAVM",true,"",0);
@@ -51,11 +84,21 @@ namespace LLVMJIT
 			
 			auto zeroAsMetadata = llvm::ConstantAsMetadata::get(emitLiteral(int32(0)));
 			auto i32MaxAsMetadata = llvm::ConstantAsMetadata::get(emitLiteral(int32(INT32_MAX)));
-			likelyFalseBranchWeights = llvm::MDTuple::getDistinct(context,{llvm::MDString::get(context,"branch_weights"),zeroAsMetadata,i32MaxAsMetadata});
-			likelyTrueBranchWeights = llvm::MDTuple::getDistinct(context,{llvm::MDString::get(context,"branch_weights"),i32MaxAsMetadata,zeroAsMetadata});
+			likelyFalseBranchWeights = llvm::MDTuple::getDistinct(*context,{llvm::MDString::get(*context,"branch_weights"),zeroAsMetadata,i32MaxAsMetadata});
+			likelyTrueBranchWeights = llvm::MDTuple::getDistinct(*context,{llvm::MDString::get(*context,"branch_weights"),i32MaxAsMetadata,zeroAsMetadata});
 		}
 
 		llvm::Module* emit();
+
+		// Declares an external symbol, and returns its address cast to the given type. The code emitted for a module uses
+		// these symbols to reference the objects it is instantiated with, so it doesn't depend on the address of the objects
+		// and may be reused by other instances of the module.
+		llvm::Constant* emitExternalSymbolAddress(const std::string& name,llvm::Type* type)
+		{
+			llvm::GlobalVariable* global = llvmModule->getNamedGlobal(name);
+			if(!global) { global = new llvm::GlobalVariable(*llvmModule,llvmI8Type,false,llvm::GlobalVariable::ExternalLinkage,nullptr,name); }
+			return llvm::ConstantExpr::getPointerCast(global,type);
+		}
 	};
 
 	// The context used by functions involved in JITing a single AST function.
@@ -64,12 +107,29 @@ namespace LLVMJIT
 		EmitModuleContext& moduleContext;
 		const Module& module;
 		const Function& function;
+		uintp functionDefIndex;
 		const FunctionType* functionType;
-		FunctionInstance* functionInstance;
 		llvm::Function* llvmFunction;
 		llvm::IRBuilder<> irBuilder;
 
-		std::vector<llvm::Value*> localPointers;
+		// The current SSA value of each local. Locals aren't stored in memory: set_local just changes the local's current value,
+		// and the values of locals that may be assigned differently on the paths merging at a basic block are merged by PHIs.
+		std::vector<llvm::Value*> localValues;
+
+		// The locals assigned by each of the function's control structures, in the order the control structures begin, and the
+		// index of the next control structure.
+		std::vector<std::vector<uintp>> controlStructureAssignedLocals;
+		uintp nextControlStructureIndex;
+
+		// The instance context parameter, and the values derived from it that are used to access the instance's default memory and table.
+		llvm::Value* contextPointer;
+		llvm::Value* defaultMemoryBase;
+		llvm::Value* defaultMemoryAddressMask;
+		llvm::Value* defaultMemoryNumPagesPointer;
+		llvm::Value* defaultMemoryObjectAsI64;
+		llvm::Value* defaultTablePointer;
+		llvm::Value* defaultTableEndIndex;
+		llvm::Value* defaultTableObjectAsI64;
 
 		llvm::DISubprogram* diFunction;
 
@@ -94,6 +154,17 @@ namespace LLVMJIT
 			uintp outerBranchTargetStackSize;
 			bool isReachable;
 			bool isElseReachable;
+
+			// The locals assigned in the control structure, and for an if, their values when it was entered.
+			const std::vector<uintp>* assignedLocals;
+			std::vector<llvm::Value*> entryLocalValues;
+		};
+
+		// The values of a branch target's locals on a branch to it.
+		struct IncomingLocalValues
+		{
+			llvm::BasicBlock* block;
+			std::vector<llvm::Value*> values;
 		};
 
 		struct BranchTarget
@@ -101,24 +172,200 @@ namespace LLVMJIT
 			ResultType argumentType;
 			llvm::BasicBlock* block;
 			llvm::PHINode* phi;
+
+			// The locals that may have different values on the branches to the target: the locals assigned in the target's
+			// control structure. Null if the target is the function's return, which doesn't use the locals.
+			const std::vector<uintp>* assignedLocals;
+
+			// If the target is a loop, the PHIs at the start of the loop for its assigned locals. Otherwise, the values of the
+			// assigned locals on each branch to the target, which are merged when the target's control structure ends.
+			bool isLoop;
+			std::vector<llvm::PHINode*> loopLocalPHIs;
+			std::vector<IncomingLocalValues> incomingLocalValues;
+		};
+
+		// A charge of fuel for the operators in the function or a loop, excluding the operators in nested loops: the subtraction
+		// of the charge from the fuel, and the number of operators emitted for it so far, which is patched into the subtraction
+		// once the loop or function ends.
+		struct FuelCharge
+		{
+			llvm::BinaryOperator* subtract;
+			uint64 cost;
 		};
 
 		std::vector<ControlContext> controlStack;
 		std::vector<BranchTarget> branchTargetStack;
 		std::vector<llvm::Value*> stack;
+		std::vector<FuelCharge> fuelChargeStack;
 
-		EmitFunctionContext(EmitModuleContext& inEmitModuleContext,const Module& inModule,const Function& inFunction,FunctionInstance* inFunctionInstance,llvm::Function* inLLVMFunction)
+		EmitFunctionContext(EmitModuleContext& inEmitModuleContext,const Module& inModule,uintp inFunctionDefIndex,llvm::Function* inLLVMFunction)
 		: moduleContext(inEmitModuleContext)
 		, module(inModule)
-		, function(inFunction)
-		, functionType(module.types[inFunction.typeIndex])
-		, functionInstance(inFunctionInstance)
+		, function(inModule.functionDefs[inFunctionDefIndex])
+		, functionDefIndex(inFunctionDefIndex)
+		, functionType(module.types[function.typeIndex])
 		, llvmFunction(inLLVMFunction)
-		, irBuilder(context)
+		, irBuilder(*context)
+		, nextControlStructureIndex(0)
+		, contextPointer(nullptr)
+		, defaultMemoryBase(nullptr)
+		, defaultMemoryAddressMask(nullptr)
+		, defaultMemoryNumPagesPointer(nullptr)
+		, defaultMemoryObjectAsI64(nullptr)
+		, defaultTablePointer(nullptr)
+		, defaultTableEndIndex(nullptr)
+		, defaultTableObjectAsI64(nullptr)
 		{}
 
 		void emit();
 
+		// Loads a value from an offset relative to a pointer into data that doesn't change while the instance's code is running,
+		// such as the instance context. The load is marked as invariant, so LLVM may reuse the loaded value.
+		llvm::Value* loadInvariant(llvm::Value* bytePointer,uintp offset,llvm::Type* type)
+		{
+			auto valuePointer = irBuilder.CreatePointerCast(irBuilder.CreateInBoundsGEP(bytePointer,{emitLiteral(offset)}),type->getPointerTo());
+			auto load = irBuilder.CreateLoad(valuePointer);
+			load->setMetadata(llvm::LLVMContext::MD_invariant_load,llvm::MDNode::get(*context,{}));
+			return load;
+		}
+		llvm::Value* loadContextField(uintp offset,llvm::Type* type) { return loadInvariant(contextPointer,offset,type); }
+
+		// Returns a pointer to the value of one of the module's globals.
+		llvm::Value* getGlobalPointer(uintp globalIndex)
+		{
+			assert(globalIndex < moduleContext.globalValueTypes.size());
+			auto llvmValueType = asLLVMType(moduleContext.globalValueTypes[globalIndex]);
+			if(!moduleContext.options.isInstanceIndependent) { return moduleContext.globalPointers[globalIndex]; }
+			else
+			{
+				auto globalValues = loadContextField(offsetof(InstanceContext,globalValues),llvmI8PtrType);
+				return loadInvariant(globalValues,globalIndex * sizeof(UntaggedValue*),llvmValueType->getPointerTo());
+			}
+		}
+
+		// Gets the function pointer and context to call one of the module's imported functions with.
+		void getImportedFunction(uintp importIndex,llvm::FunctionType* llvmFunctionType,llvm::Value*& outFunctionPointer,llvm::Value*& outContext)
+		{
+			assert(importIndex < moduleContext.importedFunctionTypes.size());
+			if(!moduleContext.options.isInstanceIndependent)
+			{
+				outFunctionPointer = moduleContext.importedFunctionPointers[importIndex];
+				outContext = moduleContext.importedFunctionContexts[importIndex];
+			}
+			else
+			{
+				auto importedFunctions = loadContextField(offsetof(InstanceContext,importedFunctions),llvmI8PtrType);
+				const uintp importOffset = importIndex * sizeof(InstanceContext::ImportedFunction);
+				outFunctionPointer = loadInvariant(importedFunctions,importOffset + offsetof(InstanceContext::ImportedFunction,nativeFunction),llvmFunctionType->getPointerTo());
+				outContext = loadInvariant(importedFunctions,importOffset + offsetof(InstanceContext::ImportedFunction,context),llvmI8PtrType);
+			}
+		}
+
+		// Loads the current entry of one of the module's functions from the module's table of function entries.
+		llvm::Value* loadFunctionDefEntry(uintp functionDefIndex)
+		{
+			auto llvmFunctionType = moduleContext.functionDefs[functionDefIndex]->getFunctionType();
+			auto entryPointer = irBuilder.CreatePointerCast(
+				irBuilder.CreateInBoundsGEP(moduleContext.functionDefEntries,{emitLiteral(uint64(functionDefIndex * sizeof(void*)))}),
+				llvmFunctionType->getPointerTo()->getPointerTo());
+			return irBuilder.CreateLoad(entryPointer);
+		}
+
+		// Emits the code at the start of a baseline tier function that forwards calls to the function's optimized code once it
+		// has been compiled, and otherwise counts calls to the function and requests optimizing it when the count reaches the threshold.
+		void emitTierUpCheck()
+		{
+			auto forwardBlock = llvm::BasicBlock::Create(*context,"tierUpForward",llvmFunction);
+			auto countBlock = llvm::BasicBlock::Create(*context,"tierUpCount",llvmFunction);
+			auto requestBlock = llvm::BasicBlock::Create(*context,"tierUpRequest",llvmFunction);
+			auto bodyBlock = llvm::BasicBlock::Create(*context,"body",llvmFunction);
+
+			// If the function's entry no longer points to this code, tail call the new entry with the same arguments.
+			auto entry = loadFunctionDefEntry(functionDefIndex);
+			irBuilder.CreateCondBr(irBuilder.CreateICmpNE(entry,llvmFunction),forwardBlock,countBlock,moduleContext.likelyFalseBranchWeights);
+
+			irBuilder.SetInsertPoint(forwardBlock);
+			std::vector<llvm::Value*> forwardArgs;
+			for(auto argIt = llvmFunction->arg_begin();argIt != llvmFunction->arg_end();++argIt) { forwardArgs.push_back(&*argIt); }
+			auto forwardCall = irBuilder.CreateCall(entry,forwardArgs);
+			forwardCall->setTailCall();
+			if(functionType->ret == ResultType::none) { irBuilder.CreateRetVoid(); }
+			else { irBuilder.CreateRet(forwardCall); }
+
+			// Increment the function's call count, and if it reached the threshold, request that the function be optimized. The
+			// count is shared by all threads calling the function, so it's incremented atomically to ensure that exactly one
+			// call sees it reach the threshold.
+			irBuilder.SetInsertPoint(countBlock);
+			auto callCountPointer = irBuilder.CreatePointerCast(
+				irBuilder.CreateInBoundsGEP(moduleContext.functionDefCallCounts,{emitLiteral(uint64(functionDefIndex * sizeof(uint32)))}),
+				llvmI32Type->getPointerTo());
+			auto callCount = irBuilder.CreateAdd(
+				irBuilder.CreateAtomicRMW(llvm::AtomicRMWInst::Add,callCountPointer,emitLiteral(uint32(1)),llvm::AtomicOrdering::Monotonic),
+				emitLiteral(uint32(1)));
+			irBuilder.CreateCondBr(
+				irBuilder.CreateICmpEQ(callCount,emitLiteral(moduleContext.options.tierUpCallCount)),
+				requestBlock,
+				bodyBlock,
+				moduleContext.likelyFalseBranchWeights);
+
+			irBuilder.SetInsertPoint(requestBlock);
+			irBuilder.CreateCall(moduleContext.requestTierUpFunction,{moduleContext.moduleCodePointer,emitLiteral(uint32(functionDefIndex))});
+			irBuilder.CreateBr(bodyBlock);
+
+			irBuilder.SetInsertPoint(bodyBlock);
+		}
+
+		// Emits a charge of fuel at the start of the function or a loop body, which traps if the instance's fuel is exhausted.
+		// Each operator in the function or loop that isn't in a nested loop runs at most once each time the charge runs, so
+		// charging the number of those operators is an over-approximation that only needs one check per loop iteration.
+		void beginFuelCharge()
+		{
+			auto fuelPointer = irBuilder.CreatePointerCast(
+				irBuilder.CreateInBoundsGEP(contextPointer,{emitLiteral(uint64(offsetof(InstanceContext,fuel)))}),
+				llvmI64Type->getPointerTo());
+
+			// The cost isn't known until the operators have been emitted, so subtract a placeholder that endFuelCharge
+			// replaces. The subtraction is created outside the IR builder so it isn't folded.
+			auto subtract = llvm::BinaryOperator::CreateSub(irBuilder.CreateLoad(fuelPointer),emitLiteral(uint64(0)));
+			irBuilder.Insert(subtract);
+			irBuilder.CreateStore(subtract,fuelPointer);
+			emitConditionalTrapIntrinsic(
+				irBuilder.CreateICmpSLT(subtract,emitLiteral(uint64(0))),
+				"wavmIntrinsics.fuelExhaustedTrap",FunctionType::get(),{});
+
+			fuelChargeStack.push_back({subtract,0});
+		}
+		void endFuelCharge()
+		{
+			assert(fuelChargeStack.size());
+			fuelChargeStack.back().subtract->setOperand(1,emitLiteral(fuelChargeStack.back().cost));
+			fuelChargeStack.pop_back();
+		}
+
+		// Emits a poll of the runtime's epoch interrupt flag, which is only set while some invoke has been interrupted. If
+		// it's set, calls into the runtime, which throws an interrupted exception if this code is running in one of those
+		// invokes. The load is volatile so it isn't hoisted out of loops.
+		void emitEpochPoll()
+		{
+			auto checkBlock = llvm::BasicBlock::Create(*context,"epochInterruptCheck",llvmFunction);
+			auto continueBlock = llvm::BasicBlock::Create(*context,"epochInterruptSkip",llvmFunction);
+
+			auto interruptPending = irBuilder.CreateLoad(
+				moduleContext.emitExternalSymbolAddress(getEpochInterruptPendingSymbolName(),llvmI32Type->getPointerTo()));
+			interruptPending->setVolatile(true);
+			irBuilder.CreateCondBr(
+				irBuilder.CreateICmpNE(interruptPending,emitLiteral(uint32(0))),
+				checkBlock,
+				continueBlock,
+				moduleContext.likelyFalseBranchWeights);
+
+			irBuilder.SetInsertPoint(checkBlock);
+			emitRuntimeIntrinsic("wavmIntrinsics.checkEpochInterrupt",FunctionType::get(),{});
+			irBuilder.CreateBr(continueBlock);
+
+			irBuilder.SetInsertPoint(continueBlock);
+		}
+
 		// Operand stack manipulation
 		llvm::Value* pop()
 		{
@@ -145,6 +392,64 @@ namespace LLVMJIT
 			stack.push_back(value);
 		}
 
+		// Returns the locals assigned by the next control structure, and advances to the following control structure.
+		const std::vector<uintp>* beginControlStructure()
+		{
+			assert(nextControlStructureIndex < controlStructureAssignedLocals.size());
+			return &controlStructureAssignedLocals[nextControlStructureIndex++];
+		}
+
+		// Adds the current values of the locals assigned in a branch target's control structure to the target's incoming
+		// values, for a branch to the target from the current basic block.
+		void addIncomingLocalValues(BranchTarget& target)
+		{
+			if(!target.assignedLocals) { return; }
+			const std::vector<uintp>& assignedLocals = *target.assignedLocals;
+			llvm::BasicBlock* block = irBuilder.GetInsertBlock();
+			if(target.isLoop)
+			{
+				for(uintp index = 0;index < assignedLocals.size();++index)
+				{ target.loopLocalPHIs[index]->addIncoming(localValues[assignedLocals[index]],block); }
+			}
+			else
+			{
+				target.incomingLocalValues.push_back({block,std::vector<llvm::Value*>()});
+				std::vector<llvm::Value*>& values = target.incomingLocalValues.back().values;
+				values.reserve(assignedLocals.size());
+				for(auto localIndex : assignedLocals) { values.push_back(localValues[localIndex]); }
+			}
+		}
+
+		// Sets the current values of the locals assigned in a branch target's control structure to the values merged from
+		// all the branches to the target. Must be called at the start of the target block. A PHI is only created for a
+		// local if the branches don't all give it the same value.
+		void mergeIncomingLocalValues(const BranchTarget& target)
+		{
+			if(!target.assignedLocals || !target.incomingLocalValues.size()) { return; }
+			const std::vector<uintp>& assignedLocals = *target.assignedLocals;
+			for(uintp index = 0;index < assignedLocals.size();++index)
+			{
+				llvm::Value* value = target.incomingLocalValues[0].values[index];
+				bool needsPHI = false;
+				for(auto& incoming : target.incomingLocalValues) { if(incoming.values[index] != value) { needsPHI = true; break; } }
+				if(needsPHI)
+				{
+					auto phi = irBuilder.CreatePHI(value->getType(),(unsigned int)target.incomingLocalValues.size());
+					for(auto& incoming : target.incomingLocalValues) { phi->addIncoming(incoming.values[index],incoming.block); }
+					value = phi;
+				}
+				localValues[assignedLocals[index]] = value;
+			}
+		}
+
+		// Restores the locals assigned in an if to the values they had when the if was entered.
+		void restoreEntryLocalValues(const ControlContext& controlContext)
+		{
+			assert(controlContext.assignedLocals && controlContext.entryLocalValues.size() == controlContext.assignedLocals->size());
+			for(uintp index = 0;index < controlContext.entryLocalValues.size();++index)
+			{ localValues[(*controlContext.assignedLocals)[index]] = controlContext.entryLocalValues[index]; }
+		}
+
 		// Creates a PHI node for the argument of branches to a basic block.
 		llvm::PHINode* createPHI(llvm::BasicBlock* basicBlock,ResultType type)
 		{
@@ -221,20 +526,85 @@ namespace LLVMJIT
 				offsetByteIndex = irBuilder.CreateAdd(nativeByteIndex,nativeOffset);
 			}
 
-			// Mask the index to the address-space size.
-			auto maskedByteIndex = irBuilder.CreateAnd(offsetByteIndex,moduleContext.defaultMemoryAddressMask);
+			switch(moduleContext.options.memoryBoundsCheckMode)
+			{
+			case MemoryBoundsCheckMode::addressMask:
+				// Mask the index to the address-space size.
+				offsetByteIndex = irBuilder.CreateAnd(offsetByteIndex,defaultMemoryAddressMask);
+				break;
+			case MemoryBoundsCheckMode::guardRegion:
+				// The memory's reserved address-space covers any 32-bit index + 32-bit offset, so the index doesn't need to be checked.
+				break;
+			case MemoryBoundsCheckMode::explicitChecks:
+			{
+				// Trap if the end of the access is beyond the memory's current size. The end is computed with 64-bit arithmetic,
+				// so it can't overflow on a 32 bit runtime.
+				auto accessEndIndex = irBuilder.CreateAdd(
+					irBuilder.CreateZExt(byteIndex,llvmI64Type),
+					emitLiteral(uint64(offset) + memoryType->getPrimitiveSizeInBits() / 8));
+				auto memoryNumPages = irBuilder.CreateLoad(defaultMemoryNumPagesPointer);
+				auto memoryNumBytes = irBuilder.CreateShl(
+					sizeof(uintp) == 4 ? irBuilder.CreateZExt(memoryNumPages,llvmI64Type) : memoryNumPages,
+					emitLiteral(uint64(WebAssembly::numBytesPerPageLog2)));
+				emitConditionalTrapIntrinsic(
+					irBuilder.CreateICmpUGT(accessEndIndex,memoryNumBytes),
+					"wavmIntrinsics.accessViolationTrap",FunctionType::get(),{});
+				break;
+			}
+			default: Core::unreachable();
+			};
 
 			// Cast the pointer to the appropriate type.
-			auto bytePointer = irBuilder.CreateInBoundsGEP(moduleContext.defaultMemoryBase,maskedByteIndex);
+			auto bytePointer = irBuilder.CreateInBoundsGEP(defaultMemoryBase,offsetByteIndex);
 			return irBuilder.CreatePointerCast(bytePointer,memoryType->getPointerTo());
 		}
 
-		// Traps a divide-by-zero
-		void trapDivideByZero(ValueType type,llvm::Value* divisor)
+		// Traps a divide-by-zero, and returns the divisor to use for the division.
+		llvm::Value* trapDivideByZero(ValueType type,llvm::Value* divisor)
 		{
 			emitConditionalTrapIntrinsic(
 				irBuilder.CreateICmpEQ(divisor,typedZeroConstants[(uintp)type]),
 				"wavmIntrinsics.divideByZeroTrap",FunctionType::get(),{});
+			return divisor;
+		}
+
+		// Whether a division by the divisor is left for the CPU to trap on. If the code relies on hardware traps, a non-constant
+		// divisor isn't checked, since the x86-64 div and idiv instructions raise a divide error if the divisor is zero or the
+		// signed quotient overflows. A constant divisor is still checked, which costs nothing if it isn't zero.
+		bool isHardwareTrappingDivisor(llvm::Value* divisor)
+		{
+			return moduleContext.options.useHardwareTraps && !llvm::isa<llvm::Constant>(divisor);
+		}
+
+		// Emits an x86-64 div or idiv that traps if the divisor is zero, and returns its quotient or remainder. Division by
+		// zero is undefined in LLVM IR, so the optimizer may assume the divisor of a division instruction isn't zero, or
+		// remove a division whose result is unused. The division is emitted as inline asm with side effects instead, so it's
+		// always executed with the divisor it was given.
+		llvm::Value* emitHardwareTrappingDivide(ValueType type,llvm::Value* left,llvm::Value* right,bool isSigned,bool isRemainder)
+		{
+			// The dividend is extended into rdx:rax (or edx:eax), which the instruction replaces with the remainder and quotient.
+			// rdx is written before the divisor is read, so the divisor can't be allocated to it.
+			const bool is64Bit = type == ValueType::i64;
+			const char* extendDividend = isSigned ? (is64Bit ? "cqto" : "cltd") : "xorl %edx, %edx";
+			const char* divide = isSigned ? (is64Bit ? "idivq" : "idivl") : (is64Bit ? "divq" : "divl");
+			llvm::Type* llvmType = asLLVMType(type);
+			auto divideAsm = llvm::InlineAsm::get(
+				llvm::FunctionType::get(llvm::StructType::get(*context,{llvmType,llvmType}),{llvmType,llvmType},false),
+				std::string(extendDividend) + "\n\t" + divide + " $3",
+				"={ax},=&{dx},0,r,~{flags}",
+				true);
+			auto quotientAndRemainder = irBuilder.CreateCall(divideAsm,{left,right});
+			return irBuilder.CreateExtractValue(quotientAndRemainder,isRemainder ? 1 : 0);
+		}
+
+		// Emits div_s, div_u, or rem_u, trapping if the divisor is zero.
+		llvm::Value* emitDivide(ValueType type,llvm::Value* left,llvm::Value* right,bool isSigned,bool isRemainder)
+		{
+			if(isHardwareTrappingDivisor(right)) { return emitHardwareTrappingDivide(type,left,right,isSigned,isRemainder); }
+
+			right = trapDivideByZero(type,right);
+			if(isRemainder) { assert(!isSigned); return irBuilder.CreateURem(left,right); }
+			else { return isSigned ? irBuilder.CreateSDiv(left,right) : irBuilder.CreateUDiv(left,right); }
 		}
 
 		llvm::Value* getLLVMIntrinsic(const std::initializer_list<llvm::Type*>& argTypes,llvm::Intrinsic::ID id)
@@ -245,19 +615,17 @@ namespace LLVMJIT
 		// Emits a call to a WAVM intrinsic function.
 		llvm::Value* emitRuntimeIntrinsic(const char* intrinsicName,const FunctionType* intrinsicType,const std::initializer_list<llvm::Value*>& args)
 		{
-			Object* intrinsicObject = Intrinsics::find(intrinsicName,intrinsicType);
-			assert(intrinsicObject);
-			FunctionInstance* intrinsicFunction = asFunction(intrinsicObject);
-			assert(intrinsicFunction->type == intrinsicType);
-			auto intrinsicFunctionPointer = emitLiteralPointer(intrinsicFunction->nativeFunction,asLLVMType(intrinsicType)->getPointerTo());
+			// Reference the intrinsic through a symbol that is resolved when the code is loaded.
+			assert(Intrinsics::find(intrinsicName,intrinsicType));
+			auto intrinsicFunctionPointer = moduleContext.emitExternalSymbolAddress(getIntrinsicSymbolName(intrinsicName,intrinsicType),asLLVMType(intrinsicType)->getPointerTo());
 			return irBuilder.CreateCall(intrinsicFunctionPointer,llvm::ArrayRef<llvm::Value*>(args.begin(),args.end()));
 		}
 
 		// A helper function to emit a conditional call to a non-returning intrinsic function.
 		void emitConditionalTrapIntrinsic(llvm::Value* booleanCondition,const char* intrinsicName,const FunctionType* intrinsicType,const std::initializer_list<llvm::Value*>& args)
 		{
-			auto trueBlock = llvm::BasicBlock::Create(context,llvm::Twine(intrinsicName) + "Trap",llvmFunction);
-			auto endBlock = llvm::BasicBlock::Create(context,llvm::Twine(intrinsicName) + "Skip",llvmFunction);
+			auto trueBlock = llvm::BasicBlock::Create(*context,llvm::Twine(intrinsicName) + "Trap",llvmFunction);
+			auto endBlock = llvm::BasicBlock::Create(*context,llvm::Twine(intrinsicName) + "Skip",llvmFunction);
 
 			irBuilder.CreateCondBr(booleanCondition,trueBlock,endBlock,moduleContext.likelyFalseBranchWeights);
 
@@ -285,55 +653,87 @@ namespace LLVMJIT
 			ResultType resultType,
 			llvm::BasicBlock* endBlock,
 			llvm::PHINode* endPHI,
-			llvm::BasicBlock* elseBlock = nullptr
+			llvm::BasicBlock* elseBlock = nullptr,
+			const std::vector<uintp>* assignedLocals = nullptr
 			)
 		{
 			// The unreachable operator filtering should filter out any opcodes that call pushControlStack.
 			if(controlStack.size()) { errorUnless(controlStack.back().isReachable); }
 
-			controlStack.push_back({type,endBlock,endPHI,elseBlock,resultType,stack.size(),branchTargetStack.size(),true,true});
+			controlStack.push_back({type,endBlock,endPHI,elseBlock,resultType,stack.size(),branchTargetStack.size(),true,true,assignedLocals});
 		}
 
-		void pushBranchTarget(ResultType branchArgumentType,llvm::BasicBlock* branchTargetBlock,llvm::PHINode* branchTargetPHI)
+		void pushBranchTarget(
+			ResultType branchArgumentType,
+			llvm::BasicBlock* branchTargetBlock,
+			llvm::PHINode* branchTargetPHI,
+			const std::vector<uintp>* assignedLocals = nullptr
+			)
 		{
-			branchTargetStack.push_back({branchArgumentType,branchTargetBlock,branchTargetPHI});
+			branchTargetStack.push_back({branchArgumentType,branchTargetBlock,branchTargetPHI,assignedLocals,false});
 		}
 
 		void beginBlock(ControlStructureImm imm)
 		{
+			const std::vector<uintp>* assignedLocals = beginControlStructure();
+
 			// Create an end block+phi for the block result.
-			auto endBlock = llvm::BasicBlock::Create(context,"blockEnd",llvmFunction);
+			auto endBlock = llvm::BasicBlock::Create(*context,"blockEnd",llvmFunction);
 			auto endPHI = createPHI(endBlock,imm.resultType);
 
 			// Push a control context that ends at the end block/phi.
-			pushControlStack(ControlContext::Type::block,imm.resultType,endBlock,endPHI);
+			pushControlStack(ControlContext::Type::block,imm.resultType,endBlock,endPHI,nullptr,assignedLocals);
 			
 			// Push a branch target for the end block/phi.
-			pushBranchTarget(imm.resultType,endBlock,endPHI);
+			pushBranchTarget(imm.resultType,endBlock,endPHI,assignedLocals);
 		}
 		void beginLoop(ControlStructureImm imm)
 		{
+			const std::vector<uintp>* assignedLocals = beginControlStructure();
+
 			// Create a loop block, and an end block+phi for the loop result.
-			auto loopBodyBlock = llvm::BasicBlock::Create(context,"loopBody",llvmFunction);
-			auto endBlock = llvm::BasicBlock::Create(context,"loopEnd",llvmFunction);
+			auto loopBodyBlock = llvm::BasicBlock::Create(*context,"loopBody",llvmFunction);
+			auto endBlock = llvm::BasicBlock::Create(*context,"loopEnd",llvmFunction);
 			auto endPHI = createPHI(endBlock,imm.resultType);
 			
 			// Branch to the loop body and switch the IR builder to emit there.
+			auto preheaderBlock = irBuilder.GetInsertBlock();
 			irBuilder.CreateBr(loopBodyBlock);
 			irBuilder.SetInsertPoint(loopBodyBlock);
 
+			// Create PHIs at the start of the loop body for the locals assigned in the loop, which merge their values before
+			// the loop with their values on the loop's back edges.
+			std::vector<llvm::PHINode*> loopLocalPHIs;
+			for(auto localIndex : *assignedLocals)
+			{
+				auto phi = irBuilder.CreatePHI(localValues[localIndex]->getType(),2);
+				phi->addIncoming(localValues[localIndex],preheaderBlock);
+				localValues[localIndex] = phi;
+				loopLocalPHIs.push_back(phi);
+			}
+
 			// Push a control context that ends at the end block/phi.
-			pushControlStack(ControlContext::Type::loop,imm.resultType,endBlock,endPHI);
+			pushControlStack(ControlContext::Type::loop,imm.resultType,endBlock,endPHI,nullptr,assignedLocals);
 			
 			// Push a branch target for the loop body start.
-			pushBranchTarget(ResultType::none,loopBodyBlock,nullptr);
+			pushBranchTarget(ResultType::none,loopBodyBlock,nullptr,assignedLocals);
+			branchTargetStack.back().isLoop = true;
+			branchTargetStack.back().loopLocalPHIs = std::move(loopLocalPHIs);
+
+			// If metering fuel, charge each iteration of the loop for the operators in its body.
+			if(moduleContext.options.meterFuel) { beginFuelCharge(); }
+
+			// If polling the epoch, check whether the invoke was interrupted on each iteration of the loop.
+			if(moduleContext.options.pollEpoch) { emitEpochPoll(); }
 		}
 		void beginIf(ControlStructureImm imm)
 		{
+			const std::vector<uintp>* assignedLocals = beginControlStructure();
+
 			// Create a then block and else block for the if, and an end block+phi for the if result.
-			auto thenBlock = llvm::BasicBlock::Create(context,"ifThen",llvmFunction);
-			auto elseBlock = llvm::BasicBlock::Create(context,"ifElse",llvmFunction);
-			auto endBlock = llvm::BasicBlock::Create(context,"ifElseEnd",llvmFunction);
+			auto thenBlock = llvm::BasicBlock::Create(*context,"ifThen",llvmFunction);
+			auto elseBlock = llvm::BasicBlock::Create(*context,"ifElse",llvmFunction);
+			auto endBlock = llvm::BasicBlock::Create(*context,"ifElseEnd",llvmFunction);
 			auto endPHI = createPHI(endBlock,imm.resultType);
 
 			// Pop the if condition from the operand stack.
@@ -345,10 +745,13 @@ namespace LLVMJIT
 
 			// Push an ifThen control context that ultimately ends at the end block/phi, but may
 			// be terminated by an else operator that changes the control context to the else block.
-			pushControlStack(ControlContext::Type::ifThen,imm.resultType,endBlock,endPHI,elseBlock);
+			pushControlStack(ControlContext::Type::ifThen,imm.resultType,endBlock,endPHI,elseBlock,assignedLocals);
+
+			// Save the values of the locals assigned in the if, so the else clause can start with the same values as the then clause.
+			for(auto localIndex : *assignedLocals) { controlStack.back().entryLocalValues.push_back(localValues[localIndex]); }
 			
 			// Push a branch target for the if end.
-			pushBranchTarget(imm.resultType,endBlock,endPHI);
+			pushBranchTarget(imm.resultType,endBlock,endPHI,assignedLocals);
 			
 		}
 		void beginElse(NoImm imm)
@@ -367,15 +770,17 @@ namespace LLVMJIT
 				}
 
 				// Branch to the control context's end.
+				addIncomingLocalValues(branchTargetStack[currentContext.outerBranchTargetStackSize]);
 				irBuilder.CreateBr(currentContext.endBlock);
 			}
 			assert(stack.size() == currentContext.outerStackSize);
 
-			// Switch the IR emitter to the else block.
+			// Switch the IR emitter to the else block, and restore the locals to their values before the then clause.
 			assert(currentContext.elseBlock);
 			assert(currentContext.type == ControlContext::Type::ifThen);
 			currentContext.elseBlock->moveAfter(irBuilder.GetInsertBlock());
 			irBuilder.SetInsertPoint(currentContext.elseBlock);
+			restoreEntryLocalValues(currentContext);
 
 			// Change the top of the control stack to an else clause.
 			currentContext.type = ControlContext::Type::ifElse;
@@ -387,6 +792,12 @@ namespace LLVMJIT
 			assert(controlStack.size());
 			ControlContext& currentContext = controlStack.back();
 
+			// The control context's end block is the target of branches to it, except for a loop, whose end block is only
+			// reached by falling through the end of the loop body, with the locals' values at the end of the loop body.
+			BranchTarget* endTarget = currentContext.type == ControlContext::Type::loop
+				? nullptr
+				: &branchTargetStack[currentContext.outerBranchTargetStackSize];
+
 			if(currentContext.isReachable)
 			{
 				// If the control context yields a result, take the top of the operand stack and
@@ -398,6 +809,7 @@ namespace LLVMJIT
 				}
 
 				// Branch to the control context's end.
+				if(endTarget) { addIncomingLocalValues(*endTarget); }
 				irBuilder.CreateBr(currentContext.endBlock);
 			}
 			assert(stack.size() == currentContext.outerStackSize);
@@ -407,12 +819,15 @@ namespace LLVMJIT
 				// If this is the end of an if without an else clause, create a dummy else clause.
 				currentContext.elseBlock->moveAfter(irBuilder.GetInsertBlock());
 				irBuilder.SetInsertPoint(currentContext.elseBlock);
+				restoreEntryLocalValues(currentContext);
+				addIncomingLocalValues(*endTarget);
 				irBuilder.CreateBr(currentContext.endBlock);
 			}
 
-			// Switch the IR emitter to the end block.
+			// Switch the IR emitter to the end block, and merge the locals' values from the branches to it.
 			currentContext.endBlock->moveAfter(irBuilder.GetInsertBlock());
 			irBuilder.SetInsertPoint(currentContext.endBlock);
+			if(endTarget) { mergeIncomingLocalValues(*endTarget); }
 
 			if(currentContext.endPHI)
 			{
@@ -432,6 +847,9 @@ namespace LLVMJIT
 			assert(currentContext.outerBranchTargetStackSize <= branchTargetStack.size());
 			branchTargetStack.resize(currentContext.outerBranchTargetStackSize);
 
+			// If this is the end of a loop, its body's operators have all been counted toward its fuel charge.
+			if(currentContext.type == ControlContext::Type::loop && moduleContext.options.meterFuel) { endFuelCharge(); }
+
 			// Pop this control context.
 			controlStack.pop_back();
 		}
@@ -470,9 +888,10 @@ namespace LLVMJIT
 				llvm::Value* argument = getTopValue();
 				target.phi->addIncoming(argument,irBuilder.GetInsertBlock());
 			}
+			addIncomingLocalValues(target);
 
 			// Create a new basic block for the case where the branch is not taken.
-			auto falseBlock = llvm::BasicBlock::Create(context,"br_ifElse",llvmFunction);
+			auto falseBlock = llvm::BasicBlock::Create(*context,"br_ifElse",llvmFunction);
 
 			// Emit a conditional branch to either the falseBlock or the target block.
 			irBuilder.CreateCondBr(coerceI32ToBool(condition),target.block,falseBlock);
@@ -490,6 +909,7 @@ namespace LLVMJIT
 				llvm::Value* argument = pop();
 				target.phi->addIncoming(argument,irBuilder.GetInsertBlock());
 			}
+			addIncomingLocalValues(target);
 
 			// Branch to the target block.
 			irBuilder.CreateBr(target.block);
@@ -512,6 +932,7 @@ namespace LLVMJIT
 				argument = pop();
 				defaultTarget.phi->addIncoming(argument,irBuilder.GetInsertBlock());
 			}
+			addIncomingLocalValues(defaultTarget);
 
 			// Create a LLVM switch instruction.
 			auto llvmSwitch = irBuilder.CreateSwitch(index,defaultTarget.block,(unsigned int)imm.targetDepths.size());
@@ -529,6 +950,7 @@ namespace LLVMJIT
 					// the target phi's incoming values.
 					target.phi->addIncoming(argument,irBuilder.GetInsertBlock());
 				}
+				addIncomingLocalValues(target);
 			}
 
 			enterUnreachable();
@@ -550,8 +972,10 @@ namespace LLVMJIT
 
 		void unreachable(NoImm)
 		{
-			// Call an intrinsic that causes a trap, and insert the LLVM unreachable terminator.
-			emitRuntimeIntrinsic("wavmIntrinsics.unreachableTrap",FunctionType::get(),{});
+			// Cause a trap, and insert the LLVM unreachable terminator. If the code relies on hardware traps, llvm.trap emits an
+			// undefined instruction that the runtime maps back to this operator. Otherwise, call an intrinsic that causes the trap.
+			if(moduleContext.options.useHardwareTraps) { irBuilder.CreateCall(getLLVMIntrinsic({},llvm::Intrinsic::trap)); }
+			else { emitRuntimeIntrinsic("wavmIntrinsics.unreachableTrap",FunctionType::get(),{}); }
 			irBuilder.CreateUnreachable();
 
 			enterUnreachable();
@@ -578,28 +1002,34 @@ namespace LLVMJIT
 		void call(CallImm imm)
 		{
 			// Map the callee function index to either an imported function pointer or a function in this module.
+			// Functions in this module are passed this function's context, and imported functions the context of their instance.
 			llvm::Value* callee;
+			llvm::Value* calleeContext;
 			const FunctionType* calleeType;
-			if(imm.functionIndex < moduleContext.importedFunctionPointers.size())
+			const uintp numImportedFunctions = moduleContext.importedFunctionTypes.size();
+			if(imm.functionIndex < numImportedFunctions)
 			{
-				assert(imm.functionIndex < moduleContext.moduleInstance->functions.size());
-				callee = moduleContext.importedFunctionPointers[imm.functionIndex];
-				calleeType = moduleContext.moduleInstance->functions[imm.functionIndex]->type;
+				calleeType = moduleContext.importedFunctionTypes[imm.functionIndex];
+				getImportedFunction(imm.functionIndex,asLLVMContextFunctionType(calleeType),callee,calleeContext);
 			}
 			else
 			{
-				const uintp calleeIndex = imm.functionIndex - moduleContext.importedFunctionPointers.size();
+				const uintp calleeIndex = imm.functionIndex - numImportedFunctions;
 				assert(calleeIndex < moduleContext.functionDefs.size());
-				callee = moduleContext.functionDefs[calleeIndex];
+				callee = moduleContext.options.callThroughFunctionDefEntries
+					? loadFunctionDefEntry(calleeIndex)
+					: moduleContext.functionDefs[calleeIndex];
+				calleeContext = contextPointer;
 				calleeType = module.types[module.functionDefs[calleeIndex].typeIndex];
 			}
 
-			// Pop the call arguments from the operand stack.
-			auto llvmArgs = (llvm::Value**)alloca(sizeof(llvm::Value*) * calleeType->parameters.size());
-			popMultiple(llvmArgs,calleeType->parameters.size());
+			// Pop the call arguments from the operand stack, leaving room for the context argument.
+			auto llvmArgs = (llvm::Value**)alloca(sizeof(llvm::Value*) * (calleeType->parameters.size() + 1));
+			llvmArgs[0] = calleeContext;
+			popMultiple(llvmArgs + 1,calleeType->parameters.size());
 
 			// Call the function.
-			auto result = irBuilder.CreateCall(callee,llvm::ArrayRef<llvm::Value*>(llvmArgs,calleeType->parameters.size()));
+			auto result = irBuilder.CreateCall(callee,llvm::ArrayRef<llvm::Value*>(llvmArgs,calleeType->parameters.size() + 1));
 
 			// Push the result on the operand stack.
 			if(calleeType->ret != ResultType::none) { push(result); }
@@ -609,42 +1039,53 @@ namespace LLVMJIT
 			assert(imm.typeIndex < module.types.size());
 			
 			auto calleeType = module.types[imm.typeIndex];
-			auto functionPointerType = asLLVMType(calleeType)->getPointerTo()->getPointerTo();
+			auto functionPointerType = asLLVMContextFunctionType(calleeType)->getPointerTo()->getPointerTo();
 
 			// Compile the function index.
 			auto tableElementIndex = pop();
 			
-			// Compile the call arguments.
-			auto llvmArgs = (llvm::Value**)alloca(sizeof(llvm::Value*) * calleeType->parameters.size());
-			popMultiple(llvmArgs,calleeType->parameters.size());
+			// Compile the call arguments, leaving room for the context argument.
+			auto llvmArgs = (llvm::Value**)alloca(sizeof(llvm::Value*) * (calleeType->parameters.size() + 1));
+			popMultiple(llvmArgs + 1,calleeType->parameters.size());
 
 			// Zero extend the function index to the pointer size.
-			auto functionIndexZExt = irBuilder.CreateZExt(tableElementIndex,sizeof(uintp) == 4 ? llvmI32Type : llvmI64Type);
+			auto llvmUIntPtrType = sizeof(uintp) == 4 ? llvmI32Type : llvmI64Type;
+			auto functionIndexZExt = irBuilder.CreateZExt(tableElementIndex,llvmUIntPtrType);
 			
-			// If the function index is larger than the function table size, trap.
-			emitConditionalTrapIntrinsic(
-				irBuilder.CreateICmpUGE(functionIndexZExt,moduleContext.defaultTableEndOffset),
-				"wavmIntrinsics.indirectCallIndexOutOfBounds",FunctionType::get(),{});
+			// On a 64-bit host, the table reserves address-space for every 32-bit index, so an index beyond the table's size
+			// either loads a null element, or faults in the table's uncommitted pages. Otherwise, if the function index is
+			// beyond the table's reserved address-space, trap.
+			if(!HAS_64BIT_ADDRESS_SPACE)
+			{
+				emitConditionalTrapIntrinsic(
+					irBuilder.CreateICmpUGE(functionIndexZExt,defaultTableEndIndex),
+					"wavmIntrinsics.indirectCallIndexOutOfBounds",FunctionType::get(),{});
+			}
 
-			// Load the type for this table entry.
-			auto functionTypePointerPointer = irBuilder.CreateInBoundsGEP(moduleContext.defaultTablePointer,{functionIndexZExt,emitLiteral((uint32)0)});
-			auto functionTypePointer = irBuilder.CreateLoad(functionTypePointerPointer);
-			auto llvmCalleeType = emitLiteralPointer(calleeType,llvmI8PtrType);
+			// Load the signature index for this table entry.
+			auto signatureIndexPointer = irBuilder.CreateInBoundsGEP(defaultTablePointer,{functionIndexZExt,emitLiteral((uint32)0)});
+			auto signatureIndex = irBuilder.CreateLoad(signatureIndexPointer);
+			auto expectedSignatureIndex = irBuilder.CreatePtrToInt(
+				moduleContext.emitExternalSymbolAddress(getSignatureIndexSymbolName(imm.typeIndex),llvmI8PtrType),
+				llvmUIntPtrType);
 			
-			// If the function type doesn't match, trap.
+			// If the signature index doesn't match, trap. Null elements have signature index 0, which never matches, so this
+			// also checks that the element isn't null.
 			emitConditionalTrapIntrinsic(
-				irBuilder.CreateICmpNE(llvmCalleeType,functionTypePointer),
+				irBuilder.CreateICmpNE(expectedSignatureIndex,signatureIndex),
 				"wavmIntrinsics.indirectCallSignatureMismatch",
 				FunctionType::get(ResultType::none,{ValueType::i32,ValueType::i64,ValueType::i64}),
 				{	tableElementIndex,
-					irBuilder.CreatePtrToInt(llvmCalleeType,llvmI64Type),
-					emitLiteral(reinterpret_cast<uint64>(moduleContext.moduleInstance->defaultTable))	}
+					irBuilder.CreateZExt(expectedSignatureIndex,llvmI64Type),
+					defaultTableObjectAsI64	}
 				);
 
-			// Call the function loaded from the table.
-			auto functionPointerPointer = irBuilder.CreateInBoundsGEP(moduleContext.defaultTablePointer,{functionIndexZExt,emitLiteral((uint32)1)});
+			// Call the function loaded from the table, passing it the context loaded from the table.
+			auto functionPointerPointer = irBuilder.CreateInBoundsGEP(defaultTablePointer,{functionIndexZExt,emitLiteral((uint32)1)});
 			auto functionPointer = irBuilder.CreateLoad(irBuilder.CreatePointerCast(functionPointerPointer,functionPointerType));
-			auto result = irBuilder.CreateCall(functionPointer,llvm::ArrayRef<llvm::Value*>(llvmArgs,calleeType->parameters.size()));
+			auto calleeContextPointer = irBuilder.CreateInBoundsGEP(defaultTablePointer,{functionIndexZExt,emitLiteral((uint32)2)});
+			llvmArgs[0] = irBuilder.CreateLoad(calleeContextPointer);
+			auto result = irBuilder.CreateCall(functionPointer,llvm::ArrayRef<llvm::Value*>(llvmArgs,calleeType->parameters.size() + 1));
 
 			// Push the result on the operand stack.
 			if(calleeType->ret != ResultType::none) { push(result); }
@@ -656,43 +1097,39 @@ namespace LLVMJIT
 
 		void get_local(GetOrSetVariableImm imm)
 		{
-			assert(imm.variableIndex < localPointers.size());
-			push(irBuilder.CreateLoad(localPointers[imm.variableIndex]));
+			assert(imm.variableIndex < localValues.size());
+			push(localValues[imm.variableIndex]);
 		}
 		void set_local(GetOrSetVariableImm imm)
 		{
-			assert(imm.variableIndex < localPointers.size());
-			auto value = pop();
-			irBuilder.CreateStore(value,localPointers[imm.variableIndex]);
+			assert(imm.variableIndex < localValues.size());
+			localValues[imm.variableIndex] = pop();
 		}
 		void tee_local(GetOrSetVariableImm imm)
 		{
-			assert(imm.variableIndex < localPointers.size());
-			auto value = getTopValue();
-			irBuilder.CreateStore(value,localPointers[imm.variableIndex]);
+			assert(imm.variableIndex < localValues.size());
+			localValues[imm.variableIndex] = getTopValue();
 		}
 		
 		void get_global(GetOrSetVariableImm imm)
 		{
-			assert(imm.variableIndex < moduleContext.globalPointers.size());
-			push(irBuilder.CreateLoad(moduleContext.globalPointers[imm.variableIndex]));
+			push(irBuilder.CreateLoad(getGlobalPointer(imm.variableIndex)));
 		}
 		void set_global(GetOrSetVariableImm imm)
 		{
-			assert(imm.variableIndex < moduleContext.globalPointers.size());
 			auto value = pop();
-			irBuilder.CreateStore(value,moduleContext.globalPointers[imm.variableIndex]);
+			irBuilder.CreateStore(value,getGlobalPointer(imm.variableIndex));
 		}
 
 		//
 		// Memory size operators
-		// These just call out to wavmIntrinsics.growMemory/currentMemory, passing a pointer to the default memory for the module.
+		// grow_memory calls out to wavmIntrinsics.growMemory, passing a pointer to the default memory for the module.
+		// current_memory loads the default memory's size directly, since some code calls it frequently.
 		//
 
 		void grow_memory(MemoryImm)
 		{
 			auto deltaNumPages = pop();
-			auto defaultMemoryObjectAsI64 = emitLiteral(reinterpret_cast<uint64>(moduleContext.moduleInstance->defaultMemory));
 			auto previousNumPages = emitRuntimeIntrinsic(
 				"wavmIntrinsics.growMemory",
 				FunctionType::get(ResultType::i32,{ValueType::i32,ValueType::i64}),
@@ -701,12 +1138,16 @@ namespace LLVMJIT
 		}
 		void current_memory(MemoryImm)
 		{
-			auto defaultMemoryObjectAsI64 = emitLiteral(reinterpret_cast<uint64>(moduleContext.moduleInstance->defaultMemory));
-			auto currentNumPages = emitRuntimeIntrinsic(
-				"wavmIntrinsics.currentMemory",
-				FunctionType::get(ResultType::i32,{ValueType::i64}),
-				{defaultMemoryObjectAsI64});
-			push(currentNumPages);
+			// The pointer to the memory's size is only loaded on function entry if the bounds check mode uses it, so load it
+			// from the context here otherwise. A memory can't have more than 2^16 pages, so its size always fits in an i32.
+			llvm::Value* numPagesPointer = defaultMemoryNumPagesPointer;
+			if(!numPagesPointer)
+			{
+				auto llvmUIntPtrType = sizeof(uintp) == 4 ? llvmI32Type : llvmI64Type;
+				numPagesPointer = loadContextField(offsetof(InstanceContext,defaultMemoryNumPages),llvmUIntPtrType->getPointerTo());
+			}
+			auto currentNumPages = irBuilder.CreateLoad(numPagesPointer);
+			push(sizeof(uintp) == 4 ? currentNumPages : irBuilder.CreateTrunc(currentNumPages,llvmI32Type));
 		}
 
 		//
@@ -787,15 +1228,16 @@ namespace LLVMJIT
 
 		llvm::Value* emitSRem(ValueType type,llvm::Value* left,llvm::Value* right)
 		{
-			// Trap if the dividend is zero.
-			trapDivideByZero(type,right); 
+			// Trap if the divisor is zero, unless the division is left for the CPU to trap on.
+			const bool useHardwareTrap = isHardwareTrappingDivisor(right);
+			if(!useHardwareTrap) { right = trapDivideByZero(type,right); }
 
 			// LLVM's srem has undefined behavior where WebAssembly's rem_s defines that it should not trap if the corresponding
 			// division would overflow a signed integer. To avoid this case, we just branch around the srem if the INT_MAX%-1 case
 			// that overflows is detected.
 			auto preOverflowBlock = irBuilder.GetInsertBlock();
-			auto noOverflowBlock = llvm::BasicBlock::Create(context,"sremNoOverflow",llvmFunction);
-			auto endBlock = llvm::BasicBlock::Create(context,"sremEnd",llvmFunction);
+			auto noOverflowBlock = llvm::BasicBlock::Create(*context,"sremNoOverflow",llvmFunction);
+			auto endBlock = llvm::BasicBlock::Create(*context,"sremEnd",llvmFunction);
 			auto noOverflow = irBuilder.CreateOr(
 				irBuilder.CreateICmpNE(left,type == ValueType::i32 ? emitLiteral((uint32)INT32_MIN) : emitLiteral((uint64)INT64_MIN)),
 				irBuilder.CreateICmpNE(right,type == ValueType::i32 ? emitLiteral((uint32)-1) : emitLiteral((uint64)-1))
@@ -803,7 +1245,9 @@ namespace LLVMJIT
 			irBuilder.CreateCondBr(noOverflow,noOverflowBlock,endBlock,moduleContext.likelyTrueBranchWeights);
 
 			irBuilder.SetInsertPoint(noOverflowBlock);
-			auto noOverflowValue = irBuilder.CreateSRem(left,right);
+			auto noOverflowValue = useHardwareTrap
+				? emitHardwareTrappingDivide(type,left,right,true,true)
+				: irBuilder.CreateSRem(left,right);
 			irBuilder.CreateBr(endBlock);
 
 			irBuilder.SetInsertPoint(endBlock);
@@ -855,10 +1299,10 @@ namespace LLVMJIT
 		EMIT_INT_BINARY_OP(rotr,emitRotr(type,left,right))
 		EMIT_INT_BINARY_OP(rotl,emitRotl(type,left,right))
 			
-		// Divides use trapDivideByZero to avoid the undefined behavior in LLVM's division instructions.
-		EMIT_INT_BINARY_OP(div_s, (trapDivideByZero(type,right), irBuilder.CreateSDiv(left,right)) )
-		EMIT_INT_BINARY_OP(div_u, (trapDivideByZero(type,right), irBuilder.CreateUDiv(left,right)) )
-		EMIT_INT_BINARY_OP(rem_u, (trapDivideByZero(type,right), irBuilder.CreateURem(left,right)) )
+		// Divides use emitDivide to avoid the undefined behavior in LLVM's division instructions.
+		EMIT_INT_BINARY_OP(div_s,emitDivide(type,left,right,true,false))
+		EMIT_INT_BINARY_OP(div_u,emitDivide(type,left,right,false,false))
+		EMIT_INT_BINARY_OP(rem_u,emitDivide(type,left,right,false,true))
 		EMIT_INT_BINARY_OP(rem_s,emitSRem(type,left,right))
 
 		// Explicitly mask the shift amount operand to the word size to avoid LLVM's undefined behavior.
@@ -886,6 +1330,82 @@ namespace LLVMJIT
 		// FP operators
 		//
 
+		// Sets the quiet bit of a NaN. WebAssembly's float operators that LLVM doesn't have an exact equivalent for return
+		// their NaN operands as quiet NaNs.
+		llvm::Value* emitQuietNaN(llvm::Value* nan)
+		{
+			const bool isF32 = nan->getType() == llvmF32Type;
+			auto bits = irBuilder.CreateBitCast(nan,isF32 ? llvmI32Type : llvmI64Type);
+			auto quietBits = irBuilder.CreateOr(bits,isF32 ? emitLiteral(uint32(1) << 22) : emitLiteral(uint64(1) << 51));
+			return irBuilder.CreateBitCast(quietBits,nan->getType());
+		}
+
+		// LLVM's minnum and maxnum return the other operand if one is a NaN, and may return either of -0 and +0, so min and
+		// max are emitted as compares and selects, which LLVM can still vectorize.
+		llvm::Value* emitFloatMinOrMax(llvm::Value* left,llvm::Value* right,bool isMin)
+		{
+			llvm::Type* floatType = left->getType();
+			llvm::Type* intType = floatType == llvmF32Type ? llvmI32Type : llvmI64Type;
+
+			// If neither operand is less (for min) or greater (for max) than the other, they're either the same value, or
+			// -0 and +0. ORing their bits picks -0 for min, and ANDing their bits picks +0 for max.
+			auto leftBits = irBuilder.CreateBitCast(left,intType);
+			auto rightBits = irBuilder.CreateBitCast(right,intType);
+			auto equalResult = irBuilder.CreateBitCast(
+				isMin ? irBuilder.CreateOr(leftBits,rightBits) : irBuilder.CreateAnd(leftBits,rightBits),
+				floatType);
+			auto orderedResult = irBuilder.CreateSelect(
+				isMin ? irBuilder.CreateFCmpOLT(left,right) : irBuilder.CreateFCmpOGT(left,right),
+				left,
+				irBuilder.CreateSelect(
+					isMin ? irBuilder.CreateFCmpOLT(right,left) : irBuilder.CreateFCmpOGT(right,left),
+					right,
+					equalResult));
+
+			// If either operand is a NaN, return it as a quiet NaN, preferring the left operand.
+			auto nanResult = emitQuietNaN(irBuilder.CreateSelect(irBuilder.CreateFCmpUNO(left,left),left,right));
+			return irBuilder.CreateSelect(irBuilder.CreateFCmpUNO(left,right),nanResult,orderedResult);
+		}
+
+		// Emits a call to one of LLVM's float rounding intrinsics, returning NaN operands as quiet NaNs.
+		llvm::Value* emitFloatRound(llvm::Value* operand,llvm::Intrinsic::ID id)
+		{
+			auto roundedValue = irBuilder.CreateCall(getLLVMIntrinsic({operand->getType()},id),llvm::ArrayRef<llvm::Value*>({operand}));
+			return irBuilder.CreateSelect(irBuilder.CreateFCmpUNO(operand,operand),emitQuietNaN(operand),roundedValue);
+		}
+
+		// LLVM's fptosi and fptoui have undefined behavior if the operand is NaN or out of the range of the result type,
+		// where WebAssembly's trunc_s and trunc_u trap, so check for those cases before converting.
+		llvm::Value* emitTruncFloatToInt(ValueType destType,bool isSigned,llvm::Value* operand)
+		{
+			// The truncated operand must be greater than the minimum value of the result type minus one, and less than the
+			// maximum value of the result type plus one. The maximum plus one is a power of two, so it's exactly representable
+			// by both float types. The minimum minus one is only representable for an f64 operand and i32 result; otherwise,
+			// the operand must be greater than or equal to the minimum, which is -1 or a power of two.
+			const bool isF32 = operand->getType() == llvmF32Type;
+			const float64 numResultValues = destType == ValueType::i32 ? 4294967296.0 : 18446744073709551616.0;
+			const float64 minResult = isSigned ? -numResultValues / 2.0 : 0.0;
+			const float64 maxResultPlusOne = isSigned ? numResultValues / 2.0 : numResultValues;
+			const bool canRepresentMinResultMinusOne = isF32
+				? float32(minResult - 1.0) != float32(minResult)
+				: minResult - 1.0 != minResult;
+			llvm::Value* isTooSmall = canRepresentMinResultMinusOne
+				? irBuilder.CreateFCmpOLE(operand,llvm::ConstantFP::get(operand->getType(),minResult - 1.0))
+				: irBuilder.CreateFCmpOLT(operand,llvm::ConstantFP::get(operand->getType(),minResult));
+			llvm::Value* isTooLarge = irBuilder.CreateFCmpOGE(operand,llvm::ConstantFP::get(operand->getType(),maxResultPlusOne));
+
+			emitConditionalTrapIntrinsic(
+				irBuilder.CreateFCmpUNO(operand,operand),
+				"wavmIntrinsics.invalidFloatOperationTrap",FunctionType::get(),{});
+			emitConditionalTrapIntrinsic(
+				irBuilder.CreateOr(isTooSmall,isTooLarge),
+				"wavmIntrinsics.integerOverflowTrap",FunctionType::get(),{});
+
+			return isSigned
+				? irBuilder.CreateFPToSI(operand,asLLVMType(destType))
+				: irBuilder.CreateFPToUI(operand,asLLVMType(destType));
+		}
+
 		EMIT_FP_BINARY_OP(add,irBuilder.CreateFAdd(left,right))
 		EMIT_FP_BINARY_OP(sub,irBuilder.CreateFSub(left,right))
 		EMIT_FP_BINARY_OP(mul,irBuilder.CreateFMul(left,right))
@@ -919,17 +1439,17 @@ namespace LLVMJIT
 		EMIT_UNARY_OP(i32,reinterpret_f32,irBuilder.CreateBitCast(operand,llvmI32Type))
 		EMIT_UNARY_OP(i64,reinterpret_f64,irBuilder.CreateBitCast(operand,llvmI64Type))
 
-		// These operations don't match LLVM's semantics exactly, so just call out to C++ implementations.
-		EMIT_FP_BINARY_OP(min,emitRuntimeIntrinsic("wavmIntrinsics.floatMin",FunctionType::get(asResultType(type),{type,type}),{left,right}))
-		EMIT_FP_BINARY_OP(max,emitRuntimeIntrinsic("wavmIntrinsics.floatMax",FunctionType::get(asResultType(type),{type,type}),{left,right}))
-		EMIT_FP_UNARY_OP(ceil,emitRuntimeIntrinsic("wavmIntrinsics.floatCeil",FunctionType::get(asResultType(type),{type}),{operand}))
-		EMIT_FP_UNARY_OP(floor,emitRuntimeIntrinsic("wavmIntrinsics.floatFloor",FunctionType::get(asResultType(type),{type}),{operand}))
-		EMIT_FP_UNARY_OP(trunc,emitRuntimeIntrinsic("wavmIntrinsics.floatTrunc",FunctionType::get(asResultType(type),{type}),{operand}))
-		EMIT_FP_UNARY_OP(nearest,emitRuntimeIntrinsic("wavmIntrinsics.floatNearest",FunctionType::get(asResultType(type),{type}),{operand}))
-		EMIT_INT_UNARY_OP(trunc_s_f32,emitRuntimeIntrinsic("wavmIntrinsics.floatToSignedInt",FunctionType::get(asResultType(type),{ValueType::f32}),{operand}))
-		EMIT_INT_UNARY_OP(trunc_s_f64,emitRuntimeIntrinsic("wavmIntrinsics.floatToSignedInt",FunctionType::get(asResultType(type),{ValueType::f64}),{operand}))
-		EMIT_INT_UNARY_OP(trunc_u_f32,emitRuntimeIntrinsic("wavmIntrinsics.floatToUnsignedInt",FunctionType::get(asResultType(type),{ValueType::f32}),{operand}))
-		EMIT_INT_UNARY_OP(trunc_u_f64,emitRuntimeIntrinsic("wavmIntrinsics.floatToUnsignedInt",FunctionType::get(asResultType(type),{ValueType::f64}),{operand}))
+		// These operations don't match LLVM's semantics exactly, so they're emitted with the helpers above.
+		EMIT_FP_BINARY_OP(min,emitFloatMinOrMax(left,right,true))
+		EMIT_FP_BINARY_OP(max,emitFloatMinOrMax(left,right,false))
+		EMIT_FP_UNARY_OP(ceil,emitFloatRound(operand,llvm::Intrinsic::ceil))
+		EMIT_FP_UNARY_OP(floor,emitFloatRound(operand,llvm::Intrinsic::floor))
+		EMIT_FP_UNARY_OP(trunc,emitFloatRound(operand,llvm::Intrinsic::trunc))
+		EMIT_FP_UNARY_OP(nearest,emitFloatRound(operand,llvm::Intrinsic::nearbyint))
+		EMIT_INT_UNARY_OP(trunc_s_f32,emitTruncFloatToInt(type,true,operand))
+		EMIT_INT_UNARY_OP(trunc_s_f64,emitTruncFloatToInt(type,true,operand))
+		EMIT_INT_UNARY_OP(trunc_u_f32,emitTruncFloatToInt(type,false,operand))
+		EMIT_INT_UNARY_OP(trunc_u_f64,emitTruncFloatToInt(type,false,operand))
 	};
 	
 	// A do-nothing visitor used to decode past unreachable operators (but supporting logging, and passing the end operator through).
@@ -953,9 +1473,10 @@ namespace LLVMJIT
 		void call_indirect(CallIndirectImm) {}
 
 		// Keep track of control structure nesting level in unreachable code, so we know when we reach the end of the unreachable code.
-		void beginBlock(ControlStructureImm) { ++unreachableControlDepth; }
-		void beginLoop(ControlStructureImm) { ++unreachableControlDepth; }
-		void beginIf(ControlStructureImm) { ++unreachableControlDepth; }
+		// The IR emitter also needs to skip the control structures, so it stays in sync with the locals they assign.
+		void beginBlock(ControlStructureImm) { ++unreachableControlDepth; context.beginControlStructure(); }
+		void beginLoop(ControlStructureImm) { ++unreachableControlDepth; context.beginControlStructure(); }
+		void beginIf(ControlStructureImm) { ++unreachableControlDepth; context.beginControlStructure(); }
 
 		// If an else or end opcode would signal an end to the unreachable code, then pass it through to the IR emitter.
 		void beginElse(NoImm imm)
@@ -974,6 +1495,56 @@ namespace LLVMJIT
 		uintp unreachableControlDepth;
 	};
 
+	// Finds the locals assigned by each control structure in a function, including the control structures nested in it.
+	// The branches that merge at the start of a loop or the end of a block or if only give different values to the locals
+	// assigned by the control structure, so the IR emitter only needs to merge those locals' values.
+	struct LocalAssignmentVisitor
+	{
+		// The locals assigned by each control structure, in the order the control structures begin.
+		std::vector<std::vector<uintp>> controlStructureAssignedLocals;
+
+		#define VISIT_OP(encoding,name,Imm) void name(Imm imm) { visitOp(Opcode::name,imm); }
+		ENUM_OPS(VISIT_OP)
+		#undef VISIT_OP
+		void unknown(Opcode opcode) { Core::unreachable(); }
+
+	private:
+
+		// The indices of the control structures enclosing the current operator.
+		std::vector<uintp> controlStack;
+
+		template<typename Imm> void visitOp(Opcode opcode,Imm imm) {}
+		void visitOp(Opcode opcode,ControlStructureImm imm)
+		{
+			controlStack.push_back(controlStructureAssignedLocals.size());
+			controlStructureAssignedLocals.push_back(std::vector<uintp>());
+		}
+		void visitOp(Opcode opcode,NoImm imm)
+		{
+			// The final end operator ends the function, which isn't included in controlStack.
+			if(opcode != Opcode::end || !controlStack.size()) { return; }
+
+			// Remove duplicates from the locals assigned by the control structure, and add them to the locals assigned by
+			// the enclosing control structure.
+			std::vector<uintp>& assignedLocals = controlStructureAssignedLocals[controlStack.back()];
+			std::sort(assignedLocals.begin(),assignedLocals.end());
+			assignedLocals.erase(std::unique(assignedLocals.begin(),assignedLocals.end()),assignedLocals.end());
+			controlStack.pop_back();
+			if(controlStack.size())
+			{
+				std::vector<uintp>& outerAssignedLocals = controlStructureAssignedLocals[controlStack.back()];
+				outerAssignedLocals.insert(outerAssignedLocals.end(),assignedLocals.begin(),assignedLocals.end());
+			}
+		}
+		void visitOp(Opcode opcode,GetOrSetVariableImm imm)
+		{
+			if((opcode == Opcode::set_local || opcode == Opcode::tee_local) && controlStack.size())
+			{
+				controlStructureAssignedLocals[controlStack.back()].push_back(imm.variableIndex);
+			}
+		}
+	};
+
 	void EmitFunctionContext::emit()
 	{
 		// Create debug info for the function.
@@ -982,7 +1553,7 @@ namespace LLVMJIT
 		auto diFunctionType = moduleContext.diBuilder.createSubroutineType(moduleContext.diBuilder.getOrCreateTypeArray(diFunctionParameterTypes));
 		diFunction = moduleContext.diBuilder.createFunction(
 			moduleContext.diModuleScope,
-			functionInstance->debugName,
+			moduleContext.functionDefNames[functionDefIndex],
 			llvmFunction->getName(),
 			moduleContext.diModuleScope,
 			0,
@@ -993,48 +1564,105 @@ namespace LLVMJIT
 		llvmFunction->setSubprogram(diFunction);
 
 		// Create the return basic block, and push the root control context for the function.
-		auto returnBlock = llvm::BasicBlock::Create(context,"return",llvmFunction);
+		auto returnBlock = llvm::BasicBlock::Create(*context,"return",llvmFunction);
 		auto returnPHI = createPHI(returnBlock,functionType->ret);
 		pushControlStack(ControlContext::Type::function,functionType->ret,returnBlock,returnPHI);
 		pushBranchTarget(functionType->ret,returnBlock,returnPHI);
 
 		// Create an initial basic block for the function.
-		auto entryBasicBlock = llvm::BasicBlock::Create(context,"entry",llvmFunction);
+		auto entryBasicBlock = llvm::BasicBlock::Create(*context,"entry",llvmFunction);
 		irBuilder.SetInsertPoint(entryBasicBlock);
 
+		// Get the values used to access the instance's default memory and table: if the code is instance-independent, load
+		// them from the instance context, otherwise use the module's references to them.
+		auto llvmArgIt = llvmFunction->arg_begin();
+		contextPointer = (llvm::Argument*)llvmArgIt++;
+		auto llvmUIntPtrType = sizeof(uintp) == 4 ? llvmI32Type : llvmI64Type;
+		if(moduleContext.hasDefaultMemory)
+		{
+			if(!moduleContext.options.isInstanceIndependent)
+			{
+				defaultMemoryBase = moduleContext.defaultMemoryBase;
+				defaultMemoryAddressMask = moduleContext.defaultMemoryAddressMask;
+				defaultMemoryNumPagesPointer = moduleContext.defaultMemoryNumPagesPointer;
+				defaultMemoryObjectAsI64 = moduleContext.defaultMemoryObjectAsI64;
+			}
+			else
+			{
+				// Only load the values that the memory bounds check mode uses.
+				const MemoryBoundsCheckMode boundsCheckMode = moduleContext.options.memoryBoundsCheckMode;
+				defaultMemoryBase = loadContextField(offsetof(InstanceContext,defaultMemoryBase),llvmI8PtrType);
+				if(boundsCheckMode == MemoryBoundsCheckMode::addressMask)
+				{ defaultMemoryAddressMask = loadContextField(offsetof(InstanceContext,defaultMemoryAddressMask),llvmUIntPtrType); }
+				if(boundsCheckMode == MemoryBoundsCheckMode::explicitChecks)
+				{ defaultMemoryNumPagesPointer = loadContextField(offsetof(InstanceContext,defaultMemoryNumPages),llvmUIntPtrType->getPointerTo()); }
+				defaultMemoryObjectAsI64 = loadContextField(offsetof(InstanceContext,defaultMemory),llvmI64Type);
+			}
+		}
+		if(moduleContext.hasDefaultTable)
+		{
+			if(!moduleContext.options.isInstanceIndependent)
+			{
+				defaultTablePointer = moduleContext.defaultTablePointer;
+				defaultTableEndIndex = moduleContext.defaultTableEndIndex;
+				defaultTableObjectAsI64 = moduleContext.defaultTableObjectAsI64;
+			}
+			else
+			{
+				defaultTablePointer = loadContextField(offsetof(InstanceContext,defaultTableBase),moduleContext.tableElementType->getPointerTo());
+				defaultTableEndIndex = HAS_64BIT_ADDRESS_SPACE ? nullptr : loadContextField(offsetof(InstanceContext,defaultTableEndIndex),llvmUIntPtrType);
+				defaultTableObjectAsI64 = loadContextField(offsetof(InstanceContext,defaultTable),llvmI64Type);
+			}
+		}
+
+		// If enabled, trap if the stack pointer is below the thread's stack limit. The limit is loaded through the x86-64 FS
+		// segment (LLVM address space 257) at the offset of the runtime's thread-local limit from the thread pointer.
+		if(moduleContext.options.checkStackLimit)
+		{
+			auto stackLimitOffset = irBuilder.CreatePtrToInt(
+				moduleContext.emitExternalSymbolAddress(getStackLimitOffsetSymbolName(),llvmI8PtrType),
+				llvmI64Type);
+			auto stackLimit = irBuilder.CreateLoad(irBuilder.CreateIntToPtr(stackLimitOffset,llvmI64Type->getPointerTo(257)));
+			auto stackPointer = irBuilder.CreatePtrToInt(irBuilder.CreateCall(getLLVMIntrinsic({},llvm::Intrinsic::stacksave)),llvmI64Type);
+			emitConditionalTrapIntrinsic(
+				irBuilder.CreateICmpULT(stackPointer,stackLimit),
+				"wavmIntrinsics.stackOverflowTrap",FunctionType::get(),{});
+		}
+
 		// If enabled, emit a call to the WAVM function enter hook (for debugging).
 		if(ENABLE_FUNCTION_ENTER_EXIT_HOOKS)
 		{
 			emitRuntimeIntrinsic(
 				"wavmIntrinsics.debugEnterFunction",
-				FunctionType::get(ResultType::none,{ValueType::i64}),
-				{emitLiteral(reinterpret_cast<uint64>(functionInstance))}
+				FunctionType::get(ResultType::none,{ValueType::i64,ValueType::i32}),
+				{irBuilder.CreatePtrToInt(contextPointer,llvmI64Type),emitLiteral(uint32(functionDefIndex))}
 				);
 		}
 
-		// Create and initialize allocas for all the locals and parameters.
-		auto llvmArgIt = llvmFunction->arg_begin();
-		for(uintp localIndex = 0;localIndex < functionType->parameters.size() + function.nonParameterLocalTypes.size();++localIndex)
-		{
-			auto localType = localIndex < functionType->parameters.size()
-				? functionType->parameters[localIndex]
-				: function.nonParameterLocalTypes[localIndex - functionType->parameters.size()];
-			auto localPointer = irBuilder.CreateAlloca(asLLVMType(localType),nullptr,"");
-			localPointers.push_back(localPointer);
+		// Initialize the parameters' locals to the argument values, and the other locals to zero.
+		for(uintp parameterIndex = 0;parameterIndex < functionType->parameters.size();++parameterIndex)
+		{ localValues.push_back((llvm::Argument*)llvmArgIt++); }
+		for(auto localType : function.nonParameterLocalTypes) { localValues.push_back(typedZeroConstants[(uintp)localType]); }
 
-			if(localIndex < functionType->parameters.size())
-			{
-				// Copy the parameter value into the local that stores it.
-				irBuilder.CreateStore((llvm::Argument*)llvmArgIt,localPointer);
-				++llvmArgIt;
-			}
-			else
-			{
-				// Initialize non-parameter locals to zero.
-				irBuilder.CreateStore(typedZeroConstants[(uintp)localType],localPointer);
-			}
+		// Find the locals assigned by each of the function's control structures.
+		{
+			Serialization::MemoryInputStream assignmentCodeStream(module.code.data() + function.code.offset,function.code.numBytes);
+			OperationDecoder assignmentDecoder(assignmentCodeStream);
+			LocalAssignmentVisitor localAssignmentVisitor;
+			while(assignmentDecoder) { assignmentDecoder.decodeOp(localAssignmentVisitor); }
+			controlStructureAssignedLocals = std::move(localAssignmentVisitor.controlStructureAssignedLocals);
 		}
 
+		// If the code is the baseline tier, emit the check for whether to forward calls to the function's optimized code.
+		if(moduleContext.options.tier == CodeTier::baseline) { emitTierUpCheck(); }
+
+		// If metering fuel, charge each call to the function for the operators outside its loops. The charge comes after
+		// the tier-up check, so a call forwarded to the function's optimized code is only charged by the optimized code.
+		if(moduleContext.options.meterFuel) { beginFuelCharge(); }
+
+		// If polling the epoch, check whether the invoke was interrupted on each call to the function.
+		if(moduleContext.options.pollEpoch) { emitEpochPoll(); }
+
 		// Decode the WebAssembly opcodes and emit LLVM IR for them.
 		Serialization::MemoryInputStream codeStream(module.code.data() + function.code.offset,function.code.numBytes);
 		OperationDecoder decoder(codeStream);
@@ -1044,7 +1672,11 @@ namespace LLVMJIT
 		uintp opIndex = 0;
 		while(decoder && controlStack.size())
 		{
-			irBuilder.SetCurrentDebugLocation(llvm::DILocation::get(context,(unsigned int)opIndex++,0,diFunction));
+			irBuilder.SetCurrentDebugLocation(llvm::DILocation::get(*context,(unsigned int)opIndex++,0,diFunction));
+
+			// Count each reachable operator toward the fuel charge of the innermost loop containing it, or the function's.
+			if(moduleContext.options.meterFuel && controlStack.back().isReachable) { ++fuelChargeStack.back().cost; }
+
 			if(ENABLE_LOGGING)
 			{
 				if(controlStack.back().isReachable) { decoder.decodeOp(loggingProxy); }
@@ -1057,14 +1689,16 @@ namespace LLVMJIT
 			}
 		};
 		assert(irBuilder.GetInsertBlock() == returnBlock);
+		if(moduleContext.options.meterFuel) { endFuelCharge(); }
+		assert(!fuelChargeStack.size());
 		
 		// If enabled, emit a call to the WAVM function enter hook (for debugging).
 		if(ENABLE_FUNCTION_ENTER_EXIT_HOOKS)
 		{
 			emitRuntimeIntrinsic(
 				"wavmIntrinsics.debugExitFunction",
-				FunctionType::get(ResultType::none,{ValueType::i64}),
-				{emitLiteral(reinterpret_cast<uint64>(functionInstance))}
+				FunctionType::get(ResultType::none,{ValueType::i64,ValueType::i32}),
+				{irBuilder.CreatePtrToInt(contextPointer,llvmI64Type),emitLiteral(uint32(functionDefIndex))}
 				);
 		}
 
@@ -1077,40 +1711,84 @@ namespace LLVMJIT
 	{
 		Core::Timer emitTimer;
 
-		// Create literals for the default memory base and mask.
-		if(moduleInstance->defaultMemory)
+		// Gather the types of the module's imported functions and globals, and find whether it has a default memory and table.
+		hasDefaultMemory = module.memoryDefs.size() > 0;
+		hasDefaultTable = module.tableDefs.size() > 0;
+		for(auto& import : module.imports)
 		{
-			defaultMemoryBase = emitLiteralPointer(moduleInstance->defaultMemory->baseAddress,llvmI8PtrType);
-			const uintp defaultMemoryAddressMaskValue = uintp(moduleInstance->defaultMemory->endOffset) - 1;
-			defaultMemoryAddressMask = emitLiteral(defaultMemoryAddressMaskValue);
+			switch(import.type.kind)
+			{
+			case ObjectKind::function: importedFunctionTypes.push_back(module.types[import.type.functionTypeIndex]); break;
+			case ObjectKind::table: hasDefaultTable = true; break;
+			case ObjectKind::memory: hasDefaultMemory = true; break;
+			case ObjectKind::global: globalValueTypes.push_back(import.type.global.valueType); break;
+			default: Core::unreachable();
+			};
 		}
-		else { defaultMemoryBase = defaultMemoryAddressMask = nullptr; }
+		for(auto& global : module.globalDefs) { globalValueTypes.push_back(global.type.valueType); }
+
+		// Create the type of a table's call_indirect data: the element's signature index, and its function's entry and context.
+		auto llvmUIntPtrType = sizeof(uintp) == 4 ? llvmI32Type : llvmI64Type;
+		tableElementType = llvm::StructType::get(*context,{
+			llvmUIntPtrType,
+			llvmI8PtrType,
+			llvmI8PtrType
+			});
+
+		// Create references to the default memory base and mask.
+		if(hasDefaultMemory && !options.isInstanceIndependent)
+		{
+			defaultMemoryBase = emitExternalSymbolAddress(getDefaultMemoryBaseSymbolName(),llvmI8PtrType);
+			defaultMemoryAddressMask = emitExternalSymbolAddress(getDefaultMemoryAddressMaskSymbolName(),llvmUIntPtrType);
+			defaultMemoryNumPagesPointer = emitExternalSymbolAddress(getDefaultMemoryNumPagesSymbolName(),llvmUIntPtrType->getPointerTo());
+			defaultMemoryObjectAsI64 = emitExternalSymbolAddress(getDefaultMemoryObjectSymbolName(),llvmI64Type);
+		}
+		else { defaultMemoryBase = defaultMemoryAddressMask = defaultMemoryNumPagesPointer = defaultMemoryObjectAsI64 = nullptr; }
 
 		// Set up the LLVM values used to access the global table.
-		if(moduleInstance->defaultTable)
+		if(hasDefaultTable && !options.isInstanceIndependent)
 		{
-			auto tableElementType = llvm::StructType::get(context,{
-				llvmI8PtrType,
-				llvmI8PtrType
-				});
-			defaultTablePointer = emitLiteralPointer(moduleInstance->defaultTable->baseAddress,tableElementType->getPointerTo());
-			defaultTableEndOffset = emitLiteral((uintp)moduleInstance->defaultTable->endOffset);
+			defaultTablePointer = emitExternalSymbolAddress(getDefaultTableBaseSymbolName(),tableElementType->getPointerTo());
+			defaultTableEndIndex = HAS_64BIT_ADDRESS_SPACE ? nullptr : emitExternalSymbolAddress(getDefaultTableEndIndexSymbolName(),llvmUIntPtrType);
+			defaultTableObjectAsI64 = emitExternalSymbolAddress(getDefaultTableObjectSymbolName(),llvmI64Type);
 		}
 		else
 		{
-			defaultTablePointer = defaultTableEndOffset = nullptr;
+			defaultTablePointer = defaultTableEndIndex = defaultTableObjectAsI64 = nullptr;
+		}
+
+		// Create references to the module's table of function entries, and the state of baseline tier code.
+		functionDefEntries = options.callThroughFunctionDefEntries || options.tier == CodeTier::baseline
+			? emitExternalSymbolAddress(getFunctionDefEntriesSymbolName(),llvmI8PtrType)
+			: nullptr;
+		if(options.tier == CodeTier::baseline)
+		{
+			functionDefCallCounts = emitExternalSymbolAddress(getFunctionDefCallCountsSymbolName(),llvmI8PtrType);
+			moduleCodePointer = emitExternalSymbolAddress(getModuleCodeSymbolName(),llvmI8PtrType);
+			requestTierUpFunction = emitExternalSymbolAddress(
+				getRequestTierUpSymbolName(),
+				llvm::FunctionType::get(llvmVoidType,{llvmI8PtrType,llvmI32Type},false)->getPointerTo());
 		}
+		else { functionDefCallCounts = moduleCodePointer = requestTierUpFunction = nullptr; }
 
-		// Create LLVM pointer constants for the module's imported functions.
-		for(uintp functionIndex = 0;functionIndex < moduleInstance->functions.size() - module.functionDefs.size();++functionIndex)
+		// Create references to the module's imported functions and their contexts.
+		if(!options.isInstanceIndependent)
 		{
-			const FunctionInstance* functionInstance = moduleInstance->functions[functionIndex];
-			importedFunctionPointers.push_back(emitLiteralPointer(functionInstance->nativeFunction,asLLVMType(functionInstance->type)->getPointerTo()));
+			for(uintp functionIndex = 0;functionIndex < importedFunctionTypes.size();++functionIndex)
+			{
+				importedFunctionPointers.push_back(emitExternalSymbolAddress(getImportedFunctionSymbolName(functionIndex),asLLVMContextFunctionType(importedFunctionTypes[functionIndex])->getPointerTo()));
+				importedFunctionContexts.push_back(emitExternalSymbolAddress(getImportedFunctionContextSymbolName(functionIndex),llvmI8PtrType));
+			}
 		}
 
-		// Create LLVM pointer constants for the module's globals.
-		for(auto global : moduleInstance->globals)
-		{ globalPointers.push_back(emitLiteralPointer(&global->value,asLLVMType(global->type.valueType)->getPointerTo())); }
+		// Create references to the module's globals.
+		if(!options.isInstanceIndependent)
+		{
+			for(uintp globalIndex = 0;globalIndex < globalValueTypes.size();++globalIndex)
+			{
+				globalPointers.push_back(emitExternalSymbolAddress(getGlobalSymbolName(globalIndex),asLLVMType(globalValueTypes[globalIndex])->getPointerTo()));
+			}
+		}
 		
 		// Create the LLVM functions.
 		functionDefs.resize(module.functionDefs.size());
@@ -1118,25 +1796,33 @@ namespace LLVMJIT
 		{
 			const Function& function = module.functionDefs[functionDefIndex];
 			const FunctionType* functionType = module.types[function.typeIndex];
-			auto llvmFunctionType = asLLVMType(functionType);
-			auto externalName = getExternalFunctionName(moduleInstance,functionDefIndex);
+			auto llvmFunctionType = asLLVMContextFunctionType(functionType);
+			auto externalName = getExternalFunctionName(functionDefIndex,functionDefNames[functionDefIndex]);
 			functionDefs[functionDefIndex] = llvm::Function::Create(llvmFunctionType,llvm::Function::ExternalLinkage,externalName,llvmModule);
 		}
 
-		// Compile each function in the module.
-		for(uintp functionDefIndex = 0;functionDefIndex < module.functionDefs.size();++functionDefIndex)
-		{ EmitFunctionContext(*this,module,module.functionDefs[functionDefIndex],moduleInstance->functionDefs[functionDefIndex],functionDefs[functionDefIndex]).emit(); }
+		// Compile each function in the module's range of function definitions. The functions outside the range are left as
+		// declarations, and calls to them are resolved when the module's shards are linked together.
+		assert(beginFunctionDefIndex <= endFunctionDefIndex && endFunctionDefIndex <= module.functionDefs.size());
+		for(uintp functionDefIndex = beginFunctionDefIndex;functionDefIndex < endFunctionDefIndex;++functionDefIndex)
+		{ EmitFunctionContext(*this,module,functionDefIndex,functionDefs[functionDefIndex]).emit(); }
 		
 		// Finalize the debug info.
 		diBuilder.finalize();
 
-		Log::logRatePerSecond("Emitted LLVM IR",emitTimer,(float64)llvmModule->size(),"functions");
+		Log::logRatePerSecond("Emitted LLVM IR",emitTimer,(float64)(endFunctionDefIndex - beginFunctionDefIndex),"functions");
 
 		return llvmModule;
 	}
 
-	llvm::Module* emitModule(const Module& module,ModuleInstance* moduleInstance)
+	llvm::Module* emitModule(
+		const Module& module,
+		const std::vector<std::string>& functionDefNames,
+		uintp beginFunctionDefIndex,
+		uintp endFunctionDefIndex,
+		const EmitModuleOptions& options)
 	{
-		return EmitModuleContext(module,moduleInstance).emit();
+		assert(functionDefNames.size() == module.functionDefs.size());
+		return EmitModuleContext(module,functionDefNames,beginFunctionDefIndex,endFunctionDefIndex,options).emit();
 	}
 }
\ No newline at end of file
@@ -1,4 +1,10 @@
 #include "LLVMJIT.h"
+#include "Core/Serialization.h"
+
+#include <atomic>
+#include <deque>
+#include <math.h>
+#include <thread>
 
 // This needs to be 1 to allow debuggers such as Visual Studio to place breakpoints and step through the JITed code.
 #define USE_WRITEABLE_JIT_CODE_PAGES _DEBUG
@@ -9,51 +15,88 @@
 
 namespace LLVMJIT
 {
-	llvm::LLVMContext& context = llvm::getGlobalContext();
-	llvm::TargetMachine* targetMachine = nullptr;
-	llvm::Type* llvmResultTypes[(size_t)ResultType::num];
-	llvm::Type* llvmI8Type;
-	llvm::Type* llvmI16Type;
-	llvm::Type* llvmI32Type;
-	llvm::Type* llvmI64Type;
-	llvm::Type* llvmF32Type;
-	llvm::Type* llvmF64Type;
-	llvm::Type* llvmVoidType;
-	llvm::Type* llvmBoolType;
-	llvm::Type* llvmI8PtrType;
-	llvm::Constant* typedZeroConstants[(size_t)ValueType::num];
+	THREAD_LOCAL llvm::LLVMContext* context = nullptr;
+	THREAD_LOCAL llvm::TargetMachine* targetMachine = nullptr;
+	THREAD_LOCAL llvm::Type* llvmResultTypes[(size_t)ResultType::num];
+	THREAD_LOCAL llvm::Type* llvmI8Type;
+	THREAD_LOCAL llvm::Type* llvmI16Type;
+	THREAD_LOCAL llvm::Type* llvmI32Type;
+	THREAD_LOCAL llvm::Type* llvmI64Type;
+	THREAD_LOCAL llvm::Type* llvmF32Type;
+	THREAD_LOCAL llvm::Type* llvmF64Type;
+	THREAD_LOCAL llvm::Type* llvmVoidType;
+	THREAD_LOCAL llvm::Type* llvmBoolType;
+	THREAD_LOCAL llvm::Type* llvmI8PtrType;
+	THREAD_LOCAL llvm::Constant* typedZeroConstants[(size_t)ValueType::num];
+
+	// The target triple that code is generated for.
+	std::string targetTriple;
 	
-	// A map from address to loaded JIT symbols.
+	// A map from address to loaded JIT symbols. Tiered code adds symbols to it from the tier-up thread, so it's protected by a mutex.
 	std::map<uintp,struct JITSymbol*> addressToSymbolMap;
+	Platform::Mutex addressToSymbolMapMutex;
 
 	// A map from function types to function indices in the invoke thunk unit.
 	std::map<const FunctionType*,struct JITSymbol*> invokeThunkTypeToSymbolMap;
 
+	// A map from intrinsic functions to the thunks that adapt them to the calling convention of JIT compiled functions.
+	std::map<FunctionInstance*,struct JITSymbol*> intrinsicThunkMap;
+
+	// Protects invokeThunkTypeToSymbolMap and intrinsicThunkMap, and serializes compiling thunks so each is only compiled once.
+	Platform::Mutex thunkMutex;
+
+	// A lock-free cache of the invoke thunks in invokeThunkTypeToSymbolMap, so invokeFunction can find the thunk for a
+	// function type without locking thunkMutex. Invoke thunks are never freed, so entries are only ever added: the thunk is
+	// written before the entry's type is published, and a reader that sees the type also sees the thunk. A type that doesn't
+	// fit within invokeThunkCacheMaxProbes of its hash is only found through invokeThunkTypeToSymbolMap.
+	enum { invokeThunkCacheSize = 1024, invokeThunkCacheMaxProbes = 8 };
+	struct InvokeThunkCacheEntry
+	{
+		std::atomic<const FunctionType*> type;
+		std::atomic<InvokeFunctionPointer> thunk;
+	};
+	InvokeThunkCacheEntry invokeThunkCache[invokeThunkCacheSize];
+
+	// A map from keys identifying instance-independent module code to the code, and a mutex that protects it and the
+	// reference counts of the code in it.
+	std::map<std::string,struct ModuleCode*> sharedModuleCodeMap;
+	Platform::Mutex sharedModuleCodeMutex;
+
 	// Information about a JIT symbol, used to map instruction pointers to descriptive names.
 	struct JITSymbol
 	{
 		enum class Type
 		{
-			functionInstance,
-			invokeThunk
+			functionDef,
+			invokeThunk,
+			intrinsicThunk
 		};
 		Type type;
-		union
-		{
-			FunctionInstance* functionInstance;
-			const FunctionType* invokeThunkType;
-		};
+		std::string functionDefName;
+		const FunctionType* thunkType;
 		uintp baseAddress;
 		size_t numBytes;
 		std::map<uint32,uint32> offsetToOpIndexMap;
 		
-		JITSymbol(FunctionInstance* inFunctionInstance,uintp inBaseAddress,size_t inNumBytes,std::map<uint32,uint32>&& inOffsetToOpIndexMap)
-		: type(Type::functionInstance), functionInstance(inFunctionInstance), baseAddress(inBaseAddress), numBytes(inNumBytes), offsetToOpIndexMap(inOffsetToOpIndexMap) {}
+		JITSymbol(const std::string& inFunctionDefName,uintp inBaseAddress,size_t inNumBytes,std::map<uint32,uint32>&& inOffsetToOpIndexMap)
+		: type(Type::functionDef), functionDefName(inFunctionDefName), thunkType(nullptr), baseAddress(inBaseAddress), numBytes(inNumBytes), offsetToOpIndexMap(inOffsetToOpIndexMap) {}
 
-		JITSymbol(const FunctionType* inInvokeThunkType,uintp inBaseAddress,size_t inNumBytes,std::map<uint32,uint32>&& inOffsetToOpIndexMap)
-		: type(Type::invokeThunk), invokeThunkType(inInvokeThunkType), baseAddress(inBaseAddress), numBytes(inNumBytes), offsetToOpIndexMap(inOffsetToOpIndexMap) {}
+		JITSymbol(Type inType,const FunctionType* inThunkType,uintp inBaseAddress,size_t inNumBytes,std::map<uint32,uint32>&& inOffsetToOpIndexMap)
+		: type(inType), thunkType(inThunkType), baseAddress(inBaseAddress), numBytes(inNumBytes), offsetToOpIndexMap(inOffsetToOpIndexMap) {}
 	};
 
+	static void addJITSymbol(JITSymbol* symbol)
+	{
+		Platform::Lock lock(addressToSymbolMapMutex);
+		addressToSymbolMap[symbol->baseAddress + symbol->numBytes] = symbol;
+	}
+
+	static void removeJITSymbol(JITSymbol* symbol)
+	{
+		Platform::Lock lock(addressToSymbolMapMutex);
+		addressToSymbolMap.erase(addressToSymbolMap.find(symbol->baseAddress + symbol->numBytes));
+	}
+
 	// Allocates memory for the LLVM object loader.
 	struct UnitMemoryManager : llvm::RTDyldMemoryManager
 	{
@@ -181,6 +224,60 @@ namespace LLVMJIT
 		void operator=(const UnitMemoryManager&) = delete;
 	};
 
+	// Used to override LLVM's default behavior of looking up unresolved symbols in DLL exports.
+	struct NullResolver : llvm::RuntimeDyld::SymbolResolver
+	{
+		static NullResolver singleton;
+		virtual llvm::RuntimeDyld::SymbolInfo findSymbol(const std::string& name) override;
+		virtual llvm::RuntimeDyld::SymbolInfo findSymbolInLogicalDylib(const std::string& name) override;
+	};
+	
+	// Returns the address of a C library float rounding function. The LLVM X86 code generator lowers the float rounding
+	// intrinsics to calls to them when the target CPU doesn't support SSE4.1's rounding instructions.
+	static uintp getFloatRoundingFunctionAddress(const std::string& name)
+	{
+		// Mach-O symbol names have a leading underscore.
+		#ifdef __APPLE__
+			const std::string functionName = name.size() && name[0] == '_' ? name.substr(1) : name;
+		#else
+			const std::string& functionName = name;
+		#endif
+
+		static const std::map<std::string,uintp> functionAddressMap =
+		{
+			{"ceilf",reinterpret_cast<uintp>(static_cast<float32(*)(float32)>(&ceilf))},
+			{"ceil",reinterpret_cast<uintp>(static_cast<float64(*)(float64)>(&ceil))},
+			{"floorf",reinterpret_cast<uintp>(static_cast<float32(*)(float32)>(&floorf))},
+			{"floor",reinterpret_cast<uintp>(static_cast<float64(*)(float64)>(&floor))},
+			{"truncf",reinterpret_cast<uintp>(static_cast<float32(*)(float32)>(&truncf))},
+			{"trunc",reinterpret_cast<uintp>(static_cast<float64(*)(float64)>(&trunc))},
+			{"nearbyintf",reinterpret_cast<uintp>(static_cast<float32(*)(float32)>(&nearbyintf))},
+			{"nearbyint",reinterpret_cast<uintp>(static_cast<float64(*)(float64)>(&nearbyint))},
+		};
+		auto mapIt = functionAddressMap.find(functionName);
+		return mapIt == functionAddressMap.end() ? 0 : mapIt->second;
+	}
+
+	NullResolver NullResolver::singleton;
+	llvm::RuntimeDyld::SymbolInfo NullResolver::findSymbol(const std::string& name)
+	{
+		// Allow __chkstk through: the LLVM X86 code generator adds calls to it when allocating more than 4KB of stack space.
+		if(name == "__chkstk")
+		{
+			void *addr = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(name);
+			if (addr) { return llvm::RuntimeDyld::SymbolInfo(reinterpret_cast<uintp>(addr),llvm::JITSymbolFlags::None); }
+		}
+
+		// Allow calls to the C library's float rounding functions, which may be generated for WebAssembly's float rounding
+		// operators.
+		const uintp floatRoundingFunctionAddress = getFloatRoundingFunctionAddress(name);
+		if(floatRoundingFunctionAddress) { return llvm::RuntimeDyld::SymbolInfo(floatRoundingFunctionAddress,llvm::JITSymbolFlags::None); }
+
+		Log::printf(Log::Category::error,"LLVM generated code referenced external symbol: %s\n",name.c_str());
+		Core::unreachable();
+	}
+	llvm::RuntimeDyld::SymbolInfo NullResolver::findSymbolInLogicalDylib(const std::string& name) { return llvm::RuntimeDyld::SymbolInfo(nullptr); }
+
 	// A unit of JIT compilation.
 	// Encapsulates the LLVM JIT compilation pipeline but allows subclasses to define how the resulting code is used.
 	struct JITUnit
@@ -192,18 +289,25 @@ namespace LLVMJIT
 		{
 			objectLayer = llvm::make_unique<ObjectLayer>(NotifyLoadedFunctor(this));
 			objectLayer->setProcessAllSections(true);
-			compileLayer = llvm::make_unique<CompileLayer>(*objectLayer,llvm::orc::SimpleCompiler(*targetMachine));
 		}
-		~JITUnit()
+		virtual ~JITUnit()
 		{
-			compileLayer->removeModuleSet(handle);
+			objectLayer->removeObjectSet(handle);
 			#ifdef _WIN32
 				if(registerSEHUnwindInfoResult) { Platform::deregisterSEHUnwindInfo(registerSEHUnwindInfoResult); }
 			#endif
 		}
 
+		// Compiles a LLVM module on the calling thread, and loads and finalizes the resulting object. Deletes the LLVM module.
 		void compile(llvm::Module* llvmModule);
 
+		// Loads an object into memory and notifies the unit of the symbols it defines, but doesn't resolve the object's
+		// relocations. This allows the addresses of the symbols in multiple units to be known before any of them are finalized.
+		void load(llvm::object::OwningBinary<llvm::object::ObjectFile>&& object,llvm::RuntimeDyld::SymbolResolver* resolver);
+
+		// Resolves the relocations of the loaded object, and sets the final access for its memory.
+		void finalize();
+
 		virtual void notifySymbolLoaded(const char* name,uintp baseAddress,size_t numBytes,std::map<uint32,uint32>&& offsetToOpIndexMap) = 0;
 
 	private:
@@ -221,91 +325,422 @@ namespace LLVMJIT
 		};
 
 		typedef llvm::orc::ObjectLinkingLayer<NotifyLoadedFunctor> ObjectLayer;
-		typedef llvm::orc::IRCompileLayer<ObjectLayer> CompileLayer;
 
 		UnitMemoryManager memoryManager;
 		std::unique_ptr<ObjectLayer> objectLayer;
-		std::unique_ptr<CompileLayer> compileLayer;
-		CompileLayer::ModuleSetHandleT handle;
+		ObjectLayer::ObjSetHandleT handle;
 
 		#ifdef _WIN32
 			void* registerSEHUnwindInfoResult;
 		#endif
 	};
 
-	// The JIT compilation unit for a WebAssembly module instance.
-	struct JITModule : JITUnit, JITModuleBase
+	struct ModuleCode;
+
+	// The JIT compilation unit for a shard of a WebAssembly module's function definitions.
+	struct JITModuleShard : JITUnit
+	{
+		ModuleCode* moduleCode;
+
+		JITModuleShard(ModuleCode* inModuleCode): moduleCode(inModuleCode) {}
+
+		void notifySymbolLoaded(const char* name,uintp baseAddress,size_t numBytes,std::map<uint32,uint32>&& offsetToOpIndexMap) override;
+	};
+
+	// The JIT compilation unit for a single function compiled after the rest of the module's code was loaded: either the
+	// optimized tier code of a function in tiered code, or a function in lazily compiled code.
+	struct JITFunctionUnit;
+
+	// The JIT compilation unit for the stubs that compile the functions in lazily compiled code when they're first called.
+	struct JITLazyStubUnit;
+
+	static void requestTierUp(ModuleCode* moduleCode,uint32 functionDefIndex);
+	static void cancelTierUps(ModuleCode* moduleCode);
+	static void* compileLazyFunction(ModuleCode* moduleCode,uint32 functionDefIndex);
+
+	// Returns whether code compiled with some options relies on hardware traps for integer division and unreachable. The
+	// trapping instructions that code relies on are specific to x86-64, so the option is ignored for other targets.
+	static bool shouldUseHardwareTraps(const CompileOptions& compileOptions)
+	{
+		return compileOptions.useHardwareTraps && llvm::Triple(targetTriple).getArch() == llvm::Triple::x86_64;
+	}
+
+	// Returns whether code compiled with some options checks the stack limit in each function's prologue. The code reads the
+	// limit relative to the x86-64 thread pointer, so the option is ignored for other targets, or if the runtime can't
+	// determine the offset of the limit from the thread pointer.
+	static bool shouldCheckStackLimit(const CompileOptions& compileOptions)
 	{
+		intp stackLimitOffset;
+		return compileOptions.checkStackLimit
+			&& llvm::Triple(targetTriple).getArch() == llvm::Triple::x86_64
+			&& getStackLimitOffset(stackLimitOffset);
+	}
+
+	// The code compiled for a WebAssembly module: the JIT compilation units for the shards of its function definitions.
+	// Also resolves the references between the units to the functions they define, and if the code was compiled for a
+	// specific module instance, the references to the instance's objects.
+	struct ModuleCode : llvm::RuntimeDyld::SymbolResolver
+	{
+		// The module instance the code was compiled for, or null if the code is instance-independent.
 		ModuleInstance* moduleInstance;
 
+		std::vector<const FunctionType*> types;
+		std::vector<std::string> functionDefNames;
+
+		std::vector<JITModuleShard*> shards;
 		std::vector<JITSymbol*> functionDefSymbols;
 
-		JITModule(ModuleInstance* inModuleInstance): moduleInstance(inModuleInstance) {}
-		~JITModule() override
+		// The current entry of each function. Tiered and lazily compiled code calls the module's functions through this table.
+		// The tier-up thread replaces a function's entry with its optimized code, and the first call to a lazily compiled
+		// function replaces its entry with the compiled code.
+		std::vector<std::atomic<void*>> functionDefEntries;
+
+		// The tier the code was compiled for, whether its functions are compiled lazily, the optimization level used to compile
+		// the code's untiered or optimized tier functions, if the code is the baseline tier, the number of calls to a
+		// function that triggers optimizing it, how the code bounds checks memory accesses, whether it relies on hardware
+		// traps for integer division and unreachable, and whether it checks the stack limit.
+		CodeTier tier;
+		bool isLazy;
+		uintp optimizationLevel;
+		uint32 tierUpCallCount;
+		MemoryBoundsCheckMode memoryBoundsCheckMode;
+		bool useHardwareTraps;
+		bool checkStackLimit;
+		bool meterFuel;
+		bool pollEpoch;
+
+		// If the code is tiered or lazily compiled, the state used to compile its functions after it's loaded: a copy of the
+		// module, the number of times the baseline code for each function has been called, the stubs that compile each
+		// function on its first call, and the units containing the functions compiled after the code was loaded.
+		// functionUnitsMutex protects the units and symbols that are added after the code was loaded.
+		Module retainedModule;
+		std::vector<uint32> functionDefCallCounts;
+		JITLazyStubUnit* lazyStubUnit;
+		std::vector<void*> lazyStubs;
+		std::vector<JITFunctionUnit*> functionUnits;
+		Platform::Mutex functionUnitsMutex;
+
+		// Serializes compiling lazy functions, so a function that is first called by multiple threads at once is only compiled once.
+		Platform::Mutex lazyCompileMutex;
+
+		// If the code is shared between module instances, its key in sharedModuleCodeMap, and the number of instances using it.
+		std::string sharedKey;
+		uintp numSharedReferences;
+
+		ModuleCode(
+			const Module& module,
+			ModuleInstance* inModuleInstance,
+			std::vector<std::string>&& inFunctionDefNames,
+			CodeTier inTier,
+			const CompileOptions& compileOptions)
+		: moduleInstance(inModuleInstance)
+		, types(module.types)
+		, functionDefNames(std::move(inFunctionDefNames))
+		, functionDefEntries(module.functionDefs.size())
+		, tier(inTier)
+		, isLazy(compileOptions.enableLazyCompilation)
+		, optimizationLevel(compileOptions.optimizationLevel)
+		, tierUpCallCount(uint32(compileOptions.tierUpCallCount))
+		, memoryBoundsCheckMode(compileOptions.memoryBoundsCheckMode)
+		, useHardwareTraps(shouldUseHardwareTraps(compileOptions))
+		, checkStackLimit(shouldCheckStackLimit(compileOptions))
+		, meterFuel(compileOptions.meterFuel)
+		, pollEpoch(compileOptions.pollEpoch)
+		, retainedModule(inTier == CodeTier::untiered && !isLazy ? Module() : module)
+		, functionDefCallCounts(inTier == CodeTier::untiered ? 0 : module.functionDefs.size(),0)
+		, lazyStubUnit(nullptr)
+		, lazyStubs(isLazy ? module.functionDefs.size() : 0,nullptr)
+		, numSharedReferences(0)
+		{
+			assert(functionDefNames.size() == module.functionDefs.size());
+		}
+		~ModuleCode();
+
+		// Creates a symbol for a function definition loaded at an address, for future address->symbol lookups.
+		void addFunctionDefSymbol(uintp functionDefIndex,uintp baseAddress,size_t numBytes,std::map<uint32,uint32>&& offsetToOpIndexMap)
+		{
+			assert(functionDefIndex < functionDefEntries.size());
+			addSymbol(new JITSymbol(functionDefNames[functionDefIndex],baseAddress,numBytes,std::move(offsetToOpIndexMap)));
+		}
+
+		// Records the address of the stub that lazily compiles a function, and initializes the function's entry to the stub.
+		void notifyLazyStubLoaded(const char* name,uintp baseAddress,size_t numBytes)
+		{
+			uintp functionDefIndex;
+			if(!parseIndexedSymbolName(name,"wavmLazyStub",functionDefIndex)) { return; }
+			assert(functionDefIndex < lazyStubs.size());
+			addSymbol(new JITSymbol(functionDefNames[functionDefIndex] + " (lazy compile stub)",baseAddress,numBytes,std::map<uint32,uint32>()));
+			lazyStubs[functionDefIndex] = reinterpret_cast<void*>(baseAddress);
+			functionDefEntries[functionDefIndex] = lazyStubs[functionDefIndex];
+		}
+
+		void notifySymbolLoaded(const char* name,uintp baseAddress,size_t numBytes,std::map<uint32,uint32>&& offsetToOpIndexMap)
 		{
-			// Delete the module's symbols, and remove them from the global address-to-symbol map.
-			for(auto symbol : functionDefSymbols)
+			uintp functionDefIndex;
+			if(getFunctionIndexFromExternalName(name,functionDefIndex))
 			{
-				addressToSymbolMap.erase(addressToSymbolMap.find(symbol->baseAddress + symbol->numBytes));
-				delete symbol;
+				addFunctionDefSymbol(functionDefIndex,baseAddress,numBytes,std::move(offsetToOpIndexMap));
+				functionDefEntries[functionDefIndex] = reinterpret_cast<void*>(baseAddress);
 			}
 		}
 
-		void notifySymbolLoaded(const char* name,uintp baseAddress,size_t numBytes,std::map<uint32,uint32>&& offsetToOpIndexMap) override
+		// Returns the options used to emit the code's functions for a tier.
+		EmitModuleOptions getEmitModuleOptions(CodeTier emitTier) const
 		{
-			// Save the address range this function was loaded at for future address->symbol lookups.
+			EmitModuleOptions options;
+			options.isInstanceIndependent = !moduleInstance;
+			options.callThroughFunctionDefEntries = tier != CodeTier::untiered || isLazy;
+			options.tier = emitTier;
+			options.tierUpCallCount = tierUpCallCount;
+			options.memoryBoundsCheckMode = memoryBoundsCheckMode;
+			options.useHardwareTraps = useHardwareTraps;
+			options.checkStackLimit = checkStackLimit;
+			options.meterFuel = meterFuel;
+			options.pollEpoch = pollEpoch;
+			return options;
+		}
+
+		// Returns the optimization level used to compile the code's functions for a tier. Baseline tier code isn't optimized.
+		uintp getOptimizationLevel(CodeTier emitTier) const { return emitTier == CodeTier::baseline ? 0 : optimizationLevel; }
+
+		// Compiles a single function after the rest of the code was loaded, and returns the unit containing it.
+		JITFunctionUnit* compileFunction(uintp functionDefIndex,CodeTier emitTier);
+
+		// Compiles a function of tiered code with the optimized tier, and replaces the function's entry with the optimized code.
+		void optimizeFunction(uintp functionDefIndex);
+
+		// Compiles a function of lazily compiled code with the code's initial tier, and returns the compiled code.
+		void* compileLazyFunction(uintp functionDefIndex);
+
+		llvm::RuntimeDyld::SymbolInfo findSymbol(const std::string& name) override
+		{
+			// Resolve references to functions defined by another shard of the module to the address the function was loaded at.
 			uintp functionDefIndex;
-			if(getFunctionIndexFromExternalName(name,functionDefIndex))
+			if(getFunctionIndexFromExternalName(name.c_str(),functionDefIndex))
+			{
+				assert(functionDefIndex < functionDefEntries.size());
+				void* entry = functionDefEntries[functionDefIndex];
+				if(entry) { return llvm::RuntimeDyld::SymbolInfo(reinterpret_cast<uintp>(entry),llvm::JITSymbolFlags::None); }
+			}
+
+			uintp address;
+			if(resolveModuleSymbol(name,address)) { return llvm::RuntimeDyld::SymbolInfo(address,llvm::JITSymbolFlags::None); }
+
+			return NullResolver::singleton.findSymbol(name);
+		}
+		llvm::RuntimeDyld::SymbolInfo findSymbolInLogicalDylib(const std::string& name) override { return llvm::RuntimeDyld::SymbolInfo(nullptr); }
+
+	private:
+
+		// Adds a symbol to the code's symbols and the global address-to-symbol map. Symbols may be added concurrently by the
+		// tier-up thread and threads compiling lazy functions after the code is loaded.
+		void addSymbol(JITSymbol* symbol)
+		{
 			{
-				assert(moduleInstance);
-				assert(functionDefIndex < moduleInstance->functionDefs.size());
-				FunctionInstance* functionInstance = moduleInstance->functionDefs[functionDefIndex];
-				auto symbol = new JITSymbol(functionInstance,baseAddress,numBytes,std::move(offsetToOpIndexMap));
+				Platform::Lock lock(functionUnitsMutex);
 				functionDefSymbols.push_back(symbol);
-				addressToSymbolMap[baseAddress + numBytes] = symbol;
-				functionInstance->nativeFunction = reinterpret_cast<void*>(baseAddress);
 			}
+			addJITSymbol(symbol);
+		}
+
+		// Parses a symbol name of the form <prefix><index>.
+		static bool parseIndexedSymbolName(const std::string& name,const char* prefix,uintp& outIndex)
+		{
+			const size_t prefixLength = strlen(prefix);
+			if(name.compare(0,prefixLength,prefix)) { return false; }
+			char* numberEnd = nullptr;
+			outIndex = std::strtoull(name.c_str() + prefixLength,&numberEnd,10);
+			return numberEnd != name.c_str() + prefixLength && !*numberEnd;
+		}
+
+		// Resolves the symbols used by the module's code to reference intrinsics, the signature indices of its function types,
+		// and the stack limit, and if the code was compiled for a specific instance, the objects the instance was instantiated with.
+		bool resolveModuleSymbol(const std::string& name,uintp& outAddress)
+		{
+			uintp index;
+			if(parseIndexedSymbolName(name,"wavmSignatureIndex",index))
+			{
+				assert(index < types.size());
+				outAddress = getSignatureIndex(types[index]);
+				return true;
+			}
+			else if(!name.compare(0,14,"wavmIntrinsic:"))
+			{
+				Object* intrinsicObject = Intrinsics::findFunctionByDecoratedName(name.substr(14));
+				if(!intrinsicObject) { return false; }
+				outAddress = reinterpret_cast<uintp>(asFunction(intrinsicObject)->nativeFunction);
+				return true;
+			}
+			else if((tier != CodeTier::untiered || isLazy) && name == getFunctionDefEntriesSymbolName())
+			{
+				outAddress = reinterpret_cast<uintp>(functionDefEntries.data());
+				return true;
+			}
+			else if(tier != CodeTier::untiered && name == getFunctionDefCallCountsSymbolName())
+			{
+				outAddress = reinterpret_cast<uintp>(functionDefCallCounts.data());
+				return true;
+			}
+			else if((tier != CodeTier::untiered || isLazy) && name == getModuleCodeSymbolName())
+			{
+				outAddress = reinterpret_cast<uintp>(this);
+				return true;
+			}
+			else if(tier != CodeTier::untiered && name == getRequestTierUpSymbolName())
+			{
+				outAddress = reinterpret_cast<uintp>(&requestTierUp);
+				return true;
+			}
+			else if(isLazy && name == getCompileLazyFunctionSymbolName())
+			{
+				outAddress = reinterpret_cast<uintp>(&LLVMJIT::compileLazyFunction);
+				return true;
+			}
+			else if(checkStackLimit && name == getStackLimitOffsetSymbolName())
+			{
+				intp stackLimitOffset;
+				errorUnless(getStackLimitOffset(stackLimitOffset));
+				outAddress = uintp(stackLimitOffset);
+				return true;
+			}
+			else if(pollEpoch && name == getEpochInterruptPendingSymbolName())
+			{
+				outAddress = reinterpret_cast<uintp>(getEpochInterruptPendingAddress());
+				return true;
+			}
+			else if(!moduleInstance) { return false; }
+
+			const InstanceContext& instanceContext = moduleInstance->context;
+			if(parseIndexedSymbolName(name,"wavmImportedFuncContext",index))
+			{
+				assert(index < moduleInstance->contextImportedFunctions.size());
+				outAddress = reinterpret_cast<uintp>(instanceContext.importedFunctions[index].context);
+			}
+			else if(parseIndexedSymbolName(name,"wavmImportedFunc",index))
+			{
+				assert(index < moduleInstance->contextImportedFunctions.size());
+				outAddress = reinterpret_cast<uintp>(instanceContext.importedFunctions[index].nativeFunction);
+			}
+			else if(parseIndexedSymbolName(name,"wavmGlobal",index))
+			{
+				assert(index < moduleInstance->contextGlobalValues.size());
+				outAddress = reinterpret_cast<uintp>(instanceContext.globalValues[index]);
+			}
+			else if(moduleInstance->defaultMemory && name == getDefaultMemoryBaseSymbolName())
+			{ outAddress = reinterpret_cast<uintp>(instanceContext.defaultMemoryBase); }
+			else if(moduleInstance->defaultMemory && name == getDefaultMemoryAddressMaskSymbolName())
+			{ outAddress = instanceContext.defaultMemoryAddressMask; }
+			else if(moduleInstance->defaultMemory && name == getDefaultMemoryNumPagesSymbolName())
+			{ outAddress = reinterpret_cast<uintp>(instanceContext.defaultMemoryNumPages); }
+			else if(moduleInstance->defaultMemory && name == getDefaultMemoryObjectSymbolName())
+			{ outAddress = reinterpret_cast<uintp>(instanceContext.defaultMemory); }
+			else if(moduleInstance->defaultTable && name == getDefaultTableBaseSymbolName())
+			{ outAddress = reinterpret_cast<uintp>(instanceContext.defaultTableBase); }
+			else if(moduleInstance->defaultTable && name == getDefaultTableEndIndexSymbolName())
+			{ outAddress = instanceContext.defaultTableEndIndex; }
+			else if(moduleInstance->defaultTable && name == getDefaultTableObjectSymbolName())
+			{ outAddress = reinterpret_cast<uintp>(instanceContext.defaultTable); }
+			else { return false; }
+			return true;
 		}
 	};
 
-	// The JIT compilation unit for a single invoke thunk.
-	struct JITInvokeThunkUnit : JITUnit
+	void JITModuleShard::notifySymbolLoaded(const char* name,uintp baseAddress,size_t numBytes,std::map<uint32,uint32>&& offsetToOpIndexMap)
 	{
-		const FunctionType* functionType;
+		moduleCode->notifySymbolLoaded(name,baseAddress,numBytes,std::move(offsetToOpIndexMap));
+	}
 
-		JITSymbol* symbol;
+	struct JITFunctionUnit : JITUnit
+	{
+		ModuleCode* moduleCode;
+		uintp functionDefIndex;
+		void* entry;
 
-		JITInvokeThunkUnit(const FunctionType* inFunctionType): functionType(inFunctionType), symbol(nullptr) {}
+		JITFunctionUnit(ModuleCode* inModuleCode,uintp inFunctionDefIndex)
+		: moduleCode(inModuleCode), functionDefIndex(inFunctionDefIndex), entry(nullptr) {}
 
 		void notifySymbolLoaded(const char* name,uintp baseAddress,size_t numBytes,std::map<uint32,uint32>&& offsetToOpIndexMap) override
 		{
-			assert(!strcmp(name,"invokeThunk"));
-			symbol = new JITSymbol(functionType,baseAddress,numBytes,std::move(offsetToOpIndexMap));
+			// The unit declares the module's other functions, but only defines the function it was compiled for.
+			uintp loadedFunctionDefIndex;
+			if(getFunctionIndexFromExternalName(name,loadedFunctionDefIndex) && loadedFunctionDefIndex == functionDefIndex)
+			{
+				moduleCode->addFunctionDefSymbol(functionDefIndex,baseAddress,numBytes,std::move(offsetToOpIndexMap));
+				entry = reinterpret_cast<void*>(baseAddress);
+			}
 		}
 	};
-	
-	// Used to override LLVM's default behavior of looking up unresolved symbols in DLL exports.
-	struct NullResolver : llvm::RuntimeDyld::SymbolResolver
+
+	struct JITLazyStubUnit : JITUnit
 	{
-		static NullResolver singleton;
-		virtual llvm::RuntimeDyld::SymbolInfo findSymbol(const std::string& name) override;
-		virtual llvm::RuntimeDyld::SymbolInfo findSymbolInLogicalDylib(const std::string& name) override;
+		ModuleCode* moduleCode;
+
+		JITLazyStubUnit(ModuleCode* inModuleCode): moduleCode(inModuleCode) {}
+
+		void notifySymbolLoaded(const char* name,uintp baseAddress,size_t numBytes,std::map<uint32,uint32>&& offsetToOpIndexMap) override
+		{
+			moduleCode->notifyLazyStubLoaded(name,baseAddress,numBytes);
+		}
 	};
-	
-	NullResolver NullResolver::singleton;
-	llvm::RuntimeDyld::SymbolInfo NullResolver::findSymbol(const std::string& name)
+
+	ModuleCode::~ModuleCode()
 	{
-		// Allow __chkstk through: the LLVM X86 code generator adds calls to it when allocating more than 4KB of stack space.
-		if(name == "__chkstk")
+		// Make sure the tier-up thread isn't using the code.
+		if(tier != CodeTier::untiered) { cancelTierUps(this); }
+
+		// Delete the module's symbols, and remove them from the global address-to-symbol map.
+		for(auto symbol : functionDefSymbols)
 		{
-			void *addr = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(name);
-			if (addr) { return llvm::RuntimeDyld::SymbolInfo(reinterpret_cast<uintp>(addr),llvm::JITSymbolFlags::None); }
+			removeJITSymbol(symbol);
+			delete symbol;
 		}
 
-		Log::printf(Log::Category::error,"LLVM generated code referenced external symbol: %s\n",name.c_str());
-		Core::unreachable();
+		// Delete the module's compilation units.
+		for(auto shard : shards) { delete shard; }
+		for(auto unit : functionUnits) { delete unit; }
+		if(lazyStubUnit) { delete lazyStubUnit; }
 	}
-	llvm::RuntimeDyld::SymbolInfo NullResolver::findSymbolInLogicalDylib(const std::string& name) { return llvm::RuntimeDyld::SymbolInfo(nullptr); }
+
+	// The JIT state for a WebAssembly module instance: a reference to the code compiled for it, which may be shared with
+	// other instances of the same module.
+	struct JITModule : JITModuleBase
+	{
+		ModuleCode* moduleCode;
+
+		JITModule(ModuleCode* inModuleCode): moduleCode(inModuleCode) {}
+		~JITModule() override
+		{
+			if(!moduleCode->sharedKey.size()) { delete moduleCode; }
+			else
+			{
+				// Delete shared code once the last instance using it is deleted.
+				Platform::Lock sharedModuleCodeLock(sharedModuleCodeMutex);
+				if(!--moduleCode->numSharedReferences)
+				{
+					sharedModuleCodeMap.erase(moduleCode->sharedKey);
+					sharedModuleCodeLock.Release();
+					delete moduleCode;
+				}
+			}
+		}
+	};
+
+	// The JIT compilation unit for a single thunk.
+	struct JITThunkUnit : JITUnit
+	{
+		JITSymbol::Type type;
+		const FunctionType* functionType;
+
+		JITSymbol* symbol;
+
+		JITThunkUnit(JITSymbol::Type inType,const FunctionType* inFunctionType): type(inType), functionType(inFunctionType), symbol(nullptr) {}
+
+		void notifySymbolLoaded(const char* name,uintp baseAddress,size_t numBytes,std::map<uint32,uint32>&& offsetToOpIndexMap) override
+		{
+			assert(!strcmp(name,"thunk"));
+			symbol = new JITSymbol(type,functionType,baseAddress,numBytes,std::move(offsetToOpIndexMap));
+		}
+	};
 
 	void JITUnit::NotifyLoadedFunctor::operator()(
 		const llvm::orc::ObjectLinkingLayerBase::ObjSetHandleT& objectSetHandle,
@@ -321,7 +756,7 @@ namespace LLVMJIT
 
 			#ifdef _WIN32
 				// On Windows, look for .pdata and .xdata sections containing information about how to unwind the stack.
-				// This needs to be done before the below emitAndFinalize call, which will incorrectly apply relocations to the unwind info.
+				// This needs to be done before the object is finalized, which will incorrectly apply relocations to the unwind info.
 				
 				// Find the text, pdata, and xdata sections.
 				llvm::object::SectionRef textSection;
@@ -351,9 +786,6 @@ namespace LLVMJIT
 				}
 			#endif
 
-			// Relocate and finalize the memory of the object.
-			jitUnit->compileLayer->emitAndFinalize(objectSetHandle);
-
 			// Create a DWARF context to interpret the debug information in this compilation unit.
 			auto dwarfContext = llvm::make_unique<llvm::DWARFContextInMemory>(*object,loadedObject.get());
 
@@ -387,7 +819,7 @@ namespace LLVMJIT
 		}
 	}
 
-	static uintp printedModuleId = 0;
+	static std::atomic<uintp> printedModuleId(0);
 
 	void printModule(const llvm::Module* llvmModule,const char* filename)
 	{
@@ -398,7 +830,22 @@ namespace LLVMJIT
 		Log::printf(Log::Category::debug,"Dumped LLVM module to: %s\n",augmentedFilename.c_str());
 	}
 
-	void JITUnit::compile(llvm::Module* llvmModule)
+	// Returns the level of optimization the target machine uses to generate code for an optimization level.
+	static llvm::CodeGenOpt::Level getCodeGenOptLevel(uintp optimizationLevel)
+	{
+		switch(optimizationLevel)
+		{
+		case 0: return llvm::CodeGenOpt::None;
+		case 1: case 2: return llvm::CodeGenOpt::Default;
+		case 3: return llvm::CodeGenOpt::Aggressive;
+		default: Core::unreachable();
+		}
+	}
+
+	// Optimizes a LLVM module and generates machine code for it using the calling thread's LLVM context and target machine.
+	// See CompileOptions::optimizationLevel for the meaning of optimizationLevel. Deletes the LLVM module, and returns the
+	// resulting relocatable object.
+	static llvm::object::OwningBinary<llvm::object::ObjectFile> compileModule(llvm::Module* llvmModule,uintp optimizationLevel)
 	{
 		// Get a target machine object for this host, and set the module to use its data layout.
 		llvmModule->setDataLayout(targetMachine->createDataLayout());
@@ -417,51 +864,847 @@ namespace LLVMJIT
 		// Run some optimization on the module's functions.
 		Core::Timer optimizationTimer;
 
-		auto fpm = new llvm::legacy::FunctionPassManager(llvmModule);
-		fpm->add(llvm::createPromoteMemoryToRegisterPass());
-		fpm->add(llvm::createInstructionCombiningPass());
-		fpm->add(llvm::createCFGSimplificationPass());
-		fpm->add(llvm::createJumpThreadingPass());
-		fpm->add(llvm::createConstantPropagationPass());
-		fpm->doInitialization();
-		for(auto functionIt = llvmModule->begin();functionIt != llvmModule->end();++functionIt)
-		{ fpm->run(*functionIt); }
-		delete fpm;
+		// The IR emitter generates the locals as SSA values, so level 0 doesn't need to run any passes on the IR.
+		if(optimizationLevel == 1)
+		{
+			auto fpm = new llvm::legacy::FunctionPassManager(llvmModule);
+			fpm->add(llvm::createInstructionCombiningPass());
+			fpm->add(llvm::createCFGSimplificationPass());
+			fpm->add(llvm::createJumpThreadingPass());
+			fpm->add(llvm::createConstantPropagationPass());
+			fpm->doInitialization();
+			for(auto functionIt = llvmModule->begin();functionIt != llvmModule->end();++functionIt)
+			{ fpm->run(*functionIt); }
+			delete fpm;
+		}
+		else if(optimizationLevel >= 2)
+		{
+			// Use LLVM's standard function and module pass pipelines, with the inliner and vectorizers enabled.
+			llvm::PassManagerBuilder passManagerBuilder;
+			passManagerBuilder.OptLevel = unsigned(optimizationLevel);
+			passManagerBuilder.SizeLevel = 0;
+			passManagerBuilder.Inliner = llvm::createFunctionInliningPass(passManagerBuilder.OptLevel,passManagerBuilder.SizeLevel);
+			passManagerBuilder.LoopVectorize = true;
+			passManagerBuilder.SLPVectorize = true;
+
+			// Give the passes the target's cost model, so the vectorizers know which vector types and operations are legal.
+			auto fpm = new llvm::legacy::FunctionPassManager(llvmModule);
+			fpm->add(llvm::createTargetTransformInfoWrapperPass(targetMachine->getTargetIRAnalysis()));
+			passManagerBuilder.populateFunctionPassManager(*fpm);
+			fpm->doInitialization();
+			for(auto functionIt = llvmModule->begin();functionIt != llvmModule->end();++functionIt)
+			{ fpm->run(*functionIt); }
+			fpm->doFinalization();
+			delete fpm;
+
+			auto mpm = new llvm::legacy::PassManager();
+			mpm->add(llvm::createTargetTransformInfoWrapperPass(targetMachine->getTargetIRAnalysis()));
+			passManagerBuilder.populateModulePassManager(*mpm);
+			mpm->run(*llvmModule);
+			delete mpm;
+		}
 		
 		Log::logRatePerSecond("Optimized LLVM module",optimizationTimer,(float64)llvmModule->size(),"functions");
 
 		if(DUMP_OPTIMIZED_MODULE) { printModule(llvmModule,"llvmOptimizedDump"); }
 
-		// Pass the module to the JIT compiler.
+		// Generate machine code for the module.
 		Core::Timer machineCodeTimer;
-		handle = compileLayer->addModuleSet(
-			std::vector<llvm::Module*>{llvmModule},
-			&memoryManager,
-			&NullResolver::singleton);
-
+		targetMachine->setOptLevel(getCodeGenOptLevel(optimizationLevel));
+		auto object = llvm::orc::SimpleCompiler(*targetMachine)(*llvmModule);
 		Log::logRatePerSecond("Generated machine code",machineCodeTimer,(float64)llvmModule->size(),"functions");
 		
 		delete llvmModule;
+		return object;
+	}
+
+	void JITUnit::compile(llvm::Module* llvmModule)
+	{
+		load(compileModule(llvmModule,getCompileOptions().optimizationLevel),&NullResolver::singleton);
+		finalize();
+	}
+
+	void JITUnit::load(llvm::object::OwningBinary<llvm::object::ObjectFile>&& object,llvm::RuntimeDyld::SymbolResolver* resolver)
+	{
+		// Separate the object from the memory buffer backing it, which is handed to the object layer to keep alive as long as the object.
+		auto objectAndBuffer = object.takeBinary();
+		std::vector<std::unique_ptr<llvm::object::ObjectFile>> objectSet;
+		std::vector<std::unique_ptr<llvm::MemoryBuffer>> bufferSet;
+		objectSet.push_back(std::move(objectAndBuffer.first));
+		bufferSet.push_back(std::move(objectAndBuffer.second));
+
+		// Load the object. This calls NotifyLoadedFunctor, which notifies this unit of the symbols in the object.
+		handle = objectLayer->addObjectSet(std::move(objectSet),&memoryManager,resolver);
+		objectLayer->takeOwnershipOfBuffers(handle,std::move(bufferSet));
+	}
+
+	void JITUnit::finalize()
+	{
+		// Relocate and finalize the memory of the object.
+		objectLayer->emitAndFinalize(handle);
+	}
+
+	// Initializes the calling thread's LLVM context, target machine, and the types and constants derived from the context.
+	static void initThreadLLVMContext(llvm::LLVMContext& threadContext)
+	{
+		context = &threadContext;
+		targetMachine = llvm::EngineBuilder().selectTarget(llvm::Triple(targetTriple),"","",llvm::SmallVector<std::string,0>());
+
+		llvmI8Type = llvm::Type::getInt8Ty(*context);
+		llvmI16Type = llvm::Type::getInt16Ty(*context);
+		llvmI32Type = llvm::Type::getInt32Ty(*context);
+		llvmI64Type = llvm::Type::getInt64Ty(*context);
+		llvmF32Type = llvm::Type::getFloatTy(*context);
+		llvmF64Type = llvm::Type::getDoubleTy(*context);
+		llvmVoidType = llvm::Type::getVoidTy(*context);
+		llvmBoolType = llvm::Type::getInt1Ty(*context);
+		llvmI8PtrType = llvmI8Type->getPointerTo();
+
+		llvmResultTypes[(size_t)ResultType::none] = llvm::Type::getVoidTy(*context);
+		llvmResultTypes[(size_t)ResultType::i32] = llvmI32Type;
+		llvmResultTypes[(size_t)ResultType::i64] = llvmI64Type;
+		llvmResultTypes[(size_t)ResultType::f32] = llvmF32Type;
+		llvmResultTypes[(size_t)ResultType::f64] = llvmF64Type;
+
+		// Create zero constants of each type.
+		typedZeroConstants[(size_t)ValueType::invalid] = nullptr;
+		typedZeroConstants[(size_t)ValueType::i32] = emitLiteral((uint32)0);
+		typedZeroConstants[(size_t)ValueType::i64] = emitLiteral((uint64)0);
+		typedZeroConstants[(size_t)ValueType::f32] = emitLiteral((float32)0.0f);
+		typedZeroConstants[(size_t)ValueType::f64] = emitLiteral((float64)0.0);
 	}
 
-	void instantiateModule(const WebAssembly::Module& module,ModuleInstance* moduleInstance)
+	// Gives the calling thread a temporary LLVM context if it doesn't already have one.
+	struct ScopedThreadLLVMContext
 	{
-		// Emit LLVM IR for the module.
-		auto llvmModule = emitModule(module,moduleInstance);
+		ScopedThreadLLVMContext(): ownedContext(nullptr)
+		{
+			if(!context)
+			{
+				ownedContext = new llvm::LLVMContext();
+				initThreadLLVMContext(*ownedContext);
+			}
+		}
+		~ScopedThreadLLVMContext()
+		{
+			if(ownedContext)
+			{
+				delete targetMachine;
+				targetMachine = nullptr;
+				context = nullptr;
+				delete ownedContext;
+			}
+		}
 
-		// Construct the JIT compilation pipeline for this module.
-		auto jitModule = new JITModule(moduleInstance);
-		moduleInstance->jitModule = jitModule;
+	private:
+		llvm::LLVMContext* ownedContext;
+	};
+
+	// Partitions a module's function definitions into at most maxShards contiguous ranges with roughly equal amounts of code.
+	// Returns the boundaries of the ranges: shard i contains the function definitions in [result[i],result[i+1]).
+	static std::vector<uintp> partitionFunctionDefs(const Module& module,uintp maxShards)
+	{
+		uintp totalCodeBytes = 0;
+		for(auto& function : module.functionDefs) { totalCodeBytes += function.code.numBytes; }
 
-		// Compile the module.
-		jitModule->compile(llvmModule);
+		std::vector<uintp> shardBoundaries;
+		shardBoundaries.push_back(0);
+		uintp shardCodeBytes = 0;
+		for(uintp functionDefIndex = 0;functionDefIndex + 1 < module.functionDefs.size();++functionDefIndex)
+		{
+			// Start a new shard once the current shard has its share of the module's code.
+			shardCodeBytes += module.functionDefs[functionDefIndex].code.numBytes;
+			if(shardBoundaries.size() < maxShards && shardCodeBytes * maxShards >= totalCodeBytes)
+			{
+				shardBoundaries.push_back(functionDefIndex + 1);
+				shardCodeBytes = 0;
+			}
+		}
+		shardBoundaries.push_back(module.functionDefs.size());
+		return shardBoundaries;
 	}
 
-	std::string getExternalFunctionName(ModuleInstance* moduleInstance,uintp functionDefIndex)
+	// Identifies the version of the code generated by the runtime in object cache keys. This must be changed whenever a change
+	// to the runtime changes the code generated for a module, so objects cached by older versions of the runtime aren't used.
+	static const char* objectCacheVersion = "WAVM object cache v14";
+
+	// Returns a string describing everything other than the module that affects the code generated for it.
+	static std::string getCodeGenerationConfig(bool isInstanceIndependent,const CompileOptions& compileOptions)
 	{
-		assert(functionDefIndex < moduleInstance->functionDefs.size());
-		return "wasmFunc" + std::to_string(functionDefIndex)
-			+ "_" + moduleInstance->functionDefs[functionDefIndex]->debugName;
+		return std::string(objectCacheVersion)
+			+ ";LLVM " + LLVM_VERSION_STRING
+			+ ";" + targetTriple
+			+ (isInstanceIndependent ? ";instance-independent" : "")
+			+ (compileOptions.enableTieredCompilation ? ";tiered " + std::to_string(compileOptions.tierUpCallCount) : "")
+			+ (compileOptions.enableLazyCompilation ? ";lazy" : "")
+			+ ";O" + std::to_string(compileOptions.optimizationLevel)
+			+ ";bounds-checks " + std::to_string(uintp(compileOptions.memoryBoundsCheckMode))
+			+ (shouldUseHardwareTraps(compileOptions) ? ";hardware-traps" : "")
+			+ (shouldCheckStackLimit(compileOptions) ? ";stack-limit" : "")
+			+ (compileOptions.meterFuel ? ";fuel" : "")
+			+ (compileOptions.pollEpoch ? ";epoch" : "");
+	}
+
+	// Returns the tier that a module's code is initially compiled for.
+	static CodeTier getInitialCodeTier(const CompileOptions& compileOptions)
+	{
+		return compileOptions.enableTieredCompilation ? CodeTier::baseline : CodeTier::untiered;
+	}
+
+	// Computes a key that identifies the code generated for a module with a configuration.
+	static std::string getModuleCodeKey(const std::vector<uint8>& moduleBytes,const std::string& configString)
+	{
+		llvm::MD5 md5;
+		md5.update(llvm::ArrayRef<uint8>(moduleBytes));
+		md5.update(configString);
+		llvm::MD5::MD5Result md5Result;
+		md5.final(md5Result);
+
+		llvm::SmallString<32> keyString;
+		llvm::MD5::stringifyResult(md5Result,keyString);
+		return keyString.str();
+	}
+
+	// Emits a LLVM module containing a stub for each of a module's function definitions. If the function's entry still points
+	// to the stub, the stub calls compileLazyFunction to compile the function. It then tail calls the function's entry with
+	// the arguments it was called with.
+	static llvm::Module* emitLazyStubs(const Module& module)
+	{
+		auto llvmModule = new llvm::Module("",*context);
+		auto emitExternalSymbolAddress = [&](const char* name,llvm::Type* type) -> llvm::Constant*
+		{
+			auto global = new llvm::GlobalVariable(*llvmModule,llvmI8Type,false,llvm::GlobalVariable::ExternalLinkage,nullptr,name);
+			return llvm::ConstantExpr::getPointerCast(global,type);
+		};
+		auto functionDefEntries = emitExternalSymbolAddress(getFunctionDefEntriesSymbolName(),llvmI8PtrType);
+		auto moduleCodePointer = emitExternalSymbolAddress(getModuleCodeSymbolName(),llvmI8PtrType);
+		auto compileLazyFunctionPointer = emitExternalSymbolAddress(
+			getCompileLazyFunctionSymbolName(),
+			llvm::FunctionType::get(llvmI8PtrType,{llvmI8PtrType,llvmI32Type},false)->getPointerTo());
+
+		for(uintp functionDefIndex = 0;functionDefIndex < module.functionDefs.size();++functionDefIndex)
+		{
+			const FunctionType* functionType = module.types[module.functionDefs[functionDefIndex].typeIndex];
+			auto llvmFunctionType = asLLVMContextFunctionType(functionType);
+			auto llvmFunction = llvm::Function::Create(
+				llvmFunctionType,
+				llvm::Function::ExternalLinkage,
+				"wavmLazyStub" + std::to_string(functionDefIndex),
+				llvmModule);
+			auto entryBlock = llvm::BasicBlock::Create(*context,"entry",llvmFunction);
+			auto compileBlock = llvm::BasicBlock::Create(*context,"compile",llvmFunction);
+			auto callBlock = llvm::BasicBlock::Create(*context,"call",llvmFunction);
+			llvm::IRBuilder<> irBuilder(entryBlock);
+
+			// Load the function's entry, and check whether it still points to this stub.
+			auto entryPointer = irBuilder.CreatePointerCast(
+				irBuilder.CreateInBoundsGEP(functionDefEntries,{emitLiteral(uint64(functionDefIndex * sizeof(void*)))}),
+				llvmI8PtrType->getPointerTo());
+			auto entry = irBuilder.CreateLoad(entryPointer);
+			irBuilder.CreateCondBr(irBuilder.CreateICmpEQ(entry,irBuilder.CreatePointerCast(llvmFunction,llvmI8PtrType)),compileBlock,callBlock);
+
+			irBuilder.SetInsertPoint(compileBlock);
+			auto compiledEntry = irBuilder.CreateCall(compileLazyFunctionPointer,{moduleCodePointer,emitLiteral(uint32(functionDefIndex))});
+			irBuilder.CreateBr(callBlock);
+
+			// Tail call the function's entry with the same arguments.
+			irBuilder.SetInsertPoint(callBlock);
+			auto calleePHI = irBuilder.CreatePHI(llvmI8PtrType,2);
+			calleePHI->addIncoming(entry,entryBlock);
+			calleePHI->addIncoming(compiledEntry,compileBlock);
+			std::vector<llvm::Value*> args;
+			for(auto argIt = llvmFunction->arg_begin();argIt != llvmFunction->arg_end();++argIt) { args.push_back(&*argIt); }
+			auto call = irBuilder.CreateCall(irBuilder.CreatePointerCast(calleePHI,llvmFunctionType->getPointerTo()),args);
+			call->setTailCall();
+			if(functionType->ret == ResultType::none) { irBuilder.CreateRetVoid(); }
+			else { irBuilder.CreateRet(call); }
+		}
+
+		return llvmModule;
+	}
+
+	static std::string getObjectCachePath(const std::string& objectCacheDirectory,const std::string& key)
+	{
+		llvm::SmallString<128> path(objectCacheDirectory);
+		llvm::sys::path::append(path,key + ".o");
+		return path.str();
+	}
+
+	// Parses an object file in a memory buffer, and gives the resulting object ownership of the buffer.
+	static bool parseObject(std::unique_ptr<llvm::MemoryBuffer>&& buffer,llvm::object::OwningBinary<llvm::object::ObjectFile>& outObject)
+	{
+		auto objectOrError = llvm::object::ObjectFile::createObjectFile(buffer->getMemBufferRef());
+		if(!objectOrError) { return false; }
+
+		outObject = llvm::object::OwningBinary<llvm::object::ObjectFile>(std::move(*objectOrError),std::move(buffer));
+		return true;
+	}
+
+	// Tries to load an object from the object cache.
+	static bool loadCachedObject(const std::string& objectCacheDirectory,const std::string& key,llvm::object::OwningBinary<llvm::object::ObjectFile>& outObject)
+	{
+		const std::string path = getObjectCachePath(objectCacheDirectory,key);
+		auto bufferOrError = llvm::MemoryBuffer::getFile(path);
+		if(!bufferOrError) { return false; }
+
+		if(!parseObject(std::move(*bufferOrError),outObject))
+		{
+			Log::printf(Log::Category::error,"Ignoring invalid cached object: %s\n",path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// Writes an object to the object cache. Failing to write the object isn't fatal: it will just be compiled again next time.
+	static void storeCachedObject(const std::string& objectCacheDirectory,const std::string& key,const llvm::object::OwningBinary<llvm::object::ObjectFile>& object)
+	{
+		const std::string path = getObjectCachePath(objectCacheDirectory,key);
+		if(llvm::sys::fs::create_directories(objectCacheDirectory))
+		{
+			Log::printf(Log::Category::error,"Couldn't create object cache directory: %s\n",objectCacheDirectory.c_str());
+			return;
+		}
+
+		// Write the object to a temporary file, then rename it to the cache path. This ensures that other processes sharing
+		// the cache never see a partially written object.
+		int fileDescriptor;
+		llvm::SmallString<128> tempPath;
+		if(llvm::sys::fs::createUniqueFile(path + "-%%%%%%.tmp",fileDescriptor,tempPath))
+		{
+			Log::printf(Log::Category::error,"Couldn't create temporary file for cached object: %s\n",path.c_str());
+			return;
+		}
+		llvm::raw_fd_ostream tempStream(fileDescriptor,true);
+		tempStream << object.getBinary()->getData();
+		tempStream.close();
+		if(tempStream.has_error() || llvm::sys::fs::rename(tempPath,path))
+		{
+			tempStream.clear_error();
+			llvm::sys::fs::remove(tempPath);
+			Log::printf(Log::Category::error,"Couldn't write cached object: %s\n",path.c_str());
+		}
+	}
+
+	// Compiles a module's code. If moduleInstance is non-null, the code is compiled for and linked to that module instance.
+	// Otherwise, the code is instance-independent, and may be shared by any instance of the module.
+	static ModuleCode* compileModuleCode(
+		const Module& module,
+		std::vector<std::string>&& functionDefNames,
+		ModuleInstance* moduleInstance,
+		const std::vector<uint8>& moduleBytes,
+		const CompileOptions& compileOptions)
+	{
+		const bool isInstanceIndependent = !moduleInstance;
+		const CodeTier tier = getInitialCodeTier(compileOptions);
+		auto moduleCode = new ModuleCode(module,moduleInstance,std::move(functionDefNames),tier,compileOptions);
+		if(tier != CodeTier::untiered) { startTierUpThread(); }
+
+		// If the code is lazily compiled, just compile the stubs that compile each function when it's first called.
+		if(moduleCode->isLazy)
+		{
+			ScopedThreadLLVMContext scopedThreadContext;
+			moduleCode->lazyStubUnit = new JITLazyStubUnit(moduleCode);
+			moduleCode->lazyStubUnit->load(compileModule(emitLazyStubs(module),compileOptions.optimizationLevel),moduleCode);
+			moduleCode->lazyStubUnit->finalize();
+			return moduleCode;
+		}
+
+		const bool useObjectCache = compileOptions.objectCacheDirectory.size() > 0;
+		const std::string codeGenerationConfig = getCodeGenerationConfig(isInstanceIndependent,compileOptions);
+
+		// Partition the module's function definitions into a shard for each compile thread.
+		uintp numCompileThreads = compileOptions.numCompileThreads;
+		if(!numCompileThreads) { numCompileThreads = std::max(std::thread::hardware_concurrency(),1u); }
+		const std::vector<uintp> shardBoundaries = partitionFunctionDefs(module,numCompileThreads);
+		const uintp numShards = shardBoundaries.size() - 1;
+
+		// Emit LLVM IR for each shard and compile it to an object, or load the object from the cache. The first shard is
+		// compiled on this thread, and the others on worker threads. Each thread uses its own LLVM context, so the shards are
+		// compiled in parallel.
+		Core::Timer compileTimer;
+		std::vector<llvm::object::OwningBinary<llvm::object::ObjectFile>> shardObjects(numShards);
+		std::atomic<uintp> numCachedShards(0);
+		auto compileShard = [&](uintp shardIndex)
+		{
+			std::string objectCacheKey;
+			if(useObjectCache)
+			{
+				objectCacheKey = getModuleCodeKey(moduleBytes,codeGenerationConfig
+					+ ";functions " + std::to_string(shardBoundaries[shardIndex]) + "-" + std::to_string(shardBoundaries[shardIndex + 1]));
+				if(loadCachedObject(compileOptions.objectCacheDirectory,objectCacheKey,shardObjects[shardIndex]))
+				{
+					++numCachedShards;
+					return;
+				}
+			}
+
+			ScopedThreadLLVMContext scopedThreadContext;
+			auto llvmModule = emitModule(
+				module,
+				moduleCode->functionDefNames,
+				shardBoundaries[shardIndex],
+				shardBoundaries[shardIndex + 1],
+				moduleCode->getEmitModuleOptions(tier));
+			shardObjects[shardIndex] = compileModule(llvmModule,moduleCode->getOptimizationLevel(tier));
+
+			if(useObjectCache) { storeCachedObject(compileOptions.objectCacheDirectory,objectCacheKey,shardObjects[shardIndex]); }
+		};
+		std::vector<std::thread> workerThreads;
+		for(uintp shardIndex = 1;shardIndex < numShards;++shardIndex) { workerThreads.emplace_back(compileShard,shardIndex); }
+		compileShard(0);
+		for(auto& workerThread : workerThreads) { workerThread.join(); }
+		if(numShards > 1) { Log::logRatePerSecond("Compiled module shards",compileTimer,(float64)numShards,"shards"); }
+		if(useObjectCache) { Log::printf(Log::Category::debug,"Loaded %u of %u module shards from the object cache\n",(uint32)numCachedShards,(uint32)numShards); }
+
+		// Load all the shards before finalizing any of them, so calls between shards can be resolved to the address the callee was loaded at.
+		for(uintp shardIndex = 0;shardIndex < numShards;++shardIndex)
+		{
+			auto shard = new JITModuleShard(moduleCode);
+			moduleCode->shards.push_back(shard);
+			shard->load(std::move(shardObjects[shardIndex]),moduleCode);
+		}
+		for(auto shard : moduleCode->shards) { shard->finalize(); }
+
+		return moduleCode;
+	}
+
+	JITFunctionUnit* ModuleCode::compileFunction(uintp functionDefIndex,CodeTier emitTier)
+	{
+		ScopedThreadLLVMContext scopedThreadContext;
+		auto llvmModule = emitModule(retainedModule,functionDefNames,functionDefIndex,functionDefIndex + 1,getEmitModuleOptions(emitTier));
+
+		auto unit = new JITFunctionUnit(this,functionDefIndex);
+		unit->load(compileModule(llvmModule,getOptimizationLevel(emitTier)),this);
+		unit->finalize();
+		assert(unit->entry);
+		{
+			Platform::Lock lock(functionUnitsMutex);
+			functionUnits.push_back(unit);
+		}
+		return unit;
+	}
+
+	void ModuleCode::optimizeFunction(uintp functionDefIndex)
+	{
+		// Replace the function's entry with the optimized code. Calls to the function's baseline code will forward to it.
+		functionDefEntries[functionDefIndex] = compileFunction(functionDefIndex,CodeTier::optimized)->entry;
+	}
+
+	void* ModuleCode::compileLazyFunction(uintp functionDefIndex)
+	{
+		Platform::Lock lock(lazyCompileMutex);
+
+		// If another thread compiled the function while this thread was waiting for the lock, just return its entry.
+		assert(functionDefIndex < lazyStubs.size());
+		if(functionDefEntries[functionDefIndex] != lazyStubs[functionDefIndex]) { return functionDefEntries[functionDefIndex]; }
+
+		// Compile the function, and replace its entry with the compiled code. Subsequent calls through the stub will forward
+		// to the compiled code, and calls from the module's other functions will call it directly.
+		Core::Timer compileTimer;
+		void* entry = compileFunction(functionDefIndex,tier)->entry;
+		functionDefEntries[functionDefIndex] = entry;
+		Log::printf(Log::Category::debug,"Lazily compiled %s in %.2fms\n",functionDefNames[functionDefIndex].c_str(),compileTimer.getMilliseconds());
+		return entry;
+	}
+
+	// Called by the stub for a function in lazily compiled code when the function's entry still points to the stub.
+	static void* compileLazyFunction(ModuleCode* moduleCode,uint32 functionDefIndex)
+	{
+		return moduleCode->compileLazyFunction(functionDefIndex);
+	}
+
+	// The state of the thread that compiles the optimized tier of functions in tiered code. requestEvent is signaled when a
+	// request is added or the thread should shut down, and functionOptimizedEvent is signaled each time the thread finishes
+	// optimizing a function.
+	struct TierUpThread
+	{
+		Platform::Mutex mutex;
+		Platform::Event requestEvent;
+		Platform::Event functionOptimizedEvent;
+		std::deque<std::pair<ModuleCode*,uintp>> pendingRequests;
+		ModuleCode* activeModuleCode;
+		uintp numOptimizedFunctions;
+		bool isShuttingDown;
+		std::thread thread;
+
+		TierUpThread(): activeModuleCode(nullptr), numOptimizedFunctions(0), isShuttingDown(false) {}
+	};
+	static TierUpThread* tierUpThread = nullptr;
+	static Platform::Mutex startTierUpThreadMutex;
+
+	static void tierUpThreadMain()
+	{
+		while(true)
+		{
+			Platform::Lock lock(tierUpThread->mutex);
+			if(tierUpThread->isShuttingDown) { break; }
+			if(!tierUpThread->pendingRequests.size())
+			{
+				lock.Release();
+				tierUpThread->requestEvent.wait();
+				continue;
+			}
+
+			// Take the oldest request, and compile it without holding the lock.
+			auto request = tierUpThread->pendingRequests.front();
+			tierUpThread->pendingRequests.pop_front();
+			tierUpThread->activeModuleCode = request.first;
+			lock.Release();
+
+			Core::Timer tierUpTimer;
+			request.first->optimizeFunction(request.second);
+			Log::printf(Log::Category::debug,"Optimized %s in %.2fms\n",request.first->functionDefNames[request.second].c_str(),tierUpTimer.getMilliseconds());
+
+			{
+				Platform::Lock finishedLock(tierUpThread->mutex);
+				tierUpThread->activeModuleCode = nullptr;
+				++tierUpThread->numOptimizedFunctions;
+			}
+			tierUpThread->functionOptimizedEvent.signal();
+		}
+	}
+
+	// Stops the tier-up thread at exit, so it isn't compiling while LLVM's global state is destroyed.
+	static void shutdownTierUpThread()
+	{
+		{
+			Platform::Lock lock(tierUpThread->mutex);
+			tierUpThread->isShuttingDown = true;
+			tierUpThread->pendingRequests.clear();
+		}
+		tierUpThread->requestEvent.signal();
+		tierUpThread->thread.join();
+	}
+
+	static void startTierUpThread()
+	{
+		// Multiple threads may compile tiered code at once, so make sure only one of them starts the tier-up thread.
+		Platform::Lock lock(startTierUpThreadMutex);
+		if(!tierUpThread)
+		{
+			tierUpThread = new TierUpThread();
+			tierUpThread->thread = std::thread(tierUpThreadMain);
+			std::atexit(shutdownTierUpThread);
+		}
+	}
+
+	// Called by baseline tier code when a function's call count reaches the threshold.
+	static void requestTierUp(ModuleCode* moduleCode,uint32 functionDefIndex)
+	{
+		{
+			Platform::Lock lock(tierUpThread->mutex);
+			tierUpThread->pendingRequests.push_back(std::make_pair(moduleCode,uintp(functionDefIndex)));
+		}
+		tierUpThread->requestEvent.signal();
+	}
+
+	// Waits for the tier-up thread to finish optimizing a function, and passes the signal on to any other thread waiting for it.
+	// Callers must check what they're waiting for again afterwards, since the event may have been signaled before they waited.
+	static void waitForOptimizedFunction()
+	{
+		tierUpThread->functionOptimizedEvent.wait();
+		tierUpThread->functionOptimizedEvent.signal();
+	}
+
+	// Removes any pending requests to optimize functions in some code, and waits for the tier-up thread to finish optimizing
+	// a function in the code if it's doing so.
+	static void cancelTierUps(ModuleCode* moduleCode)
+	{
+		if(!tierUpThread) { return; }
+		{
+			Platform::Lock lock(tierUpThread->mutex);
+			auto& pendingRequests = tierUpThread->pendingRequests;
+			for(auto requestIt = pendingRequests.begin();requestIt != pendingRequests.end();)
+			{
+				if(requestIt->first == moduleCode) { requestIt = pendingRequests.erase(requestIt); }
+				else { ++requestIt; }
+			}
+		}
+		while(true)
+		{
+			{
+				Platform::Lock lock(tierUpThread->mutex);
+				if(tierUpThread->activeModuleCode != moduleCode) { break; }
+			}
+			waitForOptimizedFunction();
+		}
+	}
+
+	uintp waitForTierUps()
+	{
+		if(!tierUpThread) { return 0; }
+		while(true)
+		{
+			{
+				Platform::Lock lock(tierUpThread->mutex);
+				if(!tierUpThread->pendingRequests.size() && !tierUpThread->activeModuleCode) { return tierUpThread->numOptimizedFunctions; }
+			}
+			waitForOptimizedFunction();
+		}
+	}
+
+	// Serializes a module, to compute the keys for its code.
+	static std::vector<uint8> serializeModule(const Module& module)
+	{
+		Serialization::ArrayOutputStream moduleStream;
+		WebAssembly::serialize(moduleStream,module);
+		return moduleStream.getBytes();
+	}
+
+	// Looks up the shared code with the given key, and adds a reference to it. If there isn't any, adds newModuleCode to the
+	// shared code with the key, or returns null if newModuleCode is null. If another thread added code with the same key
+	// while newModuleCode was being compiled, newModuleCode is deleted and the other thread's code is used instead.
+	static ModuleCode* findOrAddSharedModuleCode(const std::string& sharedKey,ModuleCode* newModuleCode)
+	{
+		Platform::Lock sharedModuleCodeLock(sharedModuleCodeMutex);
+		ModuleCode* moduleCode;
+		auto sharedCodeIt = sharedModuleCodeMap.find(sharedKey);
+		if(sharedCodeIt != sharedModuleCodeMap.end()) { moduleCode = sharedCodeIt->second; }
+		else if(!newModuleCode) { return nullptr; }
+		else
+		{
+			moduleCode = newModuleCode;
+			moduleCode->sharedKey = sharedKey;
+			sharedModuleCodeMap[sharedKey] = moduleCode;
+		}
+		++moduleCode->numSharedReferences;
+		sharedModuleCodeLock.Release();
+
+		if(newModuleCode && newModuleCode != moduleCode) { delete newModuleCode; }
+		return moduleCode;
+	}
+
+	// Returns the instance-independent code for a module, and adds a reference to it. The code is compiled the first time it's
+	// requested for a module, and shared by all subsequent requests until the last reference to it is removed. The code isn't
+	// compiled while holding sharedModuleCodeMutex, so threads instantiating different modules can compile them in parallel.
+	static ModuleCode* getSharedModuleCode(
+		const Module& module,
+		std::vector<std::string>&& functionDefNames,
+		const std::vector<uint8>& moduleBytes,
+		const CompileOptions& compileOptions)
+	{
+		const std::string sharedKey = getModuleCodeKey(moduleBytes,getCodeGenerationConfig(true,compileOptions));
+		ModuleCode* moduleCode = findOrAddSharedModuleCode(sharedKey,nullptr);
+		if(!moduleCode)
+		{
+			moduleCode = findOrAddSharedModuleCode(sharedKey,
+				compileModuleCode(module,std::move(functionDefNames),nullptr,moduleBytes,compileOptions));
+		}
+		return moduleCode;
+	}
+
+	// Initializes the context that a module instance's code uses to access the instance's objects.
+	static void initInstanceContext(ModuleInstance* moduleInstance,uintp numImportedFunctions)
+	{
+		InstanceContext& instanceContext = moduleInstance->context;
+		if(moduleInstance->defaultMemory)
+		{
+			instanceContext.defaultMemoryBase = moduleInstance->defaultMemory->baseAddress;
+			instanceContext.defaultMemoryAddressMask = uintp(moduleInstance->defaultMemory->endOffset) - 1;
+			instanceContext.defaultMemoryNumPages = &moduleInstance->defaultMemory->numPages;
+			instanceContext.defaultMemory = moduleInstance->defaultMemory;
+		}
+		if(moduleInstance->defaultTable)
+		{
+			instanceContext.defaultTableBase = moduleInstance->defaultTable->baseAddress;
+			instanceContext.defaultTableEndIndex = uintp(moduleInstance->defaultTable->endIndex);
+			instanceContext.defaultTable = moduleInstance->defaultTable;
+		}
+		for(auto global : moduleInstance->globals) { moduleInstance->contextGlobalValues.push_back(&global->value); }
+		for(uintp functionIndex = 0;functionIndex < numImportedFunctions;++functionIndex)
+		{
+			FunctionInstance* importedFunction = moduleInstance->functions[functionIndex];
+			moduleInstance->contextImportedFunctions.push_back({getFunctionEntry(importedFunction),getFunctionContext(importedFunction)});
+		}
+		instanceContext.globalValues = moduleInstance->contextGlobalValues.data();
+		instanceContext.importedFunctions = moduleInstance->contextImportedFunctions.data();
+	}
+
+	// Gives a module instance a reference to the code compiled for it, and points the instance's functions at the code.
+	static void bindModuleCode(ModuleInstance* moduleInstance,ModuleCode* moduleCode)
+	{
+		// Code that doesn't explicitly bounds check memory accesses relies on the memory's address-space reservation to contain them.
+		if(moduleInstance->defaultMemory
+		&& moduleCode->memoryBoundsCheckMode != MemoryBoundsCheckMode::explicitChecks
+		&& !hasFullAddressSpaceReservation(moduleInstance->defaultMemory))
+		{ Core::error("a memory created for explicitly bounds checked code can't be used by code without explicit bounds checks"); }
+
+		moduleInstance->jitModule = new JITModule(moduleCode);
+
+		assert(moduleCode->functionDefEntries.size() == moduleInstance->functionDefs.size());
+		for(uintp functionDefIndex = 0;functionDefIndex < moduleInstance->functionDefs.size();++functionDefIndex)
+		{
+			assert(moduleCode->functionDefEntries[functionDefIndex]);
+			FunctionInstance* functionDef = moduleInstance->functionDefs[functionDefIndex];
+			functionDef->nativeFunction = moduleCode->functionDefEntries[functionDefIndex];
+			functionDef->debugName = moduleCode->functionDefNames[functionDefIndex].c_str();
+		}
+	}
+
+	void instantiateModule(const WebAssembly::Module& module,std::vector<std::string>&& functionDefNames,ModuleInstance* moduleInstance)
+	{
+		initInstanceContext(moduleInstance,moduleInstance->functions.size() - module.functionDefs.size());
+
+		// If the object cache or instance-independent code is enabled, serialize the module to compute the keys for its code.
+		const CompileOptions compileOptions = getCompileOptions();
+		const bool isInstanceIndependent = compileOptions.shareCodeBetweenInstances;
+		std::vector<uint8> moduleBytes;
+		if(isInstanceIndependent || compileOptions.objectCacheDirectory.size()) { moduleBytes = serializeModule(module); }
+
+		// Reuse the instance-independent code compiled for a previous instance of the module if possible.
+		ModuleCode* moduleCode = isInstanceIndependent
+			? getSharedModuleCode(module,std::move(functionDefNames),moduleBytes,compileOptions)
+			: compileModuleCode(module,std::move(functionDefNames),moduleInstance,moduleBytes,compileOptions);
+		bindModuleCode(moduleInstance,moduleCode);
+	}
+
+	JITModuleBase* compileModule(const WebAssembly::Module& module,std::vector<std::string>&& functionDefNames)
+	{
+		const std::vector<uint8> moduleBytes = serializeModule(module);
+		return new JITModule(getSharedModuleCode(module,std::move(functionDefNames),moduleBytes,getCompileOptions()));
+	}
+
+	void instantiateCompiledModule(JITModuleBase* compiledModule,ModuleInstance* moduleInstance)
+	{
+		ModuleCode* moduleCode = static_cast<JITModule*>(compiledModule)->moduleCode;
+		initInstanceContext(moduleInstance,moduleInstance->functions.size() - moduleCode->functionDefNames.size());
+
+		{
+			Platform::Lock sharedModuleCodeLock(sharedModuleCodeMutex);
+			++moduleCode->numSharedReferences;
+		}
+		bindModuleCode(moduleInstance,moduleCode);
+	}
+
+	// Returns the header of a precompiled object for a module: a key that identifies the module and everything else that
+	// affects whether the object's code can be used for it. The header is followed by the object file.
+	static std::string getPrecompiledObjectHeader(const std::vector<uint8>& moduleBytes,const CompileOptions& compileOptions)
+	{
+		const std::string codeGenerationConfig = std::string(objectCacheVersion)
+			+ ";LLVM " + LLVM_VERSION_STRING
+			+ ";" + targetTriple
+			+ ";instance-independent;precompiled"
+			+ ";bounds-checks " + std::to_string(uintp(compileOptions.memoryBoundsCheckMode))
+			+ (shouldUseHardwareTraps(compileOptions) ? ";hardware-traps" : "")
+			+ (shouldCheckStackLimit(compileOptions) ? ";stack-limit" : "")
+			+ (compileOptions.meterFuel ? ";fuel" : "")
+			+ (compileOptions.pollEpoch ? ";epoch" : "");
+		return "WAVM precompiled object " + getModuleCodeKey(moduleBytes,codeGenerationConfig) + "\n";
+	}
+
+	// Returns the line that follows the header of a precompiled object: a checksum of the object's code, which is checked
+	// before loading it so a corrupted object is rejected instead of running corrupted code.
+	static std::string getPrecompiledObjectChecksum(const uint8* objectData,size_t numObjectBytes)
+	{
+		llvm::MD5 md5;
+		md5.update(llvm::ArrayRef<uint8>(objectData,numObjectBytes));
+		llvm::MD5::MD5Result md5Result;
+		md5.final(md5Result);
+
+		llvm::SmallString<32> checksumString;
+		llvm::MD5::stringifyResult(md5Result,checksumString);
+		return checksumString.str().str() + "\n";
+	}
+
+	std::vector<uint8> compilePrecompiledObject(const WebAssembly::Module& module,std::vector<std::string>&& functionDefNames)
+	{
+		const std::vector<uint8> moduleBytes = serializeModule(module);
+		const CompileOptions compileOptions = getCompileOptions();
+
+		// Emit and compile all the module's function definitions to a single instance-independent object.
+		EmitModuleOptions emitOptions;
+		emitOptions.isInstanceIndependent = true;
+		emitOptions.callThroughFunctionDefEntries = false;
+		emitOptions.tier = CodeTier::untiered;
+		emitOptions.tierUpCallCount = 0;
+		emitOptions.memoryBoundsCheckMode = compileOptions.memoryBoundsCheckMode;
+		emitOptions.useHardwareTraps = shouldUseHardwareTraps(compileOptions);
+		emitOptions.checkStackLimit = shouldCheckStackLimit(compileOptions);
+		emitOptions.meterFuel = compileOptions.meterFuel;
+		emitOptions.pollEpoch = compileOptions.pollEpoch;
+
+		ScopedThreadLLVMContext scopedThreadContext;
+		auto llvmModule = emitModule(module,functionDefNames,0,module.functionDefs.size(),emitOptions);
+		auto object = compileModule(llvmModule,compileOptions.optimizationLevel);
+
+		const llvm::StringRef objectData = object.getBinary()->getData();
+		const std::string header = getPrecompiledObjectHeader(moduleBytes,compileOptions)
+			+ getPrecompiledObjectChecksum((const uint8*)objectData.data(),objectData.size());
+		std::vector<uint8> precompiledObject(header.begin(),header.end());
+		precompiledObject.insert(precompiledObject.end(),objectData.begin(),objectData.end());
+		return precompiledObject;
+	}
+
+	JITModuleBase* loadPrecompiledObject(
+		const WebAssembly::Module& module,
+		std::vector<std::string>&& functionDefNames,
+		const std::vector<uint8>& precompiledObject)
+	{
+		// Check that the object was compiled for the module with a compatible configuration.
+		CompileOptions precompiledOptions;
+		precompiledOptions.memoryBoundsCheckMode = getCompileOptions().memoryBoundsCheckMode;
+		precompiledOptions.useHardwareTraps = getCompileOptions().useHardwareTraps;
+		precompiledOptions.checkStackLimit = getCompileOptions().checkStackLimit;
+		precompiledOptions.meterFuel = getCompileOptions().meterFuel;
+		precompiledOptions.pollEpoch = getCompileOptions().pollEpoch;
+		const std::string header = getPrecompiledObjectHeader(serializeModule(module),precompiledOptions);
+		if(precompiledObject.size() < header.size() || memcmp(precompiledObject.data(),header.data(),header.size()))
+		{
+			Log::printf(Log::Category::error,"Precompiled object wasn't compiled for this module with this version and configuration of WAVM\n");
+			return nullptr;
+		}
+
+		// Check that the object's code matches the checksum that follows the header.
+		const size_t checksumBytes = getPrecompiledObjectChecksum(nullptr,0).size();
+		if(precompiledObject.size() < header.size() + checksumBytes)
+		{
+			Log::printf(Log::Category::error,"Precompiled object is corrupted\n");
+			return nullptr;
+		}
+		const uint8* objectData = precompiledObject.data() + header.size() + checksumBytes;
+		const size_t numObjectBytes = precompiledObject.size() - header.size() - checksumBytes;
+		if(memcmp(precompiledObject.data() + header.size(),getPrecompiledObjectChecksum(objectData,numObjectBytes).data(),checksumBytes))
+		{
+			Log::printf(Log::Category::error,"Precompiled object is corrupted\n");
+			return nullptr;
+		}
+
+		// Reuse the code if the same object was already loaded.
+		ModuleCode* moduleCode = findOrAddSharedModuleCode(header,nullptr);
+		if(!moduleCode)
+		{
+			llvm::object::OwningBinary<llvm::object::ObjectFile> object;
+			auto objectBuffer = llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef((const char*)objectData,numObjectBytes));
+			if(!parseObject(std::move(objectBuffer),object))
+			{
+				Log::printf(Log::Category::error,"Invalid precompiled object\n");
+				return nullptr;
+			}
+
+			// Load the object as the only shard of untiered, instance-independent code for the module.
+			moduleCode = new ModuleCode(module,nullptr,std::move(functionDefNames),CodeTier::untiered,precompiledOptions);
+			auto shard = new JITModuleShard(moduleCode);
+			moduleCode->shards.push_back(shard);
+			shard->load(std::move(object),moduleCode);
+			shard->finalize();
+
+			moduleCode = findOrAddSharedModuleCode(header,moduleCode);
+		}
+		return new JITModule(moduleCode);
+	}
+
+	std::string getExternalFunctionName(uintp functionDefIndex,const std::string& functionDefName)
+	{
+		return "wasmFunc" + std::to_string(functionDefIndex) + "_" + functionDefName;
+	}
+
+	std::string getImportedFunctionSymbolName(uintp importedFunctionIndex) { return "wavmImportedFunc" + std::to_string(importedFunctionIndex); }
+	std::string getImportedFunctionContextSymbolName(uintp importedFunctionIndex) { return "wavmImportedFuncContext" + std::to_string(importedFunctionIndex); }
+	std::string getGlobalSymbolName(uintp globalIndex) { return "wavmGlobal" + std::to_string(globalIndex); }
+	std::string getSignatureIndexSymbolName(uintp typeIndex) { return "wavmSignatureIndex" + std::to_string(typeIndex); }
+	std::string getIntrinsicSymbolName(const char* intrinsicName,const FunctionType* intrinsicType)
+	{
+		return "wavmIntrinsic:" + Intrinsics::getDecoratedName(intrinsicName,intrinsicType);
 	}
 
 	bool getFunctionIndexFromExternalName(const char* externalName,uintp& outFunctionDefIndex)
@@ -477,6 +1720,7 @@ namespace LLVMJIT
 
 	bool describeInstructionPointer(uintp ip,std::string& outDescription)
 	{
+		Platform::Lock lock(addressToSymbolMapMutex);
 		auto symbolIt = addressToSymbolMap.upper_bound(ip);
 		if(symbolIt == addressToSymbolMap.end()) { return false; }
 
@@ -485,12 +1729,15 @@ namespace LLVMJIT
 
 		switch(symbol->type)
 		{
-		case JITSymbol::Type::functionInstance:
-			outDescription = symbol->functionInstance->debugName;
+		case JITSymbol::Type::functionDef:
+			outDescription = symbol->functionDefName;
 			if(!outDescription.size()) { outDescription = "<unnamed function>"; }
 			break;
 		case JITSymbol::Type::invokeThunk:
-			outDescription = "<invoke thunk : " + asString(symbol->invokeThunkType) + ">";
+			outDescription = "<invoke thunk : " + asString(symbol->thunkType) + ">";
+			break;
+		case JITSymbol::Type::intrinsicThunk:
+			outDescription = "<intrinsic thunk : " + asString(symbol->thunkType) + ">";
 			break;
 		default: Core::unreachable();
 		};
@@ -507,26 +1754,69 @@ namespace LLVMJIT
 		return true;
 	}
 
+	bool isFunctionDefInstructionPointer(uintp ip)
+	{
+		Platform::Lock lock(addressToSymbolMapMutex);
+		auto symbolIt = addressToSymbolMap.upper_bound(ip);
+		if(symbolIt == addressToSymbolMap.end()) { return false; }
+
+		JITSymbol* symbol = symbolIt->second;
+		return symbol->type == JITSymbol::Type::functionDef && ip >= symbol->baseAddress && ip < symbol->baseAddress + symbol->numBytes;
+	}
+
+	static uintp getInvokeThunkCacheIndex(const FunctionType* functionType,uintp probeIndex)
+	{
+		return ((reinterpret_cast<uintp>(functionType) >> 4) + probeIndex) & (invokeThunkCacheSize - 1);
+	}
+
+	static void addInvokeThunkToCache(const FunctionType* functionType,InvokeFunctionPointer thunk)
+	{
+		// This is only called with thunkMutex locked, so there aren't any concurrent writers to the cache.
+		for(uintp probeIndex = 0;probeIndex < invokeThunkCacheMaxProbes;++probeIndex)
+		{
+			InvokeThunkCacheEntry& entry = invokeThunkCache[getInvokeThunkCacheIndex(functionType,probeIndex)];
+			if(!entry.type.load(std::memory_order_relaxed))
+			{
+				entry.thunk.store(thunk,std::memory_order_relaxed);
+				entry.type.store(functionType,std::memory_order_release);
+				return;
+			}
+		}
+	}
+
 	InvokeFunctionPointer getInvokeThunk(const FunctionType* functionType)
 	{
+		// Look for the function type in the lock-free cache first.
+		for(uintp probeIndex = 0;probeIndex < invokeThunkCacheMaxProbes;++probeIndex)
+		{
+			const InvokeThunkCacheEntry& entry = invokeThunkCache[getInvokeThunkCacheIndex(functionType,probeIndex)];
+			const FunctionType* entryType = entry.type.load(std::memory_order_acquire);
+			if(entryType == functionType) { return entry.thunk.load(std::memory_order_relaxed); }
+			else if(!entryType) { break; }
+		}
+
 		// Reuse cached invoke thunks for the same function type.
+		Platform::Lock thunkLock(thunkMutex);
 		auto mapIt = invokeThunkTypeToSymbolMap.find(functionType);
 		if(mapIt != invokeThunkTypeToSymbolMap.end()) { return reinterpret_cast<InvokeFunctionPointer>(mapIt->second->baseAddress); }
 
-		auto llvmModule = new llvm::Module("",context);
+		ScopedThreadLLVMContext scopedThreadContext;
+		auto llvmModule = new llvm::Module("",*context);
 		auto llvmFunctionType = llvm::FunctionType::get(
 			llvmVoidType,
-			{asLLVMType(functionType)->getPointerTo(),llvmI64Type->getPointerTo()},
+			{asLLVMContextFunctionType(functionType)->getPointerTo(),llvmI8PtrType,llvmI64Type->getPointerTo()},
 			false);
-		auto llvmFunction = llvm::Function::Create(llvmFunctionType,llvm::Function::ExternalLinkage,"invokeThunk",llvmModule);
+		auto llvmFunction = llvm::Function::Create(llvmFunctionType,llvm::Function::ExternalLinkage,"thunk",llvmModule);
 		auto argIt = llvmFunction->args().begin();
 		llvm::Value* functionPointer = &*argIt++;
+		llvm::Value* contextPointer = &*argIt++;
 		llvm::Value* argBaseAddress = &*argIt;
-		auto entryBlock = llvm::BasicBlock::Create(context,"entry",llvmFunction);
+		auto entryBlock = llvm::BasicBlock::Create(*context,"entry",llvmFunction);
 		llvm::IRBuilder<> irBuilder(entryBlock);
 
 		// Load the function's arguments from an array of 64-bit values at an address provided by the caller.
 		std::vector<llvm::Value*> structArgLoads;
+		structArgLoads.push_back(contextPointer);
 		for(uintp parameterIndex = 0;parameterIndex < functionType->parameters.size();++parameterIndex)
 		{
 			structArgLoads.push_back(irBuilder.CreateLoad(
@@ -556,13 +1846,52 @@ namespace LLVMJIT
 		irBuilder.CreateRetVoid();
 
 		// Compile the invoke thunk.
-		auto jitUnit = new JITInvokeThunkUnit(functionType);
+		auto jitUnit = new JITThunkUnit(JITSymbol::Type::invokeThunk,functionType);
 		jitUnit->compile(llvmModule);
 
 		assert(jitUnit->symbol);
 		invokeThunkTypeToSymbolMap[functionType] = jitUnit->symbol;
-		addressToSymbolMap[jitUnit->symbol->baseAddress + jitUnit->symbol->numBytes] = jitUnit->symbol;
-		return reinterpret_cast<InvokeFunctionPointer>(jitUnit->symbol->baseAddress);
+		addJITSymbol(jitUnit->symbol);
+
+		InvokeFunctionPointer thunk = reinterpret_cast<InvokeFunctionPointer>(jitUnit->symbol->baseAddress);
+		addInvokeThunkToCache(functionType,thunk);
+		return thunk;
+	}
+
+	void* getFunctionEntry(FunctionInstance* function)
+	{
+		// Functions defined by a module are already compiled with the right calling convention.
+		if(function->moduleInstance) { return function->nativeFunction; }
+
+		// Reuse cached thunks for the same intrinsic.
+		Platform::Lock thunkLock(thunkMutex);
+		auto mapIt = intrinsicThunkMap.find(function);
+		if(mapIt != intrinsicThunkMap.end()) { return reinterpret_cast<void*>(mapIt->second->baseAddress); }
+
+		// Generate a thunk that discards the context parameter, and passes the rest of its arguments to the intrinsic.
+		ScopedThreadLLVMContext scopedThreadContext;
+		auto llvmModule = new llvm::Module("",*context);
+		auto llvmFunction = llvm::Function::Create(asLLVMContextFunctionType(function->type),llvm::Function::ExternalLinkage,"thunk",llvmModule);
+		auto entryBlock = llvm::BasicBlock::Create(*context,"entry",llvmFunction);
+		llvm::IRBuilder<> irBuilder(entryBlock);
+
+		std::vector<llvm::Value*> args;
+		for(auto argIt = ++llvmFunction->args().begin();argIt != llvmFunction->args().end();++argIt) { args.push_back(&*argIt); }
+		auto nativeFunctionPointer = llvm::ConstantExpr::getIntToPtr(
+			emitLiteral(reinterpret_cast<uintp>(function->nativeFunction)),
+			asLLVMType(function->type)->getPointerTo());
+		auto result = irBuilder.CreateCall(nativeFunctionPointer,args);
+		if(function->type->ret == ResultType::none) { irBuilder.CreateRetVoid(); }
+		else { irBuilder.CreateRet(result); }
+
+		// Compile the thunk.
+		auto jitUnit = new JITThunkUnit(JITSymbol::Type::intrinsicThunk,function->type);
+		jitUnit->compile(llvmModule);
+
+		assert(jitUnit->symbol);
+		intrinsicThunkMap[function] = jitUnit->symbol;
+		addJITSymbol(jitUnit->symbol);
+		return reinterpret_cast<void*>(jitUnit->symbol->baseAddress);
 	}
 	
 	void init()
@@ -572,35 +1901,14 @@ namespace LLVMJIT
 		llvm::InitializeNativeTargetAsmParser();
 		llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
 
-		auto targetTriple = llvm::sys::getProcessTriple();
+		targetTriple = llvm::sys::getProcessTriple();
 		#ifdef __APPLE__
 			// Didn't figure out exactly why, but this works around a problem with the MacOS dynamic loader. Without it,
 			// our symbols can't be found in the JITed object file.
 			targetTriple += "-elf";
 		#endif
-		targetMachine = llvm::EngineBuilder().selectTarget(llvm::Triple(targetTriple),"","",llvm::SmallVector<std::string,0>());
-
-		llvmI8Type = llvm::Type::getInt8Ty(context);
-		llvmI16Type = llvm::Type::getInt16Ty(context);
-		llvmI32Type = llvm::Type::getInt32Ty(context);
-		llvmI64Type = llvm::Type::getInt64Ty(context);
-		llvmF32Type = llvm::Type::getFloatTy(context);
-		llvmF64Type = llvm::Type::getDoubleTy(context);
-		llvmVoidType = llvm::Type::getVoidTy(context);
-		llvmBoolType = llvm::Type::getInt1Ty(context);
-		llvmI8PtrType = llvmI8Type->getPointerTo();
 
-		llvmResultTypes[(size_t)ResultType::none] = llvm::Type::getVoidTy(context);
-		llvmResultTypes[(size_t)ResultType::i32] = llvmI32Type;
-		llvmResultTypes[(size_t)ResultType::i64] = llvmI64Type;
-		llvmResultTypes[(size_t)ResultType::f32] = llvmF32Type;
-		llvmResultTypes[(size_t)ResultType::f64] = llvmF64Type;
-
-		// Create zero constants of each type.
-		typedZeroConstants[(size_t)ValueType::invalid] = nullptr;
-		typedZeroConstants[(size_t)ValueType::i32] = emitLiteral((uint32)0);
-		typedZeroConstants[(size_t)ValueType::i64] = emitLiteral((uint64)0);
-		typedZeroConstants[(size_t)ValueType::f32] = emitLiteral((float32)0.0f);
-		typedZeroConstants[(size_t)ValueType::f64] = emitLiteral((float64)0.0);
+		// Use the global LLVM context for the thread that initializes the runtime.
+		initThreadLLVMContext(llvm::getGlobalContext());
 	}
 }
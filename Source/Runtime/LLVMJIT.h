@@ -23,6 +23,7 @@
 #endif
 
 #include "llvm/Analysis/Passes.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
@@ -42,10 +43,16 @@
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Object/SymbolSize.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/Support/DataTypes.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/IR/DIBuilder.h"
 #include "llvm/DebugInfo/DIContext.h"
@@ -60,23 +67,24 @@
 
 namespace LLVMJIT
 {
-	// The global LLVM context.
-	extern llvm::LLVMContext& context;
+	// The LLVM context used by the current thread. LLVM contexts may not be shared between threads, so each thread
+	// that emits or compiles LLVM IR has its own context, and its own copy of the types and constants below.
+	extern THREAD_LOCAL llvm::LLVMContext* context;
 	
 	// Maps a type ID to the corresponding LLVM type.
-	extern llvm::Type* llvmResultTypes[(size_t)ResultType::num];
-	extern llvm::Type* llvmI8Type;
-	extern llvm::Type* llvmI16Type;
-	extern llvm::Type* llvmI32Type;
-	extern llvm::Type* llvmI64Type;
-	extern llvm::Type* llvmF32Type;
-	extern llvm::Type* llvmF64Type;
-	extern llvm::Type* llvmVoidType;
-	extern llvm::Type* llvmBoolType;
-	extern llvm::Type* llvmI8PtrType;
+	extern THREAD_LOCAL llvm::Type* llvmResultTypes[(size_t)ResultType::num];
+	extern THREAD_LOCAL llvm::Type* llvmI8Type;
+	extern THREAD_LOCAL llvm::Type* llvmI16Type;
+	extern THREAD_LOCAL llvm::Type* llvmI32Type;
+	extern THREAD_LOCAL llvm::Type* llvmI64Type;
+	extern THREAD_LOCAL llvm::Type* llvmF32Type;
+	extern THREAD_LOCAL llvm::Type* llvmF64Type;
+	extern THREAD_LOCAL llvm::Type* llvmVoidType;
+	extern THREAD_LOCAL llvm::Type* llvmBoolType;
+	extern THREAD_LOCAL llvm::Type* llvmI8PtrType;
 
 	// Zero constants of each type.
-	extern llvm::Constant* typedZeroConstants[(size_t)ValueType::num];
+	extern THREAD_LOCAL llvm::Constant* typedZeroConstants[(size_t)ValueType::num];
 
 	// Converts a WebAssembly type to a LLVM type.
 	inline llvm::Type* asLLVMType(ValueType type) { return llvmResultTypes[(uintp)asResultType(type)]; }
@@ -94,24 +102,115 @@ namespace LLVMJIT
 		return llvm::FunctionType::get(llvmResultType,llvm::ArrayRef<llvm::Type*>(llvmArgTypes,functionType->parameters.size()),false);
 	}
 
+	// Converts a WebAssembly function type to the LLVM type of a JIT compiled WebAssembly function, which takes a pointer to
+	// its instance's context as a hidden first parameter.
+	inline llvm::FunctionType* asLLVMContextFunctionType(const FunctionType* functionType)
+	{
+		auto llvmArgTypes = (llvm::Type**)alloca(sizeof(llvm::Type*) * (functionType->parameters.size() + 1));
+		llvmArgTypes[0] = llvmI8PtrType;
+		for(uintp argIndex = 0;argIndex < functionType->parameters.size();++argIndex)
+		{
+			llvmArgTypes[argIndex + 1] = asLLVMType(functionType->parameters[argIndex]);
+		}
+		auto llvmResultType = asLLVMType(functionType->ret);
+		return llvm::FunctionType::get(llvmResultType,llvm::ArrayRef<llvm::Type*>(llvmArgTypes,functionType->parameters.size() + 1),false);
+	}
+
 	// Overloaded functions that compile a literal value to a LLVM constant of the right type.
 	inline llvm::ConstantInt* emitLiteral(uint32 value) { return (llvm::ConstantInt*)llvm::ConstantInt::get(llvmI32Type,llvm::APInt(32,(uint64)value,false)); }
 	inline llvm::ConstantInt* emitLiteral(int32 value) { return (llvm::ConstantInt*)llvm::ConstantInt::get(llvmI32Type,llvm::APInt(32,(int64)value,false)); }
 	inline llvm::ConstantInt* emitLiteral(uint64 value) { return (llvm::ConstantInt*)llvm::ConstantInt::get(llvmI64Type,llvm::APInt(64,value,false)); }
 	inline llvm::ConstantInt* emitLiteral(int64 value) { return (llvm::ConstantInt*)llvm::ConstantInt::get(llvmI64Type,llvm::APInt(64,value,false)); }
-	inline llvm::Constant* emitLiteral(float32 value) { return llvm::ConstantFP::get(context,llvm::APFloat(value)); }
-	inline llvm::Constant* emitLiteral(float64 value) { return llvm::ConstantFP::get(context,llvm::APFloat(value)); }
+	inline llvm::Constant* emitLiteral(float32 value) { return llvm::ConstantFP::get(*context,llvm::APFloat(value)); }
+	inline llvm::Constant* emitLiteral(float64 value) { return llvm::ConstantFP::get(*context,llvm::APFloat(value)); }
 	inline llvm::Constant* emitLiteral(bool value) { return llvm::ConstantInt::get(llvmBoolType,llvm::APInt(1,value ? 1 : 0,false)); }
-	inline llvm::Constant* emitLiteralPointer(const void* pointer,llvm::Type* type)
-	{
-		auto pointerInt = llvm::APInt(sizeof(uintp) == 8 ? 64 : 32,reinterpret_cast<uintp>(pointer));
-		return llvm::Constant::getIntegerValue(type,pointerInt);
-	}
 
 	// Functions that map between the symbols used for externally visible functions and the function
-	std::string getExternalFunctionName(ModuleInstance* moduleInstance,uintp functionDefIndex);
+	std::string getExternalFunctionName(uintp functionDefIndex,const std::string& functionDefName);
 	bool getFunctionIndexFromExternalName(const char* externalName,uintp& outFunctionDefIndex);
 
-	// Emits LLVM IR for a module.
-	llvm::Module* emitModule(const WebAssembly::Module& module,ModuleInstance* moduleInstance);
+	// The names of the external symbols used by the code generated for a module to reference the objects the module is
+	// instantiated with. The symbols are resolved to the addresses of a module instance's objects when its code is loaded.
+	std::string getImportedFunctionSymbolName(uintp importedFunctionIndex);
+	std::string getImportedFunctionContextSymbolName(uintp importedFunctionIndex);
+	std::string getGlobalSymbolName(uintp globalIndex);
+	std::string getSignatureIndexSymbolName(uintp typeIndex);
+	std::string getIntrinsicSymbolName(const char* intrinsicName,const FunctionType* intrinsicType);
+	inline const char* getDefaultMemoryBaseSymbolName() { return "wavmDefaultMemoryBase"; }
+	inline const char* getDefaultMemoryAddressMaskSymbolName() { return "wavmDefaultMemoryAddressMask"; }
+	inline const char* getDefaultMemoryNumPagesSymbolName() { return "wavmDefaultMemoryNumPages"; }
+	inline const char* getDefaultMemoryObjectSymbolName() { return "wavmDefaultMemoryObject"; }
+	inline const char* getDefaultTableBaseSymbolName() { return "wavmDefaultTableBase"; }
+	inline const char* getDefaultTableEndIndexSymbolName() { return "wavmDefaultTableEndIndex"; }
+	inline const char* getDefaultTableObjectSymbolName() { return "wavmDefaultTableObject"; }
+
+	// The name of the external symbol used by code that checks the stack limit. It's resolved to the offset of the thread's
+	// stack limit from its thread pointer, rather than to an address.
+	inline const char* getStackLimitOffsetSymbolName() { return "wavmStackLimitOffset"; }
+
+	// The name of the external symbol used by code that polls whether its invoke has been interrupted. It's resolved to the
+	// address of the runtime's flag that's set while any invoke is interrupted.
+	inline const char* getEpochInterruptPendingSymbolName() { return "wavmEpochInterruptPending"; }
+
+	// The names of the external symbols used by tiered and lazily compiled code to reference the state used to replace
+	// its functions' entries. The symbols are resolved to the state of the module's code when it is loaded.
+	inline const char* getFunctionDefEntriesSymbolName() { return "wavmFunctionDefEntries"; }
+	inline const char* getFunctionDefCallCountsSymbolName() { return "wavmFunctionDefCallCounts"; }
+	inline const char* getModuleCodeSymbolName() { return "wavmModuleCode"; }
+	inline const char* getRequestTierUpSymbolName() { return "wavmRequestTierUp"; }
+	inline const char* getCompileLazyFunctionSymbolName() { return "wavmCompileLazyFunction"; }
+
+	// The tier that code is compiled for. Untiered code is fully optimized. Baseline tier code is compiled quickly with
+	// minimal optimization, and counts calls to each function, requesting that the function be compiled with the optimized
+	// tier once its call count reaches a threshold.
+	enum class CodeTier : uint8
+	{
+		untiered,
+		baseline,
+		optimized
+	};
+
+	// Options that control the code emitted for a module.
+	struct EmitModuleOptions
+	{
+		// If true, the code references the instance's objects through the instance context parameter, so it may be shared by
+		// all instances of the module. Otherwise, it references them through the symbols above.
+		bool isInstanceIndependent;
+
+		// If true, calls to the module's functions load the callee from the module's table of function entries, so the
+		// callee's code may be compiled or replaced while the module is running. Otherwise, the callee is called directly.
+		bool callThroughFunctionDefEntries;
+
+		// The tier the code is compiled for, and if it's CodeTier::baseline, the number of calls to a function that triggers optimizing it.
+		CodeTier tier;
+		uint32 tierUpCallCount;
+
+		// How the code checks that memory accesses are within the bounds of the default memory.
+		MemoryBoundsCheckMode memoryBoundsCheckMode;
+
+		// If true, integer division relies on the hardware to trap if the divisor is zero, and unreachable emits llvm.trap.
+		// Only set when the target is x86-64.
+		bool useHardwareTraps;
+
+		// If true, each function checks that the stack pointer isn't below the thread's stack limit when it's called, and
+		// traps with a stack overflow if it is. Only set when the target is x86-64 and the runtime can read the limit.
+		bool checkStackLimit;
+
+		// If true, the code charges the fuel in the instance context for the operators it executes, and traps with
+		// fuelExhausted if a charge makes it negative.
+		bool meterFuel;
+
+		// If true, the code polls the runtime's epoch interrupt flag when entering each function and at the start of each
+		// loop iteration, and calls into the runtime to check whether its invoke was interrupted if the flag is set.
+		bool pollEpoch;
+	};
+
+	// Emits LLVM IR for a module. Only the function definitions in [beginFunctionDefIndex,endFunctionDefIndex) are
+	// defined in the LLVM module: the rest are declared as external functions, to be linked against the other shards of the module.
+	llvm::Module* emitModule(
+		const WebAssembly::Module& module,
+		const std::vector<std::string>& functionDefNames,
+		uintp beginFunctionDefIndex,
+		uintp endFunctionDefIndex,
+		const EmitModuleOptions& options);
 }
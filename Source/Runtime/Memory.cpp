@@ -5,8 +5,8 @@
 
 namespace Runtime
 {
-	// Global lists of memories; used to query whether an address is reserved by one of them.
-	std::vector<Memory*> memories;
+	// A global index of the address-space reserved by memories; used to query whether an address is reserved by one of them.
+	AddressReservationIndex memoryReservations;
 
 	static uintp getPlatformPagesPerWebAssemblyPageLog2()
 	{
@@ -14,6 +14,13 @@ namespace Runtime
 		return WebAssembly::numBytesPerPageLog2 - Platform::getPageSizeLog2();
 	}
 
+	// Returns the alignment of the address-space reserved for memories: a huge page if the platform supports them, so the
+	// memory's pages can be backed by huge pages if CompileOptions::useHugePages is set.
+	static size_t getMemoryAlignmentBytes()
+	{
+		return (size_t)1 << std::max(Platform::getPageSizeLog2(),Platform::getHugePageSizeLog2());
+	}
+
 	uint8* allocateVirtualPagesAligned(size_t numBytes,size_t alignmentBytes,uint8*& outUnalignedBaseAddress,size_t& outUnalignedNumPlatformPages)
 	{
 		const size_t numAllocatedVirtualPages = numBytes >> Platform::getPageSizeLog2();
@@ -24,58 +31,165 @@ namespace Runtime
 		else { return (uint8*)((uintp)(outUnalignedBaseAddress + alignmentBytes - 1) & ~(alignmentBytes - 1)); }
 	}
 
-	Memory* createMemory(MemoryType type)
+	// On a 64-bit runtime, allocate 8GB of address space for the memory.
+	// This allows eliding bounds checks on memory accesses, since a 32-bit index + 32-bit offset will always be within the reserved address-space.
+	// On a 32-bit runtime, allocate 1GB.
+	static const size_t fullReservationBytes = HAS_64BIT_ADDRESS_SPACE ? 8ull*1024*1024*1024 : 0x40000000;
+
+	// A pool of full address-space reservations freed by memories, which are reused by later memories to avoid the cost of
+	// reserving and freeing the address-space. The reservations in the pool have no committed pages.
+	struct MemoryReservation
 	{
-		Memory* memory = new Memory(type);
+		uint8* baseAddress;
+		uint8* reservedBaseAddress;
+		size_t reservedNumPlatformPages;
+	};
+	struct MemoryReservationPool
+	{
+		Platform::Mutex mutex;
+		std::vector<MemoryReservation> reservations;
+		MemoryReservationPoolStats stats;
+
+		MemoryReservationPool(): stats() {}
+	};
+	static MemoryReservationPool& getMemoryReservationPool()
+	{
+		static MemoryReservationPool pool;
+		return pool;
+	}
 
-		// On a 64-bit runtime, allocate 8GB of address space for the memory.
-		// This allows eliding bounds checks on memory accesses, since a 32-bit index + 32-bit offset will always be within the reserved address-space.
-		// On a 32-bit runtime, allocate 1GB.
-		const size_t memoryMaxBytes = HAS_64BIT_ADDRESS_SPACE ? 8ull*1024*1024*1024 : 0x40000000;
-		
+	static bool allocateFullReservation(MemoryReservation& outReservation)
+	{
 		// On a 64 bit runtime, align the instance memory base to a 4GB boundary, so the lower 32-bits will all be zero. Maybe it will allow better code generation?
 		// Note that this reserves a full extra 4GB, but only uses (4GB-1 page) for alignment, so there will always be a guard page at the end to
 		// protect against unaligned loads/stores that straddle the end of the address-space.
-		const size_t alignmentBytes = HAS_64BIT_ADDRESS_SPACE ? 4ull*1024*1024*1024 : ((uintp)1 << Platform::getPageSizeLog2());
-		memory->baseAddress = allocateVirtualPagesAligned(memoryMaxBytes,alignmentBytes,memory->reservedBaseAddress,memory->reservedNumPlatformPages);
-		memory->endOffset = memoryMaxBytes;
-		if(!memory->baseAddress) { delete memory; return nullptr; }
+		const size_t alignmentBytes = HAS_64BIT_ADDRESS_SPACE ? 4ull*1024*1024*1024 : getMemoryAlignmentBytes();
+		outReservation.baseAddress = allocateVirtualPagesAligned(fullReservationBytes,alignmentBytes,outReservation.reservedBaseAddress,outReservation.reservedNumPlatformPages);
+		return outReservation.baseAddress != nullptr;
+	}
+
+	bool setMemoryReservationPoolSize(uintp maxPooledReservations)
+	{
+		MemoryReservationPool& pool = getMemoryReservationPool();
+		Platform::Lock poolLock(pool.mutex);
+		pool.stats.maxPooledReservations = maxPooledReservations;
+
+		// Free any reservations beyond the new size of the pool.
+		while(pool.reservations.size() > maxPooledReservations)
+		{
+			const MemoryReservation& reservation = pool.reservations.back();
+			Platform::freeVirtualPages(reservation.reservedBaseAddress,reservation.reservedNumPlatformPages);
+			pool.reservations.pop_back();
+		}
+
+		// Reserve address-space up front to fill the pool.
+		while(pool.reservations.size() < maxPooledReservations)
+		{
+			MemoryReservation reservation;
+			if(!allocateFullReservation(reservation)) { pool.stats.numPooledReservations = pool.reservations.size(); return false; }
+			pool.reservations.push_back(reservation);
+		}
+		pool.stats.numPooledReservations = pool.reservations.size();
+		return true;
+	}
+
+	MemoryReservationPoolStats getMemoryReservationPoolStats()
+	{
+		MemoryReservationPool& pool = getMemoryReservationPool();
+		Platform::Lock poolLock(pool.mutex);
+		return pool.stats;
+	}
+
+	Memory* createMemory(MemoryType type)
+	{
+		ObjectMutationScope mutationScope;
+		Memory* memory = new Memory(type);
+		memory->useHugePages = getCompileOptions().useHugePages && Platform::getHugePageSizeLog2() > 0;
+
+		if(getCompileOptions().memoryBoundsCheckMode != MemoryBoundsCheckMode::explicitChecks)
+		{
+			memory->endOffset = fullReservationBytes;
+
+			// Take a reservation from the pool if there is one, or reserve new address-space if not.
+			MemoryReservation reservation;
+			MemoryReservationPool& pool = getMemoryReservationPool();
+			Platform::Lock poolLock(pool.mutex);
+			if(pool.reservations.size())
+			{
+				reservation = pool.reservations.back();
+				pool.reservations.pop_back();
+				pool.stats.numPooledReservations = pool.reservations.size();
+				++pool.stats.numReused;
+				poolLock.Release();
+			}
+			else
+			{
+				++pool.stats.numAllocated;
+				poolLock.Release();
+				if(!allocateFullReservation(reservation)) { delete memory; return nullptr; }
+			}
+			memory->baseAddress = reservation.baseAddress;
+			memory->reservedBaseAddress = reservation.reservedBaseAddress;
+			memory->reservedNumPlatformPages = reservation.reservedNumPlatformPages;
+		}
+		else
+		{
+			// If the code explicitly checks that memory accesses are within the memory's current size, only allocate address
+			// space for the memory's maximum size.
+			const uint64 maxPages = std::min(type.size.max,(uint64)WebAssembly::maxMemoryPages);
+			memory->endOffset = (size_t)std::min(maxPages << WebAssembly::numBytesPerPageLog2,(uint64)fullReservationBytes);
+			memory->baseAddress = allocateVirtualPagesAligned(memory->endOffset,getMemoryAlignmentBytes(),memory->reservedBaseAddress,memory->reservedNumPlatformPages);
+			if(!memory->baseAddress) { delete memory; return nullptr; }
+		}
 
 		// Grow the memory to the type's minimum size.
 		if(growMemory(memory,type.size.min) == -1) { delete memory; return nullptr; }
 
-		// Add the memory to the global array.
-		memories.push_back(memory);
+		// Add the memory's reserved address-space to the global index.
+		memoryReservations.add(memory->reservedBaseAddress,memory->reservedNumPlatformPages << Platform::getPageSizeLog2());
 		return memory;
 	}
 
 	Memory::~Memory()
 	{
-		// Decommit all default memory pages.
-		if(numPages > 0) { Platform::decommitVirtualPages(baseAddress,numPages << getPlatformPagesPerWebAssemblyPageLog2()); }
+		// Remove the memory's reserved address-space from the global index before freeing it, so it can't be confused with
+		// another memory that reuses the addresses.
+		if(reservedNumPlatformPages > 0) { memoryReservations.remove(reservedBaseAddress,reservedNumPlatformPages << Platform::getPageSizeLog2()); }
 
-		// Free the virtual address space.
-		if(reservedNumPlatformPages > 0) { Platform::freeVirtualPages(reservedBaseAddress,reservedNumPlatformPages); }
-		reservedBaseAddress = baseAddress = nullptr;
-		reservedNumPlatformPages = 0;
+		// Decommit all default memory pages.
+		if(numCommittedPages > 0) { Platform::decommitVirtualPages(baseAddress,numCommittedPages << getPlatformPagesPerWebAssemblyPageLog2()); }
 
-		// Remove the memory from the global array.
-		for(uintp memoryIndex = 0;memoryIndex < memories.size();++memoryIndex)
+		// Return a full address-space reservation to the pool if it isn't full, or free the virtual address space.
+		if(reservedNumPlatformPages > 0)
 		{
-			if(memories[memoryIndex] == this) { memories.erase(memories.begin() + memoryIndex); break; }
+			bool isPooled = false;
+			if(endOffset == fullReservationBytes)
+			{
+				MemoryReservationPool& pool = getMemoryReservationPool();
+				Platform::Lock poolLock(pool.mutex);
+				if(pool.reservations.size() < pool.stats.maxPooledReservations)
+				{
+					pool.reservations.push_back({baseAddress,reservedBaseAddress,reservedNumPlatformPages});
+					pool.stats.numPooledReservations = pool.reservations.size();
+					++pool.stats.numReturned;
+					isPooled = true;
+				}
+				else { ++pool.stats.numFreed; }
+			}
+			if(!isPooled) { Platform::freeVirtualPages(reservedBaseAddress,reservedNumPlatformPages); }
 		}
+		reservedBaseAddress = baseAddress = nullptr;
+		reservedNumPlatformPages = 0;
+	}
+	
+	bool hasFullAddressSpaceReservation(Memory* memory)
+	{
+		return memory->endOffset == fullReservationBytes;
 	}
 	
 	bool isAddressOwnedByMemory(uint8* address)
 	{
-		// Iterate over all memories and check if the address is within the reserved address space for each.
-		for(auto memory : memories)
-		{
-			uint8* startAddress = memory->reservedBaseAddress;
-			uint8* endAddress = memory->reservedBaseAddress + (memory->reservedNumPlatformPages << Platform::getPageSizeLog2());
-			if(address >= startAddress && address < endAddress) { return true; }
-		}
-		return false;
+		return memoryReservations.contains(address);
 	}
 
 	size_t getMemoryNumPages(Memory* memory) { return memory->numPages; }
@@ -89,15 +203,41 @@ namespace Runtime
 			// If the number of pages to grow would cause the memory's size to exceed its maximum, return -1.
 			if(numNewPages > memory->type.size.max || memory->numPages > memory->type.size.max - numNewPages) { return -1; }
 
-			// Try to commit the new pages, and return -1 if the commit fails.
-			if(!Platform::commitVirtualPages(
-				memory->baseAddress + (memory->numPages << WebAssembly::numBytesPerPageLog2),
-				numNewPages << getPlatformPagesPerWebAssemblyPageLog2()
-				))
+			// If the new pages wouldn't fit in the memory's reserved address-space, return -1.
+			if(memory->numPages + numNewPages > (memory->endOffset >> WebAssembly::numBytesPerPageLog2)) { return -1; }
+
+			const size_t newNumPages = memory->numPages + numNewPages;
+			if(newNumPages > memory->numCommittedPages)
 			{
-				return -1;
+				// Code that uses explicit bounds checks can't access the pages beyond the memory's size, so memories that are only
+				// used by such code commit pages ahead of their size. They commit at least twice as many pages as they had, so a
+				// memory that's grown a page at a time (e.g. by sbrk) only commits pages a logarithmic number of times. If the
+				// memory uses huge pages, it commits whole huge pages, since a huge page can only back a huge page aligned range
+				// that's entirely committed. Memories with a full address-space reservation rely on faulting on the uncommitted
+				// pages beyond their size, so they can't commit more pages than that.
+				size_t newNumCommittedPages = newNumPages;
+				if(!hasFullAddressSpaceReservation(memory))
+				{
+					newNumCommittedPages = std::max(newNumPages,memory->numPages * 2);
+					if(memory->useHugePages && Platform::getHugePageSizeLog2() > WebAssembly::numBytesPerPageLog2)
+					{
+						const size_t numPagesPerHugePage = (size_t)1 << (Platform::getHugePageSizeLog2() - WebAssembly::numBytesPerPageLog2);
+						newNumCommittedPages = (newNumCommittedPages + numPagesPerHugePage - 1) & ~(numPagesPerHugePage - 1);
+					}
+					newNumCommittedPages = std::min(newNumCommittedPages,memory->endOffset >> WebAssembly::numBytesPerPageLog2);
+				}
+
+				// Try to commit the new pages, and return -1 if the commit fails.
+				uint8* commitBaseAddress = memory->baseAddress + (memory->numCommittedPages << WebAssembly::numBytesPerPageLog2);
+				const size_t numCommitPlatformPages = (newNumCommittedPages - memory->numCommittedPages) << getPlatformPagesPerWebAssemblyPageLog2();
+				if(!Platform::commitVirtualPages(commitBaseAddress,numCommitPlatformPages)) { return -1; }
+
+				// Ask for the new pages to be backed by huge pages. This is only advice, so ignore failure.
+				if(memory->useHugePages) { Platform::adviseHugePages(commitBaseAddress,numCommitPlatformPages); }
+
+				memory->numCommittedPages = newNumCommittedPages;
 			}
-			memory->numPages += numNewPages;
+			memory->numPages = newNumPages;
 		}
 		return previousNumPages;
 	}
@@ -113,15 +253,68 @@ namespace Runtime
 			{ return -1; }
 			memory->numPages -= numPagesToShrink;
 
-			// Decommit the pages that were shrunk off the end of the memory.
+			// Decommit the pages that were shrunk off the end of the memory, and any pages committed beyond its end.
 			Platform::decommitVirtualPages(
 				memory->baseAddress + (memory->numPages << WebAssembly::numBytesPerPageLog2),
-				numPagesToShrink << getPlatformPagesPerWebAssemblyPageLog2()
+				(memory->numCommittedPages - memory->numPages) << getPlatformPagesPerWebAssemblyPageLog2()
 				);
+			memory->numCommittedPages = memory->numPages;
 		}
 		return previousNumPages;
 	}
 
+	struct MemorySnapshot
+	{
+		size_t numPages;
+
+		// The memory's contents: an image if the platform supports them, or a copy of the contents if not.
+		Platform::MemoryImage* image;
+		std::vector<uint8> data;
+
+		MemorySnapshot(size_t inNumPages): numPages(inNumPages), image(nullptr) {}
+		~MemorySnapshot() { if(image) { Platform::destroyMemoryImage(image); } }
+	};
+
+	MemorySnapshot* snapshotMemory(Memory* memory)
+	{
+		MemorySnapshot* snapshot = new MemorySnapshot(memory->numPages);
+		if(memory->numPages)
+		{
+			snapshot->image = Platform::createMemoryImage(memory->baseAddress,memory->numPages << getPlatformPagesPerWebAssemblyPageLog2());
+			if(!snapshot->image)
+			{
+				snapshot->data.assign(memory->baseAddress,memory->baseAddress + (memory->numPages << WebAssembly::numBytesPerPageLog2));
+			}
+		}
+		return snapshot;
+	}
+
+	void restoreMemory(Memory* memory,MemorySnapshot* snapshot)
+	{
+		errorUnless(snapshot->numPages >= memory->type.size.min && snapshot->numPages <= memory->type.size.max);
+
+		// Resize the memory to the snapshot's size. Shrinking the memory decommits the pages beyond the snapshot's size, so
+		// they will be zeroed if the memory is grown again.
+		if(memory->numPages > snapshot->numPages) { shrinkMemory(memory,memory->numPages - snapshot->numPages); }
+		else if(memory->numPages < snapshot->numPages)
+		{
+			if(growMemory(memory,snapshot->numPages - memory->numPages) == -1) { causeException(Exception::Cause::outOfMemory); }
+		}
+
+		if(snapshot->image)
+		{
+			// Replace the memory's pages with a new copy-on-write mapping of the image. Only the pages that were written to or
+			// read since the image was last mapped have to be unmapped, and the rest of the mapping is populated lazily.
+			if(!Platform::mapMemoryImage(snapshot->image,memory->baseAddress)) { causeException(Exception::Cause::outOfMemory); }
+		}
+		else if(snapshot->data.size()) { memcpy(memory->baseAddress,snapshot->data.data(),snapshot->data.size()); }
+	}
+
+	void deleteMemorySnapshot(MemorySnapshot* snapshot)
+	{
+		delete snapshot;
+	}
+
 	uint8* getMemoryBaseAddress(Memory* memory)
 	{
 		return memory->baseAddress;
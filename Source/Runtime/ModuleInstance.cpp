@@ -4,8 +4,6 @@
 
 namespace Runtime
 {
-	std::vector<ModuleInstance*> moduleInstances;
-	
 	Value evaluateInitializer(ModuleInstance* moduleInstance,InitializerExpression expression)
 	{
 		switch(expression.type)
@@ -35,14 +33,109 @@ namespace Runtime
 		};
 	}
 
-	ModuleInstance* instantiateModule(const Module& module,std::vector<Object*>&& imports)
+	// Returns the name of each of a module's function definitions, from its disassembly names if it has them.
+	static std::vector<std::string> getFunctionDefNames(const Module& module)
 	{
-		ModuleInstance* moduleInstance = new ModuleInstance(std::move(imports));
-		
-		// Get disassembly names for the module's objects.
 		DisassemblyNames disassemblyNames;
 		getDisassemblyNames(module,disassemblyNames);
 
+		const uintp numImportedFunctions = disassemblyNames.functions.size() - module.functionDefs.size();
+		std::vector<std::string> functionDefNames;
+		for(uintp functionDefIndex = 0;functionDefIndex < module.functionDefs.size();++functionDefIndex)
+		{
+			std::string name = std::move(disassemblyNames.functions[numImportedFunctions + functionDefIndex]);
+			if(!name.size()) { name = "<function #" + std::to_string(functionDefIndex) + ">"; }
+			functionDefNames.push_back(std::move(name));
+		}
+		return functionDefNames;
+	}
+
+	// Creates an image of a module's default memory after its data segments are copied into it. This is only possible if the
+	// module defines the memory, and the offsets of its data segments are constant and within the memory's initial size.
+	static void initMemoryImage(CompiledModule* compiledModule)
+	{
+		const Module& module = compiledModule->module;
+		if(module.memoryDefs.size() != 1) { return; }
+		const uint64 numInitialBytes = module.memoryDefs[0].size.min << WebAssembly::numBytesPerPageLog2;
+
+		// Find the range of memory that the data segments are copied to.
+		uintp beginOffset = UINTPTR_MAX;
+		uintp endOffset = 0;
+		for(auto& dataSegment : module.dataSegments)
+		{
+			if(dataSegment.baseOffset.type != InitializerExpression::Type::i32_const) { return; }
+			const uint32 baseOffset = dataSegment.baseOffset.i32;
+			if(baseOffset + dataSegment.data.size() > numInitialBytes) { return; }
+			if(dataSegment.data.size())
+			{
+				beginOffset = std::min(beginOffset,uintp(baseOffset));
+				endOffset = std::max(endOffset,uintp(baseOffset + dataSegment.data.size()));
+			}
+		}
+		if(beginOffset >= endOffset) { return; }
+
+		// Round the range out to whole platform pages, and copy the data segments into it in order.
+		const uintp pageMask = ((uintp)1 << Platform::getPageSizeLog2()) - 1;
+		beginOffset &= ~pageMask;
+		endOffset = (endOffset + pageMask) & ~pageMask;
+		compiledModule->memoryImageOffset = beginOffset;
+		compiledModule->memoryImageData.resize(endOffset - beginOffset,0);
+		for(auto& dataSegment : module.dataSegments)
+		{
+			const uintp segmentOffset = uint32(dataSegment.baseOffset.i32) - beginOffset;
+			std::copy(dataSegment.data.begin(),dataSegment.data.end(),compiledModule->memoryImageData.begin() + segmentOffset);
+		}
+		compiledModule->hasMemoryImage = true;
+
+		// If the platform supports it, create an image that can be mapped copy-on-write into new memories.
+		compiledModule->memoryImage = Platform::createMemoryImage(
+			compiledModule->memoryImageData.data(),
+			compiledModule->memoryImageData.size() >> Platform::getPageSizeLog2()
+			);
+		if(compiledModule->memoryImage) { std::vector<uint8>().swap(compiledModule->memoryImageData); }
+	}
+
+	CompiledModule* compileModule(const Module& module)
+	{
+		CompiledModule* compiledModule = new CompiledModule(module);
+		initMemoryImage(compiledModule);
+		compiledModule->jitModule = LLVMJIT::compileModule(module,getFunctionDefNames(module));
+		return compiledModule;
+	}
+
+	std::vector<uint8> compilePrecompiledObject(const Module& module)
+	{
+		return LLVMJIT::compilePrecompiledObject(module,getFunctionDefNames(module));
+	}
+
+	CompiledModule* loadPrecompiledModule(const Module& module,const std::vector<uint8>& precompiledObject)
+	{
+		LLVMJIT::JITModuleBase* jitModule = LLVMJIT::loadPrecompiledObject(module,getFunctionDefNames(module),precompiledObject);
+		if(!jitModule) { return nullptr; }
+
+		CompiledModule* compiledModule = new CompiledModule(module);
+		initMemoryImage(compiledModule);
+		compiledModule->jitModule = jitModule;
+		return compiledModule;
+	}
+
+	CompiledModule::~CompiledModule()
+	{
+		delete jitModule;
+		if(memoryImage) { Platform::destroyMemoryImage(memoryImage); }
+	}
+
+	void deleteCompiledModule(CompiledModule* compiledModule)
+	{
+		delete compiledModule;
+	}
+
+	// Instantiates a module. If compiledModule is non-null, it must be the result of compileModule for the module, and
+	// its code and memory image are used instead of compiling the module and copying its data segments.
+	static ModuleInstance* instantiateModuleImpl(const Module& module,CompiledModule* compiledModule,std::vector<Object*>&& imports)
+	{
+		ModuleInstance* moduleInstance = new ModuleInstance(std::move(imports));
+
 		// Initialize the ModuleInstance's imports.
 		errorUnless(imports.size() == module.imports.size());
 		for(uintp importIndex = 0;importIndex < module.imports.size();++importIndex)
@@ -107,8 +200,18 @@ namespace Runtime
 			{ causeException(Exception::Cause::invalidSegmentOffset); }
 		}
 
-		// Copy the module's data segments into the module's default memory.
-		for(auto& dataSegment : module.dataSegments)
+		// Copy the module's data segments into the module's default memory, or if the module was compiled with an image of
+		// its memory's initial contents, map or copy the image into the memory.
+		if(compiledModule && compiledModule->hasMemoryImage)
+		{
+			uint8* imageBaseAddress = moduleInstance->defaultMemory->baseAddress + compiledModule->memoryImageOffset;
+			if(compiledModule->memoryImage)
+			{
+				if(!Platform::mapMemoryImage(compiledModule->memoryImage,imageBaseAddress)) { causeException(Exception::Cause::outOfMemory); }
+			}
+			else { memcpy(imageBaseAddress,compiledModule->memoryImageData.data(),compiledModule->memoryImageData.size()); }
+		}
+		else for(auto& dataSegment : module.dataSegments)
 		{
 			Memory* memory = moduleInstance->memories[dataSegment.memoryIndex];
 
@@ -129,19 +232,17 @@ namespace Runtime
 			moduleInstance->globals.push_back(new GlobalInstance(global.type,initialValue));
 		}
 		
-		// Create the FunctionInstance objects for the module's function definitions.
+		// Create the FunctionInstance objects for the module's function definitions. Their code and names are set by LLVMJIT.
 		for(uintp functionDefIndex = 0;functionDefIndex < module.functionDefs.size();++functionDefIndex)
 		{
-			const uintp functionIndex = moduleInstance->functions.size();
-			auto disassemblyName = disassemblyNames.functions[functionIndex];
-			if(!disassemblyName.size()) { disassemblyName = "<function #" + std::to_string(functionDefIndex) + ">"; }
-			auto functionInstance = new FunctionInstance(moduleInstance,module.types[module.functionDefs[functionDefIndex].typeIndex],nullptr,disassemblyName.c_str());
+			auto functionInstance = new FunctionInstance(moduleInstance,module.types[module.functionDefs[functionDefIndex].typeIndex]);
 			moduleInstance->functionDefs.push_back(functionInstance);
 			moduleInstance->functions.push_back(functionInstance);
 		}
 
-		// Generate machine code for the module.
-		LLVMJIT::instantiateModule(module,moduleInstance);
+		// Generate machine code for the module, or use the code it was compiled to.
+		if(compiledModule) { LLVMJIT::instantiateCompiledModule(compiledModule->jitModule,moduleInstance); }
+		else { LLVMJIT::instantiateModule(module,getFunctionDefNames(module),moduleInstance); }
 
 		// Set up the instance's exports.
 		for(auto& exportIt : module.exports)
@@ -183,10 +284,23 @@ namespace Runtime
 			invokeFunction(moduleInstance->functions[module.startFunctionIndex],{});
 		}
 
-		moduleInstances.push_back(moduleInstance);
 		return moduleInstance;
 	}
 
+	// The instance and the objects it defines aren't referenced by the caller until it returns, so garbage isn't collected
+	// while instantiating it, including while running its start function.
+	ModuleInstance* instantiateModule(const Module& module,std::vector<Object*>&& imports)
+	{
+		ObjectMutationScope mutationScope;
+		return instantiateModuleImpl(module,nullptr,std::move(imports));
+	}
+
+	ModuleInstance* instantiateCompiledModule(CompiledModule* compiledModule,std::vector<Object*>&& imports)
+	{
+		ObjectMutationScope mutationScope;
+		return instantiateModuleImpl(compiledModule->module,compiledModule,std::move(imports));
+	}
+
 	ModuleInstance::~ModuleInstance()
 	{
 		delete jitModule;
@@ -200,4 +314,51 @@ namespace Runtime
 		auto mapIt = moduleInstance->exportMap.find(name);
 		return mapIt == moduleInstance->exportMap.end() ? nullptr : mapIt->second;
 	}
+
+	void setInstanceFuel(ModuleInstance* moduleInstance,int64 fuel) { moduleInstance->context.fuel = fuel; }
+	int64 getInstanceFuel(ModuleInstance* moduleInstance) { return moduleInstance->context.fuel; }
+
+	struct ModuleInstanceSnapshot
+	{
+		ModuleInstance* moduleInstance;
+		std::vector<std::pair<Memory*,MemorySnapshot*>> memories;
+		std::vector<std::pair<GlobalInstance*,UntaggedValue>> globals;
+
+		ModuleInstanceSnapshot(ModuleInstance* inModuleInstance): moduleInstance(inModuleInstance) {}
+		~ModuleInstanceSnapshot()
+		{
+			for(auto& memorySnapshot : memories) { deleteMemorySnapshot(memorySnapshot.second); }
+		}
+	};
+
+	static bool isImportedBy(ModuleInstance* moduleInstance,Object* object)
+	{
+		return std::find(moduleInstance->imports.begin(),moduleInstance->imports.end(),object) != moduleInstance->imports.end();
+	}
+
+	ModuleInstanceSnapshot* snapshotModuleInstance(ModuleInstance* moduleInstance)
+	{
+		ModuleInstanceSnapshot* snapshot = new ModuleInstanceSnapshot(moduleInstance);
+		for(auto memory : moduleInstance->memories)
+		{
+			if(!isImportedBy(moduleInstance,memory)) { snapshot->memories.push_back(std::make_pair(memory,snapshotMemory(memory))); }
+		}
+		for(auto global : moduleInstance->globals)
+		{
+			if(global->type.isMutable && !isImportedBy(moduleInstance,global)) { snapshot->globals.push_back(std::make_pair(global,global->value)); }
+		}
+		return snapshot;
+	}
+
+	void restoreModuleInstance(ModuleInstance* moduleInstance,ModuleInstanceSnapshot* snapshot)
+	{
+		errorUnless(snapshot->moduleInstance == moduleInstance);
+		for(auto& memorySnapshot : snapshot->memories) { restoreMemory(memorySnapshot.first,memorySnapshot.second); }
+		for(auto& globalSnapshot : snapshot->globals) { globalSnapshot.first->value = globalSnapshot.second; }
+	}
+
+	void deleteModuleInstanceSnapshot(ModuleInstanceSnapshot* snapshot)
+	{
+		delete snapshot;
+	}
 }
\ No newline at end of file
@@ -8,35 +8,86 @@
 
 namespace Runtime
 {
-	// Keep a global list of all objects.
+	// Keep a global list of all objects. The list is split into shards by the object's address, each protected by its own
+	// mutex, so threads creating and deleting objects at the same time rarely contend for the same mutex.
 	struct GCGlobals
 	{
-		std::set<GCObject*> allObjects;
+		enum { numShards = 64 };
+		struct Shard
+		{
+			Platform::Mutex mutex;
+			std::set<GCObject*> objects;
+		};
+		Shard shards[numShards];
+
+		// The number of ObjectMutationScopes in progress, and an event signaled when it drops to zero. freeUnreferencedObjects
+		// holds mutationMutex while it runs, so new scopes wait for it to finish. collectionMutex serializes collections, so
+		// only one waits for the event at a time.
+		Platform::Mutex mutationMutex;
+		uintp numMutationScopes;
+		Platform::Event noMutationScopesEvent;
+		Platform::Mutex collectionMutex;
 
 		static GCGlobals& get()
 		{
 			static GCGlobals globals;
 			return globals;
 		}
+
+		Shard& getShard(GCObject* object)
+		{
+			// Skip the low bits of the address, which are the same for all objects due to the allocator's alignment.
+			return shards[(reinterpret_cast<uintp>(object) >> 6) & (numShards - 1)];
+		}
 		
 	private:
-		GCGlobals() {}
+		GCGlobals(): numMutationScopes(0) {}
 	};
 
+	ObjectMutationScope::ObjectMutationScope()
+	{
+		GCGlobals& gcGlobals = GCGlobals::get();
+		Platform::Lock mutationLock(gcGlobals.mutationMutex);
+		++gcGlobals.numMutationScopes;
+	}
+
+	ObjectMutationScope::~ObjectMutationScope()
+	{
+		GCGlobals& gcGlobals = GCGlobals::get();
+		Platform::Lock mutationLock(gcGlobals.mutationMutex);
+		if(!--gcGlobals.numMutationScopes) { gcGlobals.noMutationScopesEvent.signal(); }
+	}
+
 	GCObject::GCObject(ObjectKind inKind): Object(inKind)
 	{
 		// Add the object to the global array.
-		GCGlobals::get().allObjects.insert(this);
+		GCGlobals::Shard& shard = GCGlobals::get().getShard(this);
+		Platform::Lock shardLock(shard.mutex);
+		shard.objects.insert(this);
 	}
 
 	GCObject::~GCObject()
 	{
 		// Remove the object from the global array.
-		GCGlobals::get().allObjects.erase(this);
+		GCGlobals::Shard& shard = GCGlobals::get().getShard(this);
+		Platform::Lock shardLock(shard.mutex);
+		shard.objects.erase(this);
 	}
 
 	void freeUnreferencedObjects(const std::vector<Object*>& rootObjectReferences)
 	{
+		// Wait until no thread is creating objects or changing references, and keep them from starting until the unreferenced
+		// objects are freed. The event may have been signaled before this waited for it, so recheck the count after waking.
+		GCGlobals& gcGlobals = GCGlobals::get();
+		Platform::Lock collectionLock(gcGlobals.collectionMutex);
+		gcGlobals.mutationMutex.Lock();
+		while(gcGlobals.numMutationScopes)
+		{
+			gcGlobals.mutationMutex.Unlock();
+			gcGlobals.noMutationScopesEvent.wait();
+			gcGlobals.mutationMutex.Lock();
+		}
+
 		std::set<Object*> referencedObjects;
 		std::vector<Object*> pendingScanObjects;
 
@@ -112,17 +163,27 @@ namespace Runtime
 		};
 
 		// Iterate over all objects, and delete objects that weren't referenced directly or indirectly by the root set.
-		GCGlobals& gcGlobals = GCGlobals::get();
-		auto objectIt = gcGlobals.allObjects.begin();
-		while(objectIt != gcGlobals.allObjects.end())
+		// The unreferenced objects in each shard are removed from it with the shard locked, then deleted after unlocking it.
+		std::vector<GCObject*> unreferencedObjects;
+		for(auto& shard : gcGlobals.shards)
 		{
-			if(referencedObjects.count(*objectIt)) { ++objectIt; }
-			else
 			{
-				Object* object = *objectIt;
-				objectIt = gcGlobals.allObjects.erase(objectIt);
-				delete object;
+				Platform::Lock shardLock(shard.mutex);
+				auto objectIt = shard.objects.begin();
+				while(objectIt != shard.objects.end())
+				{
+					if(referencedObjects.count(*objectIt)) { ++objectIt; }
+					else
+					{
+						unreferencedObjects.push_back(*objectIt);
+						objectIt = shard.objects.erase(objectIt);
+					}
+				}
 			}
+			for(auto object : unreferencedObjects) { delete object; }
+			unreferencedObjects.clear();
 		}
+
+		gcGlobals.mutationMutex.Unlock();
 	}
 }
\ No newline at end of file
@@ -3,13 +3,49 @@
 #include "Runtime.h"
 #include "RuntimePrivate.h"
 
+#include <algorithm>
+#include <atomic>
+
 namespace Runtime
 {
+	static CompileOptions compileOptions;
+
+	// The lowest stack address that WebAssembly code called by this thread may use, or zero if it isn't limited, and the
+	// number of bytes of stack each invoke by this thread may use, or zero if only the thread's stack limits it.
+	THREAD_LOCAL uintp stackLimit = 0;
+	THREAD_LOCAL size_t invokeStackBudget = 0;
+
+	// The offset of each thread's stackLimit from its thread pointer, if the platform supports reading it that way.
+	static bool hasStackLimitOffset = false;
+	static intp stackLimitOffset = 0;
+
+	// The number of bytes of stack left below the stack limit for the runtime code called by WebAssembly code: the intrinsic
+	// that throws the stackOverflow exception, and the unwinding of the stack after it's thrown.
+	enum { stackLimitReserveBytes = 64 * 1024 };
+
 	void init()
 	{
+		hasStackLimitOffset = Platform::getThreadLocalOffset(&stackLimit,stackLimitOffset);
 		LLVMJIT::init();
 		initWAVMIntrinsics();
 	}
+
+	CompileOptions getCompileOptions()
+	{
+		return compileOptions;
+	}
+
+	void setCompileOptions(const CompileOptions& newOptions)
+	{
+		errorUnless(newOptions.optimizationLevel <= 3);
+		errorUnless(newOptions.memoryBoundsCheckMode != MemoryBoundsCheckMode::guardRegion || HAS_64BIT_ADDRESS_SPACE);
+		compileOptions = newOptions;
+	}
+
+	uintp waitForTierUps()
+	{
+		return LLVMJIT::waitForTierUps();
+	}
 	
 	// Returns a vector of strings, each element describing a frame of the call stack.
 	// If the frame is a JITed function, use the JIT's information about the function
@@ -60,6 +96,220 @@ namespace Runtime
 		}
 	}
 
+	bool getStackLimitOffset(intp& outOffset)
+	{
+		outOffset = stackLimitOffset;
+		return hasStackLimitOffset;
+	}
+
+	void setInvokeStackBudget(size_t numBytes)
+	{
+		invokeStackBudget = numBytes;
+	}
+
+	// Sets the calling thread's stack limit for the duration of an invoke, and restores the limit of any outer invoke when
+	// the invoke returns or throws.
+	struct InvokeStackLimitScope
+	{
+		InvokeStackLimitScope(): outerStackLimit(stackLimit)
+		{
+			// Code that checks the stack limit reads it at the same offset from every thread's thread pointer.
+			if(hasStackLimitOffset)
+			{
+				intp threadStackLimitOffset;
+				Platform::getThreadLocalOffset(&stackLimit,threadStackLimitOffset);
+				errorUnless(threadStackLimitOffset == stackLimitOffset);
+			}
+
+			// The address of a local is a close enough approximation of the stack pointer.
+			uint8 stackMarker;
+			const uintp stackPointer = reinterpret_cast<uintp>(&stackMarker);
+
+			// Leave enough of the thread's stack below the limit for the runtime to handle the stack overflow. If the invoke
+			// isn't on the thread's stack, the stack it is on must have been limited by an outer scope.
+			uintp newStackLimit = outerStackLimit;
+			uint8* threadStackMinAddr;
+			uint8* threadStackMaxAddr;
+			Platform::getThreadStack(threadStackMinAddr,threadStackMaxAddr);
+			if(stackPointer >= reinterpret_cast<uintp>(threadStackMinAddr) && stackPointer < reinterpret_cast<uintp>(threadStackMaxAddr))
+			{
+				newStackLimit = std::max(newStackLimit,reinterpret_cast<uintp>(threadStackMinAddr) + stackLimitReserveBytes);
+			}
+
+			// Limit the invoke to the budget from the current stack pointer, within the limit of any outer invoke.
+			if(invokeStackBudget) { newStackLimit = std::max(newStackLimit,stackPointer - std::min(stackPointer,invokeStackBudget)); }
+
+			stackLimit = newStackLimit;
+		}
+		~InvokeStackLimitScope() { stackLimit = outerStackLimit; }
+
+	private:
+		uintp outerStackLimit;
+	};
+
+	// The current epoch and the number of invokes in progress that started in it, packed into one word so starting an invoke
+	// reads the epoch and counts the invoke in it atomically. Only the outermost invoke on each thread or fiber is counted,
+	// since the invokes nested in it are interrupted with it.
+	enum { epochNumInvokesBits = 24 };
+	static const uint64 epochNumInvokesMask = (uint64(1) << epochNumInvokesBits) - 1;
+	static std::atomic<uint64> epochAndNumInvokes(0);
+
+	// The number of invokes in progress that started before the current epoch. Code compiled with CompileOptions::pollEpoch
+	// polls it, and only calls into the runtime to check whether its own invoke was interrupted while it's nonzero. The
+	// invokes counted in an epoch are added to it after the epoch is incremented, so it may briefly wrap below zero if one of
+	// them finishes first, which only makes polling code call into the runtime.
+	static std::atomic<uint32> numInterruptedInvokes(0);
+
+	// The epoch the outermost invoke running on this thread or fiber started in, or noInvokeEpoch if it isn't running an invoke.
+	static const uint64 noInvokeEpoch = UINT64_MAX;
+	static THREAD_LOCAL uint64 invokeEpoch = noInvokeEpoch;
+
+	static uint64 unpackEpoch(uint64 epochAndNumInvokesValue) { return epochAndNumInvokesValue >> epochNumInvokesBits; }
+
+	uint64 incrementEpoch()
+	{
+		// Move to the next epoch with no invokes, and count the previous epoch's invokes as interrupted.
+		uint64 previousValue = epochAndNumInvokes.load();
+		while(!epochAndNumInvokes.compare_exchange_weak(previousValue,(unpackEpoch(previousValue) + 1) << epochNumInvokesBits)) {}
+		const uint32 numPreviousEpochInvokes = uint32(previousValue & epochNumInvokesMask);
+		if(numPreviousEpochInvokes) { numInterruptedInvokes += numPreviousEpochInvokes; }
+		return unpackEpoch(previousValue) + 1;
+	}
+
+	uint64 getEpoch()
+	{
+		return unpackEpoch(epochAndNumInvokes.load());
+	}
+
+	const uint32* getEpochInterruptPendingAddress()
+	{
+		return reinterpret_cast<const uint32*>(&numInterruptedInvokes);
+	}
+
+	bool isInvokeInterrupted()
+	{
+		return invokeEpoch < getEpoch();
+	}
+
+	// Records the epoch an outermost invoke started in for the duration of the invoke.
+	struct InvokeEpochScope
+	{
+		InvokeEpochScope(): isOutermostInvoke(invokeEpoch == noInvokeEpoch)
+		{
+			if(isOutermostInvoke)
+			{
+				const uint64 previousValue = epochAndNumInvokes.fetch_add(1);
+				errorUnless((previousValue & epochNumInvokesMask) != epochNumInvokesMask);
+				invokeEpoch = unpackEpoch(previousValue);
+			}
+		}
+		~InvokeEpochScope()
+		{
+			if(isOutermostInvoke)
+			{
+				// If the epoch hasn't been incremented since the invoke started, it's still counted in the current epoch.
+				// Otherwise, it was counted as interrupted when the epoch was incremented.
+				bool wasInterrupted = true;
+				uint64 value = epochAndNumInvokes.load();
+				while(unpackEpoch(value) == invokeEpoch)
+				{
+					if(epochAndNumInvokes.compare_exchange_weak(value,value - 1)) { wasInterrupted = false; break; }
+				}
+				if(wasInterrupted) { --numInterruptedInvokes; }
+				invokeEpoch = noInvokeEpoch;
+			}
+		}
+
+	private:
+		bool isOutermostInvoke;
+	};
+
+	// Truncates the call stack of a trap caught by catchTrapsAsExceptions to the frames of the code it invoked. The frames
+	// the trap call stack shares with the call stack of catchTrapsAsExceptions's callers are outside the invoke, as are the
+	// frames between catchHardwareTraps and the outermost WebAssembly function, which belong to the runtime's invoke code.
+	static FORCENOINLINE void truncateTrapCallStack(Platform::CallStack& trapCallStack)
+	{
+		// Compare the call stacks from the outermost frame, so the WebAssembly frames of an outer invoke aren't mistaken for
+		// this invoke's. The frame of catchTrapsAsExceptions itself is at a different call site in each call stack.
+		const Platform::CallStack callerStack = Platform::captureCallStack();
+		uintp numInvokeFrames = trapCallStack.stackFrames.size();
+		uintp numCallerFrames = callerStack.stackFrames.size();
+		while(numInvokeFrames && numCallerFrames
+		&& trapCallStack.stackFrames[numInvokeFrames - 1].ip == callerStack.stackFrames[numCallerFrames - 1].ip)
+		{
+			--numInvokeFrames;
+			--numCallerFrames;
+		}
+
+		// Drop the runtime's frames outside the outermost WebAssembly function. If the trap wasn't in a WebAssembly function
+		// or code it called (e.g. in an intrinsic invoked directly), keep all the frames in the invoke.
+		uintp numFramesToWebAssembly = numInvokeFrames;
+		while(numFramesToWebAssembly && !LLVMJIT::isFunctionDefInstructionPointer(trapCallStack.stackFrames[numFramesToWebAssembly - 1].ip))
+		{
+			--numFramesToWebAssembly;
+		}
+		trapCallStack.stackFrames.resize(numFramesToWebAssembly ? numFramesToWebAssembly : numInvokeFrames);
+	}
+
+	// Calls a thunk, and turns any hardware traps it causes into a Runtime::Exception.
+	static void catchTrapsAsExceptions(const std::function<void()>& thunk)
+	{
+		InvokeStackLimitScope stackLimitScope;
+		InvokeEpochScope epochScope;
+
+		Platform::CallStack trapCallStack;
+		uintp trapOperand;
+		Platform::HardwareTrapType trapType = Platform::catchHardwareTraps(trapCallStack,trapOperand,thunk);
+
+		// If there was no hardware trap, just return.
+		if(trapType == Platform::HardwareTrapType::none) { return; }
+
+		// The call stack is only captured after a trap, so it's only truncated to the invoked code then.
+		truncateTrapCallStack(trapCallStack);
+
+		std::vector<std::string> callStackDescription = describeCallStack(trapCallStack);
+
+		switch(trapType)
+		{
+		case Platform::HardwareTrapType::accessViolation:
+		{
+			// If the access violation occured in a Table's reserved pages, treat it as an undefined table element runtime error.
+			if(isAddressOwnedByTable(reinterpret_cast<uint8*>(trapOperand))) { throw Exception { Exception::Cause::undefinedTableElement, callStackDescription }; }
+			// If the access violation occured in a Memory's reserved pages, treat it as an access violation runtime error.
+			else if(isAddressOwnedByMemory(reinterpret_cast<uint8*>(trapOperand))) { throw Exception { Exception::Cause::accessViolation, callStackDescription }; }
+			else
+			{
+				// If the access violation occured outside of a Table or Memory, treat it as a bug (possibly a security hole)
+				// rather than a runtime error in the WebAssembly code.
+				Log::printf(Log::Category::error,"Access violation outside of table or memory reserved addresses. Call stack:\n");
+				for(auto calledFunction : callStackDescription) { Log::printf(Log::Category::error,"  %s\n",calledFunction.c_str()); }
+				Core::errorf("");
+			}
+		}
+		case Platform::HardwareTrapType::stackOverflow: throw Exception { Exception::Cause::stackOverflow, callStackDescription };
+		case Platform::HardwareTrapType::intDivideByZeroOrOverflow: throw Exception { Exception::Cause::integerDivideByZeroOrIntegerOverflow, callStackDescription };
+		case Platform::HardwareTrapType::illegalInstruction:
+		{
+			// Code compiled with CompileOptions::useHardwareTraps executes an undefined instruction for unreachable, and that's
+			// the only illegal instruction the code compiled for WebAssembly functions contains. An illegal instruction
+			// anywhere else is a bug in the runtime.
+			if(LLVMJIT::isFunctionDefInstructionPointer(trapOperand)) { throw Exception { Exception::Cause::reachedUnreachable, callStackDescription }; }
+			else
+			{
+				Log::printf(Log::Category::error,"Illegal instruction outside of WebAssembly code. Call stack:\n");
+				for(auto calledFunction : callStackDescription) { Log::printf(Log::Category::error,"  %s\n",calledFunction.c_str()); }
+				Core::errorf("");
+			}
+		}
+		default: Core::unreachable();
+		};
+	}
+
+	void catchRuntimeTraps(const std::function<void()>& thunk)
+	{
+		catchTrapsAsExceptions(thunk);
+	}
+
 	Result invokeFunction(FunctionInstance* function,const std::vector<Value>& parameters)
 	{
 		const FunctionType* functionType = function->type;
@@ -82,19 +332,13 @@ namespace Runtime
 		// Get the invoke thunk for this function type.
 		LLVMJIT::InvokeFunctionPointer invokeFunctionPointer = LLVMJIT::getInvokeThunk(functionType);
 
-		// Catch platform-specific runtime exceptions and turn them into Runtime::Values.
+		// Catch platform-specific runtime exceptions and turn them into Runtime::Exceptions.
 		Result result;
-		Platform::HardwareTrapType trapType;
-		Platform::CallStack trapCallStack;
-		Platform::CallStack callerStack;
-		uintp trapOperand;
-		trapType = Platform::catchHardwareTraps(trapCallStack,trapOperand,
+		catchTrapsAsExceptions(
 			[&]
 			{
-				callerStack = Platform::captureCallStack();
-
 				// Call the invoke thunk.
-				(*invokeFunctionPointer)(function->nativeFunction,thunkMemory);
+				(*invokeFunctionPointer)(LLVMJIT::getFunctionEntry(function),getFunctionContext(function),thunkMemory);
 
 				// Read the return value out of the thunk memory block.
 				if(functionType->ret != ResultType::none)
@@ -103,41 +347,243 @@ namespace Runtime
 					result.i64 = thunkMemory[functionType->parameters.size()];
 				}
 			});
+		return result;
+	}
 
-		// If there was no hardware trap, just return the result.
-		if(trapType == Platform::HardwareTrapType::none) { return result; }
-		else
-		{		
-			// Truncate the stack frame to the native code invoking the function.
-			if(trapCallStack.stackFrames.size() >= callerStack.stackFrames.size() + 1)
+	struct InvokeFiber
+	{
+		Platform::Fiber* fiber;
+		size_t numStackBytes;
+
+		// The function the fiber is invoking and its parameters, and once the invoke has finished, its result or the exception
+		// it threw.
+		FunctionInstance* function;
+		std::vector<Value> parameters;
+		bool isFinished;
+		bool didThrow;
+
+		// Whether the invoke is being cancelled, so the yieldInvokeFiber call that suspended it throws when it's resumed.
+		bool isCancelled;
+		Result result;
+		Exception exception;
+
+		// While the invoke is running, the fiber that resumed it, the invoke that fiber was running, and that fiber's stack
+		// limit and invoke epoch. While the invoke is suspended, its stack limit and invoke epoch, and the thread that must
+		// resume it, identified by the address of its currentInvokeFiber variable.
+		Platform::Fiber* resumingFiber;
+		InvokeFiber* resumingInvokeFiber;
+		uintp resumingStackLimit;
+		uint64 resumingInvokeEpoch;
+		uintp suspendedStackLimit;
+		uint64 suspendedInvokeEpoch;
+		const void* suspendedThread;
+	};
+
+	// The invoke running on the thread's current fiber, or null if the thread isn't running an invoke on a fiber.
+	static THREAD_LOCAL InvokeFiber* currentInvokeFiber = nullptr;
+
+	struct InvokeFiberPool
+	{
+		Platform::Mutex mutex;
+		std::vector<InvokeFiber*> fibers;
+		size_t numStackBytes;
+		uintp maxPooledFibers;
+
+		InvokeFiberPool(): numStackBytes(1024 * 1024), maxPooledFibers(16) {}
+	};
+
+	static InvokeFiberPool& getInvokeFiberPool()
+	{
+		static InvokeFiberPool pool;
+		return pool;
+	}
+
+	static void destroyInvokeFiber(InvokeFiber* invokeFiber)
+	{
+		Platform::destroyFiber(invokeFiber->fiber);
+		delete invokeFiber;
+	}
+
+	// Returns a finished invoke's fiber to the pool, unless the pool is full or the fiber's stack size is no longer the pool's.
+	static void releaseInvokeFiber(InvokeFiber* invokeFiber)
+	{
+		invokeFiber->parameters.clear();
+		invokeFiber->exception = Exception();
+		{
+			InvokeFiberPool& pool = getInvokeFiberPool();
+			Platform::Lock lock(pool.mutex);
+			if(pool.fibers.size() < pool.maxPooledFibers && invokeFiber->numStackBytes == pool.numStackBytes)
 			{
-				trapCallStack.stackFrames.resize(trapCallStack.stackFrames.size() - callerStack.stackFrames.size() -1);
+				pool.fibers.push_back(invokeFiber);
+				return;
 			}
+		}
+		destroyInvokeFiber(invokeFiber);
+	}
 
-			std::vector<std::string> callStackDescription = describeCallStack(trapCallStack);
+	// Switches the thread from the fiber that's running to an invoke's fiber. The thread's state is switched before the fiber,
+	// since the fiber may have been suspended on a different thread. These functions aren't inlined, so their callers can't
+	// reuse the addresses of thread-local variables computed before the switch after the fiber is resumed by another thread.
+	static FORCENOINLINE void switchToInvokeFiber(InvokeFiber* invokeFiber)
+	{
+		invokeFiber->resumingFiber = Platform::getCurrentFiber();
+		invokeFiber->resumingInvokeFiber = currentInvokeFiber;
+		invokeFiber->resumingStackLimit = stackLimit;
+		invokeFiber->resumingInvokeEpoch = invokeEpoch;
+		invokeFiber->suspendedThread = nullptr;
+		stackLimit = invokeFiber->suspendedStackLimit;
+		invokeEpoch = invokeFiber->suspendedInvokeEpoch;
+		currentInvokeFiber = invokeFiber;
+		Platform::switchToFiber(invokeFiber->fiber);
+	}
 
-			switch(trapType)
+	// Switches the thread from an invoke's fiber back to the fiber that resumed it.
+	static FORCENOINLINE void switchFromInvokeFiber(InvokeFiber* invokeFiber)
+	{
+		invokeFiber->suspendedStackLimit = stackLimit;
+		invokeFiber->suspendedInvokeEpoch = invokeEpoch;
+		invokeFiber->suspendedThread = &currentInvokeFiber;
+		stackLimit = invokeFiber->resumingStackLimit;
+		invokeEpoch = invokeFiber->resumingInvokeEpoch;
+		currentInvokeFiber = invokeFiber->resumingInvokeFiber;
+		Platform::switchToFiber(invokeFiber->resumingFiber);
+	}
+
+	// Runs an invoke on its fiber, and records its result or exception. Like the switch functions, this isn't inlined into
+	// invokeFiberEntry, since a pooled fiber may run each invoke on a different thread.
+	static FORCENOINLINE void runInvokeFiber(InvokeFiber* invokeFiber)
+	{
+		try { invokeFiber->result = invokeFunction(invokeFiber->function,invokeFiber->parameters); }
+		catch(const Exception& exception)
+		{
+			invokeFiber->didThrow = true;
+			invokeFiber->exception = exception;
+		}
+		invokeFiber->isFinished = true;
+	}
+
+	static void invokeFiberEntry(void* argument)
+	{
+		InvokeFiber* invokeFiber = (InvokeFiber*)argument;
+		while(true)
+		{
+			runInvokeFiber(invokeFiber);
+
+			// Switch back to the thread that resumed the invoke. If the fiber is reused for another invoke, it resumes here.
+			switchFromInvokeFiber(invokeFiber);
+		}
+	}
+
+	InvokeFiber* startInvokeOnFiber(FunctionInstance* function,const std::vector<Value>& parameters)
+	{
+		// Take a fiber from the pool, or create a new one if the pool is empty.
+		InvokeFiber* invokeFiber = nullptr;
+		size_t numStackBytes;
+		{
+			InvokeFiberPool& pool = getInvokeFiberPool();
+			Platform::Lock lock(pool.mutex);
+			numStackBytes = pool.numStackBytes;
+			if(pool.fibers.size())
 			{
-			case Platform::HardwareTrapType::accessViolation:
+				invokeFiber = pool.fibers.back();
+				pool.fibers.pop_back();
+			}
+		}
+		if(!invokeFiber)
+		{
+			invokeFiber = new InvokeFiber();
+			invokeFiber->numStackBytes = numStackBytes;
+			invokeFiber->fiber = Platform::createFiber(numStackBytes,invokeFiberEntry,invokeFiber);
+			if(!invokeFiber->fiber)
 			{
-				// If the access violation occured in a Table's reserved pages, treat it as an undefined table element runtime error.
-				if(isAddressOwnedByTable(reinterpret_cast<uint8*>(trapOperand))) { throw Exception { Exception::Cause::undefinedTableElement, callStackDescription }; }
-				// If the access violation occured in a Memory's reserved pages, treat it as an access violation runtime error.
-				else if(isAddressOwnedByMemory(reinterpret_cast<uint8*>(trapOperand))) { throw Exception { Exception::Cause::accessViolation, callStackDescription }; }
-				else
-				{
-					// If the access violation occured outside of a Table or Memory, treat it as a bug (possibly a security hole)
-					// rather than a runtime error in the WebAssembly code.
-					Log::printf(Log::Category::error,"Access violation outside of table or memory reserved addresses. Call stack:\n");
-					for(auto calledFunction : callStackDescription) { Log::printf(Log::Category::error,"  %s\n",calledFunction.c_str()); }
-					Core::errorf("");
-				}
+				delete invokeFiber;
+				causeException(Exception::Cause::outOfMemory);
+			}
+		}
+
+		invokeFiber->function = function;
+		invokeFiber->parameters = parameters;
+		invokeFiber->isFinished = false;
+		invokeFiber->didThrow = false;
+		invokeFiber->isCancelled = false;
+		invokeFiber->result = Result();
+		invokeFiber->suspendedStackLimit = 0;
+		invokeFiber->suspendedInvokeEpoch = noInvokeEpoch;
+		switchToInvokeFiber(invokeFiber);
+		return invokeFiber;
+	}
+
+	void resumeInvokeFiber(InvokeFiber* invokeFiber)
+	{
+		errorUnless(!invokeFiber->isFinished && invokeFiber->suspendedThread == &currentInvokeFiber);
+		switchToInvokeFiber(invokeFiber);
+	}
+
+	bool isInvokeFiberFinished(InvokeFiber* invokeFiber)
+	{
+		return invokeFiber->isFinished;
+	}
+
+	Result finishInvokeFiber(InvokeFiber* invokeFiber)
+	{
+		errorUnless(invokeFiber->isFinished);
+		const Result result = invokeFiber->result;
+		const bool didThrow = invokeFiber->didThrow;
+		const Exception exception = std::move(invokeFiber->exception);
+		releaseInvokeFiber(invokeFiber);
+
+		if(didThrow) { throw exception; }
+		return result;
+	}
+
+	void cancelInvokeFiber(InvokeFiber* invokeFiber)
+	{
+		// Resume the invoke until it finishes, with each yieldInvokeFiber call that suspended it throwing an exception. That
+		// unwinds the invoke's stack, so it no longer counts as an invoke in progress, and its fiber can be reused.
+		invokeFiber->isCancelled = true;
+		while(!invokeFiber->isFinished) { resumeInvokeFiber(invokeFiber); }
+		releaseInvokeFiber(invokeFiber);
+	}
+
+	void yieldInvokeFiber()
+	{
+		InvokeFiber* invokeFiber = currentInvokeFiber;
+		errorUnless(invokeFiber);
+		switchFromInvokeFiber(invokeFiber);
+		if(invokeFiber->isCancelled) { causeException(Exception::Cause::interrupted); }
+	}
+
+	InvokeFiber* getCurrentInvokeFiber()
+	{
+		return currentInvokeFiber;
+	}
+
+	void setInvokeFiberPool(size_t numStackBytes,uintp maxPooledFibers)
+	{
+		// Each invoke leaves stackLimitReserveBytes of the fiber's stack for the runtime, so the stack must be larger than that.
+		errorUnless(numStackBytes >= 2 * stackLimitReserveBytes);
+
+		std::vector<InvokeFiber*> freedFibers;
+		{
+			InvokeFiberPool& pool = getInvokeFiberPool();
+			Platform::Lock lock(pool.mutex);
+			pool.numStackBytes = numStackBytes;
+			pool.maxPooledFibers = maxPooledFibers;
+			std::vector<InvokeFiber*> keptFibers;
+			for(auto invokeFiber : pool.fibers)
+			{
+				if(invokeFiber->numStackBytes == numStackBytes && keptFibers.size() < maxPooledFibers) { keptFibers.push_back(invokeFiber); }
+				else { freedFibers.push_back(invokeFiber); }
 			}
-			case Platform::HardwareTrapType::stackOverflow: throw Exception { Exception::Cause::stackOverflow, callStackDescription };
-			case Platform::HardwareTrapType::intDivideByZeroOrOverflow: throw Exception { Exception::Cause::integerDivideByZeroOrIntegerOverflow, callStackDescription };
-			default: Core::unreachable();
-			};
+			pool.fibers = std::move(keptFibers);
 		}
+		for(auto invokeFiber : freedFibers) { destroyInvokeFiber(invokeFiber); }
+	}
+
+	void getFunctionEntryAndContext(FunctionInstance* function,void*& outEntry,void*& outContext)
+	{
+		outEntry = LLVMJIT::getFunctionEntry(function);
+		outContext = getFunctionContext(function);
 	}
 
 	const FunctionType* getFunctionType(FunctionInstance* function)
@@ -147,6 +593,7 @@ namespace Runtime
 
 	GlobalInstance* createGlobal(GlobalType type,Value initialValue)
 	{
+		ObjectMutationScope mutationScope;
 		return new GlobalInstance(type,initialValue);
 	}
 
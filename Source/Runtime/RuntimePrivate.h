@@ -20,13 +20,46 @@ namespace LLVMJIT
 	};
 
 	void init();
-	void instantiateModule(const WebAssembly::Module& module,Runtime::ModuleInstance* moduleInstance);
+
+	// Compiles a module's code for a module instance, and points the instance's function definitions at it.
+	// functionDefNames gives the name of each of the module's function definitions.
+	void instantiateModule(const WebAssembly::Module& module,std::vector<std::string>&& functionDefNames,Runtime::ModuleInstance* moduleInstance);
+
+	// Compiles instance-independent code for a module, which may be used to instantiate any number of instances of the module
+	// without compiling it again. The returned JITModuleBase holds a reference to the code until it is deleted.
+	JITModuleBase* compileModule(const WebAssembly::Module& module,std::vector<std::string>&& functionDefNames);
+
+	// Points a module instance's function definitions at the code compiled for its module by compileModule.
+	void instantiateCompiledModule(JITModuleBase* compiledModule,Runtime::ModuleInstance* moduleInstance);
+
+	// Compiles instance-independent code for a module to a precompiled object that may be loaded by loadPrecompiledObject.
+	std::vector<uint8> compilePrecompiledObject(const WebAssembly::Module& module,std::vector<std::string>&& functionDefNames);
+
+	// Loads the code in a precompiled object for a module. Like compileModule, the returned JITModuleBase may be used by
+	// instantiateCompiledModule. Returns null if the object wasn't compiled for the module with a compatible configuration.
+	JITModuleBase* loadPrecompiledObject(
+		const WebAssembly::Module& module,
+		std::vector<std::string>&& functionDefNames,
+		const std::vector<uint8>& precompiledObject);
+
 	bool describeInstructionPointer(uintp ip,std::string& outDescription);
+
+	// Waits for the functions that tiered code has requested optimizing to be optimized, and returns the number of functions
+	// that have been optimized.
+	uintp waitForTierUps();
+
+	// Returns whether an instruction pointer is in the code compiled for a WebAssembly function definition.
+	bool isFunctionDefInstructionPointer(uintp ip);
 	
-	typedef void (*InvokeFunctionPointer)(void*,uint64*);
+	typedef void (*InvokeFunctionPointer)(void*,void*,uint64*);
 
 	// Generates an invoke thunk for a specific function type.
 	InvokeFunctionPointer getInvokeThunk(const WebAssembly::FunctionType* functionType);
+
+	// Returns a pointer to code that calls a function using the calling convention of JIT compiled WebAssembly functions,
+	// which take a pointer to their instance's context as a hidden first parameter. For an intrinsic function, this is a
+	// thunk that discards the context parameter and calls the intrinsic's native function.
+	void* getFunctionEntry(Runtime::FunctionInstance* function);
 }
 
 namespace Runtime
@@ -40,13 +73,24 @@ namespace Runtime
 		~GCObject() override;
 	};
 
+	// Held by a thread while it creates objects or changes the objects an object references. freeUnreferencedObjects waits
+	// until no thread is in one of these scopes, and keeps new scopes from starting until it finishes, so it doesn't free an
+	// object that's still being created, or scan references that are being changed. Scopes may be nested.
+	struct ObjectMutationScope
+	{
+		ObjectMutationScope();
+		~ObjectMutationScope();
+	};
+
 	// An instance of a function: a function defined in an instantiated module, or an intrinsic function.
 	struct FunctionInstance : GCObject
 	{
 		ModuleInstance* moduleInstance;
 		const FunctionType* type;
 		void* nativeFunction;
-		std::string debugName;
+
+		// For a function defined by a module, this points to the name stored with the code compiled for the module.
+		const char* debugName;
 
 		FunctionInstance(ModuleInstance* inModuleInstance,const FunctionType* inType,void* inNativeFunction = nullptr,const char* inDebugName = "<unidentified FunctionInstance>")
 		: GCObject(ObjectKind::function), moduleInstance(inModuleInstance), type(inType), nativeFunction(inNativeFunction), debugName(inDebugName) {}
@@ -55,16 +99,21 @@ namespace Runtime
 	// An instance of a WebAssembly Table.
 	struct Table : GCObject
 	{
+		// The data used by call_indirect for each element: the signature index of the element's function type, or zero if
+		// the element is null, and the function's entry and context.
 		struct FunctionElement
 		{
-			const FunctionType* type;
+			uintp signatureIndex;
 			void* value;
+			struct InstanceContext* context;
 		};
 
 		TableType type;
 
+		// The table's FunctionElements, and the number of elements that fit in its reserved address-space. Indices below
+		// endIndex but beyond the table's size access zeroed elements or uncommitted pages.
 		FunctionElement* baseAddress;
-		size_t endOffset;
+		size_t endIndex;
 
 		uint8* reservedBaseAddress;
 		size_t reservedNumPlatformPages;
@@ -72,7 +121,7 @@ namespace Runtime
 		// The Objects corresponding to the FunctionElements at baseAddress.
 		std::vector<Object*> elements;
 
-		Table(const TableType& inType): GCObject(ObjectKind::table), type(inType), baseAddress(nullptr), endOffset(0), reservedBaseAddress(nullptr), reservedNumPlatformPages(0) {}
+		Table(const TableType& inType): GCObject(ObjectKind::table), type(inType), baseAddress(nullptr), endIndex(0), reservedBaseAddress(nullptr), reservedNumPlatformPages(0) {}
 		~Table() override;
 	};
 
@@ -85,10 +134,16 @@ namespace Runtime
 		size_t numPages;
 		size_t endOffset;
 
+		// The number of pages committed at baseAddress; may exceed numPages for memories only accessed with explicit bounds checks.
+		size_t numCommittedPages;
+		bool useHugePages;
+
 		uint8* reservedBaseAddress;
 		size_t reservedNumPlatformPages;
 
-		Memory(const MemoryType& inType): GCObject(ObjectKind::memory), type(inType), baseAddress(nullptr), numPages(0), endOffset(0), reservedBaseAddress(nullptr), reservedNumPlatformPages(0) {}
+		Memory(const MemoryType& inType)
+		: GCObject(ObjectKind::memory), type(inType), baseAddress(nullptr), numPages(0), endOffset(0), numCommittedPages(0), useHugePages(false)
+		, reservedBaseAddress(nullptr), reservedNumPlatformPages(0) {}
 		~Memory() override;
 	};
 
@@ -101,6 +156,35 @@ namespace Runtime
 		GlobalInstance(GlobalType inType,UntaggedValue inValue): GCObject(ObjectKind::global), type(inType), value(inValue) {}
 	};
 
+	// The state of a module instance that is accessed by its JIT compiled code. A pointer to the context is passed to the
+	// instance's functions as a hidden first parameter. Code compiled to be shared between instances of a module references
+	// the instance's memory, table, globals, and imported functions through it.
+	struct InstanceContext
+	{
+		struct ImportedFunction
+		{
+			void* nativeFunction;
+			InstanceContext* context;
+		};
+
+		uint8* defaultMemoryBase;
+		uintp defaultMemoryAddressMask;
+		const size_t* defaultMemoryNumPages;
+		Memory* defaultMemory;
+
+		Table::FunctionElement* defaultTableBase;
+		uintp defaultTableEndIndex;
+		Table* defaultTable;
+
+		UntaggedValue** globalValues;
+		ImportedFunction* importedFunctions;
+
+		ModuleInstance* moduleInstance;
+
+		// The fuel left for code compiled with CompileOptions::meterFuel, which traps when a charge makes it negative.
+		int64 fuel;
+	};
+
 	// An instance of a WebAssembly module.
 	struct ModuleInstance : GCObject
 	{
@@ -117,6 +201,10 @@ namespace Runtime
 		Memory* defaultMemory;
 		Table* defaultTable;
 
+		InstanceContext context;
+		std::vector<UntaggedValue*> contextGlobalValues;
+		std::vector<InstanceContext::ImportedFunction> contextImportedFunctions;
+
 		LLVMJIT::JITModuleBase* jitModule;
 
 		ModuleInstance(std::vector<Object*>&& inImports)
@@ -124,18 +212,99 @@ namespace Runtime
 		, imports(inImports)
 		, defaultMemory(nullptr)
 		, defaultTable(nullptr)
+		, context({0})
 		, jitModule(nullptr)
-		{}
+		{
+			context.moduleInstance = this;
+			context.fuel = INT64_MAX;
+		}
 
 		~ModuleInstance() override;
 	};
 
+	// A module that has been compiled for instantiation by instantiateCompiledModule.
+	struct CompiledModule
+	{
+		Module module;
+		LLVMJIT::JITModuleBase* jitModule;
+
+		// If hasMemoryImage is true, the initial contents of the module's default memory starting at memoryImageOffset, after
+		// the module's data segments are copied into it. If the platform supports memory images, memoryImage can be mapped
+		// copy-on-write into new memories. Otherwise, memoryImage is null and memoryImageData is copied into them.
+		bool hasMemoryImage;
+		uintp memoryImageOffset;
+		std::vector<uint8> memoryImageData;
+		Platform::MemoryImage* memoryImage;
+
+		CompiledModule(const Module& inModule)
+		: module(inModule), jitModule(nullptr), hasMemoryImage(false), memoryImageOffset(0), memoryImage(nullptr) {}
+		~CompiledModule();
+	};
+
+	// Returns the context to pass to a function: its module instance's context, or null for intrinsic functions.
+	inline InstanceContext* getFunctionContext(FunctionInstance* function)
+	{
+		return function->moduleInstance ? &function->moduleInstance->context : nullptr;
+	}
+
+	// If code compiled for this platform can check the stack limit, returns true, and the offset of each thread's stack
+	// limit from its thread pointer. The stack limit is the lowest stack address that WebAssembly code called by the thread
+	// may use, or zero if it isn't limited.
+	bool getStackLimitOffset(intp& outOffset);
+
+	// Returns the address of the word that code compiled with CompileOptions::pollEpoch polls: it's nonzero while an invoke
+	// that was interrupted by incrementEpoch is in progress. isInvokeInterrupted returns whether the invoke running on the
+	// calling thread or fiber is one of them.
+	const uint32* getEpochInterruptPendingAddress();
+	bool isInvokeInterrupted();
+
 	// Initializes global state used by the WAVM intrinsics.
 	void initWAVMIntrinsics();
 
+	// Returns whether a memory reserved enough address-space to be accessed by code that doesn't explicitly bounds check its
+	// accesses: the address-space reserved if the MemoryBoundsCheckMode isn't explicitChecks when the memory is created.
+	bool hasFullAddressSpaceReservation(Memory* memory);
+
+	// Returns the process-wide signature index of a function type, which call_indirect compares against the signature index
+	// stored in a table element. Signature indices are assigned in the order function types are first used, starting at 1;
+	// 0 is the signature index of null table elements. getSignatureIndexType maps a signature index back to its function type,
+	// or to null if the index hasn't been assigned.
+	uintp getSignatureIndex(const FunctionType* type);
+	const FunctionType* getSignatureIndexType(uintp signatureIndex);
+
 	// Checks whether an address is owned by a table or memory.
 	bool isAddressOwnedByTable(uint8* address);
 	bool isAddressOwnedByMemory(uint8* address);
+
+	// An index of the address ranges reserved by some kind of object. The ranges are ordered by address, so finding the range
+	// that contains an address, and adding or removing a range, take O(log n) time. It's safe to use from multiple threads.
+	struct AddressReservationIndex
+	{
+		void add(uint8* baseAddress,size_t numBytes)
+		{
+			Platform::Lock lock(mutex);
+			endToBaseAddressMap[baseAddress + numBytes] = baseAddress;
+		}
+
+		void remove(uint8* baseAddress,size_t numBytes)
+		{
+			Platform::Lock lock(mutex);
+			auto mapIt = endToBaseAddressMap.find(baseAddress + numBytes);
+			if(mapIt != endToBaseAddressMap.end() && mapIt->second == baseAddress) { endToBaseAddressMap.erase(mapIt); }
+		}
+
+		bool contains(uint8* address)
+		{
+			// Find the range with the lowest end address above the address, and check whether it starts at or below the address.
+			Platform::Lock lock(mutex);
+			auto mapIt = endToBaseAddressMap.upper_bound(address);
+			return mapIt != endToBaseAddressMap.end() && address >= mapIt->second;
+		}
+
+	private:
+		Platform::Mutex mutex;
+		std::map<uint8*,uint8*> endToBaseAddressMap;
+	};
 	
 	// Allocates virtual pages with alignBytes of padding, and returns an aligned base address.
 	// The unaligned allocation address and size are written to outUnalignedBaseAddress and outUnalignedNumPlatformPages.
@@ -5,8 +5,31 @@
 
 namespace Runtime
 {
-	// Global lists of tables; used to query whether an address is reserved by one of them.
-	std::vector<Table*> tables;
+	// A global index of the address-space reserved by tables; used to query whether an address is reserved by one of them.
+	AddressReservationIndex tableReservations;
+
+	// The function type of each signature index, and the signature index assigned to each function type.
+	static Platform::Mutex signatureIndexMutex;
+	static std::vector<const FunctionType*> signatureIndexTypes = {nullptr};
+	static std::map<const FunctionType*,uintp> typeToSignatureIndexMap;
+
+	uintp getSignatureIndex(const FunctionType* type)
+	{
+		Platform::Lock lock(signatureIndexMutex);
+		auto mapIt = typeToSignatureIndexMap.find(type);
+		if(mapIt != typeToSignatureIndexMap.end()) { return mapIt->second; }
+
+		const uintp signatureIndex = signatureIndexTypes.size();
+		signatureIndexTypes.push_back(type);
+		typeToSignatureIndexMap[type] = signatureIndex;
+		return signatureIndex;
+	}
+
+	const FunctionType* getSignatureIndexType(uintp signatureIndex)
+	{
+		Platform::Lock lock(signatureIndexMutex);
+		return signatureIndex < signatureIndexTypes.size() ? signatureIndexTypes[signatureIndex] : nullptr;
+	}
 
 	static size_t getNumPlatformPages(size_t numBytes)
 	{
@@ -15,6 +38,7 @@ namespace Runtime
 
 	Table* createTable(TableType type)
 	{
+		ObjectMutationScope mutationScope;
 		Table* table = new Table(type);
 
 		// In 64-bit, allocate enough address-space to safely access 32-bit table indices without bounds checking, or 16MB (4M elements) if the host is 32-bit.
@@ -25,19 +49,23 @@ namespace Runtime
 		// protect against unaligned loads/stores that straddle the end of the address-space.
 		const size_t alignmentBytes = HAS_64BIT_ADDRESS_SPACE ? 4ull*1024*1024*1024 : (uintp(1) << Platform::getPageSizeLog2());
 		table->baseAddress = (Table::FunctionElement*)allocateVirtualPagesAligned(tableMaxBytes,alignmentBytes,table->reservedBaseAddress,table->reservedNumPlatformPages);
-		table->endOffset = tableMaxBytes;
+		table->endIndex = tableMaxBytes / sizeof(Table::FunctionElement);
 		if(!table->baseAddress) { delete table; return nullptr; }
 		
 		// Grow the table to the type's minimum size.
 		if(growTable(table,type.size.min) == -1) { delete table; return nullptr; }
 		
-		// Add the table to the global array.
-		tables.push_back(table);
+		// Add the table's reserved address-space to the global index.
+		tableReservations.add((uint8*)table->reservedBaseAddress,table->reservedNumPlatformPages << Platform::getPageSizeLog2());
 		return table;
 	}
 	
 	Table::~Table()
 	{
+		// Remove the table's reserved address-space from the global index before freeing it, so it can't be confused with
+		// another table that reuses the addresses.
+		if(reservedNumPlatformPages > 0) { tableReservations.remove((uint8*)reservedBaseAddress,reservedNumPlatformPages << Platform::getPageSizeLog2()); }
+
 		// Decommit all pages.
 		if(elements.size() > 0) { Platform::decommitVirtualPages((uint8*)baseAddress,getNumPlatformPages(elements.size() * sizeof(Table::FunctionElement))); }
 
@@ -46,34 +74,23 @@ namespace Runtime
 		reservedBaseAddress = nullptr;
 		reservedNumPlatformPages = 0;
 		baseAddress = nullptr;
-		
-		// Remove the table from the global array.
-		for(uintp tableIndex = 0;tableIndex < tables.size();++tableIndex)
-		{
-			if(tables[tableIndex] == this) { tables.erase(tables.begin() + tableIndex); break; }
-		}
 	}
 
 	bool isAddressOwnedByTable(uint8* address)
 	{
-		// Iterate over all tables and check if the address is within the reserved address space for each.
-		for(auto table : tables)
-		{
-			uint8* startAddress = (uint8*)table->reservedBaseAddress;
-			uint8* endAddress = ((uint8*)table->reservedBaseAddress) + (table->reservedNumPlatformPages << Platform::getPageSizeLog2());
-			if(address >= startAddress && address < endAddress) { return true; }
-		}
-		return false;
+		return tableReservations.contains(address);
 	}
 
 	Object* setTableElement(Table* table,uintp index,Object* newValue)
 	{
 		// Write the new table element to both the table's elements array and its indirect function call data.
+		ObjectMutationScope mutationScope;
 		assert(index < table->elements.size());
 		FunctionInstance* functionInstance = asFunction(newValue);
 		assert(functionInstance->nativeFunction);
-		table->baseAddress[index].type = functionInstance->type;
-		table->baseAddress[index].value = functionInstance->nativeFunction;
+		table->baseAddress[index].signatureIndex = getSignatureIndex(functionInstance->type);
+		table->baseAddress[index].value = LLVMJIT::getFunctionEntry(functionInstance);
+		table->baseAddress[index].context = getFunctionContext(functionInstance);
 		auto oldValue = table->elements[index];
 		table->elements[index] = newValue;
 		return oldValue;
@@ -86,6 +103,7 @@ namespace Runtime
 
 	intp growTable(Table* table,size_t numNewElements)
 	{
+		ObjectMutationScope mutationScope;
 		const size_t previousNumElements = table->elements.size();
 		if(numNewElements > 0)
 		{
@@ -112,6 +130,7 @@ namespace Runtime
 
 	intp shrinkTable(Table* table,size_t numElementsToShrink)
 	{
+		ObjectMutationScope mutationScope;
 		const size_t previousNumElements = table->elements.size();
 		if(numElementsToShrink > 0)
 		{
@@ -119,8 +138,10 @@ namespace Runtime
 			if(numElementsToShrink > table->elements.size()
 			|| table->elements.size() - numElementsToShrink < table->type.size.min) { return -1; }
 
-			// Shrink the table's elements array.
+			// Shrink the table's elements array, and null the indirect function call data for the shrunk elements: call_indirect
+			// doesn't check indices against the table's size, so it relies on elements beyond the end of the table being null.
 			table->elements.resize(table->elements.size() - numElementsToShrink);
+			memset(table->baseAddress + table->elements.size(),0,numElementsToShrink * sizeof(Table::FunctionElement));
 			
 			// Decommit the pages that were shrunk off the end of the table's indirect function call data.
 			const size_t previousNumPlatformPages = getNumPlatformPages(previousNumElements * sizeof(Table::FunctionElement));
@@ -18,14 +18,14 @@ namespace WAST
 
 	const SExp::SymbolIndexMap& getWASTSymbolIndexMap()
 	{
-		static bool isInitialized = false;
-		static SExp::SymbolIndexMap symbolIndexMap;
-		if(!isInitialized)
+		// Initialize the map on first use. C++11 guarantees that only one thread initializes a function-local static.
+		static const SExp::SymbolIndexMap symbolIndexMap = []
 		{
+			SExp::SymbolIndexMap result;
 			auto numSymbols = sizeof(wastSymbols) / sizeof(wastSymbols[0]);
-			for(uintp symbolIndex = 0;symbolIndex < numSymbols;++symbolIndex) { symbolIndexMap.emplace(std::make_pair(wastSymbols[symbolIndex], symbolIndex)); }
-			isInitialized = true;
-		}
+			for(uintp symbolIndex = 0;symbolIndex < numSymbols;++symbolIndex) { result.emplace(std::make_pair(wastSymbols[symbolIndex], symbolIndex)); }
+			return result;
+		}();
 		return symbolIndexMap;
 	}
 }
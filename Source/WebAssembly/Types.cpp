@@ -1,5 +1,6 @@
 #include "WebAssembly.h"
 #include "Types.h"
+#include "Core/Platform.h"
 
 #include <map>
 
@@ -21,11 +22,19 @@ namespace WebAssembly
 			static std::map<Key,FunctionType*> map;
 			return map;
 		}
+
+		// Function types may be looked up by multiple threads compiling a module in parallel.
+		static Platform::Mutex& getMutex()
+		{
+			static Platform::Mutex mutex;
+			return mutex;
+		}
 	};
 
 	template<typename Key,typename Value,typename CreateValueThunk>
 	Value findExistingOrCreateNew(std::map<Key,Value>& map,Key&& key,CreateValueThunk createValueThunk)
 	{
+		Platform::Lock lock(FunctionTypeMap::getMutex());
 		auto mapIt = map.find(key);
 		if(mapIt != map.end()) { return mapIt->second; }
 		else
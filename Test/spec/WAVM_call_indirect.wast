@@ -0,0 +1,51 @@
+;; Checks call_indirect with indices beyond the end of a table, which load null elements from the table's committed pages
+;; or fault in its uncommitted pages, and with a table shared by modules that define the same function types separately.
+
+(module $Mt
+  (type $i32 (func (result i32)))
+  (type $i64 (func (result i64)))
+  (func $const_i32 (type $i32) (i32.const 32))
+  (func $const_i64 (type $i64) (i64.const 64))
+
+  (table (export "tab") 200 anyfunc)
+  (elem (i32.const 0) $const_i32 $const_i64)
+  (elem (i32.const 199) $const_i32)
+
+  (func (export "call_i32") (param i32) (result i32) (call_indirect $i32 (get_local 0)))
+  (func (export "call_i64") (param i32) (result i64) (call_indirect $i64 (get_local 0)))
+)
+(register "Mt" $Mt)
+
+(assert_return (invoke "call_i32" (i32.const 0)) (i32.const 32))
+(assert_return (invoke "call_i64" (i32.const 1)) (i64.const 64))
+(assert_return (invoke "call_i32" (i32.const 199)) (i32.const 32))
+(assert_trap (invoke "call_i32" (i32.const 1)) "indirect call signature mismatch")
+(assert_trap (invoke "call_i64" (i32.const 0)) "indirect call signature mismatch")
+(assert_trap (invoke "call_i32" (i32.const 2)) "uninitialized element")
+(assert_trap (invoke "call_i32" (i32.const 200)) "undefined element")
+(assert_trap (invoke "call_i32" (i32.const 300)) "undefined element")
+(assert_trap (invoke "call_i32" (i32.const 100000)) "undefined element")
+(assert_trap (invoke "call_i32" (i32.const 0x7fffffff)) "undefined element")
+(assert_trap (invoke "call_i64" (i32.const -1)) "undefined element")
+
+;; A module that imports the table, and calls the functions in it through its own definitions of the same types.
+(module $Mu
+  (type $f64 (func (result f64)))
+  (type $i64 (func (result i64)))
+  (type $i32 (func (result i32)))
+  (import "Mt" "tab" (table 200 anyfunc))
+  (func $const_f64 (type $f64) (f64.const 1.5))
+  (elem (i32.const 2) $const_f64)
+
+  (func (export "call_i32") (param i32) (result i32) (call_indirect $i32 (get_local 0)))
+  (func (export "call_i64") (param i32) (result i64) (call_indirect $i64 (get_local 0)))
+  (func (export "call_f64") (param i32) (result f64) (call_indirect $f64 (get_local 0)))
+)
+
+(assert_return (invoke $Mu "call_i32" (i32.const 0)) (i32.const 32))
+(assert_return (invoke $Mu "call_i64" (i32.const 1)) (i64.const 64))
+(assert_return (invoke $Mu "call_f64" (i32.const 2)) (f64.const 1.5))
+(assert_trap (invoke $Mu "call_f64" (i32.const 0)) "indirect call signature mismatch")
+(assert_trap (invoke $Mu "call_i32" (i32.const 2)) "indirect call signature mismatch")
+(assert_trap (invoke $Mu "call_f64" (i32.const 3)) "uninitialized element")
+(assert_trap (invoke $Mu "call_f64" (i32.const -1)) "undefined element")
@@ -0,0 +1,55 @@
+;; Checks that code compiled with epoch polling throws an interrupted exception once the epoch is incremented during its
+;; invoke, at the next loop iteration or function entry, and that invokes started afterwards run normally. Must be run with
+;; --poll-epoch. wavmTest.interrupt increments the epoch from inside the invoke, as another thread might.
+
+(module
+  (import "wavmTest" "interrupt" (func $interrupt))
+  (import "wavmTest" "yield" (func $yield))
+
+  ;; Counts to n, interrupting the invoke once the count reaches interruptAt.
+  (func (export "count") (param $n i32) (param $interruptAt i32) (result i32)
+    (local $i i32)
+    (block $done
+      (loop $continue
+        (br_if $done (i32.ge_u (get_local $i) (get_local $n)))
+        (if (i32.eq (get_local $i) (get_local $interruptAt)) (call $interrupt))
+        (set_local $i (i32.add (get_local $i) (i32.const 1)))
+        (br $continue)))
+    (get_local $i))
+
+  (func (export "interrupt_then_loop_forever")
+    (call $interrupt)
+    (loop $forever (br $forever)))
+
+  (func (export "interrupt_then_yield_then_loop_forever")
+    (call $interrupt)
+    (call $yield)
+    (loop $forever (br $forever)))
+
+  ;; Recurses n calls deep without loops, interrupting the invoke at the bottom of the recursion. Each call's result is
+  ;; subtracted from its parameter, so the optimizer can't turn the recursion into a loop.
+  (func $recurse (export "recurse") (param $n i32) (result i32)
+    (if i32 (i32.eqz (get_local $n))
+      (block i32 (call $interrupt) (i32.const 0))
+      (i32.sub (get_local $n) (call $recurse (i32.sub (get_local $n) (i32.const 1))))))
+
+  (func (export "interrupt_then_recurse") (param $n i32) (result i32)
+    (call $interrupt)
+    (call $recurse (get_local $n)))
+
+  (func (export "interrupt_then_return") (result i32)
+    (call $interrupt)
+    (i32.const 1))
+)
+
+(assert_return (invoke "count" (i32.const 1000) (i32.const -1)) (i32.const 1000))
+(assert_trap (invoke "count" (i32.const 1000) (i32.const 10)) "interrupted")
+(assert_return (invoke "count" (i32.const 1000) (i32.const -1)) (i32.const 1000))
+
+(assert_trap (invoke "interrupt_then_loop_forever") "interrupted")
+(assert_trap (invoke "interrupt_then_yield_then_loop_forever") "interrupted")
+(assert_trap (invoke "interrupt_then_recurse" (i32.const 10)) "interrupted")
+
+;; Code that doesn't enter another function or loop iteration after the epoch is incremented finishes normally.
+(assert_return (invoke "interrupt_then_return") (i32.const 1))
+(assert_return (invoke "recurse" (i32.const 0)) (i32.const 0))
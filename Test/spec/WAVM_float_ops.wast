@@ -0,0 +1,65 @@
+;; Checks the edge cases of the float operators that are emitted inline: the bounds of the float-to-int conversions that
+;; aren't exactly representable, signaling NaN operands, and the sign of zero results.
+
+(module
+  (func (export "i32.trunc_s_f64") (param f64) (result i32) (i32.trunc_s/f64 (get_local 0)))
+  (func (export "i32.trunc_u_f64") (param f64) (result i32) (i32.trunc_u/f64 (get_local 0)))
+  (func (export "i64.trunc_s_f32") (param f32) (result i64) (i64.trunc_s/f32 (get_local 0)))
+  (func (export "i64.trunc_u_f64") (param f64) (result i64) (i64.trunc_u/f64 (get_local 0)))
+
+  (func (export "f32.min") (param f32 f32) (result f32) (f32.min (get_local 0) (get_local 1)))
+  (func (export "f32.max") (param f32 f32) (result f32) (f32.max (get_local 0) (get_local 1)))
+  (func (export "f64.min") (param f64 f64) (result f64) (f64.min (get_local 0) (get_local 1)))
+  (func (export "f64.max") (param f64 f64) (result f64) (f64.max (get_local 0) (get_local 1)))
+
+  (func (export "f32.ceil") (param f32) (result f32) (f32.ceil (get_local 0)))
+  (func (export "f64.floor") (param f64) (result f64) (f64.floor (get_local 0)))
+  (func (export "f64.trunc") (param f64) (result f64) (f64.trunc (get_local 0)))
+  (func (export "f32.nearest") (param f32) (result f32) (f32.nearest (get_local 0)))
+  (func (export "f64.nearest") (param f64) (result f64) (f64.nearest (get_local 0)))
+)
+
+;; An f64 operand truncates to the minimum i32 if it's greater than the minimum minus one.
+(assert_return (invoke "i32.trunc_s_f64" (f64.const -2147483648.5)) (i32.const -2147483648))
+(assert_return (invoke "i32.trunc_s_f64" (f64.const -2147483648.9999995)) (i32.const -2147483648))
+(assert_trap (invoke "i32.trunc_s_f64" (f64.const -2147483649.0)) "integer overflow")
+(assert_return (invoke "i32.trunc_s_f64" (f64.const 2147483647.9999995)) (i32.const 2147483647))
+(assert_trap (invoke "i32.trunc_s_f64" (f64.const 2147483648.0)) "integer overflow")
+
+(assert_return (invoke "i32.trunc_u_f64" (f64.const -0.9999999999999999)) (i32.const 0))
+(assert_trap (invoke "i32.trunc_u_f64" (f64.const -1.0)) "integer overflow")
+(assert_return (invoke "i32.trunc_u_f64" (f64.const 4294967295.9999995)) (i32.const -1))
+(assert_trap (invoke "i32.trunc_u_f64" (f64.const 4294967296.0)) "integer overflow")
+(assert_trap (invoke "i32.trunc_u_f64" (f64.const -nan)) "invalid conversion to integer")
+
+(assert_return (invoke "i64.trunc_s_f32" (f32.const -9223372036854775808.0)) (i64.const -9223372036854775808))
+(assert_trap (invoke "i64.trunc_s_f32" (f32.const -9223373136366403584.0)) "integer overflow")
+(assert_trap (invoke "i64.trunc_s_f32" (f32.const 9223372036854775808.0)) "integer overflow")
+(assert_trap (invoke "i64.trunc_s_f32" (f32.const nan:0x200000)) "invalid conversion to integer")
+
+(assert_return (invoke "i64.trunc_u_f64" (f64.const 18446744073709549568.0)) (i64.const -2048))
+(assert_trap (invoke "i64.trunc_u_f64" (f64.const 18446744073709551616.0)) "integer overflow")
+(assert_trap (invoke "i64.trunc_u_f64" (f64.const -1.0)) "integer overflow")
+
+;; min and max order -0 before +0, and return a quieted NaN if either operand is NaN.
+(assert_return (invoke "f32.min" (f32.const 0.0) (f32.const -0.0)) (f32.const -0.0))
+(assert_return (invoke "f32.max" (f32.const -0.0) (f32.const 0.0)) (f32.const 0.0))
+(assert_return (invoke "f64.min" (f64.const -0.0) (f64.const 0.0)) (f64.const -0.0))
+(assert_return (invoke "f64.max" (f64.const 0.0) (f64.const -0.0)) (f64.const 0.0))
+(assert_return (invoke "f32.min" (f32.const nan:0x200000) (f32.const 1.0)) (f32.const nan:0x600000))
+(assert_return (invoke "f32.max" (f32.const 1.0) (f32.const -nan:0x200000)) (f32.const -nan:0x600000))
+(assert_return (invoke "f64.min" (f64.const 1.0) (f64.const nan:0x4000000000000)) (f64.const nan:0xc000000000000))
+(assert_return (invoke "f64.max" (f64.const -nan:0x4000000000000) (f64.const -infinity)) (f64.const -nan:0xc000000000000))
+
+;; The rounding operators preserve the sign of zero results, and quiet NaN operands.
+(assert_return (invoke "f32.ceil" (f32.const -0.5)) (f32.const -0.0))
+(assert_return (invoke "f64.floor" (f64.const -0.0)) (f64.const -0.0))
+(assert_return (invoke "f64.trunc" (f64.const -0.9)) (f64.const -0.0))
+(assert_return (invoke "f32.nearest" (f32.const -0.5)) (f32.const -0.0))
+(assert_return (invoke "f32.nearest" (f32.const 2.5)) (f32.const 2.0))
+(assert_return (invoke "f64.nearest" (f64.const -3.5)) (f64.const -4.0))
+(assert_return (invoke "f64.nearest" (f64.const 4503599627370495.5)) (f64.const 4503599627370496.0))
+(assert_return (invoke "f32.ceil" (f32.const nan:0x200000)) (f32.const nan:0x600000))
+(assert_return (invoke "f64.floor" (f64.const -nan:0x4000000000000)) (f64.const -nan:0xc000000000000))
+(assert_return (invoke "f64.trunc" (f64.const nan:0x4000000000000)) (f64.const nan:0xc000000000000))
+(assert_return (invoke "f64.nearest" (f64.const nan:0x4000000000000)) (f64.const nan:0xc000000000000))
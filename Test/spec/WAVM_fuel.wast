@@ -0,0 +1,61 @@
+;; Checks that code compiled with fuel metering traps once it exhausts its instance's fuel, in loops, in nested loops, and
+;; in recursion without loops, and that it runs normally again once the fuel is refilled. Must be run with --fuel 100000,
+;; which refills the instance with enough fuel for about 10000 iterations of the loops below before each invoke.
+
+(module
+  (func (export "count") (param $n i32) (result i32)
+    (local $i i32)
+    (block $done
+      (loop $continue
+        (br_if $done (i32.ge_u (get_local $i) (get_local $n)))
+        (set_local $i (i32.add (get_local $i) (i32.const 1)))
+        (br $continue)))
+    (get_local $i))
+
+  (func (export "count_nested") (param $n i32) (result i32)
+    (local $i i32)
+    (local $j i32)
+    (local $total i32)
+    (block $outer_done
+      (loop $outer
+        (br_if $outer_done (i32.ge_u (get_local $i) (get_local $n)))
+        (set_local $j (i32.const 0))
+        (block $inner_done
+          (loop $inner
+            (br_if $inner_done (i32.ge_u (get_local $j) (get_local $n)))
+            (set_local $total (i32.add (get_local $total) (i32.const 1)))
+            (set_local $j (i32.add (get_local $j) (i32.const 1)))
+            (br $inner)))
+        (set_local $i (i32.add (get_local $i) (i32.const 1)))
+        (br $outer)))
+    (get_local $total))
+
+  (func (export "loop_forever")
+    (loop $forever (br $forever)))
+
+  (func (export "loop_forever_br_table") (param $n i32)
+    (block $exit
+      (loop $forever
+        (br_table $forever $exit (get_local $n)))))
+
+  (func $recurse (export "recurse") (param $n i32) (result i32)
+    (if i32 (i32.eqz (get_local $n))
+      (i32.const 0)
+      (i32.sub (get_local $n) (call $recurse (i32.sub (get_local $n) (i32.const 1))))))
+)
+
+(assert_return (invoke "count" (i32.const 1000)) (i32.const 1000))
+(assert_trap (invoke "count" (i32.const 100000)) "fuel exhausted")
+(assert_return (invoke "count" (i32.const 1000)) (i32.const 1000))
+
+(assert_return (invoke "count_nested" (i32.const 30)) (i32.const 900))
+(assert_trap (invoke "count_nested" (i32.const 1000)) "fuel exhausted")
+(assert_return (invoke "count_nested" (i32.const 30)) (i32.const 900))
+
+(assert_trap (invoke "loop_forever") "fuel exhausted")
+(assert_return (invoke "loop_forever_br_table" (i32.const 1)))
+(assert_trap (invoke "loop_forever_br_table" (i32.const 0)) "fuel exhausted")
+
+(assert_return (invoke "recurse" (i32.const 1000)) (i32.const 500))
+(assert_trap (invoke "recurse" (i32.const 10000)) "fuel exhausted")
+(assert_return (invoke "recurse" (i32.const 1000)) (i32.const 500))
@@ -0,0 +1,48 @@
+;; Grows a memory a page at a time, as sbrk does, and checks the memory's size, the contents of its new pages, and that
+;; accesses beyond its end trap. Memories that use explicit bounds checks commit pages ahead of their size, so this also
+;; checks that those pages can't be accessed until the memory is grown to include them.
+
+(module
+  (memory 1 64)
+
+  (func (export "size") (result i32) (current_memory))
+  (func (export "grow") (param i32) (result i32) (grow_memory (get_local 0)))
+
+  ;; Grows the memory by one page n times. Each new page must be zeroed, and its last word is set to the memory's new size.
+  (func (export "grow_by_one") (param $n i32) (result i32)
+    (loop
+      (if (i32.ne (grow_memory (i32.const 1)) (i32.sub (current_memory) (i32.const 1)))
+        (unreachable))
+      (if (i32.load (i32.sub (i32.mul (current_memory) (i32.const 65536)) (i32.const 4)))
+        (unreachable))
+      (i32.store (i32.sub (i32.mul (current_memory) (i32.const 65536)) (i32.const 4)) (current_memory))
+      (br_if 0 (tee_local $n (i32.sub (get_local $n) (i32.const 1))))
+    )
+    (current_memory)
+  )
+
+  (func (export "load_last") (result i32) (i32.load (i32.sub (i32.mul (current_memory) (i32.const 65536)) (i32.const 4))))
+  (func (export "load_past_end") (result i32) (i32.load (i32.mul (current_memory) (i32.const 65536))))
+  (func (export "store_past_end") (i32.store (i32.mul (current_memory) (i32.const 65536)) (i32.const 1)))
+)
+
+(assert_return (invoke "size") (i32.const 1))
+(assert_trap (invoke "load_past_end") "out of bounds memory access")
+(assert_return (invoke "grow_by_one" (i32.const 1)) (i32.const 2))
+(assert_return (invoke "load_last") (i32.const 2))
+(assert_trap (invoke "load_past_end") "out of bounds memory access")
+(assert_trap (invoke "store_past_end") "out of bounds memory access")
+(assert_return (invoke "grow_by_one" (i32.const 5)) (i32.const 7))
+(assert_return (invoke "load_last") (i32.const 7))
+(assert_trap (invoke "load_past_end") "out of bounds memory access")
+(assert_trap (invoke "store_past_end") "out of bounds memory access")
+(assert_return (invoke "grow_by_one" (i32.const 26)) (i32.const 33))
+(assert_return (invoke "load_last") (i32.const 33))
+(assert_trap (invoke "load_past_end") "out of bounds memory access")
+(assert_trap (invoke "store_past_end") "out of bounds memory access")
+(assert_return (invoke "grow" (i32.const 0)) (i32.const 33))
+(assert_return (invoke "grow_by_one" (i32.const 31)) (i32.const 64))
+(assert_return (invoke "load_last") (i32.const 64))
+(assert_trap (invoke "load_past_end") "out of bounds memory access")
+(assert_return (invoke "grow" (i32.const 1)) (i32.const -1))
+(assert_return (invoke "size") (i32.const 64))
@@ -0,0 +1,73 @@
+;; Checks that integer division by zero traps when the divisor can only be zero on some paths through a function, which
+;; an optimizer that assumes division by zero can't happen might remove. Also checks that unreachable traps wherever it is.
+
+(module
+  (func (export "div_s_select") (param $x i32) (param $y i32) (param $c i32) (result i32)
+    (i32.div_s (get_local $x) (select (i32.const 0) (get_local $y) (get_local $c))))
+  (func (export "div_u_select") (param $x i64) (param $y i64) (param $c i32) (result i64)
+    (i64.div_u (get_local $x) (select (i64.const 0) (get_local $y) (get_local $c))))
+  (func (export "rem_u_if") (param $x i32) (param $y i32) (param $c i32) (result i32)
+    (i32.rem_u (get_local $x) (if i32 (get_local $c) (i32.const 0) (get_local $y))))
+  (func (export "rem_s_if") (param $x i64) (param $y i64) (param $c i32) (result i64)
+    (i64.rem_s (get_local $x) (if i64 (get_local $c) (i64.const 0) (get_local $y))))
+  (func (export "div_s_const_zero") (param $x i32) (result i32) (i32.div_s (get_local $x) (i32.const 0)))
+  (func (export "rem_s_const_minus_one") (param $x i32) (result i32) (i32.rem_s (get_local $x) (i32.const -1)))
+
+  ;; Divisions whose results are dropped, which an optimizer may remove if it doesn't know they can trap.
+  (func (export "div_s_drop") (param $x i32) (param $y i32) (drop (i32.div_s (get_local $x) (get_local $y))))
+  (func (export "div_u_drop") (param $x i64) (param $y i64) (drop (i64.div_u (get_local $x) (get_local $y))))
+  (func (export "rem_u_drop") (param $x i32) (param $y i32) (drop (i32.rem_u (get_local $x) (get_local $y))))
+  (func (export "rem_s_drop") (param $x i64) (param $y i64) (drop (i64.rem_s (get_local $x) (get_local $y))))
+
+  ;; Sums x/d for d counting down from n, so the last division is by zero.
+  (func (export "div_u_loop") (param $x i32) (param $n i32) (result i32)
+    (local $sum i32)
+    (loop
+      (set_local $sum (i32.add (get_local $sum) (i32.div_u (get_local $x) (get_local $n))))
+      (set_local $n (i32.sub (get_local $n) (i32.const 1)))
+      (br_if 0 (i32.ge_s (get_local $n) (i32.const 0)))
+    )
+    (get_local $sum)
+  )
+
+  (func (export "unreachable_if") (param $c i32) (result i32)
+    (if (get_local $c) (unreachable))
+    (i32.const 1))
+  (func (export "unreachable_loop") (param $n i32) (result i32)
+    (loop
+      (if (i32.eqz (get_local $n)) (unreachable))
+      (set_local $n (i32.sub (get_local $n) (i32.const 1)))
+      (br 0)
+    )
+    (i32.const 2))
+)
+
+(assert_return (invoke "div_s_select" (i32.const 7) (i32.const 2) (i32.const 0)) (i32.const 3))
+(assert_trap (invoke "div_s_select" (i32.const 7) (i32.const 2) (i32.const 1)) "integer divide by zero")
+(assert_trap (invoke "div_s_select" (i32.const 0x80000000) (i32.const -1) (i32.const 0)) "integer overflow")
+(assert_return (invoke "div_u_select" (i64.const 7) (i64.const 2) (i32.const 0)) (i64.const 3))
+(assert_trap (invoke "div_u_select" (i64.const 7) (i64.const 2) (i32.const 1)) "integer divide by zero")
+(assert_return (invoke "rem_u_if" (i32.const 7) (i32.const 4) (i32.const 0)) (i32.const 3))
+(assert_trap (invoke "rem_u_if" (i32.const 7) (i32.const 4) (i32.const 1)) "integer divide by zero")
+(assert_return (invoke "rem_s_if" (i64.const -7) (i64.const 4) (i32.const 0)) (i64.const -3))
+(assert_return (invoke "rem_s_if" (i64.const 0x8000000000000000) (i64.const -1) (i32.const 0)) (i64.const 0))
+(assert_trap (invoke "rem_s_if" (i64.const -7) (i64.const 4) (i32.const 1)) "integer divide by zero")
+(assert_trap (invoke "div_s_const_zero" (i32.const 1)) "integer divide by zero")
+(assert_return (invoke "rem_s_const_minus_one" (i32.const 0x80000000)) (i32.const 0))
+
+(invoke "div_s_drop" (i32.const 7) (i32.const 2))
+(assert_trap (invoke "div_s_drop" (i32.const 7) (i32.const 0)) "integer divide by zero")
+(invoke "div_u_drop" (i64.const 7) (i64.const 2))
+(assert_trap (invoke "div_u_drop" (i64.const 7) (i64.const 0)) "integer divide by zero")
+(invoke "rem_u_drop" (i32.const 7) (i32.const 2))
+(assert_trap (invoke "rem_u_drop" (i32.const 7) (i32.const 0)) "integer divide by zero")
+(invoke "rem_s_drop" (i64.const 0x8000000000000000) (i64.const -1))
+(assert_trap (invoke "rem_s_drop" (i64.const 7) (i64.const 0)) "integer divide by zero")
+
+(assert_trap (invoke "div_u_loop" (i32.const 100) (i32.const 10)) "integer divide by zero")
+(assert_trap (invoke "div_u_loop" (i32.const 100) (i32.const 0)) "integer divide by zero")
+(assert_return (invoke "div_u_loop" (i32.const 100) (i32.const -1)) (i32.const 0))
+
+(assert_return (invoke "unreachable_if" (i32.const 0)) (i32.const 1))
+(assert_trap (invoke "unreachable_if" (i32.const 1)) "unreachable")
+(assert_trap (invoke "unreachable_loop" (i32.const 5)) "unreachable")
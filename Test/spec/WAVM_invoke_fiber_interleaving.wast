@@ -0,0 +1,86 @@
+;; Checks that several invokes suspended on fibers can be interleaved on one thread: resumed in any order, trapping in one
+;; while another is suspended, and cancelling one while another is suspended. The fibers are started by wavmTest.startFiber,
+;; so this runs with and without --invoke-fibers.
+
+(module
+  (import "wavmTest" "yield" (func $yield))
+  (import "wavmTest" "startFiber" (func $startFiber (param i32 i32 i32) (result i32)))
+  (import "wavmTest" "resumeFiber" (func $resumeFiber (param i32) (result i32)))
+  (import "wavmTest" "finishFiber" (func $finishFiber (param i32) (result i32)))
+  (import "wavmTest" "cancelFiber" (func $cancelFiber (param i32)))
+  (import "wavmTest" "fiberFunctions" (table 4 4 anyfunc))
+  (elem (i32.const 0) $sum $div_after_yield $count_yields)
+
+  (global $count (mut i32) (i32.const 0))
+
+  ;; Sums 1..n, yielding before adding each number.
+  (func $sum (param $n i32) (result i32)
+    (local $sum i32)
+    (block $done
+      (loop $loop
+        (br_if $done (i32.eqz (get_local $n)))
+        (call $yield)
+        (set_local $sum (i32.add (get_local $sum) (get_local $n)))
+        (set_local $n (i32.sub (get_local $n) (i32.const 1)))
+        (br $loop)))
+    (get_local $sum))
+
+  (func $div_after_yield (param $n i32) (result i32)
+    (call $yield)
+    (i32.div_u (i32.const 100) (get_local $n)))
+
+  ;; Increments the count and yields n times, then returns the count.
+  (func $count_yields (param $n i32) (result i32)
+    (block $done
+      (loop $loop
+        (br_if $done (i32.eqz (get_local $n)))
+        (set_global $count (i32.add (get_global $count) (i32.const 1)))
+        (call $yield)
+        (set_local $n (i32.sub (get_local $n) (i32.const 1)))
+        (br $loop)))
+    (get_global $count))
+
+  (func (export "start") (param $fiber i32) (param $function i32) (param $argument i32) (result i32)
+    (call $startFiber (get_local $fiber) (get_local $function) (get_local $argument)))
+  (func (export "resume") (param $fiber i32) (result i32) (call $resumeFiber (get_local $fiber)))
+  (func (export "finish") (param $fiber i32) (result i32) (call $finishFiber (get_local $fiber)))
+  (func (export "cancel") (param $fiber i32) (call $cancelFiber (get_local $fiber)))
+  (func (export "get_count") (result i32) (get_global $count))
+)
+
+;; Two sums suspended at once, resumed alternately.
+(assert_return (invoke "start" (i32.const 0) (i32.const 0) (i32.const 3)) (i32.const 0))
+(assert_return (invoke "start" (i32.const 1) (i32.const 0) (i32.const 4)) (i32.const 0))
+(assert_return (invoke "resume" (i32.const 0)) (i32.const 0))
+(assert_return (invoke "resume" (i32.const 1)) (i32.const 0))
+(assert_return (invoke "resume" (i32.const 0)) (i32.const 0))
+(assert_return (invoke "resume" (i32.const 1)) (i32.const 0))
+(assert_return (invoke "resume" (i32.const 0)) (i32.const 1))
+(assert_return (invoke "finish" (i32.const 0)) (i32.const 6))
+(assert_return (invoke "resume" (i32.const 1)) (i32.const 0))
+(assert_return (invoke "resume" (i32.const 1)) (i32.const 1))
+(assert_return (invoke "finish" (i32.const 1)) (i32.const 10))
+
+;; A trap in one invoke doesn't affect another that's suspended.
+(assert_return (invoke "start" (i32.const 0) (i32.const 0) (i32.const 2)) (i32.const 0))
+(assert_return (invoke "start" (i32.const 1) (i32.const 1) (i32.const 0)) (i32.const 0))
+(assert_return (invoke "resume" (i32.const 1)) (i32.const 1))
+(assert_trap (invoke "finish" (i32.const 1)) "integer divide by zero")
+(assert_return (invoke "resume" (i32.const 0)) (i32.const 0))
+(assert_return (invoke "resume" (i32.const 0)) (i32.const 1))
+(assert_return (invoke "finish" (i32.const 0)) (i32.const 3))
+
+;; A cancelled invoke doesn't run past the yield that suspended it, and doesn't affect another that's suspended.
+(assert_return (invoke "start" (i32.const 0) (i32.const 2) (i32.const 5)) (i32.const 0))
+(assert_return (invoke "start" (i32.const 1) (i32.const 2) (i32.const 2)) (i32.const 0))
+(assert_return (invoke "get_count") (i32.const 2))
+(invoke "cancel" (i32.const 0))
+(assert_return (invoke "get_count") (i32.const 2))
+(assert_return (invoke "resume" (i32.const 1)) (i32.const 0))
+(assert_return (invoke "resume" (i32.const 1)) (i32.const 1))
+(assert_return (invoke "finish" (i32.const 1)) (i32.const 3))
+
+;; A cancelled invoke's fiber can be reused.
+(assert_return (invoke "start" (i32.const 0) (i32.const 0) (i32.const 1)) (i32.const 0))
+(assert_return (invoke "resume" (i32.const 0)) (i32.const 1))
+(assert_return (invoke "finish" (i32.const 0)) (i32.const 1))
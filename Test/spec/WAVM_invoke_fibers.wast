@@ -0,0 +1,57 @@
+;; Checks invokes that call an intrinsic that suspends them when they run on a fiber: loops and recursion that yield at each
+;; step, traps after yielding, and overflowing the stack of a fiber. Without --invoke-fibers, wavmTest.yield does nothing.
+
+(module
+  (import "wavmTest" "yield" (func $yield))
+  (memory 1)
+
+  ;; Sums 1..n, yielding before adding each number.
+  (func (export "sum") (param $n i32) (result i32)
+    (local $sum i32)
+    (block $done
+      (loop $loop
+        (br_if $done (i32.eqz (get_local $n)))
+        (call $yield)
+        (set_local $sum (i32.add (get_local $sum) (get_local $n)))
+        (set_local $n (i32.sub (get_local $n) (i32.const 1)))
+        (br $loop)))
+    (get_local $sum))
+
+  ;; Recurses n calls deep, yielding in each call. Each call's result is subtracted from its parameter, so the optimizer
+  ;; can't turn the recursion into a loop.
+  (func $recurse (export "recurse") (param $n i32) (result i32)
+    (call $yield)
+    (if i32 (i32.eqz (get_local $n))
+      (i32.const 0)
+      (i32.sub (get_local $n) (call $recurse (i32.sub (get_local $n) (i32.const 1))))))
+
+  (func (export "store_then_load") (param $address i32) (param $value i32) (result i32)
+    (i32.store (get_local $address) (get_local $value))
+    (call $yield)
+    (i32.load (get_local $address)))
+
+  (func (export "div_after_yield") (param $x i32) (param $y i32) (result i32)
+    (call $yield)
+    (i32.div_u (get_local $x) (get_local $y)))
+
+  (func (export "load_after_yield") (param $address i32) (result i32)
+    (call $yield)
+    (i32.load (get_local $address)))
+
+  (func (export "unreachable_after_yield")
+    (call $yield)
+    (unreachable))
+)
+
+(assert_return (invoke "sum" (i32.const 100)) (i32.const 5050))
+(assert_return (invoke "store_then_load" (i32.const 8) (i32.const 12345)) (i32.const 12345))
+
+(assert_return (invoke "recurse" (i32.const 1000)) (i32.const 500))
+(assert_trap (invoke "recurse" (i32.const 100000000)) "call stack exhausted")
+(assert_return (invoke "recurse" (i32.const 1000)) (i32.const 500))
+
+(assert_trap (invoke "div_after_yield" (i32.const 1) (i32.const 0)) "integer divide by zero")
+(assert_return (invoke "div_after_yield" (i32.const 6) (i32.const 3)) (i32.const 2))
+(assert_trap (invoke "load_after_yield" (i32.const 65536)) "out of bounds memory access")
+(assert_trap (invoke "unreachable_after_yield") "unreachable")
+(assert_return (invoke "sum" (i32.const 10)) (i32.const 55))
@@ -0,0 +1,25 @@
+;; Checks that an invoke stack budget stops recursion that succeeds without the budget, and that the same recursion succeeds
+;; again once the budget is removed. Each invoke after the one that calls wavmTest.setInvokeStackBudget uses the new budget.
+;; Each call's result is subtracted from its parameter, so the optimizer can't turn the recursion into a loop.
+
+(module
+  (import "wavmTest" "setInvokeStackBudget" (func $setInvokeStackBudget (param i32)))
+
+  (func (export "set_budget") (param $numBytes i32) (call $setInvokeStackBudget (get_local $numBytes)))
+
+  (func $recurse (export "recurse") (param $n i32) (result i32)
+    (if i32 (i32.eqz (get_local $n))
+      (i32.const 0)
+      (i32.sub (get_local $n) (call $recurse (i32.sub (get_local $n) (i32.const 1))))))
+)
+
+;; Each call uses at least 16 bytes of stack, so 10000 calls don't fit in a 64KB budget, but fit in the thread's stack.
+(assert_return (invoke "recurse" (i32.const 10000)) (i32.const 5000))
+
+(invoke "set_budget" (i32.const 65536))
+(assert_return (invoke "recurse" (i32.const 100)) (i32.const 50))
+(assert_trap (invoke "recurse" (i32.const 10000)) "call stack exhausted")
+(assert_return (invoke "recurse" (i32.const 100)) (i32.const 50))
+
+(invoke "set_budget" (i32.const 0))
+(assert_return (invoke "recurse" (i32.const 10000)) (i32.const 5000))
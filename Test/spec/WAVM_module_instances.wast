@@ -0,0 +1,114 @@
+;; Instantiates the same module several times, and checks that each instance has its own memory, table, and globals. With
+;; --share-code the instances share the module's code, and with --compiled-modules they're instantiated from the same
+;; CompiledModule, so their memories are also initialized from the same copy-on-write memory image.
+
+(module $first
+  (type $i32 (func (result i32)))
+
+  (memory 1 4)
+  (data (i32.const 0) "\2a\00\00\00")
+  (data (i32.const 65532) "\07\00\00\00")
+
+  (global $g (mut i32) (i32.const 100))
+
+  (table anyfunc (elem $get_global $load_first_word))
+  (func $get_global (type $i32) (get_global $g))
+  (func $load_first_word (type $i32) (i32.load (i32.const 0)))
+
+  (func (export "load") (param i32) (result i32) (i32.load (get_local 0)))
+  (func (export "store") (param i32 i32) (i32.store (get_local 0) (get_local 1)))
+  (func (export "get_global") (result i32) (get_global $g))
+  (func (export "set_global") (param i32) (set_global $g (get_local 0)))
+  (func (export "call_indirect") (param i32) (result i32) (call_indirect $i32 (get_local 0)))
+  (func (export "grow") (param i32) (result i32) (grow_memory (get_local 0)))
+  (func (export "size") (result i32) (current_memory))
+)
+
+(module $second
+  (type $i32 (func (result i32)))
+
+  (memory 1 4)
+  (data (i32.const 0) "\2a\00\00\00")
+  (data (i32.const 65532) "\07\00\00\00")
+
+  (global $g (mut i32) (i32.const 100))
+
+  (table anyfunc (elem $get_global $load_first_word))
+  (func $get_global (type $i32) (get_global $g))
+  (func $load_first_word (type $i32) (i32.load (i32.const 0)))
+
+  (func (export "load") (param i32) (result i32) (i32.load (get_local 0)))
+  (func (export "store") (param i32 i32) (i32.store (get_local 0) (get_local 1)))
+  (func (export "get_global") (result i32) (get_global $g))
+  (func (export "set_global") (param i32) (set_global $g (get_local 0)))
+  (func (export "call_indirect") (param i32) (result i32) (call_indirect $i32 (get_local 0)))
+  (func (export "grow") (param i32) (result i32) (grow_memory (get_local 0)))
+  (func (export "size") (result i32) (current_memory))
+)
+
+;; Both instances start with the memory image's contents.
+(assert_return (invoke $first "load" (i32.const 0)) (i32.const 42))
+(assert_return (invoke $second "load" (i32.const 0)) (i32.const 42))
+(assert_return (invoke $first "load" (i32.const 65532)) (i32.const 7))
+
+;; Writes to the image's pages, and to pages outside it, are only seen by the instance that made them.
+(invoke $first "store" (i32.const 0) (i32.const 1))
+(invoke $first "store" (i32.const 65532) (i32.const 2))
+(invoke $first "store" (i32.const 4096) (i32.const 3))
+(assert_return (invoke $first "load" (i32.const 0)) (i32.const 1))
+(assert_return (invoke $first "load" (i32.const 65532)) (i32.const 2))
+(assert_return (invoke $first "load" (i32.const 4096)) (i32.const 3))
+(assert_return (invoke $second "load" (i32.const 0)) (i32.const 42))
+(assert_return (invoke $second "load" (i32.const 65532)) (i32.const 7))
+(assert_return (invoke $second "load" (i32.const 4096)) (i32.const 0))
+
+(invoke $second "store" (i32.const 0) (i32.const 4))
+(assert_return (invoke $first "load" (i32.const 0)) (i32.const 1))
+(assert_return (invoke $second "load" (i32.const 0)) (i32.const 4))
+
+;; Growing one instance's memory doesn't grow the other's.
+(assert_return (invoke $first "grow" (i32.const 2)) (i32.const 1))
+(assert_return (invoke $first "size") (i32.const 3))
+(assert_return (invoke $second "size") (i32.const 1))
+(invoke $first "store" (i32.const 65536) (i32.const 5))
+(assert_return (invoke $first "load" (i32.const 65536)) (i32.const 5))
+(assert_trap (invoke $second "load" (i32.const 65536)) "out of bounds memory access")
+
+;; Each instance has its own globals.
+(invoke $first "set_global" (i32.const 200))
+(assert_return (invoke $first "get_global") (i32.const 200))
+(assert_return (invoke $second "get_global") (i32.const 100))
+
+;; Each instance's table calls the instance's own functions, which use the instance's own globals and memory.
+(assert_return (invoke $first "call_indirect" (i32.const 0)) (i32.const 200))
+(assert_return (invoke $second "call_indirect" (i32.const 0)) (i32.const 100))
+(assert_return (invoke $first "call_indirect" (i32.const 1)) (i32.const 1))
+(assert_return (invoke $second "call_indirect" (i32.const 1)) (i32.const 4))
+
+;; An instance that writes to its memory and is then freed doesn't change the memory of instances created after it, even if
+;; they reuse its memory's address-space.
+(module
+  (memory 1 4)
+  (data (i32.const 0) "\2a\00\00\00")
+  (data (i32.const 65532) "\07\00\00\00")
+  (func (export "load") (param i32) (result i32) (i32.load (get_local 0)))
+  (func (export "store") (param i32 i32) (i32.store (get_local 0) (get_local 1)))
+)
+(invoke "store" (i32.const 0) (i32.const 6))
+(invoke "store" (i32.const 8192) (i32.const 6))
+(assert_return (invoke "load" (i32.const 0)) (i32.const 6))
+
+(module
+  (memory 1 4)
+  (data (i32.const 0) "\2a\00\00\00")
+  (data (i32.const 65532) "\07\00\00\00")
+  (func (export "load") (param i32) (result i32) (i32.load (get_local 0)))
+  (func (export "store") (param i32 i32) (i32.store (get_local 0) (get_local 1)))
+)
+(assert_return (invoke "load" (i32.const 0)) (i32.const 42))
+(assert_return (invoke "load" (i32.const 8192)) (i32.const 0))
+(assert_return (invoke "load" (i32.const 65532)) (i32.const 7))
+
+;; The earlier instances are unchanged.
+(assert_return (invoke $first "load" (i32.const 0)) (i32.const 1))
+(assert_return (invoke $second "load" (i32.const 0)) (i32.const 4))
@@ -0,0 +1,26 @@
+;; Checks that deep recursion traps with a stack overflow, and that shallower recursion still runs normally after a stack
+;; overflow, through direct and indirect calls. Each call's result is subtracted from its parameter, so the optimizer can't turn
+;; the recursion into a loop.
+
+(module
+  (type $countdown (func (param i32) (result i32)))
+  (table anyfunc (elem $recurse_indirect))
+
+  (func $recurse (export "recurse") (param $n i32) (result i32)
+    (if i32 (i32.eqz (get_local $n))
+      (i32.const 0)
+      (i32.sub (get_local $n) (call $recurse (i32.sub (get_local $n) (i32.const 1))))))
+
+  (func $recurse_indirect (export "recurse_indirect") (param $n i32) (result i32)
+    (if i32 (i32.eqz (get_local $n))
+      (i32.const 0)
+      (i32.sub (get_local $n) (call_indirect $countdown (i32.sub (get_local $n) (i32.const 1)) (i32.const 0)))))
+)
+
+(assert_return (invoke "recurse" (i32.const 1000)) (i32.const 500))
+(assert_trap (invoke "recurse" (i32.const 100000000)) "call stack exhausted")
+(assert_return (invoke "recurse" (i32.const 1000)) (i32.const 500))
+
+(assert_return (invoke "recurse_indirect" (i32.const 1000)) (i32.const 500))
+(assert_trap (invoke "recurse_indirect" (i32.const 100000000)) "call stack exhausted")
+(assert_return (invoke "recurse_indirect" (i32.const 1000)) (i32.const 500))
@@ -0,0 +1,27 @@
+;; Checks that tiered code requests optimizing a function once it has been called the number of times given by
+;; --tier-up-calls, and that calls to it are forwarded to the optimized code afterwards. Must be run with --tier-up-calls 10,
+;; and not on multiple threads, since the number of optimized functions is counted for the whole process.
+
+(module
+  (import "wavmTest" "waitForTierUps" (func $waitForTierUps (result i32)))
+
+  (func $fac (export "fac") (param $n i64) (result i64)
+    (if i64 (i64.eq (get_local $n) (i64.const 0))
+      (i64.const 1)
+      (i64.mul (get_local $n) (call $fac (i64.sub (get_local $n) (i64.const 1))))
+    )
+  )
+
+  (func (export "num_optimized") (result i32) (call $waitForTierUps))
+)
+
+;; fac is called 6 times by each of these invokes, so it reaches the threshold during the second one.
+(assert_return (invoke "fac" (i64.const 5)) (i64.const 120))
+(assert_return (invoke "num_optimized") (i32.const 0))
+(assert_return (invoke "fac" (i64.const 5)) (i64.const 120))
+(assert_return (invoke "num_optimized") (i32.const 1))
+
+;; Later calls run the optimized code, and don't request optimizing fac again.
+(assert_return (invoke "fac" (i64.const 20)) (i64.const 2432902008176640000))
+(assert_return (invoke "fac" (i64.const 20)) (i64.const 2432902008176640000))
+(assert_return (invoke "num_optimized") (i32.const 1))